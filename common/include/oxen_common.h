@@ -96,10 +96,24 @@ struct message {
     {}
 };
 
+/// Non-owning view of a message, as deserialized directly out of a received push batch.  The hash
+/// and data point into the serialized batch, which must outlive the message_view.
+struct message_view {
+    user_pubkey_t pubkey;
+    std::string_view hash;
+    std::chrono::system_clock::time_point timestamp;
+    std::chrono::system_clock::time_point expiry;
+    std::string_view data;
+};
+
 using swarm_id_t = uint64_t;
 
 constexpr swarm_id_t INVALID_SWARM_ID = UINT64_MAX;
 
+/// Maps a pubkey into a 64-bit "swarm space" value; the swarm you belong to is whichever one has a
+/// swarm id closest to this pubkey-derived value.
+uint64_t pubkey_to_swarm_space(const user_pubkey_t& pk);
+
 } // namespace oxen
 
 namespace std {
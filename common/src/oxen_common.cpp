@@ -1,4 +1,5 @@
 #include "oxen_common.h"
+#include <cassert>
 #include <oxenmq/hex.h>
 
 namespace oxen {
@@ -51,4 +52,15 @@ std::string user_pubkey_t::prefixed_raw() const {
     return bytes;
 }
 
+uint64_t pubkey_to_swarm_space(const user_pubkey_t& pk) {
+    const auto& bytes = pk.raw();
+    assert(bytes.size() == 32);
+
+    // XOR of the four big-endian 64-bit integers that make up the pubkey
+    uint64_t res = 0;
+    for (size_t i = 0; i < 32; i++)
+        res ^= uint64_t{static_cast<uint8_t>(bytes[i])} << (8 * (7 - i % 8));
+    return res;
+}
+
 }
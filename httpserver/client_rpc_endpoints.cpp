@@ -103,6 +103,47 @@ std::optional<T> parse_field(bt_dict_consumer& params, const char* name) {
             "Invalid value given for '{}': expected {}", name, type_desc<T>)};
 }
 
+// Equivalent to the json version, but for a json_object_view.
+template <typename T>
+std::optional<T> parse_field(json_object_view& params, const char* name) {
+    constexpr bool is_timestamp = std::is_same_v<T, system_clock::time_point>;
+    constexpr bool is_str_array = std::is_same_v<T, std::vector<std::string>>;
+    static_assert(std::is_unsigned_v<T> || std::is_integral_v<T> || is_timestamp || is_str_array ||
+            std::is_same_v<T, std::string_view> || std::is_same_v<T, std::string>);
+    auto* v = params.find(name);
+    if (!v || v->is_null())
+        return std::nullopt;
+
+    std::optional<T> result;
+    try {
+        if constexpr (std::is_same_v<T, bool>)
+            result = json_object_view::get_bool(*v);
+        else if constexpr (is_timestamp)
+            result = from_epoch_ms(json_object_view::get_integer<uint64_t>(*v));
+        else if constexpr (std::is_integral_v<T>)
+            result = json_object_view::get_integer<T>(*v);
+        else if constexpr (is_str_array) {
+            result.emplace();
+            for (auto& x : json_object_view::get_array(*v))
+                result->emplace_back(params.get_string(x));
+        } else
+            result.emplace(params.get_string(*v));
+    } catch (const std::invalid_argument&) {
+        throw parse_error{fmt::format(
+                "Invalid value given for '{}': expected {}", name, type_desc<T>)};
+    }
+    // See the json version
+    if constexpr (is_timestamp)
+        if (result->time_since_epoch() < 1'000'000s)
+            throw parse_error{fmt::format(
+                    "Invalid timestamp for '{}': timestamp must be in milliseconds", name)};
+    return result;
+}
+
+// True for the json-like Dict types (as opposed to bt_dict_consumer)
+template <typename Dict>
+constexpr bool is_json = std::is_same_v<Dict, json> || std::is_same_v<Dict, json_object_view>;
+
 // Backwards compat code for fields like ttl and timestamp that are accepted either as integer *or*
 // stringified integer.
 template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
@@ -115,6 +156,16 @@ std::optional<T> parse_stringified(const json& params, const char* name) {
     }
     return parse_field<T>(params, name);
 }
+template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+std::optional<T> parse_stringified(json_object_view& params, const char* name) {
+    if (auto* v = params.find(name); v && v->t == json_object_view::type::string) {
+        if (T value; !v->escaped && util::parse_int(params.get_string(*v), value))
+            return value;
+        else
+            throw parse_error{fmt::format("Invalid value given for '{}': {}", name, v->raw)};
+    }
+    return parse_field<T>(params, name);
+}
 
 #ifndef NDEBUG
 constexpr bool check_ascending(std::string_view) { return true; }
@@ -159,12 +210,12 @@ template <typename RPC, typename Dict>
 static void load_pk_signature(
         RPC &rpc,
         const Dict&,
-        std::optional<std::string>& pk,
+        const std::optional<std::string_view>& pk,
         const std::optional<std::string_view>& pk_ed,
         const std::optional<std::string_view>& sig) {
     require("pubkey", pk);
     require("signature", sig);
-    if (!rpc.pubkey.load(std::move(*pk)))
+    if (!rpc.pubkey.load(*pk))
         throw parse_error{fmt::format("Pubkey must be {} hex digits ({} bytes) long",
                 USER_PUBKEY_SIZE_HEX, USER_PUBKEY_SIZE_BYTES)};
 
@@ -182,7 +233,7 @@ static void load_pk_signature(
         }
     }
 
-    if constexpr (std::is_same_v<json, Dict>) {
+    if constexpr (is_json<Dict>) {
         if (!oxenmq::is_base64(*sig) || !(sig->size() == 88 || (sig->size() == 86 && sig->substr(84) == "==")))
             throw parse_error{"invalid signature: expected base64 encoded Ed25519 signature"};
         oxenmq::from_base64(sig->begin(), sig->end(), rpc.signature.begin());
@@ -194,21 +245,93 @@ static void load_pk_signature(
     // NB: We don't validate the signature here, we only parse input
 }
 
+// Loads the early reply options common to all recursive requests, then the endpoint-specific
+// fields.  (bt_dict_consumer fields have to be read in order, so we read the common options from a
+// copy of the consumer).
+template <typename RPC, typename Dict>
+static void load_recursive(RPC& rpc, Dict& d) {
+    std::optional<int> quorum;
+    std::optional<int64_t> reply_timeout;
+    if constexpr (is_json<Dict>) {
+        std::tie(quorum, reply_timeout) = load_fields<int, int64_t>(d, "quorum", "reply_timeout");
+    } else {
+        Dict d_copy{d};
+        std::tie(quorum, reply_timeout) =
+                load_fields<int, int64_t>(d_copy, "quorum", "reply_timeout");
+    }
+    if (quorum) {
+        if (*quorum < 1)
+            throw parse_error{"Invalid quorum: must be at least 1"};
+        rpc.quorum = *quorum;
+    }
+    if (reply_timeout) {
+        if (*reply_timeout < 1)
+            throw parse_error{"Invalid reply_timeout: must be at least 1"};
+        if (std::chrono::milliseconds{*reply_timeout} > REPLY_TIMEOUT_MAX)
+            throw parse_error{"Invalid reply_timeout: must be at most 5000"};
+        rpc.reply_timeout = std::chrono::milliseconds{*reply_timeout};
+    }
+    load(rpc, d);
+}
 
 } // anon. namespace
 
+request_data& request_data::operator=(const request_data& other) {
+    if (this != &other) {
+        owned_ = other.owned_;
+        if (owned_) {
+            storage_ = other.storage_;
+            view_ = storage_;
+        } else {
+            storage_.clear();
+            view_ = other.view_;
+        }
+    }
+    return *this;
+}
+
+request_data& request_data::operator=(request_data&& other) noexcept {
+    if (this != &other) {
+        owned_ = other.owned_;
+        storage_ = std::move(other.storage_);
+        // A moved string can have been short (and so stored inline), so re-point at our copy
+        view_ = owned_ ? std::string_view{storage_} : other.view_;
+        other.storage_.clear();
+        other.view_ = {};
+        other.owned_ = false;
+    }
+    return *this;
+}
+
+void request_data::borrow(std::string_view data) {
+    storage_.clear();
+    view_ = data;
+    owned_ = false;
+}
+
+void request_data::decode_base64(std::string_view b64) {
+    auto len = b64.size();
+    while (len > 0 && b64[len - 1] == '=')
+        len--;
+    // Every 4 base64 chars are 3 bytes; a trailing partial group of 2 or 3 chars gives 1 or 2 bytes
+    storage_.resize(len / 4 * 3 + (len % 4 ? len % 4 - 1 : 0));
+    oxenmq::from_base64(b64.begin(), b64.end(), storage_.begin());
+    view_ = storage_;
+    owned_ = true;
+}
+
 
 template <typename Dict>
 static void load(store& s, Dict& d) {
     auto [data, expiry, pubkey_alt, pubkey] =
-        load_fields<std::string_view, system_clock::time_point, std::string, std::string>(
+        load_fields<std::string_view, system_clock::time_point, std::string_view, std::string_view>(
                 d, "data", "expiry", "pubKey", "pubkey");
 
     // timestamp and ttl are special snowflakes: for backwards compat reasons, they can be passed as
     // strings when loading from json.
     std::optional<uint64_t> ttl;
     std::optional<system_clock::time_point> timestamp;
-    if constexpr (std::is_same_v<Dict, json>) {
+    if constexpr (is_json<Dict>) {
         if (auto ts = parse_stringified<int64_t>(d, "timestamp"))
             timestamp = from_epoch_ms(*ts);
         ttl = parse_stringified<uint64_t>(d, "ttl");
@@ -218,7 +341,7 @@ static void load(store& s, Dict& d) {
     }
 
     require_exactly_one_of("pubkey", pubkey, "pubKey", pubkey_alt, true);
-    if (!s.pubkey.load(std::move(pubkey ? *pubkey : *pubkey_alt)))
+    if (!s.pubkey.load(pubkey ? *pubkey : *pubkey_alt))
         throw parse_error{fmt::format("Pubkey must be {} hex digits/{} bytes long",
                 USER_PUBKEY_SIZE_HEX, USER_PUBKEY_SIZE_BYTES)};
 
@@ -228,7 +351,7 @@ static void load(store& s, Dict& d) {
     s.expiry = expiry ? *expiry : s.timestamp + std::chrono::milliseconds{*ttl};
 
     require("data", data);
-    if constexpr (std::is_same_v<Dict, json>) {
+    if constexpr (is_json<Dict>) {
         // For json we require data be base64 encoded
         if (!oxenmq::is_base64(*data))
             throw parse_error{"Invalid 'data' value: not base64 encoded"};
@@ -237,17 +360,18 @@ static void load(store& s, Dict& d) {
         if (data->size() > store::MAX_MESSAGE_BODY / 3 * 4)
             throw parse_error{fmt::format("Message body exceeds maximum allowed length of {} bytes",
                     store::MAX_MESSAGE_BODY)};
-        s.data = oxenmq::from_base64(*data);
+        s.data.decode_base64(*data);
     } else {
-        // Otherwise (i.e. bencoded) then we take data as bytes
+        // Otherwise (i.e. bencoded) then we take data as bytes, straight from the request
         if (data->size() > store::MAX_MESSAGE_BODY)
             throw parse_error{fmt::format("Message body exceeds maximum allowed length of {} bytes",
                     store::MAX_MESSAGE_BODY)};
-        s.data = *data;
+        s.data.borrow(*data);
     }
 }
-void store::load_from(json params) { load(*this, params); }
-void store::load_from(bt_dict_consumer params) { load(*this, params); }
+void store::load_from(json params) { load_recursive(*this, params); }
+void store::load_from(bt_dict_consumer params) { load_recursive(*this, params); }
+void store::load_from(json_object_view params) { load_recursive(*this, params); }
 bt_value store::to_bt() const {
     return bt_dict{
         {"pubkey", pubkey.prefixed_raw()},
@@ -263,8 +387,8 @@ static void load(retrieve& r, Dict& d) {
         load_fields<
             std::string,
             std::string,
-            std::string,
-            std::string,
+            std::string_view,
+            std::string_view,
             std::string_view,
             std::string_view,
             system_clock::time_point
@@ -277,7 +401,7 @@ static void load(retrieve& r, Dict& d) {
         r.timestamp = std::move(*ts);
         r.check_signature = true;
     } else {
-        if (!r.pubkey.load(std::move(pubkey ? *pubkey : *pubKey)))
+        if (!r.pubkey.load(pubkey ? *pubkey : *pubKey))
             throw parse_error{fmt::format("Pubkey must be {} hex digits/{} bytes long",
                     USER_PUBKEY_SIZE_HEX, USER_PUBKEY_SIZE_BYTES)};
     }
@@ -304,6 +428,21 @@ static void load(retrieve& r, Dict& d) {
 }
 void retrieve::load_from(json params) { load(*this, params); }
 void retrieve::load_from(bt_dict_consumer params) { load(*this, params); }
+void retrieve::load_from(json_object_view params) { load(*this, params); }
+
+template <typename Dict>
+static void load(subscribe& s, Dict& d) {
+    auto [pubkey, pubkey_ed25519, signature, timestamp] =
+        load_fields<std::string_view, std::string_view, std::string_view, system_clock::time_point>(
+            d, "pubkey", "pubkey_ed25519", "signature", "timestamp");
+
+    load_pk_signature(s, d, pubkey, pubkey_ed25519, signature);
+    require("timestamp", timestamp);
+    s.timestamp = std::move(*timestamp);
+}
+void subscribe::load_from(json params) { load(*this, params); }
+void subscribe::load_from(bt_dict_consumer params) { load(*this, params); }
+void subscribe::load_from(json_object_view params) { load(*this, params); }
 
 static bool is_valid_message_hash(std::string_view hash) {
     return
@@ -317,7 +456,7 @@ static bool is_valid_message_hash(std::string_view hash) {
 template <typename Dict>
 static void load(delete_msgs& dm, Dict& d) {
     auto [messages, pubkey, pubkey_ed25519, signature] =
-        load_fields<std::vector<std::string>, std::string, std::string_view, std::string_view>(
+        load_fields<std::vector<std::string>, std::string_view, std::string_view, std::string_view>(
             d, "messages", "pubkey", "pubkey_ed25519", "signature");
 
     load_pk_signature(dm, d, pubkey, pubkey_ed25519, signature);
@@ -329,8 +468,9 @@ static void load(delete_msgs& dm, Dict& d) {
         if (!is_valid_message_hash(m))
             throw parse_error{"invalid message hash: " + m};
 }
-void delete_msgs::load_from(json params) { load(*this, params); }
-void delete_msgs::load_from(bt_dict_consumer params) { load(*this, params); }
+void delete_msgs::load_from(json params) { load_recursive(*this, params); }
+void delete_msgs::load_from(bt_dict_consumer params) { load_recursive(*this, params); }
+void delete_msgs::load_from(json_object_view params) { load_recursive(*this, params); }
 bt_value delete_msgs::to_bt() const {
     bt_list msgs;
     for (auto& m : messages)
@@ -350,15 +490,16 @@ bt_value delete_msgs::to_bt() const {
 template <typename Dict>
 static void load(delete_all& da, Dict& d) {
     auto [pubkey, pubkey_ed25519, signature, timestamp] =
-        load_fields<std::string, std::string_view, std::string_view, system_clock::time_point>(
+        load_fields<std::string_view, std::string_view, std::string_view, system_clock::time_point>(
             d, "pubkey", "pubkey_ed25519", "signature", "timestamp");
 
     load_pk_signature(da, d, pubkey, pubkey_ed25519, signature);
     require("timestamp", timestamp);
     da.timestamp = std::move(*timestamp);
 }
-void delete_all::load_from(json params) { load(*this, params); }
-void delete_all::load_from(bt_dict_consumer params) { load(*this, params); }
+void delete_all::load_from(json params) { load_recursive(*this, params); }
+void delete_all::load_from(bt_dict_consumer params) { load_recursive(*this, params); }
+void delete_all::load_from(json_object_view params) { load_recursive(*this, params); }
 bt_value delete_all::to_bt() const {
     bt_dict ret{
         {"pubkey", pubkey.prefixed_raw()},
@@ -374,15 +515,16 @@ bt_value delete_all::to_bt() const {
 template <typename Dict>
 static void load(delete_before& db, Dict& d) {
     auto [before, pubkey, pubkey_ed25519, signature] =
-        load_fields<system_clock::time_point, std::string, std::string_view, std::string_view>(
+        load_fields<system_clock::time_point, std::string_view, std::string_view, std::string_view>(
             d, "before", "pubkey", "pubkey_ed25519", "signature");
 
     load_pk_signature(db, d, pubkey, pubkey_ed25519, signature);
     require("before", before);
     db.before = std::move(*before);
 }
-void delete_before::load_from(json params) { load(*this, params); }
-void delete_before::load_from(bt_dict_consumer params) { load(*this, params); }
+void delete_before::load_from(json params) { load_recursive(*this, params); }
+void delete_before::load_from(bt_dict_consumer params) { load_recursive(*this, params); }
+void delete_before::load_from(json_object_view params) { load_recursive(*this, params); }
 bt_value delete_before::to_bt() const {
     bt_dict ret{
         {"pubkey", pubkey.prefixed_raw()},
@@ -398,15 +540,16 @@ bt_value delete_before::to_bt() const {
 template <typename Dict>
 static void load(expire_all& e, Dict& d) {
     auto [expiry, pubkey, pubkey_ed25519, signature] =
-        load_fields<system_clock::time_point, std::string, std::string_view, std::string_view>(
+        load_fields<system_clock::time_point, std::string_view, std::string_view, std::string_view>(
             d, "expiry", "pubkey", "pubkey_ed25519", "signature");
 
     load_pk_signature(e, d, pubkey, pubkey_ed25519, signature);
     require("expiry", expiry);
     e.expiry = std::move(*expiry);
 }
-void expire_all::load_from(json params) { load(*this, params); }
-void expire_all::load_from(bt_dict_consumer params) { load(*this, params); }
+void expire_all::load_from(json params) { load_recursive(*this, params); }
+void expire_all::load_from(bt_dict_consumer params) { load_recursive(*this, params); }
+void expire_all::load_from(json_object_view params) { load_recursive(*this, params); }
 bt_value expire_all::to_bt() const {
     bt_dict ret{
         {"pubkey", pubkey.prefixed_raw()},
@@ -422,7 +565,7 @@ bt_value expire_all::to_bt() const {
 template <typename Dict>
 static void load(expire_msgs& e, Dict& d) {
     auto [expiry, messages, pubkey, pubkey_ed25519, signature] =
-        load_fields<system_clock::time_point, std::vector<std::string>, std::string, std::string_view, std::string_view>(
+        load_fields<system_clock::time_point, std::vector<std::string>, std::string_view, std::string_view, std::string_view>(
             d, "expiry", "messages", "pubkey", "pubkey_ed25519", "signature");
 
     load_pk_signature(e, d, pubkey, pubkey_ed25519, signature);
@@ -436,8 +579,9 @@ static void load(expire_msgs& e, Dict& d) {
         if (!is_valid_message_hash(m))
             throw parse_error{"invalid message hash: " + m};
 }
-void expire_msgs::load_from(json params) { load(*this, params); }
-void expire_msgs::load_from(bt_dict_consumer params) { load(*this, params); }
+void expire_msgs::load_from(json params) { load_recursive(*this, params); }
+void expire_msgs::load_from(bt_dict_consumer params) { load_recursive(*this, params); }
+void expire_msgs::load_from(json_object_view params) { load_recursive(*this, params); }
 bt_value expire_msgs::to_bt() const {
     bt_list msgs;
     for (const auto& m : messages)
@@ -456,15 +600,16 @@ bt_value expire_msgs::to_bt() const {
 
 template <typename Dict>
 static void load(get_swarm& g, Dict& d) {
-    auto [pubKey, pubkey] = load_fields<std::string, std::string>(d, "pubKey", "pubkey");
+    auto [pubKey, pubkey] = load_fields<std::string_view, std::string_view>(d, "pubKey", "pubkey");
 
     require_exactly_one_of("pubkey", pubkey, "pubKey", pubKey, true);
-    if (!g.pubkey.load(std::move(pubkey ? *pubkey : *pubKey)))
+    if (!g.pubkey.load(pubkey ? *pubkey : *pubKey))
         throw parse_error{fmt::format("Pubkey must be {} hex digits/{} bytes long",
                 USER_PUBKEY_SIZE_HEX, USER_PUBKEY_SIZE_BYTES)};
 }
 void get_swarm::load_from(json params) { load(*this, params); }
 void get_swarm::load_from(bt_dict_consumer params) { load(*this, params); }
+void get_swarm::load_from(json_object_view params) { load(*this, params); }
 
 inline const static std::unordered_set<std::string_view> allowed_lozzaxd_endpoints{{
     "get_service_nodes"sv, "ons_resolve"sv}};
@@ -480,6 +625,13 @@ static void load(lozzaxd_request& o, Dict& d) {
     if constexpr (std::is_same_v<Dict, json>) {
         if (auto it = d.find("params"); it != d.end() && !it->is_null())
             o.params = *it;
+    } else if constexpr (std::is_same_v<Dict, json_object_view>) {
+        if (auto* v = d.find("params"); v && !v->is_null()) {
+            json params = json::parse(v->raw, nullptr, false);
+            if (params.is_discarded())
+                throw parse_error{"lozzaxd_request params field does not contain valid json"};
+            o.params = std::move(params);
+        }
     } else {
         if (auto json_str = parse_field<std::string_view>(d, "params")) {
             json params = json::parse(*json_str, nullptr, false);
@@ -492,5 +644,6 @@ static void load(lozzaxd_request& o, Dict& d) {
 }
 void lozzaxd_request::load_from(json params) { load(*this, params); }
 void lozzaxd_request::load_from(bt_dict_consumer params) { load(*this, params); }
+void lozzaxd_request::load_from(json_object_view params) { load(*this, params); }
 
 } // namespace oxen::rpc
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "json_view.h"
 #include "oxen_common.h"
 #include <array>
 #include <chrono>
@@ -26,11 +27,52 @@ struct parse_error : std::runtime_error {
     using std::runtime_error::runtime_error;
 };
 
+/// Binary data value of a client request.  Values that arrive as raw bytes (i.e. in bt-encoded
+/// requests) are borrowed straight from the request buffer rather than copied: the buffer outlives
+/// the rpc request struct, as requests are always fully handled (and forwarded, and stored) before
+/// the buffer is released.  Base64-encoded (json) values are decoded directly into storage owned by
+/// this object.  Either way the data is not copied again until the database binds it.
+///
+/// Copying a request_data that owns its data copies the data; copying a borrowed one does not.
+class request_data {
+  public:
+    request_data() = default;
+    request_data(const request_data& other) { *this = other; }
+    request_data(request_data&& other) noexcept { *this = std::move(other); }
+    request_data& operator=(const request_data& other);
+    request_data& operator=(request_data&& other) noexcept;
+
+    /// Refers to `data`, which must stay valid for as long as this value (or copies of it) is used.
+    void borrow(std::string_view data);
+
+    /// Decodes `b64`, which must be valid base64 (padded or unpadded), into owned storage.
+    void decode_base64(std::string_view b64);
+
+    /// True if this data is stored here rather than borrowed from elsewhere
+    bool owned() const { return owned_; }
+
+    std::string_view view() const { return view_; }
+    operator std::string_view() const { return view_; }
+    const char* data() const { return view_.data(); }
+    size_t size() const { return view_.size(); }
+    bool empty() const { return view_.empty(); }
+
+    bool operator==(std::string_view other) const { return view_ == other; }
+    bool operator!=(std::string_view other) const { return view_ != other; }
+
+  private:
+    std::string storage_;
+    std::string_view view_;
+    bool owned_ = false;
+};
+
 // Common base type decorator of all client rpc endpoint types.
 struct endpoint {
     // Loads the rpc request from json.  Throws on error (missing keys, bad values, etc.).
     virtual void load_from(nlohmann::json params) = 0;
     virtual void load_from(oxenmq::bt_dict_consumer params) = 0;
+    // Same as the json version, but reading the fields in place from the json text
+    virtual void load_from(json_object_view params) = 0;
 
     bool b64 = true; // True if we need to base64-encode values (i.e. for json); false if we can deal with binary (i.e. bt-encoded)
 
@@ -41,6 +83,7 @@ struct endpoint {
 struct no_args : endpoint {
     void load_from(nlohmann::json) override {}
     void load_from(oxenmq::bt_dict_consumer) override {}
+    void load_from(json_object_view) override {}
 };
 
 /// Base type for a "recursive" endpoint: that is, where the request gets forwarded from the initial
@@ -54,10 +97,28 @@ struct no_args : endpoint {
 /// - "reason": a reason string, e.g. propagating a thrown exception messages
 /// - "bad_peer_response": true if the peer returned an unparseable response
 /// - "query_failure": true if the database failed to perform the query
+///
+/// By default the response is sent once every swarm member has replied (or timed out).  All
+/// recursive endpoints also accept these optional parameters to reply sooner:
+/// - `quorum` -- reply as soon as this many swarm members (including the one handling the request)
+///   have successfully processed the request.
+/// - `reply_timeout` -- reply after at most this many milliseconds (at most 5000), even if some
+///   swarm members have not yet replied.
+/// When a reply is sent before all swarm members have answered, the response contains a "pending"
+/// key listing the Ed25519 pubkeys (hex) of the members that had not yet answered.  (The node may
+/// also be configured with default values for these).
+/// The largest `reply_timeout` we accept: we never wait longer than this for forwarded requests
+/// anyway (see FORWARD_TIMEOUT), so a longer timeout could only ever make us hold on to the request.
+inline constexpr auto REPLY_TIMEOUT_MAX = 5s;
+
 struct recursive : endpoint {
     // True on the initial client request, false on forwarded requests
     bool recurse;
 
+    // Early reply settings (only used when `recurse` is true)
+    std::optional<int> quorum;
+    std::optional<std::chrono::milliseconds> reply_timeout;
+
     virtual oxenmq::bt_value to_bt() const = 0;
 };
 
@@ -107,10 +168,11 @@ struct store final : recursive {
     user_pubkey_t pubkey;
     std::chrono::system_clock::time_point timestamp;
     std::chrono::system_clock::time_point expiry; // computed from timestamp+ttl if ttl was given
-    std::string data; // always stored here in bytes
+    request_data data; // in bytes; borrowed from bt requests, decoded from base64 for json
 
     void load_from(nlohmann::json params) override;
     void load_from(oxenmq::bt_dict_consumer params) override;
+    void load_from(json_object_view params) override;
     oxenmq::bt_value to_bt() const override;
 };
 
@@ -149,6 +211,44 @@ struct retrieve final : endpoint {
 
     void load_from(nlohmann::json params) override;
     void load_from(oxenmq::bt_dict_consumer params) override;
+    void load_from(json_object_view params) override;
+};
+
+/// Subscribes to new messages for a pubkey, so that they get pushed to the client as they arrive
+/// instead of the client having to poll with `retrieve`.  Only available over OMQ (as
+/// `storage.subscribe`), because the messages are sent back over the same connection (see
+/// `Subscriptions` for the notification format).  Subscriptions expire after 30 minutes; to keep
+/// receiving messages the client should subscribe again before then.  Also invokable as
+/// `storage.unsubscribe` (with the same parameters) to end a subscription.
+///
+/// Takes parameters of:
+/// - pubkey -- the pubkey whose messages to subscribe to, in hex (66) or bytes (33)
+/// - pubkey_ed25519 -- as for `retrieve`
+/// - timestamp -- the timestamp at which this request was initiated, in milliseconds since unix
+///   epoch.  Must be within ±60s of the current time.
+/// - signature -- Ed25519 signature of ("subscribe" || timestamp) (or ("unsubscribe" ||
+///   timestamp) for an unsubscribe request), where timestamp is the base10 expression of the
+///   timestamp value.  Must be base64 encoded for json requests; binary for OMQ requests.
+///
+/// Returns dict of:
+/// - "expiry" -- when the subscription expires, in milliseconds since unix epoch (omitted when
+///   unsubscribing).
+/// - "t" -- the current time, in milliseconds since unix epoch.
+///
+/// Note that a subscription only delivers messages that arrive after it was made; clients should
+/// still `retrieve` once after subscribing to pick up anything they missed.
+struct subscribe final : endpoint {
+    static constexpr auto names() { return NAMES("subscribe", "unsubscribe"); }
+
+    user_pubkey_t pubkey;
+    std::optional<std::array<unsigned char, 32>> pubkey_ed25519;
+    std::chrono::system_clock::time_point timestamp;
+    std::array<unsigned char, 64> signature;
+    bool unsubscribe = false;
+
+    void load_from(nlohmann::json params) override;
+    void load_from(oxenmq::bt_dict_consumer params) override;
+    void load_from(json_object_view params) override;
 };
 
 /// Retrieves status information about this storage server.  Takes no parameters.
@@ -195,6 +295,7 @@ struct delete_msgs final : recursive {
 
     void load_from(nlohmann::json params) override;
     void load_from(oxenmq::bt_dict_consumer params) override;
+    void load_from(json_object_view params) override;
     oxenmq::bt_value to_bt() const override;
 };
 
@@ -230,6 +331,7 @@ struct delete_all final : recursive {
 
     void load_from(nlohmann::json params) override;
     void load_from(oxenmq::bt_dict_consumer params) override;
+    void load_from(json_object_view params) override;
     oxenmq::bt_value to_bt() const override;
 };
 
@@ -264,6 +366,7 @@ struct delete_before final : recursive {
 
     void load_from(nlohmann::json params) override;
     void load_from(oxenmq::bt_dict_consumer params) override;
+    void load_from(json_object_view params) override;
     oxenmq::bt_value to_bt() const override;
 };
 
@@ -300,6 +403,7 @@ struct expire_all final : recursive {
 
     void load_from(nlohmann::json params) override;
     void load_from(oxenmq::bt_dict_consumer params) override;
+    void load_from(json_object_view params) override;
     oxenmq::bt_value to_bt() const override;
 };
 
@@ -339,6 +443,7 @@ struct expire_msgs final : recursive {
 
     void load_from(nlohmann::json params) override;
     void load_from(oxenmq::bt_dict_consumer params) override;
+    void load_from(json_object_view params) override;
     oxenmq::bt_value to_bt() const override;
 };
 
@@ -353,6 +458,7 @@ struct get_swarm final : endpoint {
 
     void load_from(nlohmann::json params) override;
     void load_from(oxenmq::bt_dict_consumer params) override;
+    void load_from(json_object_view params) override;
 };
 
 /// Forwards an RPC request to the this storage server's lozzaxd.  Takes keys of:
@@ -374,6 +480,7 @@ struct lozzaxd_request final : endpoint {
 
     void load_from(nlohmann::json params) override;
     void load_from(oxenmq::bt_dict_consumer params) override;
+    void load_from(json_object_view params) override;
 };
 
 
@@ -2,6 +2,7 @@
 #include "oxen_logger.h"
 #include "utils.hpp"
 
+#include <algorithm>
 #include <filesystem>
 #include <iostream>
 
@@ -43,6 +44,18 @@ void command_line_parser::parse_args(int argc, char* argv[]) {
         ("version,v", po::bool_switch(&options_.print_version), "Print the version of this binary")
         ("help", po::bool_switch(&options_.print_help),"Shows this help message")
         ("stats-access-key", po::value(&options_.stats_access_keys)->multitoken(), "A public key (x25519) that will be given access to the `get_stats` omq endpoint")
+        ("https-threads", po::value(&options_.https_threads), "Number of threads handling incoming HTTPS connections (TLS and request parsing); values above 1 bind the HTTPS port with SO_REUSEPORT")
+        ("omq-threads", po::value(&options_.omq_threads), "Number of general purpose OxenMQ worker threads; 0 uses one per hardware thread")
+        ("omq-sn-threads", po::value(&options_.omq_sn_threads), "Number of OxenMQ worker threads reserved for requests from other service nodes")
+        ("omq-sn-queue", po::value(&options_.omq_sn_queue), "Maximum number of queued requests from other service nodes")
+        ("omq-storage-threads", po::value(&options_.omq_storage_threads), "Number of OxenMQ worker threads reserved for client requests received over OxenMQ")
+        ("omq-storage-queue", po::value(&options_.omq_storage_queue), "Maximum number of queued client requests received over OxenMQ")
+        ("omq-https-threads", po::value(&options_.omq_https_threads), "Number of worker threads reserved for requests received over HTTPS (the minimum, with --adaptive-workers)")
+        ("omq-https-queue", po::value(&options_.omq_https_queue), "Maximum number of queued requests received over HTTPS")
+        ("adaptive-workers", po::bool_switch(&options_.adaptive_workers), "Handle requests received over HTTPS on a worker pool that adds threads when requests wait too long in the queue, and removes them again when idle")
+        ("adaptive-max-threads", po::value(&options_.adaptive_max_threads), "Maximum number of threads of the --adaptive-workers pool; 0 uses one per hardware thread")
+        ("swarm-reply-quorum", po::value(&options_.swarm_reply_quorum), "Reply to recursive client requests once this many swarm members (including this node) have succeeded, without waiting for the rest; 0 waits for all")
+        ("swarm-reply-timeout", po::value(&options_.swarm_reply_timeout), "Reply to recursive client requests with the swarm results received so far after this many milliseconds; 0 waits for all")
 #ifdef INTEGRATION_TEST
         ("lozzaxd-key", po::value(&options_.lozzaxd_key), "Legacy secret key (integration testing only)")
         ("lozzaxd-x25519-key", po::value(&options_.lozzaxd_x25519_key), "x25519 secret key (integration testing only)")
@@ -114,6 +127,17 @@ void command_line_parser::parse_args(int argc, char* argv[]) {
             "omq-port command line option is not specified");
     }
 
+    if (options_.https_threads < 1)
+        throw std::runtime_error("Invalid option: https-threads must be at least 1");
+
+    if (options_.omq_sn_queue < 1 || options_.omq_storage_queue < 1 || options_.omq_https_queue < 1)
+        throw std::runtime_error("Invalid option: omq queue sizes must be at least 1");
+
+    if (options_.adaptive_workers && options_.adaptive_max_threads != 0 &&
+            options_.adaptive_max_threads < std::max<uint16_t>(options_.omq_https_threads, 1))
+        throw std::runtime_error(
+            "Invalid option: adaptive-max-threads must not be less than omq-https-threads");
+
     if (!vm.count("ip") || !vm.count("port")) {
         throw std::runtime_error(
             "Invalid option: address and/or port missing.");
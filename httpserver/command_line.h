@@ -21,6 +21,24 @@ struct command_line_options {
     std::string lozzaxd_ed25519_key; // test only
     // x25519 key that will be given access to get_stats omq endpoint
     std::vector<std::string> stats_access_keys;
+    // Default early reply settings for recursive client requests (0 = wait for all swarm members)
+    uint16_t swarm_reply_quorum = 0;
+    uint32_t swarm_reply_timeout = 0; // milliseconds
+    // Number of threads (each with its own event loop) handling incoming HTTPS connections
+    uint16_t https_threads = 1;
+    // OxenMQ worker threads (0 = one per hardware thread), and the threads reserved for (and
+    // maximum queued jobs of) the sn, storage and https request categories
+    uint16_t omq_threads = 1;
+    uint16_t omq_sn_threads = 2;
+    uint32_t omq_sn_queue = 1000;
+    uint16_t omq_storage_threads = 1;
+    uint32_t omq_storage_queue = 200;
+    uint16_t omq_https_threads = 2;
+    uint32_t omq_https_queue = 1000;
+    // Handle https requests on a worker pool that grows (up to adaptive_max_threads; 0 = one per
+    // hardware thread) and shrinks with the time requests spend waiting in the queue
+    bool adaptive_workers = false;
+    uint16_t adaptive_max_threads = 0;
 };
 
 class command_line_parser {
@@ -0,0 +1,49 @@
+#include "forward_batch.h"
+
+#include "oxen_logger.h"
+
+#include <oxenmq/bt_serialize.h>
+
+namespace oxen {
+
+bool forward_batch::add(std::string_view method, std::string params, forward_callback callback) {
+    bytes += method.size() + params.size();
+    parts.emplace_back(method);
+    parts.push_back(std::move(params));
+    callbacks.push_back(std::move(callback));
+    return callbacks.size() >= FORWARD_BATCH_MAX_REQUESTS || bytes >= FORWARD_BATCH_MAX_BYTES;
+}
+
+std::string encode_forward_reply(const http::response_code& status, std::string_view body) {
+    if (status == http::OK)
+        return oxenmq::bt_serialize(oxenmq::bt_list{body});
+    return oxenmq::bt_serialize(oxenmq::bt_list{std::to_string(status.first), body});
+}
+
+void deliver_forward_replies(
+        const std::vector<forward_callback>& callbacks,
+        bool success,
+        std::vector<std::string> data,
+        const x25519_pubkey& peer) {
+    if (success && data.size() != callbacks.size()) {
+        OXEN_LOG(warn, "Invalid forwarded batch response from {}: expected {} parts, got {}",
+                peer, callbacks.size(), data.size());
+        data.clear();
+        data.resize(callbacks.size()); // Will be reported as bad responses below
+    }
+    for (size_t i = 0; i < callbacks.size(); i++) {
+        std::vector<std::string> parts;
+        if (success && !data[i].empty()) {
+            try {
+                for (oxenmq::bt_list_consumer l{data[i]}; !l.is_finished(); )
+                    parts.push_back(l.consume_string());
+            } catch (const std::exception& e) {
+                OXEN_LOG(warn, "Invalid forwarded batch response part from {}: {}", peer, e.what());
+                parts.clear();
+            }
+        }
+        callbacks[i](success, std::move(parts));
+    }
+}
+
+} // namespace oxen
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "http.h"
+#include "lozzaxd_key.h"
+
+namespace oxen {
+
+using namespace std::literals;
+
+// Forwarded client requests (sn.storage_cc) to the same swarm peer are collected for up to this
+// long and then sent together in a single sn.storage_cc_batch request.
+inline constexpr auto FORWARD_BATCH_INTERVAL = 5ms;
+
+// We send a forwarding batch right away (rather than waiting for the batch interval) once it
+// reaches this many requests or this many bytes of request data.
+inline constexpr size_t FORWARD_BATCH_MAX_REQUESTS = 100;
+inline constexpr size_t FORWARD_BATCH_MAX_BYTES = 1'000'000;
+
+/// Called with the outcome of a forwarded client request: the success flag and reply parts exactly
+/// as they would be for an individual sn.storage_cc request.
+using forward_callback = std::function<void(bool success, std::vector<std::string> parts)>;
+
+/// Forwarded client requests waiting to be sent to a swarm peer as one sn.storage_cc_batch request.
+struct forward_batch {
+    std::vector<std::string> parts; // [METHOD1, PARAMS1, METHOD2, PARAMS2, ...]
+    std::vector<forward_callback> callbacks;
+    size_t bytes = 0;
+
+    /// Adds a request to the batch.  Returns true if the batch is now full and should be sent right
+    /// away (see FORWARD_BATCH_MAX_REQUESTS and FORWARD_BATCH_MAX_BYTES).
+    bool add(std::string_view method, std::string params, forward_callback callback);
+};
+
+/// Encodes the reply to one request of a sn.storage_cc_batch: the bt-encoded list of what the
+/// sn.storage_cc reply parts would have been, i.e. [BODY] on success or [ERRCODE, BODY] on failure.
+std::string encode_forward_reply(const http::response_code& status, std::string_view body);
+
+/// Hands the reply to a sn.storage_cc_batch request from `peer` to the callbacks of the individual
+/// requests, in order.  If the batch request as a whole failed then every callback gets the failure;
+/// a malformed reply (or reply part) is passed on as a success with no reply parts, which the
+/// callbacks treat as a bad response.
+void deliver_forward_replies(
+        const std::vector<forward_callback>& callbacks,
+        bool success,
+        std::vector<std::string> data,
+        const x25519_pubkey& peer);
+
+} // namespace oxen
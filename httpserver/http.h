@@ -72,6 +72,12 @@ namespace oxen::http {
     constexpr auto SNODE_SIGNATURE_HEADER = "X-Loki-Snode-Signature";
     constexpr auto SENDER_KEY_HEADER = "X-Sender-Public-Key";
 
+    constexpr auto JSON_CONTENT_TYPE = "application/json";
+
+    // Content type of bt-encoded client requests and responses.  Including it in the Accept header of
+    // a (json) client request asks for a bt-encoded response.
+    constexpr auto BT_CONTENT_TYPE = "application/x-bencode";
+
     // Returned in a HF19+ ping_test to include the remote's pubkey in the response
     constexpr auto SNODE_PUBKEY_HEADER = "X-Lozzax-Snode-Pubkey";
 }
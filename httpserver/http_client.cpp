@@ -0,0 +1,311 @@
+#include "http_client.h"
+
+#include "oxen_logger.h"
+#include "string_utils.hpp"
+
+#include <curl/curl.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <deque>
+#include <iterator>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+
+namespace oxen {
+
+const std::string* http_response::header(std::string_view name) const {
+    for (auto& [k, v] : headers)
+        if (k.size() == name.size() && std::equal(k.begin(), k.end(), name.begin(),
+                    [](char a, char b) { return a == std::tolower(static_cast<unsigned char>(b)); }))
+            return &v;
+    return nullptr;
+}
+
+namespace {
+
+size_t on_body(char* ptr, size_t size, size_t n, void* userdata) {
+    static_cast<http_response*>(userdata)->body.append(ptr, size * n);
+    return size * n;
+}
+
+size_t on_header(char* ptr, size_t size, size_t n, void* userdata) {
+    auto& res = *static_cast<http_response*>(userdata);
+    std::string_view line{ptr, size * n};
+    while (!line.empty() && (line.back() == '\r' || line.back() == '\n'))
+        line.remove_suffix(1);
+
+    if (util::starts_with(line, "HTTP/")) {
+        // A new status line (e.g. after a 100 Continue) starts a new set of headers
+        res.status_line = line;
+        res.headers.clear();
+    } else if (auto colon = line.find(':'); colon != std::string_view::npos) {
+        std::string name{line.substr(0, colon)};
+        for (auto& c : name)
+            c = std::tolower(static_cast<unsigned char>(c));
+        auto value = line.substr(colon + 1);
+        while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+            value.remove_prefix(1);
+        res.headers.emplace_back(std::move(name), value);
+    }
+    return size * n;
+}
+
+} // namespace
+
+struct HttpClient::impl {
+    struct transfer {
+        http_request req;
+        callback cb;
+        std::chrono::steady_clock::time_point deadline;
+        curl_slist* headers = nullptr;
+        http_response res;
+        char errbuf[CURL_ERROR_SIZE];
+    };
+
+    CURLM* multi;
+    CURLSH* share;
+
+    // Self-pipe used to wake up the loop thread when it is waiting in curl_multi_wait.  (Newer curl
+    // has curl_multi_poll/curl_multi_wakeup for this, but we still support building against
+    // versions older than 7.68).
+    int wake_pipe[2] = {-1, -1};
+
+    // Guards `queue` and `stopping`; everything else is only touched by the loop thread.
+    std::mutex mutex;
+    std::deque<std::unique_ptr<transfer>> queue;
+    bool stopping = false;
+
+    std::unordered_map<CURL*, std::unique_ptr<transfer>> active;
+    // Finished easy handles kept for reuse by later requests
+    std::vector<CURL*> idle_handles;
+
+    std::thread loop_thread;
+
+    impl() {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        multi = curl_multi_init();
+        share = curl_share_init();
+        if (!multi || !share)
+            throw std::runtime_error{"Failed to initialize curl"};
+
+        // Only the loop thread ever uses the share, so it doesn't need any locking callbacks.
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+
+        curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, HTTP_CLIENT_MAX_HOST_CONNECTIONS);
+        curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, HTTP_CLIENT_MAX_IDLE_CONNECTIONS);
+
+        if (pipe(wake_pipe) != 0)
+            throw std::system_error{errno, std::system_category(), "Failed to create wakeup pipe"};
+        for (int fd : wake_pipe) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+
+        loop_thread = std::thread{[this] { run(); }};
+    }
+
+    ~impl() {
+        {
+            std::lock_guard lock{mutex};
+            stopping = true;
+        }
+        wakeup();
+        loop_thread.join();
+
+        for (auto& [easy, t] : active) {
+            curl_multi_remove_handle(multi, easy);
+            curl_easy_cleanup(easy);
+            curl_slist_free_all(t->headers);
+        }
+        for (auto* easy : idle_handles)
+            curl_easy_cleanup(easy);
+        curl_multi_cleanup(multi);
+        curl_share_cleanup(share);
+        curl_global_cleanup();
+        close(wake_pipe[0]);
+        close(wake_pipe[1]);
+    }
+
+    // Wakes up the loop thread.  If the pipe is full then a wakeup is already pending, so a failed
+    // write doesn't matter.
+    void wakeup() {
+        char c = 0;
+        [[maybe_unused]] auto rc = write(wake_pipe[1], &c, 1);
+    }
+
+    // Waits for activity on any of curl's sockets or for a wakeup, for at most `timeout_ms`.
+    void wait(int timeout_ms) {
+        curl_waitfd wake{};
+        wake.fd = wake_pipe[0];
+        wake.events = CURL_WAIT_POLLIN;
+        curl_multi_wait(multi, &wake, 1, timeout_ms, nullptr);
+        char buf[64];
+        while (read(wake_pipe[0], buf, sizeof(buf)) > 0) {}
+    }
+
+    void post(std::unique_ptr<transfer> t) {
+        {
+            std::lock_guard lock{mutex};
+            if (stopping)
+                return;
+            queue.push_back(std::move(t));
+        }
+        wakeup();
+    }
+
+    void run() {
+        std::vector<std::unique_ptr<transfer>> starting, expired;
+        while (true) {
+            {
+                std::lock_guard lock{mutex};
+                if (stopping)
+                    break;
+                while (!queue.empty() && active.size() + starting.size() < HTTP_CLIENT_MAX_CONCURRENT) {
+                    starting.push_back(std::move(queue.front()));
+                    queue.pop_front();
+                }
+                if (!queue.empty()) {
+                    // We're at capacity; fail anything that has been waiting for longer than its
+                    // timeout.
+                    auto now = std::chrono::steady_clock::now();
+                    auto it = std::stable_partition(queue.begin(), queue.end(),
+                            [now](auto& t) { return t->deadline > now; });
+                    std::move(it, queue.end(), std::back_inserter(expired));
+                    queue.erase(it, queue.end());
+                }
+            }
+
+            for (auto& t : starting)
+                start(std::move(t));
+            starting.clear();
+            for (auto& t : expired)
+                fail_timed_out(std::move(t));
+            expired.clear();
+
+            int running;
+            curl_multi_perform(multi, &running);
+
+            int remaining;
+            while (CURLMsg* m = curl_multi_info_read(multi, &remaining))
+                if (m->msg == CURLMSG_DONE)
+                    finish(m->easy_handle, m->data.result);
+
+            wait(1000);
+        }
+    }
+
+    void start(std::unique_ptr<transfer> t) {
+        auto now = std::chrono::steady_clock::now();
+        if (t->deadline <= now)
+            return fail_timed_out(std::move(t));
+
+        CURL* easy;
+        if (!idle_handles.empty()) {
+            easy = idle_handles.back();
+            idle_handles.pop_back();
+            curl_easy_reset(easy);
+        } else if (!(easy = curl_easy_init())) {
+            t->res.error = "failed to initialize curl request";
+            return complete(std::move(t));
+        }
+
+        for (auto& [k, v] : t->req.headers)
+            t->headers = curl_slist_append(t->headers, (k + ": " + v).c_str());
+        // Don't wait for a 100-continue before sending larger bodies; we're always sending the body
+        // anyway, so it just costs us a round trip.
+        t->headers = curl_slist_append(t->headers, "Expect:");
+
+        auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(t->deadline - now);
+        t->errbuf[0] = 0;
+
+        curl_easy_setopt(easy, CURLOPT_URL, t->req.url.c_str());
+        curl_easy_setopt(easy, CURLOPT_POST, 1L);
+        curl_easy_setopt(easy, CURLOPT_POSTFIELDS, t->req.body.data());
+        curl_easy_setopt(easy, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(t->req.body.size()));
+        curl_easy_setopt(easy, CURLOPT_HTTPHEADER, t->headers);
+        curl_easy_setopt(easy, CURLOPT_TIMEOUT_MS, std::max<long>(1, timeout.count()));
+        curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(easy, CURLOPT_FOLLOWLOCATION, 0L);
+        curl_easy_setopt(easy, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(easy, CURLOPT_SSLVERSION, CURL_SSLVERSION_TLSv1_2);
+        curl_easy_setopt(easy, CURLOPT_SSL_VERIFYPEER, t->req.verify_peer ? 1L : 0L);
+        curl_easy_setopt(easy, CURLOPT_SSL_VERIFYHOST, t->req.verify_peer ? 2L : 0L);
+        curl_easy_setopt(easy, CURLOPT_SHARE, share);
+        curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, on_body);
+        curl_easy_setopt(easy, CURLOPT_WRITEDATA, &t->res);
+        curl_easy_setopt(easy, CURLOPT_HEADERFUNCTION, on_header);
+        curl_easy_setopt(easy, CURLOPT_HEADERDATA, &t->res);
+        curl_easy_setopt(easy, CURLOPT_ERRORBUFFER, t->errbuf);
+
+        OXEN_LOG(trace, "Starting HTTP request to {}", t->req.url);
+        if (auto rc = curl_multi_add_handle(multi, easy); rc != CURLM_OK) {
+            t->res.error = curl_multi_strerror(rc);
+            curl_slist_free_all(t->headers);
+            t->headers = nullptr;
+            idle_handles.push_back(easy);
+            return complete(std::move(t));
+        }
+        active.emplace(easy, std::move(t));
+    }
+
+    void finish(CURL* easy, CURLcode result) {
+        curl_multi_remove_handle(multi, easy);
+        auto it = active.find(easy);
+        if (it == active.end()) {
+            OXEN_LOG(err, "Internal error: finished HTTP request not found");
+            curl_easy_cleanup(easy);
+            return;
+        }
+        auto t = std::move(it->second);
+        active.erase(it);
+
+        if (result == CURLE_OK) {
+            curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &t->res.status_code);
+        } else {
+            t->res.status_code = 0;
+            t->res.timed_out = result == CURLE_OPERATION_TIMEDOUT;
+            t->res.error = t->errbuf[0] ? t->errbuf : curl_easy_strerror(result);
+        }
+
+        curl_slist_free_all(t->headers);
+        t->headers = nullptr;
+        idle_handles.push_back(easy);
+
+        complete(std::move(t));
+    }
+
+    void fail_timed_out(std::unique_ptr<transfer> t) {
+        t->res.error = "Timed out waiting to send request";
+        t->res.timed_out = true;
+        complete(std::move(t));
+    }
+
+    void complete(std::unique_ptr<transfer> t) {
+        try {
+            t->cb(std::move(t->res));
+        } catch (const std::exception& e) {
+            OXEN_LOG(err, "HTTP request callback for {} raised an exception: {}", t->req.url, e.what());
+        }
+    }
+};
+
+HttpClient::HttpClient() : impl_{std::make_unique<impl>()} {}
+
+HttpClient::~HttpClient() = default;
+
+void HttpClient::post(http_request req, callback cb) {
+    auto t = std::make_unique<impl::transfer>();
+    t->deadline = std::chrono::steady_clock::now() + req.timeout;
+    t->req = std::move(req);
+    t->cb = std::move(cb);
+    impl_->post(std::move(t));
+}
+
+} // namespace oxen
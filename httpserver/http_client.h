@@ -0,0 +1,84 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace oxen {
+
+using namespace std::literals;
+
+// Maximum number of requests we will have in progress at once; any more than this wait in a queue
+// until an earlier request finishes.
+inline constexpr size_t HTTP_CLIENT_MAX_CONCURRENT = 128;
+
+// Maximum number of simultaneous connections we open to a single host; requests beyond that wait
+// for (and then reuse) one of the existing connections.
+inline constexpr long HTTP_CLIENT_MAX_HOST_CONNECTIONS = 4;
+
+// How many idle keep-alive connections we keep open for reuse.
+inline constexpr long HTTP_CLIENT_MAX_IDLE_CONNECTIONS = 256;
+
+struct http_request {
+    std::string url;
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string body;
+    std::chrono::milliseconds timeout = 10s;
+    // Service nodes use self-signed certificates, so requests to them need to disable this.
+    bool verify_peer = true;
+};
+
+struct http_response {
+    // The HTTP status code; 0 if the request failed without getting a response.
+    long status_code = 0;
+    // The HTTP status line, e.g. "HTTP/1.1 200 OK"
+    std::string status_line;
+    // Response headers; names are lower-cased.
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string body;
+
+    // Set to a description of the failure if the request failed without getting any HTTP response
+    // (note that non-2xx responses are *not* failures).  Empty on success.
+    std::string error;
+    // True if the failure was a timeout.
+    bool timed_out = false;
+
+    // Returns a pointer to the value of the given header (case-insensitive), nullptr if not present.
+    const std::string* header(std::string_view name) const;
+};
+
+/// Asynchronous HTTP(S) client running on a single event loop thread (using a libcurl multi handle),
+/// for our outgoing HTTPS requests (reachability tests, legacy storage tests, and onion requests
+/// proxied to external servers).
+///
+/// Connections are kept alive and reused for subsequent requests to the same host, and TLS sessions
+/// are cached so that new connections to a host we've talked to before can use an abbreviated
+/// handshake.  At most HTTP_CLIENT_MAX_CONCURRENT requests are in progress at any time.
+class HttpClient {
+  public:
+    using callback = std::function<void(http_response)>;
+
+    HttpClient();
+
+    /// Stops the event loop thread.  Requests still outstanding are abandoned without invoking
+    /// their callbacks.
+    ~HttpClient();
+
+    HttpClient(const HttpClient&) = delete;
+    HttpClient& operator=(const HttpClient&) = delete;
+
+    /// Queues a POST request.  The callback is invoked from the client's event loop thread, and so
+    /// should not block.  The request timeout includes any time spent waiting in the queue.
+    void post(http_request req, callback cb);
+
+  private:
+    struct impl;
+    std::unique_ptr<impl> impl_;
+};
+
+} // namespace oxen
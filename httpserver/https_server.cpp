@@ -57,8 +57,8 @@ HTTPSServer::HTTPSServer(
         std::vector<std::tuple<std::string, uint16_t, bool>> bind,
         const std::filesystem::path& ssl_cert,
         const std::filesystem::path& ssl_key,
-        const std::filesystem::path& ssl_dh,
-        legacy_keypair legacy_keys
+        legacy_keypair legacy_keys,
+        int threads
         ) :
     service_node_{sn},
     omq_{*service_node_.omq_server()},
@@ -70,13 +70,8 @@ HTTPSServer::HTTPSServer(
     ))}
 {
 
-    // Add a category for handling incoming https requests
-    omq_.add_category("https",
-            oxenmq::AuthLevel::basic,
-            2, // minimum # of threads reserved threads for this category
-            1000 // max queued requests
-    );
-
+    if (threads < 1)
+        throw std::invalid_argument{"HTTPS server requires at least one thread"};
 
     // uWS is designed to work from a single thread, which is good (we pull off the requests and
     // then stick them into the LMQ job queue to be scheduled along with other jobs).  But as a
@@ -84,87 +79,117 @@ HTTPSServer::HTTPSServer(
     // (thread local) event loop pointer back from the thread so that we can shut it down later
     // (injecting a callback into it is one of the few thread-safe things we can do across threads).
     //
-    // Things we need in the owning thread, fulfilled from the http thread:
+    // To use more than one core for TLS and request parsing we run several such threads, each with
+    // its own app and event loop, all listening on the same address(es) via SO_REUSEPORT (with a
+    // single thread we keep the exclusive bind so that a second instance can't share our port).
+    const int listen_options = threads > 1 ? LIBUS_LISTEN_DEFAULT : LIBUS_LISTEN_EXCLUSIVE_PORT;
+
+    // No DH parameters: we only allow ECDHE key exchange (see configure_tls_context).
+    uWS::SocketContextOptions https_opts{
+        .key_file_name = ssl_key.c_str(),
+        .cert_file_name = ssl_cert.c_str()};
+
+    // Things we need in the owning thread, fulfilled from each http thread:
 
     // - the uWS::Loop* for the event loop thread (which is thread_local).  We can get this during
     //   thread startup, after the thread does basic initialization.
-    std::promise<uWS::Loop*> loop_promise;
-    auto loop_future = loop_promise.get_future();
+    std::vector<std::future<uWS::Loop*>> loop_futures;
 
-    // - the us_listen_socket_t* on which the server is listening.  We can't get this until we
-    //   actually start listening, so wait until `start()` for it.  (We also double-purpose it to
-    //   send back an exception if one fires during startup).
-    std::promise<std::vector<us_listen_socket_t*>> startup_success_promise;
-    startup_success_ = startup_success_promise.get_future();
+    for (int i = 0; i < threads; i++) {
+        auto& ev = *loops_.emplace_back(std::make_unique<event_loop>());
 
-    // Things we need to send from the owning thread to the event loop thread:
-    // - a signal when the thread should bind to the port and start the event loop (when we call
-    //   start()).
-    //startup_promise_
+        std::promise<uWS::Loop*> loop_promise;
+        loop_futures.push_back(loop_promise.get_future());
 
-    uWS::SocketContextOptions https_opts{
-        .key_file_name = ssl_key.c_str(),
-        .cert_file_name = ssl_cert.c_str(),
-        .dh_params_file_name = ssl_dh.c_str()};
-
-    server_thread_ = std::thread{[this, bind=std::move(bind), &https_opts] (
-            std::promise<uWS::Loop*> loop_promise,
-            std::future<bool> startup_future,
-            std::promise<std::vector<us_listen_socket_t*>> startup_success) {
-        uWS::SSLApp https{https_opts};
-        try {
-            create_endpoints(https);
-        } catch (...) {
-            loop_promise.set_exception(std::current_exception());
-            return;
-        }
-        // We've initialized, signal the calling thread
-        loop_promise.set_value(uWS::Loop::get());
-        // Now wait until we get the signal to go (sent when the caller calls start() call).
-        if (!startup_future.get())
-            // False means cancel, i.e. we got destroyed/shutdown without start() being called
-            return;
+        // - the us_listen_socket_t* on which the server is listening.  We can't get this until we
+        //   actually start listening, so wait until `start()` for it.  (We also double-purpose it
+        //   to send back an exception if one fires during startup).
+        std::promise<std::vector<us_listen_socket_t*>> startup_success_promise;
+        ev.startup_success = startup_success_promise.get_future();
 
-        // we don't currently do cors
-        //cors_ = {...};
+        // Things we need to send from the owning thread to the event loop thread:
+        // - a signal when the thread should bind to the port and start the event loop (when we call
+        //   start()): ev.startup_promise
 
-        std::vector<us_listen_socket_t*> listening;
-        try {
-            bool required_bind_failed = false;
-            for (const auto& [addr, port, required] : bind)
-                https.listen(addr, port, LIBUS_LISTEN_EXCLUSIVE_PORT,
-                        [&listening, req=required, &required_bind_failed, addr=fmt::format("{}:{}", addr, port)]
-                        (us_listen_socket_t* sock) {
-                            if (sock) {
-                                OXEN_LOG(info, "HTTPS server listening at {}", addr);
-                                listening.push_back(sock);
-                            } else if (req) {
-                                required_bind_failed = true;
-                                OXEN_LOG(critical, "HTTPS server failed to bind to required address {}", addr);
-                            } else {
-                                OXEN_LOG(warn, "HTTPS server failed to bind to (non-required) address {}", addr);
-                            }
-                        });
-
-            if (listening.empty() || required_bind_failed) {
-                std::ostringstream error;
-                error << "RPC HTTP server failed to bind; ";
-                if (listening.empty()) error << "no valid bind address(es) given; ";
-                error << "tried to bind to:";
+        ev.thread = std::thread{[this, bind, &https_opts, listen_options, i] (
+                std::promise<uWS::Loop*> loop_promise,
+                std::future<bool> startup_future,
+                std::promise<std::vector<us_listen_socket_t*>> startup_success) {
+            uWS::SSLApp https{https_opts};
+            try {
+                configure_tls_context(static_cast<SSL_CTX*>(https.getNativeHandle()), ticket_keys_);
+                create_endpoints(https);
+            } catch (...) {
+                loop_promise.set_exception(std::current_exception());
+                return;
+            }
+            // We've initialized, signal the calling thread
+            loop_promise.set_value(uWS::Loop::get());
+            // Now wait until we get the signal to go (sent when the caller calls start() call).
+            if (!startup_future.get())
+                // False means cancel, i.e. we got destroyed/shutdown without start() being called
+                return;
+
+            // we don't currently do cors
+            //cors_ = {...};
+
+            std::vector<us_listen_socket_t*> listening;
+            try {
+                bool required_bind_failed = false;
                 for (const auto& [addr, port, required] : bind)
-                    error << ' ' << addr << ':' << port;
-                throw std::runtime_error{error.str()};
+                    https.listen(addr, port, listen_options,
+                            [&listening, req=required, &required_bind_failed, i, addr=fmt::format("{}:{}", addr, port)]
+                            (us_listen_socket_t* sock) {
+                                if (sock) {
+                                    OXEN_LOG(info, "HTTPS server listening at {} (thread {})", addr, i);
+                                    listening.push_back(sock);
+                                } else if (req) {
+                                    required_bind_failed = true;
+                                    OXEN_LOG(critical, "HTTPS server failed to bind to required address {}", addr);
+                                } else {
+                                    OXEN_LOG(warn, "HTTPS server failed to bind to (non-required) address {}", addr);
+                                }
+                            });
+
+                if (listening.empty() || required_bind_failed) {
+                    std::ostringstream error;
+                    error << "RPC HTTP server failed to bind; ";
+                    if (listening.empty()) error << "no valid bind address(es) given; ";
+                    error << "tried to bind to:";
+                    for (const auto& [addr, port, required] : bind)
+                        error << ' ' << addr << ':' << port;
+                    throw std::runtime_error{error.str()};
+                }
+            } catch (...) {
+                for (auto* s : listening)
+                    us_listen_socket_close(/*ssl=*/true, s);
+                startup_success.set_exception(std::current_exception());
+                return;
             }
+            startup_success.set_value(std::move(listening));
+
+            https.run();
+        }, std::move(loop_promise), ev.startup_promise.get_future(), std::move(startup_success_promise)};
+    }
+
+    std::exception_ptr failed;
+    for (size_t i = 0; i < loops_.size(); i++) {
+        try {
+            loops_[i]->loop = loop_futures[i].get();
         } catch (...) {
-            startup_success.set_exception(std::current_exception());
-            return;
+            if (!failed)
+                failed = std::current_exception();
         }
-        startup_success.set_value(std::move(listening));
-
-        https.run();
-    }, std::move(loop_promise), startup_promise_.get_future(), std::move(startup_success_promise)};
+    }
+    if (failed) {
+        // Tell the threads that did initialize to give up, and wait for them to do so
+        shutdown(true);
+        std::rethrow_exception(failed);
+    }
 
-    loop_ = loop_future.get();
+    // Replace the session ticket keys now and then so that a leak of the keys doesn't expose the
+    // sessions of every past connection
+    omq_.add_timer([this] { ticket_keys_.rotate(); }, TLS_TICKET_KEY_ROTATION);
 }
 
 bool HTTPSServer::check_ready(HttpResponse& res) {
@@ -191,7 +216,7 @@ void queue_response_internal(
         const bool is_json = std::holds_alternative<json>(res.body);
         if (std::none_of(begin(res.headers), end(res.headers), [](const auto& h) {
                 return util::string_iequal(h.first, "content-type"); }))
-            r.writeHeader("Content-Type", is_json ? "application/json" : "text/plain");
+            r.writeHeader("Content-Type", is_json ? http::JSON_CONTENT_TYPE : "text/plain");
         for (const auto& [h, v] : res.headers)
             r.writeHeader(h, v);
 
@@ -216,6 +241,8 @@ namespace {
         HTTPSServer& https;
         oxenmq::OxenMQ& omq;
         HttpResponse& res;
+        // The event loop that owns the connection; everything touching `res` must run in it
+        uWS::Loop* loop;
         Request request;
         std::vector<std::pair<std::string, std::string>> extra_headers;
         bool aborted{false};
@@ -226,7 +253,7 @@ namespace {
         // this, of course, if the request got aborted and replied to.
         ~call_data() {
             if (replied || aborted) return;
-            https.loop_defer([&https=https, &res=res] {
+            https.loop_defer(loop, [&https=https, &res=res] {
                 https.error_response(res, http::SERVICE_UNAVAILABLE, "Server busy, try again later");
             });
         }
@@ -250,13 +277,36 @@ namespace {
     {
         if (!data || data->replied) return;
         data->replied = true;
-        data->https.loop_defer([data=std::move(data), res=std::move(res), force_close] () mutable {
+        auto* loop = data->loop;
+        data->https.loop_defer(loop, [data=std::move(data), res=std::move(res), force_close] () mutable {
             if (data->aborted)
                 return;
             queue_response_internal(data->https, data->res, std::move(res), force_close);
         });
     }
 
+    // The (cheap) reply to requests that we refuse, or give up on, because we are overloaded
+    Response overloaded_response(int retry_after) {
+        return Response{http::SERVICE_UNAVAILABLE, "Server busy, try again later"sv,
+            {{"Retry-After", std::to_string(retry_after)}}};
+    }
+
+    // Called when a queued request (received at `received`) starts: if its deadline has already
+    // passed then nobody is waiting for the reply anymore, so we reply with a 503 instead of
+    // handling it, and return true.
+    bool drop_expired(
+            std::shared_ptr<call_data>& data,
+            request_priority p,
+            std::chrono::steady_clock::time_point received) {
+        auto& omq = data->https.service_node().omq_server();
+        if (!omq.shedder().expired(p, received + request_deadline(p)))
+            return false;
+        OXEN_LOG(debug, "Dropping {} request that waited {} in the queue", to_string(p),
+                util::friendly_duration(std::chrono::steady_clock::now() - received));
+        queue_response(std::move(data), overloaded_response(omq.https_retry_after()));
+        return true;
+    }
+
     std::string get_remote_address(HttpResponse& res) {
         std::ostringstream result;
         bool first = true;
@@ -350,7 +400,7 @@ namespace {
             }
         }
 
-        std::shared_ptr<call_data> data{new call_data{https, omq, res}};
+        std::shared_ptr<call_data> data{new call_data{https, omq, res, uWS::Loop::get()}};
         auto& request = data->request;
         request.remote_addr = get_remote_address(res);
         request.uri = req.getUrl();
@@ -421,9 +471,8 @@ void HTTPSServer::create_endpoints(uWS::SSLApp& https)
     https.post("/retrieve_all", [this](HttpResponse* res, HttpRequest* req) {
         handle_request(req, res, [this, started=std::chrono::steady_clock::now()]
                 (std::shared_ptr<call_data> data) mutable {
-            auto& omq = data->omq;
             auto& request = data->request;
-            omq.inject_task("https", "https:" + request.uri, request.remote_addr,
+            service_node_.omq_server().inject_https_task("https:" + request.uri, request.remote_addr,
                     [data=std::move(data), started] mutable {
 
                 queue_response(std::move(data), request_handler_.process_retrieve_all());
@@ -496,6 +545,7 @@ static std::variant<legacy_pubkey, Response> validate_snode_signature(ServiceNod
 
 
 void HTTPSServer::process_storage_test_req(HttpRequest& req, HttpResponse& res) {
+    if (!admit(res, request_priority::storage_test)) return;
 
     auto check_snode_headers = [this, &res](call_data& data) {
         // Before we read the body make sure we have the required headers (so that we can reject bad
@@ -514,18 +564,19 @@ void HTTPSServer::process_storage_test_req(HttpRequest& req, HttpResponse& res)
         }
     };
 
-    handle_request(*this, omq_, req, res, [this](std::shared_ptr<call_data> data) mutable {
+    handle_request(*this, omq_, req, res, [this, started=std::chrono::steady_clock::now()]
+            (std::shared_ptr<call_data> data) mutable {
         // Now that we have the body, fully validate the snode signature:
         if (auto validate = validate_snode_signature(service_node_, data->request);
                 std::holds_alternative<Response>(validate))
             return queue_response(std::move(data), std::move(std::get<Response>(validate)));
 
-        auto& omq = data->omq;
         auto& request = data->request;
-        omq.inject_task("https", "https:" + request.uri, request.remote_addr,
-                [this, data=std::move(data)] () mutable {
+        service_node_.omq_server().inject_https_task("https:" + request.uri, request.remote_addr,
+                [this, data=std::move(data), started] () mutable {
 
             if (data->replied || data->aborted) return;
+            if (drop_expired(data, request_priority::storage_test, started)) return;
 
             auto& req = data->request;
 
@@ -592,12 +643,17 @@ void HTTPSServer::process_storage_test_req(HttpRequest& req, HttpResponse& res)
     }, std::move(check_snode_headers));
 }
 
-bool HTTPSServer::should_rate_limit_client(std::string_view addr) {
-    if (addr.size() != 4) return true;
-    uint32_t ip;
-    std::memcpy(&ip, addr.data(), 4);
-    boost::endian::big_to_native_inplace(ip);
-    return rate_limiter_.should_rate_limit_client(ip);
+bool HTTPSServer::admit(HttpResponse& res, request_priority p) {
+    auto& omq = service_node_.omq_server();
+    if (omq.admit_https_task(p))
+        return true;
+    OXEN_LOG(debug, "Overloaded: refusing {} request from {}", to_string(p), get_remote_address(res));
+    queue_response_internal(*this, res, overloaded_response(omq.https_retry_after()));
+    return false;
+}
+
+bool HTTPSServer::should_rate_limit_client(std::string_view addr, uint32_t cost) {
+    return rate_limiter_.should_rate_limit_client_address(addr, std::chrono::steady_clock::now(), cost);
 }
 
 void HTTPSServer::process_storage_rpc_req(HttpRequest& req, HttpResponse& res) {
@@ -616,15 +672,28 @@ void HTTPSServer::process_storage_rpc_req(HttpRequest& req, HttpResponse& res) {
         // Obsolete header, return an error code
         return error_response(res, http::GONE, "long polling is no longer supported, client upgrade required");
     }
+    if (!admit(res, request_priority::client)) return;
 
-    handle_request(*this, omq_, req, res, [this, started=std::chrono::steady_clock::now()]
+    handle_request(*this, omq_, req, res, [this, addr=std::string{addr}, started=std::chrono::steady_clock::now()]
             (std::shared_ptr<call_data> data) mutable {
-        auto& omq = data->omq;
         auto& request = data->request;
-        omq.inject_task("https", "https:" + request.uri, request.remote_addr,
+        // We charged one token above; now that we know how big the request is, charge the rest.
+        if (auto extra = RateLimiter::request_cost(request.body.size()) - 1;
+                extra > 0 && should_rate_limit_client(addr, extra)) {
+            OXEN_LOG(debug, "Rate limiting client request from {}", request.remote_addr);
+            return queue_response(std::move(data), {http::TOO_MANY_REQUESTS});
+        }
+        service_node_.omq_server().inject_https_task("https:" + request.uri, request.remote_addr,
                 [this, data=std::move(data), started] () mutable {
 
             if (data->replied || data->aborted) return;
+            if (drop_expired(data, request_priority::client, started)) return;
+
+            // A client can ask for a bt-encoded response (with raw binary values) via the Accept
+            // header; a bt-encoded request body gets one regardless.
+            bool bt_response = false;
+            if (auto it = data->request.headers.find("accept"); it != data->request.headers.end())
+                bt_response = it->second.find(http::BT_CONTENT_TYPE) != std::string::npos;
 
             try {
                 request_handler_.process_client_req(data->request.body,
@@ -632,7 +701,7 @@ void HTTPSServer::process_storage_rpc_req(HttpRequest& req, HttpResponse& res) {
                     OXEN_LOG(debug, "Responding to a client request after {}",
                             util::friendly_duration(std::chrono::steady_clock::now() - started));
                     queue_response(std::move(data), std::move(response));
-                });
+                }, bt_response);
             } catch (const std::exception& e) {
                 auto error = "Exception caught with processing client request: "s + e.what();
                 OXEN_LOG(critical, "{}", error);
@@ -643,14 +712,15 @@ void HTTPSServer::process_storage_rpc_req(HttpRequest& req, HttpResponse& res) {
 }
 
 void HTTPSServer::process_onion_req_v2(HttpRequest& req, HttpResponse& res) {
+    if (!admit(res, request_priority::onion)) return;
     handle_request(*this, omq_, req, res, [this, started=std::chrono::steady_clock::now()]
             (std::shared_ptr<call_data> data) mutable {
-        auto& omq = data->omq;
         auto& request = data->request;
-        omq.inject_task("https", "https:" + request.uri, request.remote_addr,
+        service_node_.omq_server().inject_https_task("https:" + request.uri, request.remote_addr,
                 [this, data=std::move(data), started] () mutable {
 
             if (data->replied || data->aborted) return;
+            if (drop_expired(data, request_priority::onion, started)) return;
 
             OnionRequestMetadata onion{
                 x25519_pubkey{},
@@ -662,6 +732,7 @@ void HTTPSServer::process_onion_req_v2(HttpRequest& req, HttpResponse& res) {
                 },
                 0, // hopno
                 EncryptType::aes_gcm,
+                started + ONION_REQUEST_DEADLINE,
             };
 
             try {
@@ -694,14 +765,28 @@ void HTTPSServer::start()
     if (sent_startup_)
         throw std::logic_error{"Cannot call HTTPSServer::start() more than once"};
 
-    startup_promise_.set_value(true);
+    for (auto& ev : loops_)
+        ev->startup_promise.set_value(true);
     sent_startup_ = true;
-    listen_socks_ = startup_success_.get();
+
+    // Collect every loop's sockets before propagating any failure so that shutdown can close the
+    // sockets of the loops that did start.
+    std::exception_ptr failed;
+    for (auto& ev : loops_) {
+        try {
+            ev->listen_socks = ev->startup_success.get();
+        } catch (...) {
+            if (!failed)
+                failed = std::current_exception();
+        }
+    }
+    if (failed)
+        std::rethrow_exception(failed);
 }
 
 void HTTPSServer::shutdown(bool join)
 {
-    if (!server_thread_.joinable())
+    if (std::none_of(loops_.begin(), loops_.end(), [](auto& ev) { return ev->thread.joinable(); }))
         return;
 
     if (!sent_shutdown_)
@@ -709,26 +794,33 @@ void HTTPSServer::shutdown(bool join)
         OXEN_LOG(trace, "initiating shutdown");
         if (!sent_startup_)
         {
-            startup_promise_.set_value(false);
+            for (auto& ev : loops_)
+                ev->startup_promise.set_value(false);
             sent_startup_ = true;
         }
-        else if (!listen_socks_.empty())
+        else
         {
-            loop_defer([this] {
-                OXEN_LOG(trace, "closing {} listening sockets", listen_socks_.size());
-                for (auto* s : listen_socks_)
-                    us_listen_socket_close(/*ssl=*/true, s);
-                listen_socks_.clear();
-
-                closing_ = true;
-            });
+            closing_ = true;
+            for (auto& ev : loops_) {
+                if (ev->listen_socks.empty())
+                    continue;
+                loop_defer(ev->loop, [&ev=*ev] {
+                    OXEN_LOG(trace, "closing {} listening sockets", ev.listen_socks.size());
+                    for (auto* s : ev.listen_socks)
+                        us_listen_socket_close(/*ssl=*/true, s);
+                    ev.listen_socks.clear();
+                });
+            }
         }
         sent_shutdown_ = true;
     }
 
-    OXEN_LOG(trace, "joining https server thread");
-    if (join)
-        server_thread_.join();
+    if (join) {
+        OXEN_LOG(trace, "joining https server threads");
+        for (auto& ev : loops_)
+            if (ev->thread.joinable())
+                ev->thread.join();
+    }
     OXEN_LOG(trace, "done shutdown");
 }
 
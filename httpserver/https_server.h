@@ -2,11 +2,15 @@
 
 #include "lozzaxd_key.h"
 #include "rate_limiter.h"
+#include "server_certificates.h"
 #include "version.h"
 #include "request_handler.h"
 
+#include <atomic>
 #include <filesystem>
 #include <future>
+#include <memory>
+#include <thread>
 #include <unordered_set>
 
 #include <uWebSockets/App.h>
@@ -32,6 +36,11 @@ public:
     // \param bind {address,port,required} tuples to bind to.  If `required` is set then the
     // constructor will throw if binding fails, if not then the construction will succeed as long as
     // at least one bind address works.
+    //
+    // \param threads the number of event loops (each in its own thread) to run.  With more than one
+    // loop every loop binds the same addresses with SO_REUSEPORT and the kernel distributes incoming
+    // connections between them; each connection is then handled entirely by the loop that accepted
+    // it.
     HTTPSServer(
         ServiceNode& sn,
         RequestHandler& rh,
@@ -39,20 +48,20 @@ public:
         std::vector<std::tuple<std::string, uint16_t, bool>> bind,
         const std::filesystem::path& ssl_cert,
         const std::filesystem::path& ssl_key,
-        const std::filesystem::path& ssl_dh,
-        legacy_keypair legacy_keys
+        legacy_keypair legacy_keys,
+        int threads = 1
         );
 
     ~HTTPSServer();
 
-    /// Starts the event loop in the thread handling http requests.  Core must have been initialized
+    /// Starts the event loops in the threads handling http requests.  Core must have been initialized
     /// and OxenMQ started.  Will propagate an exception from the thread if startup fails.
     void start();
 
     /// Closes the http server connection.  Can safely be called multiple times, or to abort a
     /// startup if called before start().
     ///
-    /// \param join - if true, wait for the server thread to exit.  If false then joining will occur
+    /// \param join - if true, wait for the server threads to exit.  If false then joining will occur
     /// during destruction.
     void shutdown(bool join = false);
 
@@ -69,12 +78,13 @@ public:
     /// handles cors headers by adding any needed headers to the given vector
     void handle_cors(HttpRequest& req, http::headers& extra_headers);
 
-    // Posts a callback to the uWebSockets thread loop controlling this connection; all writes must
-    // be done from that thread, and so this method is provided to defer a callback from another
-    // thread into that one.  The function should have signature `void ()`.
+    // Posts a callback to the uWebSockets thread loop controlling a connection (i.e. the value of
+    // `uWS::Loop::get()` in the thread that accepted it); all writes must be done from that thread,
+    // and so this method is provided to defer a callback from another thread into that one.  The
+    // function should have signature `void ()`.
     template <typename Func>
-    void loop_defer(Func&& f) {
-        loop_->defer(std::forward<Func>(f));
+    void loop_defer(uWS::Loop* loop, Func&& f) {
+        loop->defer(std::forward<Func>(f));
     }
 
     const std::string& server_header() const { return server_header_; }
@@ -91,37 +101,50 @@ private:
 
     void create_endpoints(uWS::SSLApp& http);
 
-    bool should_rate_limit_client(std::string_view addr);
+    // Takes the packed remote address of the request; `cost` is the number of tokens to charge.
+    bool should_rate_limit_client(std::string_view addr, uint32_t cost = 1);
+
+    // Checks whether we have room for a request of the given priority (see
+    // OxenmqServer::admit_https_task); if not, replies with a 503 and returns false (the handler
+    // should return immediately).
+    bool admit(HttpResponse& res, request_priority p);
 
     // Deprecated storage test over HTTPS; can be removed after HF19
     void process_storage_test_req(HttpRequest& req, HttpResponse& res);
     void process_storage_rpc_req(HttpRequest& req, HttpResponse& res);
     void process_onion_req_v2(HttpRequest& req, HttpResponse& res);
 
-    // A promise we send from outside into the event loop thread to signal it to start.  We sent
-    // "true" to go ahead with binding + starting the event loop, or false to abort.
-    std::promise<bool> startup_promise_;
-    // A future (promise held by the thread) that delivers us the listening uSockets sockets so
-    // that, when we want to shut down, we can tell uWebSockets to close them (which will then run
-    // off the end of the event loop).  This also doubles to propagate listen exceptions back to us.
-    std::future<std::vector<us_listen_socket_t*>> startup_success_;
+    // One uWebSockets event loop along with the thread it runs in.
+    struct event_loop {
+        // A promise we send from outside into the event loop thread to signal it to start.  We sent
+        // "true" to go ahead with binding + starting the event loop, or false to abort.
+        std::promise<bool> startup_promise;
+        // A future (promise held by the thread) that delivers us the listening uSockets sockets so
+        // that, when we want to shut down, we can tell uWebSockets to close them (which will then
+        // run off the end of the event loop).  This also doubles to propagate listen exceptions
+        // back to us.
+        std::future<std::vector<us_listen_socket_t*>> startup_success;
+        // The uWebSockets event loop pointer (so that we can inject a callback to shut it down)
+        uWS::Loop* loop{nullptr};
+        // The socket(s) this loop is listening on
+        std::vector<us_listen_socket_t*> listen_socks;
+        // The thread in which the uWebSockets event listener is running
+        std::thread thread;
+    };
+    std::vector<std::unique_ptr<event_loop>> loops_;
     // Whether we have sent the startup/shutdown signals
     bool sent_startup_{false}, sent_shutdown_{false};
-
-    // The uWebSockets event loop pointer (so that we can inject a callback to shut it down)
-    uWS::Loop* loop_{nullptr};
-    // The socket(s) we are listening on
-    std::vector<us_listen_socket_t*> listen_socks_;
-    // The thread in which the uWebSockets event listener is running
-    std::thread server_thread_;
+    // Session ticket keys shared by every loop's SSL context (so that a session can be resumed on
+    // whichever loop the kernel hands the new connection to); rotated every TLS_TICKET_KEY_ROTATION.
+    tls_ticket_key_ring ticket_keys_;
     // Cached string we send for the Server header
     std::string server_header_ = "Lozzax Storage Server/" + std::string{STORAGE_SERVER_VERSION_STRING};
     // Access-Control-Allow-Origin header values; if one of these match the incoming Origin header
     // we return it in the ACAO header; otherwise (or if this is empty) we omit the header entirely.
     std::unordered_set<std::string> cors_;
     // Will be set to true when we're trying to shut down which closes any connections as we reply
-    // to them.  Should only be read/write from inside the uWS loop.
-    bool closing_ = false;
+    // to them.
+    std::atomic<bool> closing_ = false;
     // If true then always reply with 'Access-Control-Allow-Origin: *' to allow anything.
     bool cors_any_ = false;
     // Our owning service node
@@ -0,0 +1,317 @@
+#include "json_view.h"
+
+#include <fmt/format.h>
+
+#include <array>
+
+namespace oxen {
+
+namespace {
+
+    using value = json_object_view::value;
+    using type = json_object_view::type;
+
+    bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+    // Characters that can appear in a json string as-is (i.e. everything except the closing quote,
+    // backslash, and control characters)
+    constexpr auto string_chars = [] {
+        std::array<bool, 256> plain{};
+        for (int c = 0x20; c < 256; c++)
+            plain[c] = c != '"' && c != '\\';
+        return plain;
+    }();
+
+    int hex_value(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    // Reads the 4 hex digits of a \uXXXX escape starting at `s[i]`; returns -1 if invalid.
+    int read_u16(std::string_view s, size_t i) {
+        if (i + 4 > s.size())
+            return -1;
+        int val = 0;
+        for (size_t j = i; j < i + 4; j++) {
+            int h = hex_value(s[j]);
+            if (h < 0)
+                return -1;
+            val = val << 4 | h;
+        }
+        return val;
+    }
+
+    // Validating recursive descent parser that records values rather than building them
+    struct parser {
+        std::string_view s;
+        size_t pos = 0;
+
+        [[noreturn]] void fail(std::string_view what) const {
+            throw std::invalid_argument{fmt::format("invalid json at offset {}: {}", pos, what)};
+        }
+
+        void skip_ws() {
+            while (pos < s.size() &&
+                    (s[pos] == ' ' || s[pos] == '\n' || s[pos] == '\r' || s[pos] == '\t'))
+                pos++;
+        }
+
+        char peek() const {
+            if (pos >= s.size())
+                fail("unexpected end of input");
+            return s[pos];
+        }
+
+        void expect(char c) {
+            if (peek() != c)
+                fail(fmt::format("expected '{}'", c));
+            pos++;
+        }
+
+        // Parses a string starting at its opening quote.  Returns the contents (without quotes) and
+        // whether it contains escapes.
+        std::pair<std::string_view, bool> string() {
+            expect('"');
+            const size_t start = pos;
+            bool escaped = false;
+            while (true) {
+                while (pos < s.size() && string_chars[static_cast<unsigned char>(s[pos])])
+                    pos++;
+                char c = peek();
+                if (c == '"')
+                    return {s.substr(start, pos++ - start), escaped};
+                if (c != '\\')
+                    fail("unescaped control character in string");
+                escaped = true;
+                pos++;
+                switch (peek()) {
+                    case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+                        pos++;
+                        break;
+                    case 'u':
+                        if (read_u16(s, pos + 1) < 0)
+                            fail("invalid \\u escape");
+                        pos += 5;
+                        break;
+                    default:
+                        fail("invalid escape sequence");
+                }
+            }
+        }
+
+        void digits() {
+            if (pos >= s.size() || !is_digit(s[pos]))
+                fail("invalid number");
+            while (pos < s.size() && is_digit(s[pos]))
+                pos++;
+        }
+
+        void number() {
+            if (s[pos] == '-')
+                pos++;
+            if (pos < s.size() && s[pos] == '0')
+                pos++;
+            else
+                digits();
+            if (pos < s.size() && s[pos] == '.') {
+                pos++;
+                digits();
+            }
+            if (pos < s.size() && (s[pos] == 'e' || s[pos] == 'E')) {
+                pos++;
+                if (pos < s.size() && (s[pos] == '+' || s[pos] == '-'))
+                    pos++;
+                digits();
+            }
+        }
+
+        void literal(std::string_view lit) {
+            if (s.substr(pos, lit.size()) != lit)
+                fail("invalid literal");
+            pos += lit.size();
+        }
+
+        value parse_value(int depth) {
+            skip_ws();
+            value v;
+            const size_t start = pos;
+            switch (peek()) {
+                case '"':
+                    v.t = type::string;
+                    v.escaped = string().second;
+                    break;
+                case '{':
+                    v.t = type::object;
+                    object(depth + 1, nullptr);
+                    break;
+                case '[':
+                    v.t = type::array;
+                    array(depth + 1, nullptr);
+                    break;
+                case 't': v.t = type::boolean; literal("true"); break;
+                case 'f': v.t = type::boolean; literal("false"); break;
+                case 'n': v.t = type::null; literal("null"); break;
+                default:
+                    v.t = type::number;
+                    number();
+            }
+            v.raw = s.substr(start, pos - start);
+            return v;
+        }
+
+        // Parses an object; if `fields` is given then the keys and values get appended to it (with
+        // any escaped keys decoded into `decoded`).
+        void object(
+                int depth,
+                std::vector<std::pair<std::string_view, value>>* fields,
+                std::deque<std::string>* decoded = nullptr) {
+            if (depth > json_object_view::MAX_DEPTH)
+                fail("nested too deeply");
+            expect('{');
+            skip_ws();
+            if (peek() == '}') {
+                pos++;
+                return;
+            }
+            while (true) {
+                skip_ws();
+                auto [key, escaped] = string();
+                skip_ws();
+                expect(':');
+                auto v = parse_value(depth);
+                if (fields) {
+                    if (escaped)
+                        key = decoded->emplace_back(decode(key));
+                    fields->emplace_back(key, v);
+                }
+                skip_ws();
+                if (peek() == ',') {
+                    pos++;
+                    continue;
+                }
+                expect('}');
+                return;
+            }
+        }
+
+        void array(int depth, std::vector<value>* elements) {
+            if (depth > json_object_view::MAX_DEPTH)
+                fail("nested too deeply");
+            expect('[');
+            skip_ws();
+            if (peek() == ']') {
+                pos++;
+                return;
+            }
+            while (true) {
+                auto v = parse_value(depth);
+                if (elements)
+                    elements->push_back(v);
+                skip_ws();
+                if (peek() == ',') {
+                    pos++;
+                    continue;
+                }
+                expect(']');
+                return;
+            }
+        }
+
+        // Decodes the contents of an (already validated) escaped string
+        std::string decode(std::string_view str) const {
+            std::string out;
+            out.reserve(str.size());
+            for (size_t i = 0; i < str.size(); i++) {
+                if (str[i] != '\\') {
+                    out += str[i];
+                    continue;
+                }
+                switch (str[++i]) {
+                    case 'b': out += '\b'; break;
+                    case 'f': out += '\f'; break;
+                    case 'n': out += '\n'; break;
+                    case 'r': out += '\r'; break;
+                    case 't': out += '\t'; break;
+                    case 'u': {
+                        uint32_t cp = read_u16(str, i + 1);
+                        i += 4;
+                        if (cp >= 0xd800 && cp <= 0xdbff) {
+                            // High surrogate; must be followed by a \u low surrogate
+                            int low = i + 2 < str.size() && str[i + 1] == '\\' && str[i + 2] == 'u'
+                                ? read_u16(str, i + 3) : -1;
+                            if (low < 0xdc00 || low > 0xdfff)
+                                fail("invalid surrogate pair in string");
+                            cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                            i += 6;
+                        } else if (cp >= 0xdc00 && cp <= 0xdfff) {
+                            fail("invalid surrogate pair in string");
+                        }
+                        if (cp < 0x80) {
+                            out += static_cast<char>(cp);
+                        } else if (cp < 0x800) {
+                            out += static_cast<char>(0xc0 | cp >> 6);
+                            out += static_cast<char>(0x80 | (cp & 0x3f));
+                        } else if (cp < 0x10000) {
+                            out += static_cast<char>(0xe0 | cp >> 12);
+                            out += static_cast<char>(0x80 | (cp >> 6 & 0x3f));
+                            out += static_cast<char>(0x80 | (cp & 0x3f));
+                        } else {
+                            out += static_cast<char>(0xf0 | cp >> 18);
+                            out += static_cast<char>(0x80 | (cp >> 12 & 0x3f));
+                            out += static_cast<char>(0x80 | (cp >> 6 & 0x3f));
+                            out += static_cast<char>(0x80 | (cp & 0x3f));
+                        }
+                        break;
+                    }
+                    default: out += str[i]; // " \ or /
+                }
+            }
+            return out;
+        }
+    };
+
+} // namespace
+
+json_object_view::json_object_view(std::string_view json) {
+    parser p{json};
+    p.skip_ws();
+    p.object(1, &fields_, &decoded_);
+    p.skip_ws();
+    if (p.pos != json.size())
+        p.fail("unexpected data after json object");
+}
+
+const json_object_view::value* json_object_view::find(std::string_view key) const {
+    for (auto it = fields_.rbegin(); it != fields_.rend(); ++it)
+        if (it->first == key)
+            return &it->second;
+    return nullptr;
+}
+
+bool json_object_view::get_bool(const value& v) {
+    if (v.t != type::boolean)
+        throw std::invalid_argument{"json value is not a boolean"};
+    return v.raw.front() == 't';
+}
+
+std::string_view json_object_view::get_string(const value& v) const {
+    if (v.t != type::string)
+        throw std::invalid_argument{"json value is not a string"};
+    auto str = v.raw.substr(1, v.raw.size() - 2);
+    if (!v.escaped)
+        return str;
+    return decoded_.emplace_back(parser{v.raw}.decode(str));
+}
+
+std::vector<value> json_object_view::get_array(const value& v) {
+    if (v.t != type::array)
+        throw std::invalid_argument{"json value is not an array"};
+    std::vector<value> elements;
+    parser p{v.raw};
+    p.array(1, &elements);
+    return elements;
+}
+
+} // namespace oxen
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace oxen {
+
+/// A read-only, on-demand view of a json object.  Construction makes a single validating pass over
+/// the json text that records where each top-level value is, without building a DOM or copying
+/// anything; values are only decoded when asked for.  Strings without escape sequences (i.e. nearly
+/// all of them) are returned as views into the json text itself, so that, for instance, the base64
+/// data of a store request never gets copied before it is decoded.
+///
+/// The json text must outlive the view, and the view must outlive any strings obtained from it.
+/// Unlike nlohmann::json this does not verify that strings are valid UTF-8: the values we read get
+/// validated by whoever uses them, and the rest are ignored.
+class json_object_view {
+  public:
+    // Maximum nesting depth of arrays and objects that we accept
+    inline static constexpr int MAX_DEPTH = 64;
+
+    enum class type : uint8_t { null, boolean, number, string, array, object };
+
+    struct value {
+        type t;
+        // The json text of the value, e.g. `"abc"` (including the quotes), `-12`, or `{"a": [1]}`
+        std::string_view raw;
+        // True for strings that contain escape sequences, and so need decoding
+        bool escaped = false;
+
+        bool is_null() const { return t == type::null; }
+    };
+
+    /// Parses `json`, which must contain a json object (possibly surrounded by whitespace).  Throws
+    /// std::invalid_argument if it is not valid json, or not an object.
+    explicit json_object_view(std::string_view json);
+
+    /// Returns the value of `key`, or nullptr if there is no such key.  If the key is repeated then
+    /// the last one wins (as with nlohmann::json).
+    const value* find(std::string_view key) const;
+
+    /// Number of keys in the object (counting any repeats)
+    size_t size() const { return fields_.size(); }
+
+    /// The value accessors throw std::invalid_argument if the value isn't of the requested type.
+    static bool get_bool(const value& v);
+
+    /// Returns an integer value.  Throws for non-integer numbers (e.g. `1.5` or `1e3`), negative
+    /// values when T is unsigned, and values that don't fit in a T.
+    template <typename T, typename = std::enable_if_t<
+            std::is_integral_v<T> && !std::is_same_v<T, bool>>>
+    static T get_integer(const value& v) {
+        if (v.t != type::number ||
+                v.raw.find_first_of(".eE") != std::string_view::npos ||
+                (std::is_unsigned_v<T> && v.raw.front() == '-'))
+            throw std::invalid_argument{"json value is not a suitable integer"};
+        T result;
+        auto* end = v.raw.data() + v.raw.size();
+        auto [ptr, ec] = std::from_chars(v.raw.data(), end, result);
+        if (ec != std::errc{} || ptr != end)
+            throw std::invalid_argument{"json integer value is out of range"};
+        return result;
+    }
+
+    /// Returns a string value.  Strings with escape sequences are decoded into storage owned by
+    /// the view; others are returned directly from the json text.
+    std::string_view get_string(const value& v) const;
+
+    /// Returns the elements of an array value.
+    static std::vector<value> get_array(const value& v);
+
+  private:
+    std::vector<std::pair<std::string_view, value>> fields_;
+    // Decoded strings (and keys) that contained escape sequences.  (A deque so that growing it
+    // doesn't move the ones we have already handed out views of).
+    mutable std::deque<std::string> decoded_;
+};
+
+} // namespace oxen
@@ -0,0 +1,57 @@
+#include "load_shedding.h"
+#include "service_node.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace oxen {
+
+std::string_view to_string(request_priority p) {
+    switch (p) {
+        case request_priority::storage_test: return "storage_test"sv;
+        case request_priority::onion: return "onion"sv;
+        case request_priority::client: return "client"sv;
+    }
+    return "unknown"sv;
+}
+
+std::chrono::milliseconds request_deadline(request_priority p) {
+    switch (p) {
+        case request_priority::storage_test: return STORAGE_TEST_TIMEOUT;
+        case request_priority::onion: return ONION_REQUEST_DEADLINE;
+        case request_priority::client: return CLIENT_REQUEST_DEADLINE;
+    }
+    return CLIENT_REQUEST_DEADLINE;
+}
+
+bool load_shedder::admit(request_priority p, const queue_stats_snapshot& queue, size_t max_queue) {
+    auto& c = counters_[static_cast<size_t>(p)];
+    const double threshold = SHED_THRESHOLD[static_cast<size_t>(p)];
+    // An empty queue means no waiting, whatever the (now stale) average wait says.
+    if (queue.depth > 0 &&
+            (queue.wait_avg_ms >= threshold * request_deadline(p).count() ||
+             queue.depth >= threshold * max_queue)) {
+        c.shed++;
+        return false;
+    }
+    c.admitted++;
+    return true;
+}
+
+bool load_shedder::expired(request_priority p, clock::time_point deadline, clock::time_point now) {
+    if (now < deadline)
+        return false;
+    counters_[static_cast<size_t>(p)].expired++;
+    return true;
+}
+
+int load_shedder::retry_after(const queue_stats_snapshot& queue) {
+    return std::clamp(static_cast<int>(std::ceil(queue.wait_avg_ms / 1000)), 1, 30);
+}
+
+shedding_stats load_shedder::get_stats(request_priority p) const {
+    auto& c = counters_[static_cast<size_t>(p)];
+    return {c.admitted, c.shed, c.expired};
+}
+
+} // namespace oxen
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+
+#include "worker_pool.h"
+
+namespace oxen {
+
+using namespace std::literals;
+
+/// Priorities of queued requests, from the most to the least protected.  When we are overloaded we
+/// start refusing client requests first, then onion requests; storage tests (which decide whether
+/// other nodes consider us to be working) only get refused once they couldn't possibly be answered
+/// in time.  (Pings never get queued at all: they are answered straight from the HTTPS thread).
+enum class request_priority : uint8_t { storage_test, onion, client };
+
+inline constexpr size_t NUM_REQUEST_PRIORITIES = 3;
+
+std::string_view to_string(request_priority p);
+
+// How long a client is still waiting for a reply to a direct storage RPC request
+inline constexpr auto CLIENT_REQUEST_DEADLINE = 15s;
+
+// How long we give an onion request that we receive as the edge node (i.e. from the client) in
+// total, across all its hops.
+inline constexpr auto ONION_REQUEST_DEADLINE = 30s;
+
+// Longest we wait for the next hop of an onion request.  This is also the deadline of onion requests
+// from older nodes that don't tell us how long they are willing to wait.
+inline constexpr auto ONION_HOP_TIMEOUT = 30s;
+
+// Each onion hop gives the next hop this much less time than it waits itself, so that the next
+// hop's timeout reply still gets back to it in time.
+inline constexpr auto ONION_HOP_MARGIN = 1s;
+
+/// Returns how long requests of the given priority are worth answering from when we receive them.
+std::chrono::milliseconds request_deadline(request_priority p);
+
+// We refuse to queue a request once the queue's average wait exceeds this fraction of the request's
+// deadline, or the queue is this fraction full (but never if the queue is empty).
+inline constexpr std::array<double, NUM_REQUEST_PRIORITIES> SHED_THRESHOLD{
+    1.0,  // storage_test
+    0.75, // onion
+    0.5}; // client
+
+struct shedding_stats {
+    uint64_t admitted = 0; // queued
+    uint64_t shed = 0;     // refused before being queued
+    uint64_t expired = 0;  // dropped because their deadline passed while they were queued
+};
+
+/// Deadline-aware admission control: decides which requests are worth queueing, and which queued
+/// requests aren't worth starting anymore, and counts the decisions for get_stats.
+class load_shedder {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    /// Decides whether to queue a new request, given the current state of the queue.  Returns false
+    /// (and counts the request as shed) if the request should be refused instead.
+    bool admit(request_priority p, const queue_stats_snapshot& queue, size_t max_queue);
+
+    /// Returns true (and counts the request as expired) if a request's deadline has passed.  This
+    /// is called when a request reaches the front of the queue, so that we don't spend time on
+    /// replies that nobody is waiting for.
+    bool expired(request_priority p, clock::time_point deadline, clock::time_point now = clock::now());
+
+    /// Suggested Retry-After value, in seconds, for requests we refuse while the queue is in the
+    /// given state.
+    static int retry_after(const queue_stats_snapshot& queue);
+
+    shedding_stats get_stats(request_priority p) const;
+
+  private:
+    struct counters {
+        std::atomic<uint64_t> admitted{0}, shed{0}, expired{0};
+    };
+    std::array<counters, NUM_REQUEST_PRIORITIES> counters_;
+};
+
+} // namespace oxen
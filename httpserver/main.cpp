@@ -177,28 +177,37 @@ int main(int argc, char* argv[]) {
 
         auto ssl_cert = data_dir / "cert.pem";
         auto ssl_key = data_dir / "key.pem";
-        auto ssl_dh = data_dir / "dh.pem";
         if (!exists(ssl_cert) || !exists(ssl_key))
             generate_cert(ssl_cert, ssl_key);
-        if (!exists(ssl_dh))
-            generate_dh_pem(ssl_dh);
+        else
+            upgrade_legacy_cert(ssl_cert, ssl_key);
 
         // Set up oxenmq now, but don't actually start it until after we set up the ServiceNode
         // instance (because ServiceNode and OxenmqServer reference each other).
-        auto oxenmq_server_ptr = std::make_unique<OxenmqServer>(me, private_key_x25519, stats_access_keys);
+        omq_worker_options workers;
+        workers.general_threads = options.omq_threads;
+        workers.sn = {options.omq_sn_threads, static_cast<int>(options.omq_sn_queue)};
+        workers.storage = {options.omq_storage_threads, static_cast<int>(options.omq_storage_queue)};
+        workers.https = {options.omq_https_threads, static_cast<int>(options.omq_https_queue)};
+        workers.adaptive = options.adaptive_workers;
+        workers.adaptive_max_threads = options.adaptive_max_threads;
+        auto oxenmq_server_ptr = std::make_unique<OxenmqServer>(
+                me, private_key_x25519, stats_access_keys, workers);
         auto& oxenmq_server = *oxenmq_server_ptr;
 
         ServiceNode service_node{
             me, private_key, oxenmq_server, data_dir, options.force_start};
 
-        RequestHandler request_handler{service_node, channel_encryption, private_key_ed25519};
+        RequestHandler request_handler{service_node, channel_encryption, private_key_ed25519,
+            {options.swarm_reply_quorum, std::chrono::milliseconds{options.swarm_reply_timeout}}};
 
         RateLimiter rate_limiter{*oxenmq_server};
 
         HTTPSServer https_server{service_node, request_handler, rate_limiter,
             {{options.ip, options.port, true}},
-            ssl_cert, ssl_key, ssl_dh,
-            {me.pubkey_legacy, private_key}};
+            ssl_cert, ssl_key,
+            {me.pubkey_legacy, private_key},
+            options.https_threads};
 
 
         oxenmq_server.init(&service_node, &request_handler, &rate_limiter,
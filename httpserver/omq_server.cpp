@@ -18,8 +18,12 @@
 #include <oxenmq/bt_serialize.h>
 #include <oxenmq/hex.h>
 
+#include <algorithm>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <stdexcept>
+#include <thread>
 #include <variant>
 
 namespace oxen {
@@ -46,16 +50,19 @@ void OxenmqServer::handle_sn_data(oxenmq::Message& message) {
     OXEN_LOG(debug, "[LMQ]   thread id: {}", std::this_thread::get_id());
     OXEN_LOG(debug, "[LMQ]   from: {}", oxenmq::to_hex(message.conn.pubkey()));
 
-    std::stringstream ss;
+    // TODO: proces push batch should move to "Request handler"
 
-    // We are only expecting a single part message, so consider removing this
-    for (auto& part : message.data) {
-        ss << part;
+    // We expect a single part message, which we can process directly out of the incoming message
+    // buffer; if a peer sends multiple parts we have to stitch them together first.
+    if (message.data.size() == 1) {
+        service_node_->process_push_batch(message.data[0]);
+    } else {
+        std::string blob;
+        for (auto& part : message.data)
+            blob += part;
+        service_node_->process_push_batch(blob);
     }
 
-    // TODO: proces push batch should move to "Request handler"
-    service_node_->process_push_batch(ss.str());
-
     OXEN_LOG(debug, "[LMQ] send reply");
 
     // TODO: Investigate if the above could fail and whether we should report
@@ -63,6 +70,21 @@ void OxenmqServer::handle_sn_data(oxenmq::Message& message) {
     message.send_reply();
 };
 
+void OxenmqServer::handle_sn_sync(oxenmq::Message& message) {
+    if (message.data.size() != 1) {
+        OXEN_LOG(warn, "Invalid sn.sync request from {}: expected 1 message part, received {}",
+                message.remote, message.data.size());
+        return message.send_reply("error", "invalid parameters");
+    }
+
+    try {
+        message.send_reply(service_node_->process_sync_request(message.data[0]));
+    } catch (const std::exception& e) {
+        OXEN_LOG(warn, "Failed to process sn.sync request from {}: {}", message.remote, e.what());
+        message.send_reply("error", e.what());
+    }
+}
+
 void OxenmqServer::handle_ping(oxenmq::Message& message) {
     OXEN_LOG(debug, "Remote pinged me");
     service_node_->update_last_ping(ReachType::OMQ);
@@ -197,23 +219,33 @@ void OxenmqServer::handle_get_stats(oxenmq::Message& message) {
 
 namespace {
 
+// Loads a client request from bt-encoded or json params.  Returns false (after invoking `cb` with
+// an error response) if the params are neither; throws if they are missing required values, etc.
+template <typename RPC>
+bool load_client_request(RPC& req, std::string_view params, const std::function<void(Response)>& cb) {
+    if (params.empty())
+        params = "{}"sv;
+    if (params.front() == 'd') {
+        req.load_from(oxenmq::bt_dict_consumer{params});
+        req.b64 = false;
+    } else {
+        auto body = nlohmann::json::parse(params, nullptr, false);
+        if (body.is_discarded()) {
+            OXEN_LOG(debug, "Bad OMQ client request: not valid json or bt_dict");
+            cb(Response{http::BAD_REQUEST, "invalid body: expected json or bt_dict"sv});
+            return false;
+        }
+        req.load_from(body);
+    }
+    return true;
+}
+
 template <typename RPC>
 void register_client_rpc_endpoint(OxenmqServer::rpc_map& regs) {
     auto call = [](RequestHandler& h, std::string_view params, bool recursive, std::function<void(Response)> cb) {
         RPC req;
-        if (params.empty())
-            params = "{}"sv;
-        if (params.front() == 'd') {
-            req.load_from(oxenmq::bt_dict_consumer{params});
-            req.b64 = false;
-        } else {
-            auto body = nlohmann::json::parse(params, nullptr, false);
-            if (body.is_discarded()) {
-                OXEN_LOG(debug, "Bad OMQ client request: not valid json or bt_dict");
-                return cb(Response{http::BAD_REQUEST, "invalid body: expected json or bt_dict"sv});
-            }
-            req.load_from(body);
-        }
+        if (!load_client_request(req, params, cb))
+            return;
         if constexpr (std::is_base_of_v<rpc::recursive, RPC>)
             req.recurse = recursive;
         h.process_client_req(std::move(req), std::move(cb));
@@ -231,6 +263,39 @@ OxenmqServer::rpc_map register_client_rpc_endpoints(rpc::type_list<RPC...>) {
     return regs;
 }
 
+// Returns the body of a client request response.  json bodies are serialized (as bt if the request
+// was bt-encoded, json otherwise) into `dump` and a view of it returned.
+std::string_view client_response_body(Response& res, bool bt_encoded, std::string& dump) {
+    if (auto* j = std::get_if<nlohmann::json>(&res.body)) {
+        if (bt_encoded)
+            dump = bt_serialize(json_to_bt(std::move(*j)));
+        else
+            dump = j->dump();
+        return dump;
+    }
+    return view_body(res);
+}
+
+// Returns a callback that sends a client request response as an OMQ reply: [BODY] on success, or
+// [ERRCODE, BODY] on failure.
+std::function<void(Response)> client_reply(oxenmq::Message::DeferredSend send, bool bt_encoded) {
+    return [send=std::move(send), bt_encoded](Response res) {
+        std::string dump;
+        std::string_view body = client_response_body(res, bt_encoded, dump);
+
+        if (res.status == http::OK) {
+            OXEN_LOG(debug, "LMQ RPC request successful, returning {}-byte {} response",
+                    body.size(), dump.empty() ? "text" : bt_encoded ? "bt" : "json");
+            // Success: return just the body
+            send.reply(body);
+        } else {
+            // On error return [errcode, body]
+            OXEN_LOG(debug, "LMQ RPC request failed, replying with [{}, {}]", res.status.first, body);
+            send.reply(std::to_string(res.status.first), body);
+        }
+    };
+}
+
 } // anon. namespace
 
 oxenmq::bt_value json_to_bt(nlohmann::json j) {
@@ -318,38 +383,16 @@ void OxenmqServer::handle_client_request(std::string_view method, oxenmq::Messag
         return;
     }
 
-    if (!forwarded && rate_limiter_->should_rate_limit_client(message.remote)) {
+    std::string_view params = message.data.size() == full_size ? message.data.back() : ""sv;
+    if (!forwarded && rate_limiter_->should_rate_limit_client(message.remote,
+                std::chrono::steady_clock::now(), RateLimiter::request_cost(params.size()))) {
         OXEN_LOG(debug, "Rate limiting client request from {}", message.remote);
         return message.send_reply(std::to_string(http::TOO_MANY_REQUESTS.first), "Too many requests, try again later");
     }
 
     try {
-        std::string_view params = message.data.size() == full_size ? message.data.back() : ""sv;
         it->second(*request_handler_, params, !forwarded,
-            [send=message.send_later(), bt_encoded = !params.empty() && params.front() == 'd']
-            (oxen::Response res) {
-                std::string dump;
-                std::string_view body;
-                if (auto* j = std::get_if<nlohmann::json>(&res.body)) {
-                    if (bt_encoded)
-                        dump = bt_serialize(json_to_bt(std::move(*j)));
-                    else
-                        dump = j->dump();
-                    body = dump;
-                } else
-                    body = view_body(res);
-
-                if (res.status == http::OK) {
-                    OXEN_LOG(debug, "LMQ RPC request successful, returning {}-byte {} response",
-                            body.size(), dump.empty() ? "text" : bt_encoded ? "bt" : "json");
-                    // Success: return just the body
-                    send.reply(body);
-                } else {
-                    // On error return [errcode, body]
-                    OXEN_LOG(debug, "LMQ RPC request failed, replying with [{}, {}]", res.status.first, body);
-                    send.reply(std::to_string(res.status.first), body);
-                }
-            });
+                client_reply(message.send_later(), !params.empty() && params.front() == 'd'));
     } catch (const rpc::parse_error& e) {
         // These exceptions carry a failure message to send back to the client
         OXEN_LOG(debug, "Invalid request: {}", e.what());
@@ -362,6 +405,143 @@ void OxenmqServer::handle_client_request(std::string_view method, oxenmq::Messag
     }
 }
 
+void OxenmqServer::handle_subscribe(oxenmq::Message& message, bool unsubscribe) {
+    const auto method = unsubscribe ? "unsubscribe"sv : "subscribe"sv;
+    OXEN_LOG(debug, "Handling LMQ {} request", method);
+    if (message.data.size() != 1) {
+        OXEN_LOG(warn, "Invalid OMQ {} request: incorrect number of message parts ({})",
+                method, message.data.size());
+        return message.send_reply(
+                std::to_string(http::BAD_REQUEST.first),
+                fmt::format("Invalid request: expected 1 message part, received {}", message.data.size()));
+    }
+
+    if (rate_limiter_->should_rate_limit_client(message.remote)) {
+        OXEN_LOG(debug, "Rate limiting client request from {}", message.remote);
+        return message.send_reply(std::to_string(http::TOO_MANY_REQUESTS.first), "Too many requests, try again later");
+    }
+
+    std::string_view params = message.data[0];
+    auto cb = client_reply(message.send_later(), !params.empty() && params.front() == 'd');
+    try {
+        rpc::subscribe req;
+        if (!load_client_request(req, params, cb))
+            return;
+        req.unsubscribe = unsubscribe;
+        request_handler_->process_subscribe(std::move(req), message.conn, std::move(cb));
+    } catch (const rpc::parse_error& e) {
+        OXEN_LOG(debug, "Invalid request: {}", e.what());
+        cb(Response{http::BAD_REQUEST, "invalid request: "s + e.what()});
+    } catch (const std::exception& e) {
+        OXEN_LOG(warn, "Client {} request raised an exception: {}", method, e.what());
+        cb(Response{http::INTERNAL_SERVER_ERROR, "request failed"sv});
+    }
+}
+
+void OxenmqServer::handle_client_request_batch(oxenmq::Message& message) {
+    if (message.data.empty() || message.data.size() % 2 != 0) {
+        OXEN_LOG(warn, "Invalid forwarded client request batch: incorrect number of message parts ({})",
+                message.data.size());
+        return message.send_reply(
+                std::to_string(http::BAD_REQUEST.first),
+                "Invalid request: expected an even number of message parts");
+    }
+
+    // Requests can complete asynchronously (and in any order), so we collect the replies here and
+    // send them back once the last one is done.
+    struct batch_replies {
+        std::mutex mutex;
+        std::vector<std::string> replies;
+        size_t pending;
+        oxenmq::Message::DeferredSend send;
+
+        batch_replies(size_t count, oxenmq::Message::DeferredSend send) :
+            replies(count), pending{count}, send{std::move(send)} {}
+    };
+    const size_t count = message.data.size() / 2;
+    auto state = std::make_shared<batch_replies>(count, message.send_later());
+
+    auto set_reply = [state](size_t i, std::string reply) {
+        std::lock_guard lock{state->mutex};
+        state->replies[i] = std::move(reply);
+        if (--state->pending == 0)
+            state->send.reply(oxenmq::send_option::data_parts(
+                        state->replies.begin(), state->replies.end()));
+    };
+
+    for (size_t i = 0; i < count; i++) {
+        auto method = message.data[2*i];
+        auto params = message.data[2*i + 1];
+        auto it = client_rpc_endpoints.find(method);
+        if (it == client_rpc_endpoints.end()) {
+            OXEN_LOG(warn, "Invalid forwarded client request for unknown method {}", method);
+            set_reply(i, encode_forward_reply(http::BAD_REQUEST, "invalid request: unknown method"sv));
+            continue;
+        }
+        try {
+            it->second(*request_handler_, params, false,
+                [set_reply, i, bt_encoded = !params.empty() && params.front() == 'd']
+                (oxen::Response res) {
+                    std::string dump;
+                    set_reply(i, encode_forward_reply(
+                                res.status, client_response_body(res, bt_encoded, dump)));
+                });
+        } catch (const rpc::parse_error& e) {
+            OXEN_LOG(debug, "Invalid request: {}", e.what());
+            set_reply(i, encode_forward_reply(http::BAD_REQUEST, "invalid request: "s + e.what()));
+        } catch (const std::exception& e) {
+            OXEN_LOG(warn, "Client request raised an exception: {}", e.what());
+            set_reply(i, encode_forward_reply(http::INTERNAL_SERVER_ERROR, "request failed"sv));
+        }
+    }
+}
+
+void OxenmqServer::forward_client_request(
+        const x25519_pubkey& peer,
+        std::string_view method,
+        std::string params,
+        forward_callback callback) {
+
+    std::unique_lock lock{forward_batches_mutex_};
+    auto& batch = forward_batches_[peer];
+    if (batch.add(method, std::move(params), std::move(callback))) {
+        auto full = std::move(batch);
+        forward_batches_.erase(peer);
+        lock.unlock();
+        send_forward_batch(peer, std::move(full));
+    }
+}
+
+void OxenmqServer::flush_forward_batches() {
+    decltype(forward_batches_) batches;
+    {
+        std::lock_guard lock{forward_batches_mutex_};
+        if (forward_batches_.empty())
+            return;
+        batches.swap(forward_batches_);
+    }
+    for (auto& [peer, batch] : batches)
+        send_forward_batch(peer, std::move(batch));
+}
+
+void OxenmqServer::send_forward_batch(const x25519_pubkey& peer, forward_batch&& batch) {
+    if (batch.callbacks.size() == 1) {
+        // Nothing to batch with, so just send it as a regular forwarded request
+        omq_.request(peer.view(), "sn.storage_cc", std::move(batch.callbacks.front()),
+                batch.parts[0], batch.parts[1],
+                oxenmq::send_option::request_timeout{FORWARD_TIMEOUT});
+        return;
+    }
+
+    OXEN_LOG(debug, "Forwarding batch of {} client requests to {}", batch.callbacks.size(), peer);
+    omq_.request(peer.view(), "sn.storage_cc_batch",
+            [callbacks=std::move(batch.callbacks), peer](bool success, std::vector<std::string> data) {
+                deliver_forward_replies(callbacks, success, std::move(data), peer);
+            },
+            oxenmq::send_option::data_parts(batch.parts.begin(), batch.parts.end()),
+            oxenmq::send_option::request_timeout{FORWARD_TIMEOUT});
+}
+
 void omq_logger(oxenmq::LogLevel level, const char* file, int line,
         std::string message) {
 #define LMQ_LOG_MAP(LMQ_LVL, SS_LVL)                                           \
@@ -383,23 +563,32 @@ void omq_logger(oxenmq::LogLevel level, const char* file, int line,
 OxenmqServer::OxenmqServer(
         const sn_record& me,
         const x25519_seckey& privkey,
-        const std::vector<x25519_pubkey>& stats_access_keys) :
+        const std::vector<x25519_pubkey>& stats_access_keys,
+        const omq_worker_options& workers) :
     omq_{
         std::string{me.pubkey_x25519.view()},
         std::string{privkey.view()},
         true, // is service node
         [this](auto pk) { return peer_lookup(pk); }, // SN-by-key lookup func
         omq_logger,
-        oxenmq::LogLevel::info}
+        oxenmq::LogLevel::info},
+    workers_{workers}
 {
+    const int hardware_threads = std::max<int>(1, std::thread::hardware_concurrency());
+    if (workers_.general_threads <= 0)
+        workers_.general_threads = hardware_threads;
+    if (workers_.adaptive_max_threads <= 0)
+        workers_.adaptive_max_threads = hardware_threads;
+
     for (const auto& key : stats_access_keys)
         stats_access_keys_.emplace(key.view());
 
     // clang-format off
 
     // Endpoints invoked by other SNs
-    omq_.add_category("sn", oxenmq::Access{oxenmq::AuthLevel::none, true, false}, 2 /*reserved threads*/, 1000 /*max queue*/)
+    omq_.add_category("sn", oxenmq::Access{oxenmq::AuthLevel::none, true, false}, workers_.sn.threads, workers_.sn.max_queue)
         .add_request_command("data", [this](auto& m) { handle_sn_data(m); })
+        .add_request_command("sync", [this](auto& m) { handle_sn_sync(m); })
         .add_request_command("ping", [this](auto& m) { handle_ping(m); })
         .add_request_command("storage_test", [this](auto& m) { handle_storage_test(m); }) // NB: requires a 60s request timeout
         .add_request_command("onion_request", [this](auto& m) { handle_onion_request(m); })
@@ -407,14 +596,19 @@ OxenmqServer::OxenmqServer(
             if (m.data.size() >= 2) return handle_client_request(m.data[0], m, true);
             OXEN_LOG(warn, "Invalid forwarded client request: incorrect number of message parts ({})",  m.data.size());
         })
+        .add_request_command("storage_cc_batch", [this](auto& m) { handle_client_request_batch(m); })
         ;
 
     // storage.WHATEVER (e.g. storage.store, storage.retrieve, etc.) endpoints are invokable by
     // anyone (i.e. clients) and have the same WHATEVER endpoints as the "method" values for the
     // HTTPS /storage_rpc/v1 endpoint.
-    auto st_cat = omq_.add_category("storage", oxenmq::AuthLevel::none, 1 /*reserved threads*/, 200 /*max queue*/);
+    auto st_cat = omq_.add_category("storage", oxenmq::AuthLevel::none, workers_.storage.threads, workers_.storage.max_queue);
     for (const auto& [name, _cb] : RequestHandler::client_rpc_endpoints)
         st_cat.add_request_command(std::string{name}, [this, name=name](auto& m) { handle_client_request(name, m); });
+    // storage.subscribe/storage.unsubscribe are OMQ-only (they push messages back over the
+    // connection), and so aren't in client_rpc_endpoints.
+    st_cat.add_request_command("subscribe", [this](auto& m) { handle_subscribe(m, false); });
+    st_cat.add_request_command("unsubscribe", [this](auto& m) { handle_subscribe(m, true); });
 
     // Endpoints invokable by a local admin
     omq_.add_category("service", oxenmq::AuthLevel::admin)
@@ -430,14 +624,100 @@ OxenmqServer::OxenmqServer(
             if (service_node_) service_node_->update_swarms();
         });
 
+    // Requests received by the HTTPS server get injected into this category (see
+    // inject_https_task) unless they go to the adaptive worker pool instead.
+    if (workers_.adaptive)
+        https_pool_ = std::make_unique<worker_pool>("https",
+                workers_.https.threads, workers_.adaptive_max_threads, workers_.https.max_queue);
+    else
+        omq_.add_category("https", oxenmq::AuthLevel::basic, workers_.https.threads, workers_.https.max_queue);
+
     // clang-format on
-    omq_.set_general_threads(1);
+    omq_.set_general_threads(workers_.general_threads);
 
     omq_.MAX_MSG_SIZE =
         10 * 1024 * 1024; // 10 MB (needed by the fileserver, and swarm msg serialization)
 
     // Be explicit about wanting per-SN unique connection IDs:
     omq_.EPHEMERAL_ROUTING_ID = false;
+
+    omq_.add_timer([this] { flush_forward_batches(); }, FORWARD_BATCH_INTERVAL);
+}
+
+namespace {
+
+// An https job queued in OxenMQ.  OxenMQ drops queued jobs (without telling us) when a category's
+// queue is full, so we count the job as dropped if it gets destroyed without having been started.
+struct tracked_task {
+    queue_stats& stats;
+    std::function<void()> task;
+    std::chrono::steady_clock::time_point queued = std::chrono::steady_clock::now();
+    bool started = false;
+
+    tracked_task(queue_stats& stats, std::function<void()> task) :
+        stats{stats}, task{std::move(task)} {}
+
+    ~tracked_task() {
+        if (!started)
+            stats.dropped();
+    }
+};
+
+nlohmann::json to_json(const category_workers& w) {
+    return nlohmann::json{{"threads", w.threads}, {"max_queue", w.max_queue}};
+}
+
+} // namespace
+
+void OxenmqServer::inject_https_task(std::string name, std::string remote, std::function<void()> task) {
+    if (https_pool_) {
+        https_pool_->submit(std::move(task));
+        return;
+    }
+    https_stats_.queued();
+    omq_.inject_task("https", std::move(name), std::move(remote),
+            [job = std::make_shared<tracked_task>(https_stats_, std::move(task))] {
+        job->started = true;
+        job->stats.started(std::chrono::steady_clock::now() - job->queued);
+        job->task();
+    });
+}
+
+queue_stats_snapshot OxenmqServer::https_queue_stats() const {
+    return https_pool_ ? https_pool_->stats() : https_stats_.get();
+}
+
+bool OxenmqServer::admit_https_task(request_priority p) {
+    return shedder_.admit(p, https_queue_stats(), workers_.https.max_queue);
+}
+
+int OxenmqServer::https_retry_after() const {
+    return load_shedder::retry_after(https_queue_stats());
+}
+
+nlohmann::json OxenmqServer::get_queue_stats() const {
+    auto https = https_queue_stats();
+    auto shedding = nlohmann::json::object();
+    for (auto p : {request_priority::storage_test, request_priority::onion, request_priority::client}) {
+        auto s = shedder_.get_stats(p);
+        shedding[std::string{to_string(p)}] = {
+            {"admitted", s.admitted}, {"shed", s.shed}, {"expired", s.expired}};
+    }
+    return nlohmann::json{
+        {"general_threads", workers_.general_threads},
+        {"sn", to_json(workers_.sn)},
+        {"storage", to_json(workers_.storage)},
+        {"https", {
+            {"adaptive", workers_.adaptive},
+            {"threads", https_pool_ ? https_pool_->threads() : workers_.https.threads},
+            {"max_queue", workers_.https.max_queue},
+            {"depth", https.depth},
+            {"max_depth", https.max_depth},
+            {"jobs", https.jobs},
+            {"dropped", https.dropped},
+            {"wait_avg_ms", https.wait_avg_ms},
+            {"wait_max_ms", https.wait_max_ms}}},
+        {"shedding", std::move(shedding)}};
 }
 
 void OxenmqServer::connect_lozzaxd(const oxenmq::address& lozzaxd_rpc) {
@@ -518,6 +798,9 @@ std::string OxenmqServer::encode_onion_data(std::string_view payload, const Onio
             {"enc_type", to_string(data.enc_type)},
             {"ephemeral_key", data.ephem_key.view()},
             {"hop_no", data.hop_no},
+            // Milliseconds the next hop has left (older nodes ignore this and use their own timeout)
+            {"timeout", std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::milliseconds>(
+                    data.deadline - std::chrono::steady_clock::now()).count())},
     });
 }
 
@@ -546,6 +829,10 @@ std::pair<std::string_view, OnionRequestMetadata> OxenmqServer::decode_onion_dat
     if (meta.hop_no < 1)
         meta.hop_no = 1;
 
+    if (d.skip_until("timeout"))
+        meta.deadline = std::chrono::steady_clock::now() + std::min<std::chrono::milliseconds>(
+                ONION_HOP_TIMEOUT, std::chrono::milliseconds{d.consume_integer<int64_t>()});
+
     return result;
 }
 
@@ -1,16 +1,23 @@
 #pragma once
 
+#include <chrono>
 #include <cstdint>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include <oxenmq/oxenmq.h>
 #include <nlohmann/json_fwd.hpp>
 
+#include "forward_batch.h"
+#include "load_shedding.h"
 #include "oxenmq/bt_serialize.h"
 #include "sn_record.h"
+#include "worker_pool.h"
 
 namespace oxen {
 
@@ -23,11 +30,36 @@ struct OnionRequestMetadata;
 void omq_logger(oxenmq::LogLevel level, const char* file, int line,
         std::string message);
 
+using namespace std::literals;
+
+// Timeout for forwarded client requests (whether batched or not)
+inline constexpr auto FORWARD_TIMEOUT = 5s;
+
 oxenmq::bt_value json_to_bt(nlohmann::json j);
 
 nlohmann::json bt_to_json(oxenmq::bt_dict_consumer d);
 nlohmann::json bt_to_json(oxenmq::bt_list_consumer l);
 
+// Worker threads reserved for, and maximum queued jobs of, an OxenMQ category
+struct category_workers {
+    int threads;
+    int max_queue;
+};
+
+// Worker thread configuration of the OxenMQ categories that handle requests
+struct omq_worker_options {
+    // General purpose OxenMQ worker threads (shared by all categories); 0 means one per hardware
+    // thread.
+    int general_threads = 1;
+    category_workers sn{2, 1000};      // requests from other service nodes
+    category_workers storage{1, 200};  // client requests over OMQ
+    category_workers https{2, 1000};   // requests received by the HTTPS server
+    // If set then https jobs run on their own worker_pool, with between `https.threads` and
+    // `adaptive_max_threads` threads (0 meaning one per hardware thread), instead of in OxenMQ.
+    bool adaptive = false;
+    int adaptive_max_threads = 0;
+};
+
 class OxenmqServer {
 
     oxenmq::OxenMQ omq_;
@@ -55,6 +87,10 @@ class OxenmqServer {
             OnionRequestMetadata&& data,
             oxenmq::Message::DeferredSend send);
 
+    // sn.sync - sent by a swarm member with its message digests to find out which of its messages
+    // we are missing.
+    void handle_sn_sync(oxenmq::Message& message);
+
     // sn.ping - sent by SNs to ping each other.
     void handle_ping(oxenmq::Message& message);
 
@@ -80,10 +116,41 @@ class OxenmqServer {
     /// requests are not-reforwarded again, and the method name is prepended on the argument list.
     void handle_client_request(std::string_view method, oxenmq::Message& message, bool forwarded = false);
 
+    /// storage.subscribe/storage.unsubscribe -- subscribes the client connection to (or
+    /// unsubscribes it from) new messages for a pubkey; see rpc::subscribe.  Replies the same way
+    /// as handle_client_request.
+    void handle_subscribe(oxenmq::Message& message, bool unsubscribe);
+
+    /// sn.storage_cc_batch -- a batch of forwarded client requests from a swarm member.  The
+    /// message parts are [METHOD1, PARAMS1, METHOD2, PARAMS2, ...]; the reply has one part per
+    /// request, in the same order, each containing the bt-encoded list of what would have been the
+    /// sn.storage_cc reply parts for that request (i.e. [VALUE] or [ERRCODE, VALUE]).
+    void handle_client_request_batch(oxenmq::Message& message);
+
+    // Forwarded client requests waiting to be sent, per swarm peer
+    std::unordered_map<x25519_pubkey, forward_batch> forward_batches_;
+    std::mutex forward_batches_mutex_;
+
+    // Sends all pending forwarded request batches; called from a FORWARD_BATCH_INTERVAL timer.
+    void flush_forward_batches();
+
+    void send_forward_batch(const x25519_pubkey& peer, forward_batch&& batch);
+
     void handle_get_logs(oxenmq::Message& message);
 
     void handle_get_stats(oxenmq::Message& message);
 
+    omq_worker_options workers_;
+
+    // Queue stats of https jobs; they either go through OxenMQ's https category, or (in adaptive
+    // mode) through https_pool_.
+    queue_stats https_stats_;
+    std::unique_ptr<worker_pool> https_pool_;
+
+    load_shedder shedder_;
+
+    queue_stats_snapshot https_queue_stats() const;
+
     // Access pubkeys for the 'service' command category (for access stats & logs), in binary.
     std::unordered_set<std::string> stats_access_keys_;
 
@@ -95,7 +162,8 @@ class OxenmqServer {
     OxenmqServer(
             const sn_record& me,
             const x25519_seckey& privkey,
-            const std::vector<x25519_pubkey>& stats_access_keys_hex);
+            const std::vector<x25519_pubkey>& stats_access_keys_hex,
+            const omq_worker_options& workers = {});
 
     // Initialize oxenmq; return a future that completes once we have connected to and initialized
     // from lozzaxd.
@@ -124,6 +192,35 @@ class OxenmqServer {
         omq_.send(lozzaxd_conn(), std::forward<Args>(args)...);
     }
 
+    // Forwards a client request to a swarm peer.  Requests to the same peer are batched (see
+    // FORWARD_BATCH_INTERVAL) into a single sn.storage_cc_batch request; `callback` is invoked
+    // with the success flag and reply parts exactly as it would be for an individual sn.storage_cc
+    // request.
+    void forward_client_request(
+            const x25519_pubkey& peer,
+            std::string_view method,
+            std::string params,
+            forward_callback callback);
+
+    // Queues a job to handle a request received by the HTTPS server.  The job runs in OxenMQ's
+    // "https" category or, in adaptive mode, on the adaptive https worker pool.  If the queue is
+    // full then the job is destroyed without being run.
+    void inject_https_task(std::string name, std::string remote, std::function<void()> task);
+
+    // Decides whether a request received by the HTTPS server should be queued with
+    // inject_https_task, or refused because we are overloaded (see load_shedder::admit).
+    bool admit_https_task(request_priority p);
+
+    // Suggested Retry-After seconds for https requests refused because we are overloaded.
+    int https_retry_after() const;
+
+    // Load shedding decisions and stats (e.g. for dropping expired requests).
+    load_shedder& shedder() { return shedder_; }
+
+    // Returns the worker thread configuration, queue depth and wait time stats, and load shedding
+    // stats of the request handling categories (for get_stats).
+    nlohmann::json get_queue_stats() const;
+
     // Encodes the onion request data that we send for internal SN-to-SN onion requests starting at
     // HF18.
     static std::string encode_onion_data(std::string_view payload, const OnionRequestMetadata& data);
@@ -29,12 +29,16 @@ ParsedInfo process_inner_request(std::string plaintext) {
         /// to identify we are the final destination...
         if (inner_json.count("headers")) {
             OXEN_LOG(trace, "Found body: <{}>", ciphertext);
-            auto& [body, json, b64] = ret.emplace<FinalDestinationInfo>();
+            auto& [body, json, b64, bt] = ret.emplace<FinalDestinationInfo>();
             body = std::move(ciphertext);
             if (auto it = inner_json.find("json"); it != inner_json.end())
                 json = it->get<bool>();
             if (auto it = inner_json.find("base64"); it != inner_json.end())
                 b64 = it->get<bool>();
+            if (auto it = inner_json.find("bt"); it != inner_json.end())
+                bt = it->get<bool>();
+            if (!body.empty() && body.front() == 'd')
+                bt = true;
         } else if (auto it = inner_json.find("host"); it != inner_json.end()) {
             auto& [payload, host, port, protocol, target] = ret.emplace<RelayToServerInfo>();
             payload = std::move(plaintext);
@@ -138,12 +142,14 @@ CiphertextPlusJson parse_combined_payload(std::string_view payload) {
 }
 
 std::ostream& operator<<(std::ostream& os, const FinalDestinationInfo& d) {
-    return os << fmt::format("[\"body\": {}]", d.body);
+    return os << fmt::format("[\"body\": {}, \"json\": {}, \"base64\": {}, \"bt\": {}]",
+            d.body, d.json, d.base64, d.bt);
 }
 
 bool operator==(const FinalDestinationInfo& lhs,
                 const FinalDestinationInfo& rhs) {
-    return lhs.body == rhs.body;
+    return std::tie(lhs.body, lhs.json, lhs.base64, lhs.bt)
+        == std::tie(rhs.body, rhs.json, rhs.base64, rhs.bt);
 }
 
 std::ostream& operator<<(std::ostream& os, const RelayToServerInfo& d) {
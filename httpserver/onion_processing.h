@@ -70,6 +70,12 @@ struct FinalDestinationInfo {
     // If true (which is the default for backwards compatibility) then encode the encrypted response
     // as base64; if false return the encrypted response as-is.
     bool base64 = true;
+
+    // If true then the response is bt-encoded, as `d4:body...6:statusi200ee`, with a bt-encoded body
+    // containing raw (rather than base64-encoded) binary values embedded directly.  This is set
+    // explicitly by a "bt" value in the request, and implicitly by a bt-encoded request body.
+    // `json` is ignored when this is set.
+    bool bt = false;
 };
 
 std::ostream& operator<<(std::ostream& os, const FinalDestinationInfo& p);
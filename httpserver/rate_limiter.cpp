@@ -6,6 +6,9 @@
 #include <oxenmq/oxenmq.h>
 
 #include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <limits>
 
 extern "C" {
 #include <arpa/inet.h>
@@ -23,93 +26,187 @@ constexpr microseconds TOKEN_PERIOD_US = 1'000'000us / RateLimiter::TOKEN_RATE;
 // Time between to consecutive tokens for snodes
 constexpr microseconds TOKEN_PERIOD_SN_US = 1'000'000us / RateLimiter::TOKEN_RATE_SN;
 
-constexpr microseconds FILL_EMPTY_BUCKET_US = TOKEN_PERIOD_US * RateLimiter::BUCKET_SIZE;
-
-}
-
-RateLimiter::RateLimiter(oxenmq::OxenMQ& omq) {
-    omq.add_timer([this] {
-        std::lock_guard lock{mutex_};
-        clean_buckets(steady_clock::now());
-    }, 10s);
+template <typename Key>
+size_t shard_index(const Key& key) {
+    // std::hash of an integer is just the integer, so mix it up a bit before picking the shard
+    uint64_t h = std::hash<Key>{}(key);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h % RateLimiter::SHARDS;
 }
 
+// Adds the tokens earned since the bucket was last filled.  We keep the time towards the next token
+// (rather than starting over from `now`) so that a client making requests at exactly the token
+// rate never gets limited.
 template <typename TokenBucket>
-static bool fill_bucket(
-        TokenBucket& bucket,
-        steady_clock::time_point now,
-        bool service_node = false) {
-    auto elapsed_us = duration_cast<microseconds>(now - bucket.last_time_point);
-    // clamp elapsed time to how long it takes to fill up the whole bucket
-    // (simplifies overlow checking)
-    elapsed_us = std::min(elapsed_us, FILL_EMPTY_BUCKET_US);
-
-    const auto token_period =
-        service_node ? TOKEN_PERIOD_SN_US : TOKEN_PERIOD_US;
-
-    const uint32_t token_added = elapsed_us.count() / token_period.count();
-    bucket.num_tokens += token_added;
-    if (bucket.num_tokens >= RateLimiter::BUCKET_SIZE) {
+void fill_bucket(TokenBucket& bucket, steady_clock::time_point now, microseconds token_period) {
+    auto elapsed = duration_cast<microseconds>(now - bucket.last_time_point);
+    if (elapsed < token_period)
+        return;
+    auto added = elapsed / token_period;
+    if (added >= RateLimiter::BUCKET_SIZE - bucket.num_tokens) {
         bucket.num_tokens = RateLimiter::BUCKET_SIZE;
-        return true;
+        bucket.last_time_point = now;
+    } else {
+        bucket.num_tokens += added;
+        bucket.last_time_point += added * token_period;
     }
-    return false;
 }
 
+// Returns true if the bucket has had time to fill up completely, i.e. if forgetting about it
+// wouldn't change anything.
 template <typename TokenBucket>
-static bool remove_token(TokenBucket& b, steady_clock::time_point now, bool sn = false) {
-    fill_bucket(b, now, sn);
-    if (b.num_tokens == 0)
-        return false;
-    b.num_tokens--;
-    b.last_time_point = now;
-    return true;
+bool bucket_full(const TokenBucket& bucket, steady_clock::time_point now, microseconds token_period) {
+    auto elapsed = duration_cast<microseconds>(now - bucket.last_time_point);
+    return elapsed.count() >= 0 &&
+        elapsed / token_period >= RateLimiter::BUCKET_SIZE - bucket.num_tokens;
 }
 
-bool RateLimiter::should_rate_limit(const legacy_pubkey& pubkey, steady_clock::time_point now) {
-    std::lock_guard lock{mutex_};
-    if (auto [it, ins] = snode_buckets_.emplace(pubkey, TokenBucket{BUCKET_SIZE-1, now});
-            ins)
-        return false;
-    else
-        return !remove_token(it->second, now, true);
 }
 
-bool RateLimiter::should_rate_limit_client(uint32_t ip, steady_clock::time_point now) {
-    std::lock_guard lock{mutex_};
+RateLimiter::RateLimiter(oxenmq::OxenMQ& omq) {
+    omq.add_timer([this] { expire(); }, 10s);
+}
 
-    if (auto it = client_buckets_.find(ip); it != client_buckets_.end())
-        return !remove_token(it->second, now);
+template <typename Key>
+size_t RateLimiter::expire(shard<Key>& s, steady_clock::time_point now, bool client, size_t limit) {
+    // The least recently used buckets are at the front, so we can stop at the first one that is
+    // still in use: later ones are (nearly always) still in use as well, and if not then they get
+    // their turn once the ones in front of them expire.
+    const auto period = client ? TOKEN_PERIOD_US : TOKEN_PERIOD_SN_US;
+    size_t expired = 0;
+    while (expired < limit && !s.lru.empty()) {
+        auto& [key, bucket] = s.lru.front();
+        if (!bucket_full(*bucket, now, period))
+            break;
+        s.buckets.erase(key);
+        s.lru.pop_front();
+        expired++;
+    }
+    if (client)
+        clients_ -= expired;
+    return expired;
+}
 
-    if (client_buckets_.size() >= MAX_CLIENTS) {
-        clean_buckets(now);
-        if (client_buckets_.size() >= MAX_CLIENTS)
+template <typename Key>
+bool RateLimiter::should_rate_limit(
+        shards<Key>& all,
+        const Key& key,
+        steady_clock::time_point now,
+        uint32_t cost,
+        bool client) {
+    auto& s = all[shard_index(key)];
+    std::unique_lock lock{s.mutex};
+    expire(s, now, client, EXPIRE_PER_CALL);
+
+    auto it = s.buckets.find(key);
+    if (it == s.buckets.end()) {
+        if (cost > BUCKET_SIZE)
             return true;
+
+        if (client && ++clients_ > MAX_CLIENTS) {
+            // Try to make room by expiring idle buckets from every shard, not just this one.  We
+            // have to let go of our own shard for that (another thread could be doing the same from
+            // another shard), so the key might have gotten a bucket in the meantime.
+            lock.unlock();
+            expire(now);
+            lock.lock();
+            it = s.buckets.find(key);
+            if (it != s.buckets.end()) {
+                clients_--;
+            } else if (clients_ > MAX_CLIENTS) {
+                clients_--;
+                return true;
+            }
+        }
+
+        if (it == s.buckets.end()) {
+            auto& e = s.buckets[key];
+            e.bucket = TokenBucket{BUCKET_SIZE - cost, now};
+            e.lru_pos = s.lru.emplace(s.lru.end(), key, &e.bucket);
+            return false;
+        }
     }
-    client_buckets_.emplace(ip, TokenBucket{BUCKET_SIZE-1, now});
+
+    auto& [bucket, lru_pos] = it->second;
+    if (std::next(lru_pos) != s.lru.end())
+        s.lru.splice(s.lru.end(), s.lru, lru_pos);
+    fill_bucket(bucket, now, client ? TOKEN_PERIOD_US : TOKEN_PERIOD_SN_US);
+    if (bucket.num_tokens < cost)
+        return true;
+    bucket.num_tokens -= cost;
     return false;
 }
 
-bool RateLimiter::should_rate_limit_client(const std::string& ip_dotted_quad, steady_clock::time_point now) {
-    struct in_addr ip;
-    int res = inet_pton(AF_INET, ip_dotted_quad.c_str(), &ip);
-    return res == 1 ? should_rate_limit_client(ip.s_addr) : false;
+bool RateLimiter::should_rate_limit(
+        const legacy_pubkey& pubkey, steady_clock::time_point now, uint32_t cost) {
+    return should_rate_limit(snode_buckets_, pubkey, now, cost, false);
 }
 
-void RateLimiter::clean_buckets(steady_clock::time_point now) {
+bool RateLimiter::should_rate_limit_client(uint32_t ip, steady_clock::time_point now, uint32_t cost) {
+    return should_rate_limit(ipv4_buckets_, ip, now, cost, true);
+}
 
-    for (auto it = client_buckets_.begin(); it != client_buckets_.end(); ) {
-        if (fill_bucket(it->second, now))
-            it = client_buckets_.erase(it);
-        else
-            ++it;
+bool RateLimiter::should_rate_limit_client(
+        const std::array<unsigned char, 16>& ipv6, steady_clock::time_point now, uint32_t cost) {
+    // IPv4-mapped addresses (::ffff:a.b.c.d, e.g. from a dual-stack socket) share the IPv4 client's
+    // bucket; as a /64 they would all land in the same bucket.
+    constexpr unsigned char v4_mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+    if (std::memcmp(ipv6.data(), v4_mapped, sizeof(v4_mapped)) == 0) {
+        uint32_t ip;
+        std::memcpy(&ip, ipv6.data() + 12, 4);
+        return should_rate_limit_client(ntohl(ip), now, cost);
     }
 
-    for (auto it = snode_buckets_.begin(); it != snode_buckets_.end(); ) {
-        if (fill_bucket(it->second, now, true))
-            it = snode_buckets_.erase(it);
-        else
-            ++it;
+    uint64_t prefix;
+    std::memcpy(&prefix, ipv6.data(), sizeof(prefix));
+    return should_rate_limit(ipv6_buckets_, prefix, now, cost, true);
+}
+
+bool RateLimiter::should_rate_limit_client(
+        const std::string& ip, steady_clock::time_point now, uint32_t cost) {
+    if (struct in_addr ipv4; inet_pton(AF_INET, ip.c_str(), &ipv4) == 1)
+        return should_rate_limit_client(ntohl(ipv4.s_addr), now, cost);
+
+    std::string_view addr{ip};
+    if (addr.size() >= 2 && addr.front() == '[' && addr.back() == ']')
+        addr = addr.substr(1, addr.size() - 2);
+    std::array<unsigned char, 16> ipv6;
+    if (inet_pton(AF_INET6, std::string{addr}.c_str(), ipv6.data()) == 1)
+        return should_rate_limit_client(ipv6, now, cost);
+
+    return false;
+}
+
+bool RateLimiter::should_rate_limit_client_address(
+        std::string_view packed_ip, steady_clock::time_point now, uint32_t cost) {
+    if (packed_ip.size() == 4) {
+        uint32_t ip;
+        std::memcpy(&ip, packed_ip.data(), 4);
+        return should_rate_limit_client(ntohl(ip), now, cost);
+    }
+    if (packed_ip.size() == 16) {
+        std::array<unsigned char, 16> ipv6;
+        std::memcpy(ipv6.data(), packed_ip.data(), 16);
+        return should_rate_limit_client(ipv6, now, cost);
+    }
+    return true;
+}
+
+void RateLimiter::expire(steady_clock::time_point now) {
+    constexpr auto all = std::numeric_limits<size_t>::max();
+    for (auto& s : snode_buckets_) {
+        std::lock_guard lock{s.mutex};
+        expire(s, now, false, all);
+    }
+    for (auto& s : ipv4_buckets_) {
+        std::lock_guard lock{s.mutex};
+        expire(s, now, true, all);
+    }
+    for (auto& s : ipv6_buckets_) {
+        std::lock_guard lock{s.mutex};
+        expire(s, now, true, all);
     }
 }
 
@@ -1,8 +1,13 @@
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <cstdint>
+#include <list>
 #include <mutex>
+#include <string>
+#include <string_view>
 #include <unordered_map>
 
 #include "lozzaxd_key.h"
@@ -23,21 +28,62 @@ class RateLimiter {
     inline constexpr static uint32_t TOKEN_RATE_SN = 600;
     inline constexpr static uint32_t MAX_CLIENTS = 10000;
 
+    // Buckets are split across this many independently locked shards (by hash of the key) so that
+    // concurrent requests from different clients don't contend on a single lock.
+    inline constexpr static size_t SHARDS = 16;
+
+    // Client requests cost one token, plus one more for each this many bytes of request (so that,
+    // for instance, a large store or a delete of many hashes costs more than an `info`).
+    inline constexpr static size_t BYTES_PER_TOKEN = 2048;
+
+    // Every call expires at most this many idle buckets from the shard it touches (on top of the
+    // periodic expiry), so that expiry is spread out instead of done in one big scan.
+    inline constexpr static int EXPIRE_PER_CALL = 2;
+
+    // Returns the token cost of a client request of the given size
+    static uint32_t request_cost(size_t request_size) {
+        return 1 + static_cast<uint32_t>(request_size / BYTES_PER_TOKEN);
+    }
+
     RateLimiter() = delete;
     RateLimiter(oxenmq::OxenMQ& omq);
 
     bool should_rate_limit(
             const legacy_pubkey& pubkey,
-            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now(),
+            uint32_t cost = 1);
     bool should_rate_limit_client(
             uint32_t ip,
-            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now(),
+            uint32_t cost = 1);
 
-    // Same as above, but takes a "a.b.c.d" string.  Returns false (i.e. don't rate limit) if the
-    // given address isn't parseable as an IPv4 address at all.
+    // IPv6 clients are limited per /64 (i.e. by the first 8 bytes of the address), since that is
+    // what a single client typically gets to pick addresses from.  IPv4-mapped addresses
+    // (::ffff:0:0/96) are limited as the IPv4 address they map.
     bool should_rate_limit_client(
-            const std::string& ip_dotted_quad,
-            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+            const std::array<unsigned char, 16>& ipv6,
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now(),
+            uint32_t cost = 1);
+
+    // Same as above, but takes a "a.b.c.d" or IPv6 address string.  Returns false (i.e. don't rate
+    // limit) if the given address isn't parseable as an IP address at all.
+    bool should_rate_limit_client(
+            const std::string& ip,
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now(),
+            uint32_t cost = 1);
+
+    // Same as above, but takes a packed (network order) 4-byte IPv4 or 16-byte IPv6 address.
+    // Addresses of any other size are always rate limited.
+    bool should_rate_limit_client_address(
+            std::string_view packed_ip,
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now(),
+            uint32_t cost = 1);
+
+    // Expires idle buckets (i.e. ones that have refilled completely) from all shards.
+    void expire(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+    // Number of client (IPv4 and IPv6) buckets currently being tracked
+    size_t client_count() const { return clients_; }
 
   private:
     struct TokenBucket {
@@ -45,12 +91,47 @@ class RateLimiter {
         std::chrono::steady_clock::time_point last_time_point;
     };
 
-    std::mutex mutex_;
+    // (Aligned so that threads using neighbouring shards don't fight over the same cache line)
+    template <typename Key>
+    struct alignas(64) shard {
+        struct entry;
+        // Keys (and their buckets) from least to most recently used, for incremental expiry.  The
+        // bucket pointers stay valid because unordered_map never moves its elements.
+        using lru_list = std::list<std::pair<Key, const TokenBucket*>>;
+        struct entry {
+            TokenBucket bucket;
+            // Our position in `lru`
+            typename lru_list::iterator lru_pos;
+        };
+
+        std::mutex mutex;
+        std::unordered_map<Key, entry> buckets;
+        lru_list lru;
+    };
+
+    template <typename Key>
+    using shards = std::array<shard<Key>, SHARDS>;
 
-    std::unordered_map<legacy_pubkey, TokenBucket> snode_buckets_;
-    std::unordered_map<uint32_t, TokenBucket> client_buckets_;
+    shards<legacy_pubkey> snode_buckets_;
+    shards<uint32_t> ipv4_buckets_;
+    shards<uint64_t> ipv6_buckets_;
+
+    std::atomic<size_t> clients_{0};
+
+    template <typename Key>
+    bool should_rate_limit(
+            shards<Key>& buckets,
+            const Key& key,
+            std::chrono::steady_clock::time_point now,
+            uint32_t cost,
+            bool client);
 
-    void clean_buckets(std::chrono::steady_clock::time_point now);
+    template <typename Key>
+    size_t expire(
+            shard<Key>& s,
+            std::chrono::steady_clock::time_point now,
+            bool client,
+            size_t limit);
 };
 
 }
@@ -0,0 +1,190 @@
+#include "relay_queue.h"
+
+#include "oxen_logger.h"
+
+#include <algorithm>
+
+namespace oxen {
+
+RelayQueue::RelayQueue(sender send, failure_handler on_failure) :
+    send_{std::move(send)}, on_failure_{std::move(on_failure)} {}
+
+void RelayQueue::enqueue(const sn_record& sn, std::shared_ptr<const std::string> batch) {
+    std::vector<outgoing> out;
+    {
+        std::lock_guard lock{mutex_};
+        auto& q = peers_[sn.pubkey_legacy];
+        // Always take the latest record so that a peer whose address changed while it had queued
+        // data gets the remainder at its new address.
+        q.sn = sn;
+        q.queued_bytes += batch->size();
+        stats_.bytes_queued += batch->size();
+        q.queued.push_back({std::move(batch)});
+        fill_window(q, std::chrono::steady_clock::now(), out);
+    }
+    send(std::move(out));
+}
+
+void RelayQueue::enqueue(const std::vector<sn_record>& snodes, batch_producer produce) {
+    if (snodes.empty())
+        return;
+    auto stream = std::make_shared<batch_stream>();
+    stream->produce = std::move(produce);
+    stream->peers = snodes.size();
+
+    std::vector<outgoing> out;
+    {
+        std::lock_guard lock{mutex_};
+        auto now = std::chrono::steady_clock::now();
+        for (auto& sn : snodes) {
+            auto it = peers_.try_emplace(sn.pubkey_legacy).first;
+            auto& q = it->second;
+            q.sn = sn;
+            q.streams.push_back({stream});
+            fill_window(q, now, out);
+            // An empty stream leaves nothing to do for a peer that wasn't otherwise busy
+            if (q.queued.empty() && q.streams.empty() && q.in_flight == 0)
+                peers_.erase(it);
+        }
+    }
+    send(std::move(out));
+}
+
+void RelayQueue::retry_due(std::chrono::steady_clock::time_point now) {
+    std::vector<outgoing> out;
+    {
+        std::lock_guard lock{mutex_};
+        for (auto& [pk, q] : peers_)
+            if ((!q.queued.empty() || !q.streams.empty()) && q.retry_at <= now)
+                fill_window(q, now, out);
+    }
+    send(std::move(out));
+}
+
+void RelayQueue::fill_window(peer_queue& q, std::chrono::steady_clock::time_point now,
+        std::vector<outgoing>& out) {
+    if (q.retry_at > now)
+        return;
+    while (q.in_flight < RELAY_WINDOW) {
+        pending_batch b;
+        if (!q.queued.empty()) {
+            b = std::move(q.queued.front());
+            q.queued.pop_front();
+            q.queued_bytes -= b.data->size();
+            stats_.bytes_queued -= b.data->size();
+        } else if (!q.streams.empty()) {
+            b.data = take_from_stream(q.streams.front());
+            if (!b.data) {
+                q.streams.pop_front();
+                continue;
+            }
+        } else {
+            break;
+        }
+        if (!b.seq)
+            b.seq = ++q.sent;
+        q.in_flight++;
+        stats_.bytes_in_flight += b.data->size();
+        out.push_back(outgoing{q.sn, std::move(b)});
+    }
+}
+
+std::shared_ptr<const std::string> RelayQueue::take_from_stream(stream_position& pos) {
+    auto& s = *pos.stream;
+    while (pos.next >= s.first + s.batches.size()) {
+        if (s.finished)
+            return nullptr;
+        if (auto batch = s.produce()) {
+            s.batches.emplace_back(std::move(batch), s.peers);
+        } else {
+            s.finished = true;
+            s.produce = nullptr; // Frees whatever the producer was holding on to
+            return nullptr;
+        }
+    }
+    auto& [batch, untaken] = s.batches[pos.next++ - s.first];
+    auto result = batch;
+    --untaken;
+    while (!s.batches.empty() && s.batches.front().second == 0) {
+        s.batches.pop_front();
+        s.first++;
+    }
+    return result;
+}
+
+void RelayQueue::send(std::vector<outgoing>&& out) {
+    for (auto& o : out) {
+        OXEN_LOG(debug, "Relaying {}B batch to {} (attempt {})",
+                o.batch.data->size(), o.sn.pubkey_legacy, o.batch.attempts + 1);
+        // Keep a reference to the data before we move the batch into the callback
+        const std::string& data = *o.batch.data;
+        send_(o.sn, data, [this, pk = o.sn.pubkey_legacy, batch = std::move(o.batch)](bool success) mutable {
+            on_reply(pk, std::move(batch), success);
+        });
+    }
+}
+
+void RelayQueue::on_reply(const legacy_pubkey& pk, pending_batch&& batch, bool success) {
+    std::vector<outgoing> out;
+    bool gave_up = false;
+    {
+        std::lock_guard lock{mutex_};
+        auto it = peers_.find(pk);
+        if (it == peers_.end()) {
+            OXEN_LOG(err, "Internal error: relay reply from {} with no relay queue", pk);
+            return;
+        }
+        auto& q = it->second;
+        auto size = batch.data->size();
+        q.in_flight--;
+        stats_.bytes_in_flight -= size;
+        auto now = std::chrono::steady_clock::now();
+
+        if (success) {
+            q.consecutive_failures = 0;
+            stats_.bytes_acked += size;
+            stats_.batches_acked++;
+        } else {
+            q.consecutive_failures++;
+            auto delay = std::min<std::chrono::steady_clock::duration>(
+                    RELAY_RETRY_MIN * (1 << std::min(q.consecutive_failures - 1, 16)),
+                    RELAY_RETRY_MAX);
+            q.retry_at = now + delay;
+
+            if (++batch.attempts >= RELAY_MAX_ATTEMPTS) {
+                gave_up = true;
+                stats_.batches_failed++;
+                OXEN_LOG(err, "Failed to relay {}B batch to {} after {} attempts; giving up",
+                        size, pk, batch.attempts);
+            } else {
+                stats_.batches_retried++;
+                q.queued_bytes += size;
+                stats_.bytes_queued += size;
+                OXEN_LOG(warn, "Failed to relay {}B batch to {}; retrying in {}s",
+                        size, pk, std::chrono::duration_cast<std::chrono::seconds>(delay).count());
+                // Put it back ahead of everything that hasn't been sent yet, but behind any earlier
+                // batches that also failed (which can come back in any order), so that the peer
+                // still receives batches in order.
+                auto pos = std::find_if(q.queued.begin(), q.queued.end(),
+                        [seq = batch.seq](const pending_batch& b) { return !b.seq || b.seq > seq; });
+                q.queued.insert(pos, std::move(batch));
+            }
+        }
+
+        fill_window(q, now, out);
+        if (q.queued.empty() && q.streams.empty() && q.in_flight == 0)
+            peers_.erase(it);
+    }
+    if (!success && on_failure_)
+        on_failure_(pk, gave_up);
+    send(std::move(out));
+}
+
+relay_stats RelayQueue::get_stats() const {
+    std::lock_guard lock{mutex_};
+    relay_stats s = stats_;
+    s.peers = peers_.size();
+    return s;
+}
+
+} // namespace oxen
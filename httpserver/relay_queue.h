@@ -0,0 +1,150 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "sn_record.h"
+
+namespace oxen {
+
+using namespace std::literals;
+
+// Maximum number of sn.data batches we will have outstanding to any one peer at a time; further
+// batches wait in the peer's queue until an earlier one is acknowledged.
+inline constexpr size_t RELAY_WINDOW = 2;
+
+// Timeout for an individual sn.data request.  This is deliberately generous: batches can be up to
+// several MB and the receiving node has to write them all to its database before replying.
+inline constexpr auto RELAY_TIMEOUT = 30s;
+
+// After a failed batch we pause sending to that peer for RELAY_RETRY_MIN, doubling with each
+// consecutive failure up to RELAY_RETRY_MAX.
+inline constexpr auto RELAY_RETRY_MIN = 5s;
+inline constexpr auto RELAY_RETRY_MAX = 5min;
+
+// We give up on a batch (and record a failed push for the peer) once it has failed this many times.
+inline constexpr int RELAY_MAX_ATTEMPTS = 8;
+
+// How often we check for peers whose retry delay has elapsed.
+inline constexpr auto RELAY_RETRY_CHECK_INTERVAL = 1s;
+
+struct relay_stats {
+    uint64_t bytes_queued = 0;    // waiting to be sent (including batches waiting for a retry)
+    uint64_t bytes_in_flight = 0; // sent, waiting for the peer to acknowledge
+    uint64_t bytes_acked = 0;     // total acknowledged by peers
+    uint64_t batches_acked = 0;
+    uint64_t batches_retried = 0;
+    uint64_t batches_failed = 0;  // given up on after RELAY_MAX_ATTEMPTS
+    size_t peers = 0;             // peers with queued or in-flight batches
+};
+
+/// Relays serialized message batches (sn.data) to other service nodes with per-peer flow control:
+/// each peer has at most RELAY_WINDOW batches in flight, and failed batches are requeued (in
+/// order) and retried with exponential backoff so that a peer that was briefly unreachable resumes
+/// from where it left off rather than losing data.
+///
+/// Batches are held by shared_ptr so that relaying the same batch to every member of a swarm keeps
+/// only one copy in memory.  Large relays (e.g. bootstrapping a new swarm) are given as a stream of
+/// batches that are only produced once a peer has room for them in its window, so that we never
+/// serialize (and hold in memory) more than the peers are ready to take.
+class RelayQueue {
+  public:
+    using send_callback = std::function<void(bool success)>;
+
+    /// Produces the next batch of a stream, or nullptr once there are no more.
+    using batch_producer = std::function<std::shared_ptr<const std::string>()>;
+
+    /// Called (without any lock held) to actually send a batch to a peer; must eventually invoke
+    /// the given callback exactly once with the outcome.
+    using sender = std::function<void(const sn_record& sn, const std::string& batch, send_callback)>;
+
+    /// Called when a batch to a peer fails; `gave_up` is true if the batch has now been dropped
+    /// after reaching RELAY_MAX_ATTEMPTS.
+    using failure_handler = std::function<void(const legacy_pubkey& sn, bool gave_up)>;
+
+    explicit RelayQueue(sender send, failure_handler on_failure = nullptr);
+
+    /// Queues a batch for delivery to the given peer, sending it immediately if the peer has room
+    /// in its window.  (Single batches go ahead of the rest of any streams still being sent to the
+    /// peer).
+    void enqueue(const sn_record& sn, std::shared_ptr<const std::string> batch);
+
+    /// Queues a stream of batches for delivery to each of the given peers, after anything already
+    /// queued for them.  `produce` is called (with the queue's lock held, so it must not call back
+    /// into the RelayQueue) whenever a peer is ready for a batch that hasn't been produced yet;
+    /// each batch is kept only until every peer has taken it.
+    void enqueue(const std::vector<sn_record>& snodes, batch_producer produce);
+
+    /// Resumes sending to any peers whose retry delay has elapsed; this is meant to be called
+    /// periodically (every RELAY_RETRY_CHECK_INTERVAL).
+    void retry_due(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+    relay_stats get_stats() const;
+
+  private:
+    struct pending_batch {
+        std::shared_ptr<const std::string> data;
+        int attempts = 0;
+        uint64_t seq = 0; // Per-peer send order, assigned when first sent; 0 if never sent
+    };
+
+    // Batches produced by a stream that haven't yet been taken by all of the stream's peers
+    struct batch_stream {
+        batch_producer produce;
+        size_t peers;
+        std::deque<std::pair<std::shared_ptr<const std::string>, size_t>> batches; // [batch, untaken]
+        size_t first = 0; // Stream index of batches.front()
+        bool finished = false;
+    };
+
+    struct stream_position {
+        std::shared_ptr<batch_stream> stream;
+        size_t next = 0;
+    };
+
+    struct peer_queue {
+        sn_record sn;
+        std::deque<pending_batch> queued;
+        std::deque<stream_position> streams; // Sent after `queued`, in order
+        size_t queued_bytes = 0;
+        size_t in_flight = 0;
+        uint64_t sent = 0;
+        int consecutive_failures = 0;
+        std::chrono::steady_clock::time_point retry_at{};
+    };
+
+    struct outgoing {
+        sn_record sn;
+        pending_batch batch;
+    };
+
+    // Moves as many queued (or streamed) batches for the peer into flight as its window allows,
+    // appending them to `out`.  Must be called with mutex_ held.
+    void fill_window(peer_queue& q, std::chrono::steady_clock::time_point now,
+            std::vector<outgoing>& out);
+
+    // Takes the next batch of a stream for a peer, producing it if no other peer of the stream has
+    // yet.  Returns nullptr at the end of the stream.  Must be called with mutex_ held.
+    std::shared_ptr<const std::string> take_from_stream(stream_position& pos);
+
+    // Sends the batches gathered by fill_window; must be called *without* mutex_ held.
+    void send(std::vector<outgoing>&& out);
+
+    void on_reply(const legacy_pubkey& pk, pending_batch&& batch, bool success);
+
+    sender send_;
+    failure_handler on_failure_;
+
+    std::unordered_map<legacy_pubkey, peer_queue> peers_;
+    relay_stats stats_;
+    mutable std::mutex mutex_;
+};
+
+} // namespace oxen
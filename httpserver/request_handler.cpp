@@ -3,6 +3,7 @@
 #include "client_rpc_endpoints.h"
 #include "http.h"
 #include "omq_server.h"
+#include "response_writer.h"
 #include "oxen_logger.h"
 #include "oxenmq/oxenmq.h"
 #include "signature.h"
@@ -12,13 +13,16 @@
 #include "utils.hpp"
 #include "version.h"
 
+#include <algorithm>
+#include <charconv>
 #include <chrono>
 #include <future>
+#include <iterator>
+#include <mutex>
+#include <utility>
 
-#include <cpr/cpr.h>
 #include <nlohmann/json.hpp>
 #include <openssl/sha.h>
-#include <oxenmq/base32z.h>
 #include <oxenmq/base64.h>
 #include <oxenmq/hex.h>
 #include <sodium/crypto_generichash.h>
@@ -49,28 +53,81 @@ std::string to_string(const Response& res) {
     return ss.str();
 }
 
-namespace {
+struct retrieve_response {
+    std::vector<message> messages;
+    std::string error;
+
+    // The response body, as json or (if `bt`) bt-encoded with raw rather than base64 data, with `t`
+    // as the response timestamp.  Everything up to the timestamp is built on first use and then
+    // shared by all requests getting this result; the timestamp is filled in per request, so that
+    // requests joining a coalesced retrieve don't get the time of the request that started it.
+    std::string body(bool bt, system_clock::time_point t) {
+        auto& b = bodies_[bt];
+        std::call_once(b.once, [&] { write_body(bt, b.body); });
+        std::string out;
+        out.reserve(b.body.size() + 24);
+        out += b.body;
+        // Finish off the `t` value and the top-level dict that write_body left open
+        if (bt)
+            fmt::format_to(std::back_inserter(out), "i{}ee", to_epoch_ms(t));
+        else
+            fmt::format_to(std::back_inserter(out), "{}}}", to_epoch_ms(t));
+        return out;
+    }
 
-json swarm_to_json(const SwarmInfo& swarm) {
-
-    json snodes_json = json::array();
-    for (const auto& sn : swarm.snodes) {
-        snodes_json.push_back(json{
-                {"address", oxenmq::to_base32z(sn.pubkey_legacy.view()) + ".snode"}, // Deprecated, use pubkey_legacy instead
-                {"pubkey_legacy", sn.pubkey_legacy.hex()},
-                {"pubkey_x25519", sn.pubkey_x25519.hex()},
-                {"pubkey_ed25519", sn.pubkey_ed25519.hex()},
-                {"port", std::to_string(sn.port)}, // Deprecated port (as a string) for backwards compat; use "port_https" instead
-                {"port_https", sn.port},
-                {"port_omq", sn.omq_port},
-                {"ip", sn.ip}});
+  private:
+    void write_body(bool bt, std::string& out) const {
+        size_t size = 64;
+        for (const auto& msg : messages)
+            size += response_writer::binary_size(bt, msg.data.size()) + msg.hash.size() + 100;
+        out.reserve(size);
+
+        response_writer w{bt, out};
+        w.begin_dict();
+        w.key("messages");
+        w.begin_list();
+        for (const auto& msg : messages) {
+            w.begin_dict();
+            w.key("data");
+            w.binary(msg.data);
+            w.key("expiration");
+            w.integer(to_epoch_ms(msg.expiry));
+            w.key("hash");
+            w.string(msg.hash);
+            w.key("timestamp");
+            w.integer(to_epoch_ms(msg.timestamp));
+            w.end_dict();
+        }
+        w.end_list();
+        // The value (and the end of the dict) is added by body()
+        w.key("t");
     }
 
-    return json{
-        {"snodes", std::move(snodes_json)},
-        {"swarm", util::int_to_string(swarm.swarm_id, 16)},
-        {"t", to_epoch_ms(std::chrono::system_clock::now())},
+    struct lazy_body {
+        std::once_flag once;
+        std::string body;
     };
+    lazy_body bodies_[2];
+};
+
+namespace {
+
+// Returns a response containing the client-facing description of a swarm with the current time
+// added: as json for json requests, or already bt-encoded for bt-encoded requests.
+Response swarm_description_response(
+        http::response_code status, const swarm_description& swarm, bool b64) {
+    auto t = to_epoch_ms(std::chrono::system_clock::now());
+    if (!b64)
+        return {status, fmt::format("{}1:ti{}ee", swarm.bt_prefix, t)};
+    auto body = swarm.json;
+    body["t"] = t;
+    return {status, std::move(body)};
+}
+
+bool has_content_type(const Response& res, std::string_view type) {
+    return std::any_of(res.headers.begin(), res.headers.end(), [type](const auto& h) {
+        return h.second == type && util::string_iequal(h.first, "content-type");
+    });
 }
 
 std::string obfuscate_pubkey(const user_pubkey_t& pk) {
@@ -83,9 +140,12 @@ std::string obfuscate_pubkey(const user_pubkey_t& pk) {
 
 template <typename RPC>
 void register_client_rpc_endpoint(RequestHandler::rpc_map& regs) {
-    auto call = [](RequestHandler& h, const json& params, std::function<void(Response)> cb) {
+    auto call = [](RequestHandler& h, RequestHandler::client_params params, bool bt_response,
+            std::function<void(Response)> cb) {
         RPC req;
-        req.load_from(params);
+        var::visit([&req](auto& p) { req.load_from(std::move(p)); }, params);
+        if (bt_response)
+            req.b64 = false; // Binary values can go straight into the bt-encoded response
         if constexpr (std::is_base_of_v<rpc::recursive, RPC>)
             req.recurse = true; // Requests through HTTP or onion reqs are *always* client requests, so always recurse
         h.process_client_req(std::move(req), std::move(cb));
@@ -216,6 +276,16 @@ std::array<unsigned char, 64> create_signature(const ed25519_seckey& sk, const T
 
 } // anon. namespace
 
+Response bt_encode_response(Response res) {
+    if (auto* j = std::get_if<json>(&res.body))
+        res.body = oxenmq::bt_serialize(json_to_bt(std::move(*j)));
+    else if ((res.status != http::OK && res.status != http::MISDIRECTED_REQUEST) ||
+            has_content_type(res, http::BT_CONTENT_TYPE))
+        return res;
+    res.headers.emplace_back("Content-Type", http::BT_CONTENT_TYPE);
+    return res;
+}
+
 const RequestHandler::rpc_map RequestHandler::client_rpc_endpoints =
     register_client_rpc_endpoints(rpc::client_rpc_types{});
 
@@ -265,50 +335,197 @@ std::string computeMessageHash(
             timestamp, expiry, std::string_view{&netid, 1}, pubkey.raw(), data);
 }
 
+// Returns the length of the bt-encoded value at the beginning of `bt`, or 0 if it doesn't start
+// with a complete, valid value.
+static size_t bt_value_length(std::string_view bt, int depth = 0) {
+    if (bt.empty() || depth > response_writer::MAX_DEPTH)
+        return 0;
+    if (bt[0] == 'i') {
+        size_t pos = bt.size() > 1 && bt[1] == '-' ? 2 : 1;
+        size_t digits = pos;
+        while (pos < bt.size() && bt[pos] >= '0' && bt[pos] <= '9')
+            pos++;
+        return pos > digits && pos < bt.size() && bt[pos] == 'e' ? pos + 1 : 0;
+    }
+    if (bt[0] == 'l' || bt[0] == 'd') {
+        const bool dict = bt[0] == 'd';
+        bool at_key = dict;
+        size_t pos = 1;
+        while (pos < bt.size() && bt[pos] != 'e') {
+            // dict keys must be strings
+            if (at_key && !(bt[pos] >= '0' && bt[pos] <= '9'))
+                return 0;
+            auto len = bt_value_length(bt.substr(pos), depth + 1);
+            if (!len)
+                return 0;
+            pos += len;
+            if (dict)
+                at_key = !at_key;
+        }
+        return pos < bt.size() && at_key == dict ? pos + 1 : 0;
+    }
+    size_t colon = bt.find(':');
+    uint64_t len;
+    if (colon == std::string_view::npos || colon > 20 ||
+            std::from_chars(bt.data(), bt.data() + colon, len).ptr != bt.data() + colon ||
+            len > bt.size() - colon - 1)
+        return 0;
+    return colon + 1 + len;
+}
+
+bool is_bt_dict(std::string_view bt) {
+    return !bt.empty() && bt[0] == 'd' && bt_value_length(bt) == bt.size();
+}
+
+std::string swarm_response_bt(const json& result, const swarm_peer_results& peers) {
+    size_t size = 256;
+    for (const auto& [member, r] : peers)
+        size += member.size() + r.size() + 4;
+    std::string out;
+    out.reserve(size);
+    response_writer w{true, out};
+
+    // Our own json results for the "swarm" dict (i.e. ours, and failures talking to peers) get
+    // encoded; the peer results are already encoded, and go in as-is.
+    auto write_swarm = [&w, &peers](const json* local) {
+        std::vector<std::string> local_bt;
+        std::map<std::string_view, std::string_view> members;
+        if (local && local->is_object()) {
+            local_bt.reserve(local->size());
+            for (auto it = local->begin(); it != local->end(); ++it)
+                members.emplace(it.key(), local_bt.emplace_back(
+                            oxenmq::bt_serialize(json_to_bt(it.value()))));
+        }
+        for (const auto& [member, r] : peers)
+            members.emplace(member, r);
+        w.begin_dict();
+        for (const auto& [member, r] : members) {
+            w.key(member);
+            w.raw(r);
+        }
+        w.end_dict();
+    };
+
+    w.begin_dict();
+    bool swarm_done = peers.empty();
+    for (auto it = result.begin(); it != result.end(); ++it) {
+        if (!swarm_done && it.key() >= "swarm") {
+            w.key("swarm");
+            write_swarm(it.key() == "swarm" ? &it.value() : nullptr);
+            swarm_done = true;
+            if (it.key() == "swarm")
+                continue;
+        }
+        w.key(it.key());
+        w.raw(oxenmq::bt_serialize(json_to_bt(it.value())));
+    }
+    if (!swarm_done) {
+        w.key("swarm");
+        write_swarm(nullptr);
+    }
+    w.end_dict();
+    return out;
+}
+
+void merge_swarm_response_json(json& result, const swarm_peer_results& peers) {
+    if (peers.empty())
+        return;
+    auto& swarm = result["swarm"];
+    for (const auto& [member, r] : peers) {
+        json peer_result;
+        try {
+            peer_result = bt_to_json(oxenmq::bt_dict_consumer{r});
+        } catch (const std::exception& e) {
+            OXEN_LOG(warn, "Unparseable swarm result from {}: {}", member, e.what());
+            swarm[member] = json{{"failed", true}, {"bad_peer_response", true}};
+            continue;
+        }
+        if (auto it = peer_result.find("signature"); it != peer_result.end() && it->is_string())
+            *it = oxenmq::to_base64(it->get_ref<const std::string&>());
+        swarm[member] = std::move(peer_result);
+    }
+}
+
 
 
 RequestHandler::RequestHandler(
         ServiceNode& sn,
         const ChannelEncryption& ce,
-        ed25519_seckey edsk)
-    : service_node_{sn}, channel_cipher_(ce), ed25519_sk_{std::move(edsk)} {
-
-    // Periodically clean up any proxy request futures
-    service_node_.omq_server()->add_timer([this] {
-        pending_proxy_requests_.remove_if(
-                [](auto& f) { return f.wait_for(0ms) == std::future_status::ready; });
-    }, 1s);
-}
+        ed25519_seckey edsk,
+        swarm_reply_options reply_opts)
+    : service_node_{sn}, channel_cipher_(ce), ed25519_sk_{std::move(edsk)}, reply_opts_{reply_opts} {}
 
-Response RequestHandler::handle_wrong_swarm(const user_pubkey_t& pubKey) {
+Response RequestHandler::handle_wrong_swarm(const user_pubkey_t& pubKey, bool b64) {
 
     OXEN_LOG(trace, "Got client request to a wrong swarm");
 
-    return {
-        http::MISDIRECTED_REQUEST,
-        swarm_to_json(service_node_.get_swarm(pubKey))};
+    return swarm_description_response(
+            http::MISDIRECTED_REQUEST, *service_node_.get_swarm_description(pubKey), b64);
 }
 
-struct swarm_response {
-    std::mutex mutex;
-    int pending;
-    bool b64;
-    nlohmann::json result;
-    std::function<void(oxen::Response)> cb;
-};
+static_assert(rpc::REPLY_TIMEOUT_MAX <= FORWARD_TIMEOUT);
+
+void reply_or_fail(swarm_response& res) {
+    res.replied = true;
+    if (res.cancel_timer)
+        std::exchange(res.cancel_timer, nullptr)();
+    if (!res.waiting.empty())
+        res.result["pending"] = res.waiting;
+    auto res_code = res.succeeded > 0 ? http::OK : http::INTERNAL_SERVER_ERROR;
+    if (res.b64) {
+        merge_swarm_response_json(res.result, res.peer_results);
+        res.cb(Response{res_code, std::move(res.result)});
+    } else {
+        res.cb(Response{res_code, swarm_response_bt(res.result, res.peer_results),
+                {{"Content-Type", http::BT_CONTENT_TYPE}}});
+    }
+}
+
+swarm_result_status swarm_result_done(swarm_response& res, const std::string& member, bool success) {
+    res.pending--;
+    if (success)
+        res.succeeded++;
+    if (auto it = std::find(res.waiting.begin(), res.waiting.end(), member);
+        it != res.waiting.end())
+        res.waiting.erase(it);
+
+    if (res.replied)
+        return swarm_result_status::late;
+    if (res.pending == 0 || (res.quorum > 0 && res.succeeded >= res.quorum)) {
+        bool early = res.pending > 0;
+        reply_or_fail(res);
+        return early ? swarm_result_status::replied_early : swarm_result_status::replied;
+    }
+    return swarm_result_status::waiting;
+}
+
+bool swarm_reply_timeout(swarm_response& res) {
+    if (res.replied)
+        return false;
+    OXEN_LOG(debug, "Reply timeout reached with {} swarm results pending", res.pending);
+    reply_or_fail(res);
+    return true;
+}
 
-// Replies to a recursive swarm request via its callback; sends an http::OK unless all of the swarm
-// entries returned things with "failed" in them, in which case we send back an
-// INTERNAL_SERVER_ERROR along with the response.
-void reply_or_fail(const std::shared_ptr<swarm_response>& res) {
-    auto res_code = http::INTERNAL_SERVER_ERROR;
-    for (const auto& [snode, reply] : res->result.items()) {
-        if (!reply.count("failed")) {
-            res_code = http::OK;
+// swarm_result_done, plus updating the early reply/late result stats.  Must be called with the
+// mutex held.
+static void swarm_result_done(
+        ServiceNode& sn,
+        const std::shared_ptr<swarm_response>& res,
+        const std::string& member,
+        bool success) {
+    switch (swarm_result_done(*res, member, success)) {
+        case swarm_result_status::late:
+            OXEN_LOG(debug, "Late {} swarm result from {} after early reply",
+                    success ? "successful" : "failed", member);
+            sn.record_swarm_late_result();
+            break;
+        case swarm_result_status::replied_early:
+            sn.record_swarm_early_reply();
+            break;
+        default:
             break;
-        }
     }
-    res->cb(Response{res_code, std::move(res->result)});
 }
 
 
@@ -319,61 +536,79 @@ static void distribute_command(
         const rpc::recursive& req) {
     auto peers = sn.get_swarm_peers();
     res->pending += peers.size();
+    for (auto& peer : peers)
+        res->waiting.push_back(peer.pubkey_ed25519.hex());
+
+    const bool batched = sn.hf_at_least(HARDFORK_BATCHED_FORWARDING);
+    const auto params = bt_serialize(req.to_bt());
 
     for (auto& peer : peers) {
-        sn.omq_server()->request(
-                peer.pubkey_x25519.view(),
-                "sn.storage_cc",
-                [res, peer, cmd](bool success, auto parts) {
-                    json peer_result;
-                    if (!success)
-                        OXEN_LOG(warn, "Response timeout from {} for forwarded command {}",
-                                peer.pubkey_legacy, cmd);
-                    bool good_result = success && parts.size() == 1;
-                    if (good_result) {
-                        try {
-                            peer_result = bt_to_json(oxenmq::bt_dict_consumer{parts[0]});
-                        } catch (const std::exception& e) {
-                            OXEN_LOG(warn, "Received unparseable response to {} from {}: {}",
-                                    cmd, peer.pubkey_legacy, e.what());
-                            good_result = false;
-                        }
-                    }
-
-                    std::lock_guard lock{res->mutex};
-
-                    // If we're the last response then we reply:
-                    bool send_reply = --res->pending == 0;
-
-                    if (!good_result) {
-                        peer_result = json{{"failed", true}};
-                        if (!success) peer_result["timeout"] = true;
-                        else if (parts.size() == 2) {
-                            peer_result["code"] = parts[0];
-                            peer_result["reason"] = parts[1];
-                        }
-                        else peer_result["bad_peer_response"] = true;
-                    }
-                    else if (res->b64) {
-                        if (auto it = peer_result.find("signature"); it != peer_result.end() && it->is_string())
-                            *it = oxenmq::to_base64(it->get_ref<const std::string&>());
-                    }
-
-                    res->result["swarm"][peer.pubkey_ed25519.hex()] = std::move(peer_result);
-
-                    if (send_reply)
-                        reply_or_fail(res);
-                },
-                cmd,
-                bt_serialize(req.to_bt()),
-                oxenmq::send_option::request_timeout{5s}
-        );
+        auto on_reply = [&sn, res, peer, cmd](bool success, std::vector<std::string> parts) {
+            if (!success)
+                OXEN_LOG(warn, "Response timeout from {} for forwarded command {}",
+                        peer.pubkey_legacy, cmd);
+            // The result stays bt-encoded (see reply_or_fail), so we only check it here
+            bool good_result = success && parts.size() == 1;
+            bool failed = true;
+            if (good_result) {
+                try {
+                    if (!is_bt_dict(parts[0]))
+                        throw std::invalid_argument{"not a bt-encoded dict"};
+                    failed = oxenmq::bt_dict_consumer{parts[0]}.skip_until("failed");
+                } catch (const std::exception& e) {
+                    OXEN_LOG(warn, "Received unparseable response to {} from {}: {}",
+                            cmd, peer.pubkey_legacy, e.what());
+                    good_result = false;
+                }
+            }
+
+            json failure;
+            if (!good_result) {
+                failure = json{{"failed", true}};
+                if (!success) failure["timeout"] = true;
+                else if (parts.size() == 2) {
+                    failure["code"] = parts[0];
+                    failure["reason"] = parts[1];
+                }
+                else failure["bad_peer_response"] = true;
+            }
+
+            bool succeeded = good_result && !failed;
+            auto member = peer.pubkey_ed25519.hex();
+
+            std::lock_guard lock{res->mutex};
+            if (res->replied) {
+                if (!succeeded)
+                    OXEN_LOG(warn, "Late failure from {} for forwarded command {}",
+                            peer.pubkey_legacy, cmd);
+            } else if (good_result)
+                res->peer_results[member] = std::move(parts[0]);
+            else
+                res->result["swarm"][member] = std::move(failure);
+            swarm_result_done(sn, res, member, succeeded);
+        };
+
+        if (batched)
+            sn.omq_server().forward_client_request(
+                    peer.pubkey_x25519, cmd, params, std::move(on_reply));
+        else
+            sn.omq_server()->request(
+                    peer.pubkey_x25519.view(),
+                    "sn.storage_cc",
+                    std::move(on_reply),
+                    cmd,
+                    params,
+                    oxenmq::send_option::request_timeout{FORWARD_TIMEOUT});
     }
 }
 
 template <typename RPC, typename = std::enable_if_t<std::is_base_of_v<rpc::recursive, RPC>>>
 std::pair<std::shared_ptr<swarm_response>, std::unique_lock<std::mutex>>
-static setup_recursive_request(ServiceNode& sn, RPC& req, std::function<void(Response)> cb) {
+static setup_recursive_request(
+        ServiceNode& sn,
+        RPC& req,
+        std::function<void(Response)> cb,
+        const swarm_reply_options& defaults) {
     auto res = std::make_shared<swarm_response>();
     res->cb = std::move(cb);
     res->pending = 1;
@@ -381,9 +616,27 @@ static setup_recursive_request(ServiceNode& sn, RPC& req, std::function<void(Res
 
     std::unique_lock<std::mutex> lock{res->mutex, std::defer_lock};
     if (req.recurse) {
+        res->quorum = req.quorum.value_or(defaults.quorum);
+        res->waiting.push_back(sn.own_address().pubkey_ed25519.hex());
+
+        // We hold the lock from before the request goes out until our own result is in: otherwise
+        // fast peer replies could reach the quorum (and send off `res->result`) before we have
+        // stored our part of it, and the timer could fire before `cancel_timer` is set (which would
+        // leave it firing, and holding on to `res`, forever).
+        lock.lock();
+
         // Send it off to our peers right away, before we process it ourselves
         distribute_command(sn, res, RPC::names()[0], req);
-        lock.lock();
+        if (auto timeout = req.reply_timeout.value_or(defaults.timeout); timeout > 0ms) {
+            auto& omq = *sn.omq_server();
+            oxenmq::TimerID timer;
+            omq.add_timer(timer, [&sn, res] {
+                std::lock_guard lock{res->mutex};
+                if (swarm_reply_timeout(*res))
+                    sn.record_swarm_early_reply();
+            }, timeout);
+            res->cancel_timer = [&omq, timer] { omq.cancel_timer(timer); };
+        }
     }
     return {std::move(res), std::move(lock)};
 }
@@ -392,10 +645,10 @@ void RequestHandler::process_client_req(
         rpc::store&& req, std::function<void(Response)> cb) {
 
     if (OXEN_LOG_ENABLED(trace))
-        OXEN_LOG(trace, "Storing message: {}", oxenmq::to_base64(req.data));
+        OXEN_LOG(trace, "Storing message: {}", oxenmq::to_base64(req.data.view()));
 
     if (!service_node_.is_pubkey_for_us(req.pubkey))
-        return cb(handle_wrong_swarm(req.pubkey));
+        return cb(handle_wrong_swarm(req.pubkey, req.b64));
 
     using namespace std::chrono;
     auto ttl = duration_cast<milliseconds>(req.expiry - req.timestamp);
@@ -415,7 +668,7 @@ void RequestHandler::process_client_req(
         // handle sn.storage_cc at all.
         req.recurse = false;
 
-    auto [res, lock] = setup_recursive_request(service_node_, req, std::move(cb));
+    auto [res, lock] = setup_recursive_request(service_node_, req, std::move(cb), reply_opts_);
     auto& mine = req.recurse
         ? res->result["swarm"][service_node_.own_address().pubkey_ed25519.hex()]
         : res->result;
@@ -424,14 +677,16 @@ void RequestHandler::process_client_req(
     std::string message_hash = computeMessageHash(
             req.timestamp, req.expiry, req.pubkey, req.data, use_old_hash);
 
+    // The data gets stored straight out of the request (or out of the buffer it was base64-decoded
+    // into); we're done with the pubkey after this, so can move it.
+    message_view msg{std::move(req.pubkey), message_hash, req.timestamp, req.expiry, req.data};
     bool new_msg;
     bool success = false;
     try {
-        success = service_node_.process_store(message{
-            req.pubkey, message_hash, req.timestamp, req.expiry, std::move(req.data)}, &new_msg);
+        success = service_node_.process_store(msg, &new_msg);
     } catch (const std::exception& e) {
         OXEN_LOG(err, "Internal Server Error. Could not store message for {}: {}",
-                obfuscate_pubkey(req.pubkey), e.what());
+                obfuscate_pubkey(msg.pubkey), e.what());
         mine["reason"] = e.what();
     }
     if (success) {
@@ -452,10 +707,13 @@ void RequestHandler::process_client_req(
     if (entry_router)
         mine["t"] = to_epoch_ms(now);
 
-    OXEN_LOG(trace, "Successfully stored message {} for {}", message_hash, obfuscate_pubkey(req.pubkey));
+    OXEN_LOG(trace, "Successfully stored message {} for {}", message_hash, obfuscate_pubkey(msg.pubkey));
 
-    if (--res->pending == 0)
-        reply_or_fail(std::move(res));
+    swarm_result_done(
+            service_node_,
+            res,
+            req.recurse ? service_node_.own_address().pubkey_ed25519.hex() : ""s,
+            !mine.count("failed"));
 }
 
 void RequestHandler::process_client_req(
@@ -493,24 +751,22 @@ void RequestHandler::process_client_req(
 void RequestHandler::process_client_req(
         rpc::get_swarm&& req, std::function<void(oxen::Response)> cb) {
 
-    const auto swarm = service_node_.get_swarm(req.pubkey);
+    const auto swarm = service_node_.get_swarm_description(req.pubkey);
 
     OXEN_LOG(debug, "get swarm for {}, swarm size: {}",
-            obfuscate_pubkey(req.pubkey), swarm.snodes.size());
-
-    auto body = swarm_to_json(swarm);
+            obfuscate_pubkey(req.pubkey), swarm->swarm.snodes.size());
 
     if (OXEN_LOG_ENABLED(trace))
-        OXEN_LOG(trace, "swarm details for pk {}: {}", obfuscate_pubkey(req.pubkey), body.dump());
+        OXEN_LOG(trace, "swarm details for pk {}: {}", obfuscate_pubkey(req.pubkey), swarm->json.dump());
 
-    cb(Response{http::OK, std::move(body)});
+    cb(swarm_description_response(http::OK, *swarm, req.b64));
 }
 
 void RequestHandler::process_client_req(
         rpc::retrieve&& req, std::function<void(oxen::Response)> cb) {
 
     if (!service_node_.is_pubkey_for_us(req.pubkey))
-        return cb(handle_wrong_swarm(req.pubkey));
+        return cb(handle_wrong_swarm(req.pubkey, req.b64));
 
     auto now = system_clock::now();
     if (req.check_signature) {
@@ -524,30 +780,73 @@ void RequestHandler::process_client_req(
         }
     }
 
-    std::vector<message> msgs;
-    try {
-        msgs = service_node_.retrieve(req.pubkey, req.last_hash.value_or(""));
-    } catch (const std::exception& e) {
-        auto msg = fmt::format("Internal Server Error. Could not retrieve messages for {}",
-                obfuscate_pubkey(req.pubkey));
-        OXEN_LOG(critical, msg);
-        return cb(Response{http::INTERNAL_SERVER_ERROR, std::move(msg)});
+    const auto& last_hash = req.last_hash.value_or("");
+    auto compute = [&] {
+        auto res = std::make_shared<retrieve_response>();
+        try {
+            res->messages = service_node_.retrieve(req.pubkey, last_hash);
+            OXEN_LOG(trace, "Retrieved {} messages for {}", res->messages.size(), obfuscate_pubkey(req.pubkey));
+        } catch (const std::exception& e) {
+            res->error = fmt::format("Internal Server Error. Could not retrieve messages for {}",
+                    obfuscate_pubkey(req.pubkey));
+            OXEN_LOG(critical, res->error);
+        }
+        return res;
+    };
+
+    // A non-b64 retrieve is one that gets a bt-encoded response, so we can hand back the (shared)
+    // bt serialization directly; otherwise we return the shared, already-serialized json.  Either
+    // way the timestamp is this request's own, even if it joined a retrieve already in progress.
+    bool coalesced = retrieves_.run(req.pubkey.prefixed_raw() + last_hash, compute,
+            [b64 = req.b64, now, cb = std::move(cb)](const std::shared_ptr<retrieve_response>& res) {
+                if (!res->error.empty())
+                    cb(Response{http::INTERNAL_SERVER_ERROR, res->error});
+                else if (b64)
+                    cb(Response{http::OK, res->body(false, now), {{"Content-Type", http::JSON_CONTENT_TYPE}}});
+                else
+                    cb(Response{http::OK, res->body(true, now)});
+            });
+    if (coalesced)
+        service_node_.record_retrieve_coalesced();
+}
+
+void RequestHandler::process_subscribe(
+        rpc::subscribe&& req,
+        const oxenmq::ConnectionID& conn,
+        std::function<void(oxen::Response)> cb) {
+
+    if (!service_node_.is_pubkey_for_us(req.pubkey))
+        return cb(handle_wrong_swarm(req.pubkey, req.b64));
+
+    auto now = system_clock::now();
+    if (req.timestamp < now - SIGNATURE_TOLERANCE || req.timestamp > now + SIGNATURE_TOLERANCE) {
+        OXEN_LOG(debug, "subscribe: invalid timestamp ({}s from now)", duration_cast<seconds>(req.timestamp - now).count());
+        return cb(Response{http::NOT_ACCEPTABLE, "subscribe timestamp too far from current time"sv});
+    }
+    if (!verify_signature(req.pubkey, req.pubkey_ed25519, req.signature,
+                req.unsubscribe ? "unsubscribe" : "subscribe", req.timestamp)) {
+        OXEN_LOG(debug, "subscribe: signature verification failed");
+        return cb(Response{http::UNAUTHORIZED, "subscribe signature verification failed"sv});
     }
 
-    OXEN_LOG(trace, "Retrieved {} messages for {}", msgs.size(), obfuscate_pubkey(req.pubkey));
+    auto& subs = service_node_.subscriptions();
+    if (req.unsubscribe) {
+        subs.unsubscribe(conn, req.pubkey);
+        return cb(Response{http::OK, json{{"t", to_epoch_ms(now)}}});
+    }
 
-    json messages = json::array();
-    for (const auto& msg : msgs) {
-        messages.push_back(json{
-            {"hash", msg.hash},
-            {"timestamp", to_epoch_ms(msg.timestamp)},
-            {"expiration", to_epoch_ms(msg.expiry)},
-            {"data", req.b64 ? oxenmq::to_base64(msg.data) : std::move(msg.data)},
-        });
+    switch (subs.subscribe(conn, req.pubkey)) {
+        case subscribe_result::ok:
+            break;
+        case subscribe_result::too_many_pubkeys:
+            return cb(Response{http::TOO_MANY_REQUESTS, "too many subscriptions on this connection"sv});
+        case subscribe_result::too_many_connections:
+            return cb(Response{http::SERVICE_UNAVAILABLE, "subscriptions are currently unavailable"sv});
     }
+    OXEN_LOG(debug, "Subscribed client to messages for {}", obfuscate_pubkey(req.pubkey));
 
     return cb(Response{http::OK, json{
-        {"messages", std::move(messages)},
+        {"expiry", to_epoch_ms(now + SUBSCRIPTION_LIFETIME)},
         {"t", to_epoch_ms(now)},
     }});
 }
@@ -567,7 +866,7 @@ void RequestHandler::process_client_req(
     OXEN_LOG(debug, "processing delete_all {} request", req.recurse ? "direct" : "forwarded");
 
     if (!service_node_.is_pubkey_for_us(req.pubkey))
-        return cb(handle_wrong_swarm(req.pubkey));
+        return cb(handle_wrong_swarm(req.pubkey, req.b64));
 
     auto now = system_clock::now();
     const auto tolerance = req.recurse ? SIGNATURE_TOLERANCE : SIGNATURE_TOLERANCE_FORWARDED;
@@ -581,7 +880,7 @@ void RequestHandler::process_client_req(
         return cb(Response{http::UNAUTHORIZED, "delete_all signature verification failed"sv});
     }
 
-    auto [res, lock] = setup_recursive_request(service_node_, req, std::move(cb));
+    auto [res, lock] = setup_recursive_request(service_node_, req, std::move(cb), reply_opts_);
 
     // If we're recursive then put our stuff inside "swarm" alongside all the other results,
     // otherwise keep it top-level
@@ -601,8 +900,11 @@ void RequestHandler::process_client_req(
     if (req.recurse)
         mine["t"] = to_epoch_ms(now);
 
-    if (--res->pending == 0)
-        reply_or_fail(std::move(res));
+    swarm_result_done(
+            service_node_,
+            res,
+            req.recurse ? service_node_.own_address().pubkey_ed25519.hex() : ""s,
+            !mine.count("failed"));
 }
 
 void RequestHandler::process_client_req(
@@ -610,14 +912,14 @@ void RequestHandler::process_client_req(
     OXEN_LOG(debug, "processing delete_msgs {} request", req.recurse ? "direct" : "forwarded");
 
     if (!service_node_.is_pubkey_for_us(req.pubkey))
-        return cb(handle_wrong_swarm(req.pubkey));
+        return cb(handle_wrong_swarm(req.pubkey, req.b64));
 
     if (!verify_signature(req.pubkey, req.pubkey_ed25519, req.signature, "delete", req.messages)) {
         OXEN_LOG(debug, "delete_msgs: signature verification failed");
         return cb(Response{http::UNAUTHORIZED, "delete_msgs signature verification failed"sv});
     }
 
-    auto [res, lock] = setup_recursive_request(service_node_, req, std::move(cb));
+    auto [res, lock] = setup_recursive_request(service_node_, req, std::move(cb), reply_opts_);
 
     // If we're recursive then put our stuff inside "swarm" alongside all the other results,
     // otherwise keep it top-level
@@ -637,8 +939,11 @@ void RequestHandler::process_client_req(
     if (req.recurse)
         mine["t"] = to_epoch_ms(std::chrono::system_clock::now());
 
-    if (--res->pending == 0)
-        reply_or_fail(std::move(res));
+    swarm_result_done(
+            service_node_,
+            res,
+            req.recurse ? service_node_.own_address().pubkey_ed25519.hex() : ""s,
+            !mine.count("failed"));
 }
 
 void RequestHandler::process_client_req(
@@ -646,7 +951,7 @@ void RequestHandler::process_client_req(
     OXEN_LOG(debug, "processing delete_before {} request", req.recurse ? "direct" : "forwarded");
 
     if (!service_node_.is_pubkey_for_us(req.pubkey))
-        return cb(handle_wrong_swarm(req.pubkey));
+        return cb(handle_wrong_swarm(req.pubkey, req.b64));
 
     auto now = system_clock::now();
     if (req.before > now + 1min) {
@@ -659,7 +964,7 @@ void RequestHandler::process_client_req(
         return cb(Response{http::UNAUTHORIZED, "delete_before signature verification failed"sv});
     }
 
-    auto [res, lock] = setup_recursive_request(service_node_, req, std::move(cb));
+    auto [res, lock] = setup_recursive_request(service_node_, req, std::move(cb), reply_opts_);
 
     // If we're recursive then put our stuff inside "swarm" alongside all the other results,
     // otherwise keep it top-level
@@ -679,8 +984,11 @@ void RequestHandler::process_client_req(
     if (req.recurse)
         mine["t"] = to_epoch_ms(now);
 
-    if (--res->pending == 0)
-        reply_or_fail(std::move(res));
+    swarm_result_done(
+            service_node_,
+            res,
+            req.recurse ? service_node_.own_address().pubkey_ed25519.hex() : ""s,
+            !mine.count("failed"));
 }
 
 void RequestHandler::process_client_req(
@@ -688,7 +996,7 @@ void RequestHandler::process_client_req(
     OXEN_LOG(debug, "processing expire_all {} request", req.recurse ? "direct" : "forwarded");
 
     if (!service_node_.is_pubkey_for_us(req.pubkey))
-        return cb(handle_wrong_swarm(req.pubkey));
+        return cb(handle_wrong_swarm(req.pubkey, req.b64));
 
     auto now = system_clock::now();
     if (req.expiry < now - (req.recurse ? SIGNATURE_TOLERANCE : SIGNATURE_TOLERANCE_FORWARDED)) {
@@ -701,7 +1009,7 @@ void RequestHandler::process_client_req(
         return cb(Response{http::UNAUTHORIZED, "expire_all signature verification failed"sv});
     }
 
-    auto [res, lock] = setup_recursive_request(service_node_, req, std::move(cb));
+    auto [res, lock] = setup_recursive_request(service_node_, req, std::move(cb), reply_opts_);
 
     // If we're recursive then put our stuff inside "swarm" alongside all the other results,
     // otherwise keep it top-level
@@ -721,15 +1029,18 @@ void RequestHandler::process_client_req(
     if (req.recurse)
         mine["t"] = to_epoch_ms(now);
 
-    if (--res->pending == 0)
-        reply_or_fail(std::move(res));
+    swarm_result_done(
+            service_node_,
+            res,
+            req.recurse ? service_node_.own_address().pubkey_ed25519.hex() : ""s,
+            !mine.count("failed"));
 }
 void RequestHandler::process_client_req(
         rpc::expire_msgs&& req, std::function<void(Response)> cb) {
     OXEN_LOG(debug, "processing expire_msgs {} request", req.recurse ? "direct" : "forwarded");
 
     if (!service_node_.is_pubkey_for_us(req.pubkey))
-        return cb(handle_wrong_swarm(req.pubkey));
+        return cb(handle_wrong_swarm(req.pubkey, req.b64));
 
     auto now = system_clock::now();
     if (req.expiry < now - 1min) {
@@ -742,7 +1053,7 @@ void RequestHandler::process_client_req(
         return cb(Response{http::UNAUTHORIZED, "expire_msgs signature verification failed"sv});
     }
 
-    auto [res, lock] = setup_recursive_request(service_node_, req, std::move(cb));
+    auto [res, lock] = setup_recursive_request(service_node_, req, std::move(cb), reply_opts_);
 
     // If we're recursive then put our stuff inside "swarm" alongside all the other results,
     // otherwise keep it top-level
@@ -762,16 +1073,69 @@ void RequestHandler::process_client_req(
     if (req.recurse)
         mine["t"] = to_epoch_ms(now);
 
-    if (--res->pending == 0)
-        reply_or_fail(std::move(res));
+    swarm_result_done(
+            service_node_,
+            res,
+            req.recurse ? service_node_.own_address().pubkey_ed25519.hex() : ""s,
+            !mine.count("failed"));
 }
 
 void RequestHandler::process_client_req(
-    std::string_view req_json, std::function<void(Response)> cb) {
+    std::string_view req, std::function<void(Response)> cb, bool bt_response) {
+
+    OXEN_LOG(trace, "process_client_req str <{}>", req);
+
+    const bool bt_request = !req.empty() && req.front() == 'd';
+    if (bt_request || bt_response) {
+        bt_response = true;
+        cb = [cb = std::move(cb)](Response res) { cb(bt_encode_response(std::move(res))); };
+    }
 
-    OXEN_LOG(trace, "process_client_req str <{}>", req_json);
+    if (bt_request) {
+        std::string_view method_name;
+        std::optional<oxenmq::bt_dict_consumer> params;
+        try {
+            oxenmq::bt_dict_consumer d{req};
+            if (d.skip_until("method"))
+                method_name = d.consume_string_view();
+            if (d.skip_until("params"))
+                params = d.consume_dict_consumer();
+        } catch (const std::exception& e) {
+            OXEN_LOG(debug, "Bad client request: invalid bt-encoded request: {}", e.what());
+            return cb(Response{http::BAD_REQUEST, "invalid bt request"sv});
+        }
+        if (method_name.empty()) {
+            OXEN_LOG(debug, "Bad client request: no method field");
+            return cb(Response{http::BAD_REQUEST, "invalid bt request: no `method` field"sv});
+        }
+        if (!params) {
+            OXEN_LOG(debug, "Bad client request: no params field");
+            return cb(Response{http::BAD_REQUEST, "invalid bt request: no `params` field"sv});
+        }
+        return process_client_req(method_name, std::move(*params), std::move(cb), true);
+    }
+
+    // Fast path: read the request fields in place, rather than parsing everything into a json DOM
+    // (which copies every value, including the potentially large data of a store request).  Invalid
+    // or unexpected requests fall through to the full parse below for its error handling.
+    std::optional<json_object_view> view_params;
+    std::string_view view_method;
+    try {
+        json_object_view body{req};
+        auto* method = body.find("method");
+        auto* p = body.find("params");
+        if (method && p && method->t == json_object_view::type::string && !method->escaped &&
+                p->t == json_object_view::type::object) {
+            view_method = body.get_string(*method);
+            view_params.emplace(p->raw);
+        }
+    } catch (const std::invalid_argument& e) {
+        OXEN_LOG(trace, "Falling back to full json parsing of client request: {}", e.what());
+    }
+    if (view_params)
+        return process_client_req(view_method, std::move(*view_params), std::move(cb), bt_response);
 
-    json body = json::parse(req_json, nullptr, false);
+    json body = json::parse(req, nullptr, false);
     if (body.is_discarded()) {
         OXEN_LOG(debug, "Bad client request: invalid json");
         return cb(Response{http::BAD_REQUEST, "invalid json"sv});
@@ -796,19 +1160,20 @@ void RequestHandler::process_client_req(
         return cb(Response{http::BAD_REQUEST, "invalid json: no `params` field"sv});
     }
 
-    process_client_req(method_name, std::move(*params_it), std::move(cb));
+    process_client_req(method_name, std::move(*params_it), std::move(cb), bt_response);
 }
 
 void RequestHandler::process_client_req(
         std::string_view method_name,
-        json params,
-        std::function<void(Response)> cb) {
+        client_params params,
+        std::function<void(Response)> cb,
+        bool bt_response) {
 
     if (auto it = client_rpc_endpoints.find(method_name);
             it != client_rpc_endpoints.end()) {
         OXEN_LOG(debug, "Process client request: {}", method_name);
         try {
-            return it->second(*this, std::move(params), cb);
+            return it->second(*this, std::move(params), bt_response, cb);
         } catch (const rpc::parse_error& e) {
             // These exceptions carry a failure message to send back to the client
             OXEN_LOG(debug, "Invalid request: {}", e.what());
@@ -859,53 +1224,53 @@ void RequestHandler::process_storage_test_req(
             height, tester, msg_hash_hex);
 
     if (status == MessageTestStatus::RETRY) {
-        // Our first attempt returned a RETRY, so set up a timer to keep retrying
-
-        auto timer = std::make_shared<oxenmq::TimerID>();
-        auto& timer_ref = *timer;
-        service_node_.omq_server()->add_timer(timer_ref, [
-                this,
-                timer=std::move(timer),
-                height,
-                tester,
-                hash=std::move(msg_hash_hex),
-                started,
-                callback=std::move(callback)] {
-            auto elapsed = steady_clock::now() - started;
-
-            OXEN_LOG(trace, "Performing storage test retry, {} since started",
-                    util::friendly_duration(elapsed));
-
-            auto [status, answer] = service_node_.process_storage_test_req(
-                    height, tester, hash);
-            if (status == MessageTestStatus::RETRY && elapsed < TEST_RETRY_PERIOD && !service_node_.shutting_down())
-                return; // Still retrying so wait for the next call
-            service_node_.omq_server()->cancel_timer(*timer);
-            callback(status, std::move(answer), elapsed);
-        }, TEST_RETRY_INTERVAL);
+        // Our first attempt returned a RETRY, so wait for the message (or block) to arrive; the
+        // service node answers as soon as it does, or gives up after TEST_RETRY_PERIOD.
+        OXEN_LOG(trace, "Storage test for {} not answerable yet; waiting", msg_hash_hex);
+        service_node_.wait_for_storage_test(height, tester, std::move(msg_hash_hex),
+                [started, callback=std::move(callback)](MessageTestStatus status, std::string answer) {
+                    callback(status, std::move(answer), steady_clock::now() - started);
+                },
+                std::chrono::duration_cast<std::chrono::milliseconds>(TEST_RETRY_PERIOD));
     } else {
         callback(status, std::move(answer), steady_clock::now() - started);
     }
 }
 
+std::string onion_response_body(Response res, bool embed_json, bool bt) {
+    int status = res.status.first;
+    if (bt) {
+        // bt-encoded bodies get embedded directly; anything else (i.e. error text) as a string
+        if (std::holds_alternative<json>(res.body))
+            res = bt_encode_response(std::move(res));
+        auto b = view_body(res);
+        std::string encoded;
+        if (!has_content_type(res, http::BT_CONTENT_TYPE))
+            b = encoded = oxenmq::bt_serialize(b);
+        return fmt::format("d4:body{}6:statusi{}ee", b, status);
+    }
+    if (embed_json && has_content_type(res, http::JSON_CONTENT_TYPE))
+        // Already serialized json
+        return fmt::format(R"({{"body":{},"status":{}}})", view_body(res), status);
+    if (std::holds_alternative<std::string>(res.body))
+        return json{{"status", status}, {"body", std::move(std::get<std::string>(res.body))}}.dump();
+    if (std::holds_alternative<std::string_view>(res.body))
+        return json{{"status", status}, {"body", std::get<std::string_view>(res.body)}}.dump();
+    if (embed_json)
+        return json{{"status", status}, {"body", std::move(std::get<json>(res.body))}}.dump();
+    // Yuck: double-encoded json
+    return json{{"status", status}, {"body", std::get<json>(res.body).dump()}}.dump();
+}
+
 Response RequestHandler::wrap_proxy_response(Response res,
                                              const x25519_pubkey& client_key,
                                              EncryptType enc_type,
                                              bool embed_json,
-                                             bool base64) const {
+                                             bool base64,
+                                             bool bt) const {
 
-    int status = res.status.first;
-    std::string body;
-    if (std::holds_alternative<std::string>(res.body))
-        body = json{{"status", status}, {"body", std::move(std::get<std::string>(res.body))}}.dump();
-    else if (std::holds_alternative<std::string_view>(res.body))
-        body = json{{"status", status}, {"body", std::get<std::string_view>(res.body)}}.dump();
-    else if (embed_json)
-        body = json{{"status", status}, {"body", std::move(std::get<json>(res.body))}}.dump();
-    else // Yuck: double-encoded json
-        body = json{{"status", status}, {"body", std::get<json>(res.body).dump()}}.dump();
-
-    std::string ciphertext = channel_cipher_.encrypt(enc_type, body, client_key);
+    std::string ciphertext = channel_cipher_.encrypt(
+            enc_type, onion_response_body(std::move(res), embed_json, bt), client_key);
     if (base64)
         ciphertext = oxenmq::to_base64(std::move(ciphertext));
 
@@ -933,14 +1298,16 @@ void RequestHandler::process_onion_req(FinalDestinationInfo&& info,
 
     if (!service_node_.snode_ready())
         return data.cb(wrap_proxy_response({http::SERVICE_UNAVAILABLE, "Snode not ready"s},
-                    data.ephem_key, data.enc_type, info.json, info.base64));
+                    data.ephem_key, data.enc_type, info.json, info.base64, info.bt));
 
     process_client_req(
             info.body,
-            [this, data = std::move(data), json = info.json, b64 = info.base64]
+            [this, data = std::move(data), json = info.json, b64 = info.base64, bt = info.bt]
             (oxen::Response res) {
-                data.cb(wrap_proxy_response(std::move(res), data.ephem_key, data.enc_type, json, b64));
-            });
+                data.cb(wrap_proxy_response(
+                        std::move(res), data.ephem_key, data.enc_type, json, b64, bt));
+            },
+            info.bt);
 }
 
 void RequestHandler::process_onion_req(RelayToNodeInfo&& info,
@@ -1000,6 +1367,15 @@ void RequestHandler::process_onion_req(
         return data.cb(wrap_proxy_response({http::BAD_REQUEST, "Invalid url"s},
             data.ephem_key, data.enc_type));
 
+    // Don't wait for the server any longer than whoever sent us the request waits for us
+    auto now = std::chrono::steady_clock::now();
+    auto timeout = std::min<std::chrono::steady_clock::duration>(ONION_URL_TIMEOUT, data.deadline - now);
+    if (timeout <= 0s) {
+        service_node_.omq_server().shedder().expired(request_priority::onion, data.deadline, now);
+        return data.cb(wrap_proxy_response({http::GATEWAY_TIMEOUT, "Request time out"s},
+            data.ephem_key, data.enc_type));
+    }
+
     std::string urlstr;
     urlstr.reserve(info.protocol.size() + 3 + info.host.size() + 6 /*:port*/ + 1 + info.target.size());
     urlstr += info.protocol;
@@ -1015,38 +1391,35 @@ void RequestHandler::process_onion_req(
 
     service_node_.record_proxy_request();
 
-    pending_proxy_requests_.emplace_front(
-        cpr::PostCallback(
-            [&omq=*service_node_.omq_server(), cb=std::move(data.cb)](cpr::Response r) {
+    http_request req;
+    req.url = urlstr;
+    req.headers = {
+        {"User-Agent", "Lozzax Storage Server/" + std::string{STORAGE_SERVER_VERSION_STRING}},
+        {"Content-Type", "application/octet-stream"}
+    };
+    req.body = std::move(info.payload);
+    req.timeout = std::chrono::duration_cast<std::chrono::milliseconds>(timeout);
+
+    service_node_.http_client().post(std::move(req),
+            [url=std::move(urlstr), cb=std::move(data.cb)](http_response r) {
                 Response res;
-                if (r.error.code != cpr::ErrorCode::OK) {
-                    OXEN_LOG(debug, "Onion proxied request to {} failed: {}", r.url.str(), r.error.message);
-                    res.body = r.error.message;
-                    if (r.error.code == cpr::ErrorCode::OPERATION_TIMEDOUT)
+                if (!r.error.empty()) {
+                    OXEN_LOG(debug, "Onion proxied request to {} failed: {}", url, r.error);
+                    res.body = std::move(r.error);
+                    if (r.timed_out)
                         res.status = http::GATEWAY_TIMEOUT;
                     else
                         res.status = http::BAD_GATEWAY;
                 } else {
                     res.status.first = r.status_code;
                     res.status.second = r.status_line;
-                    for (auto& [k, v] : r.header)
+                    for (auto& [k, v] : r.headers)
                         res.headers.emplace_back(std::move(k), std::move(v));
-                    res.body = std::move(r.text);
+                    res.body = std::move(r.body);
                 }
 
                 cb(std::move(res));
-            },
-            cpr::Url{std::move(urlstr)},
-            cpr::Header{
-                {"User-Agent", "Lozzax Storage Server/" + std::string{STORAGE_SERVER_VERSION_STRING}},
-                {"Content-Type", "application/octet-stream"}
-            },
-            cpr::Timeout{ONION_URL_TIMEOUT},
-            cpr::Ssl(cpr::ssl::TLSv1_2{}),
-            cpr::MaxRedirects{0},
-            cpr::Body{std::move(info.payload)}
-        )
-    );
+            });
 }
 
 void RequestHandler::process_onion_req(ProcessCiphertextError&& error,
@@ -3,29 +3,34 @@
 #include "channel_encryption.hpp"
 #include "client_rpc_endpoints.h"
 #include "http.h"
+#include "load_shedding.h"
 #include "onion_processing.h"
 #include "oxen_common.h"
 #include "lozzaxd_key.h"
 #include "service_node.h"
+#include "single_flight.h"
 #include "string_utils.hpp"
 
 #include <chrono>
 #include <forward_list>
+#include <functional>
 #include <future>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <string_view>
 #include <type_traits>
+#include <vector>
 
 #include <nlohmann/json_fwd.hpp>
 #include <variant>
 
 namespace oxen {
 
-// When a storage test returns a "retry" response, we retry again after this interval:
-inline constexpr auto TEST_RETRY_INTERVAL = 50ms;
-
-// If a storage test is still returning "retry" after this long since the initial request then we
-// give up and send an error response back to the requestor:
+// If a storage test is still unanswerable (i.e. we don't have the message, or haven't reached the
+// test's block height) this long after the initial request then we give up and send an error
+// response back to the requestor:
 inline constexpr auto TEST_RETRY_PERIOD = 55s;
 
 // Minimum and maximum TTL permitted for a message storage request
@@ -64,6 +69,18 @@ inline std::string_view view_body(const Response& r) {
 
 std::string to_string(const Response& res);
 
+// Finishes the response to a client request processed for a bt-encoded response (i.e. with b64 =
+// false): json bodies get bt-encoded, and responses with bt bodies get the bt content type.  In
+// this mode the string bodies of successful and wrong-swarm responses are already bt-encoded; other
+// string bodies are plain text error messages.
+Response bt_encode_response(Response res);
+
+// Returns the response to an onion request that ended at this node, before it gets encrypted for
+// the client: a json object of the response status and body or, if `bt` is true, a bt-encoded
+// dict.  If `embed_json` is true then json bodies are embedded as json values rather than as a
+// string of json.
+std::string onion_response_body(Response res, bool embed_json, bool bt);
+
 namespace detail {
 
 // detail::to_hashable takes either an integral type, system_clock::time_point, or a string type and
@@ -116,32 +133,114 @@ std::string computeMessageHash(
         std::string_view data,
         bool old);
 
+/// Returns true if `bt` is a single, complete bt-encoded dict (with nothing after it).
+bool is_bt_dict(std::string_view bt);
+
+/// Results of a recursive request from the other swarm members, keyed by Ed25519 pubkey (hex).
+/// These are kept in the bt-encoded form they arrive in: for bt clients they are copied into the
+/// response as-is, and only get decoded when the client wants json.
+using swarm_peer_results = std::map<std::string, std::string>;
+
+/// Returns the bt-encoded response body of a recursive request: `result` (this node's json result)
+/// with the peer results spliced into its "swarm" dict.
+std::string swarm_response_bt(const nlohmann::json& result, const swarm_peer_results& peers);
+
+/// Adds the peer results into the "swarm" dict of `result` for a json response, base64-encoding
+/// their signatures.  Unparseable results are replaced with `"bad_peer_response": true` failures.
+void merge_swarm_response_json(nlohmann::json& result, const swarm_peer_results& peers);
+
+/// The state of a recursive request while we wait for the results of the swarm members.
+struct swarm_response {
+    std::mutex mutex;
+    int pending;
+    bool b64;
+    // Our own result (including the "swarm" entries for ourself and for failed peer requests)
+    nlohmann::json result;
+    // Results from the other swarm members, as received
+    swarm_peer_results peer_results;
+    std::function<void(oxen::Response)> cb;
+
+    // Early reply settings and state (see rpc::recursive)
+    int quorum = 0; // Reply once this many results have succeeded; 0 means wait for all
+    int succeeded = 0;
+    bool replied = false;
+    // Swarm members (Ed25519 pubkey hex) whose results we are still waiting for
+    std::vector<std::string> waiting;
+    // Cancels the reply timeout timer, if we set one; called (once) when we reply.
+    std::function<void()> cancel_timer;
+};
+
+/// Replies to a recursive swarm request via its callback; sends an http::OK if at least one swarm
+/// member has succeeded so far, otherwise an INTERNAL_SERVER_ERROR along with the response.  If we
+/// are replying before all results are in then the members we are still waiting for are listed in
+/// "pending".  bt-encoded replies are
+/// assembled directly, with the peer results copied in as received.  Must be called with the mutex
+/// held.
+void reply_or_fail(swarm_response& res);
+
+enum class swarm_result_status {
+    waiting,       // still waiting for more results
+    replied,       // this was the last result, so we replied
+    replied_early, // this completed the quorum, so we replied without waiting for the rest
+    late,          // we had already replied
+};
+
+/// Records the result from one swarm member (`member` is its Ed25519 pubkey hex, or empty for a
+/// non-recursive request) and replies if this was the last result we were waiting for or if it
+/// completes the quorum.  Must be called with the mutex held.
+swarm_result_status swarm_result_done(swarm_response& res, const std::string& member, bool success);
+
+/// Called when the reply timeout of a recursive request expires: replies with the results we have
+/// so far, unless we already replied.  Returns true if this replied.  Must be called with the mutex
+/// held.
+bool swarm_reply_timeout(swarm_response& res);
+
 struct OnionRequestMetadata {
     x25519_pubkey ephem_key;
     std::function<void(Response)> cb;
     int hop_no = 0;
     EncryptType enc_type = EncryptType::aes_gcm;
+    // When whoever sent us the request stops waiting for the reply.  We don't start relaying the
+    // request anywhere once this has passed, and give later hops correspondingly less time.
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + ONION_HOP_TIMEOUT;
+};
+
+// Node-wide defaults for replying to recursive requests before every swarm member has responded;
+// requests can override these with their own "quorum" and "reply_timeout" (see rpc::recursive).
+struct swarm_reply_options {
+    // Reply as soon as this many swarm members (including us) have succeeded; 0 waits for all
+    int quorum = 0;
+    // Reply with whatever results we have after this long; 0 waits for all (or the quorum)
+    std::chrono::milliseconds timeout{0};
 };
 
+// The result of a client retrieve, shared by all concurrent identical retrieves (defined in
+// request_handler.cpp).
+struct retrieve_response;
 
 class RequestHandler {
 
     ServiceNode& service_node_;
     const ChannelEncryption& channel_cipher_;
     const ed25519_seckey ed25519_sk_;
+    const swarm_reply_options reply_opts_;
 
-    std::forward_list<std::future<void>> pending_proxy_requests_;
+    // In-progress retrieves, keyed by pubkey (with prefix) + last_hash; identical concurrent
+    // retrieves share a single database query and response serialization.
+    SingleFlight<std::string, std::shared_ptr<retrieve_response>> retrieves_;
 
-    // Wrap response `res` to an intermediate node
+    // Wrap response `res` to an intermediate node.  The wrapped response is a json object, or a
+    // bt-encoded dict if `bt` is true.
     Response wrap_proxy_response(
             Response res,
             const x25519_pubkey& client_key,
             EncryptType enc_type,
             bool json = false,
-            bool base64 = true) const;
+            bool base64 = true,
+            bool bt = false) const;
 
-    // Return the correct swarm for `pubKey`
-    Response handle_wrong_swarm(const user_pubkey_t& pubKey);
+    // Return the correct swarm for `pubKey`; as json, or bt-encoded if `b64` is false
+    Response handle_wrong_swarm(const user_pubkey_t& pubKey, bool b64 = true);
 
     // ===== Session Client Requests =====
 
@@ -158,7 +257,11 @@ class RequestHandler {
     // ===================================
 
   public:
-    RequestHandler(ServiceNode& sn, const ChannelEncryption& ce, ed25519_seckey ed_sk);
+    RequestHandler(
+            ServiceNode& sn,
+            const ChannelEncryption& ce,
+            ed25519_seckey ed_sk,
+            swarm_reply_options reply_opts = {});
 
     // Handlers for parsed client requests
     void process_client_req(rpc::store&& req, std::function<void(Response)> cb);
@@ -172,27 +275,44 @@ class RequestHandler {
     void process_client_req(rpc::expire_all&&, std::function<void(Response)> cb);
     void process_client_req(rpc::expire_msgs&&, std::function<void(Response)> cb);
 
+    // Handles a storage.subscribe (or storage.unsubscribe) request, subscribing the OMQ connection
+    // `conn` to (or unsubscribing it from) new messages for the request pubkey.
+    void process_subscribe(
+            rpc::subscribe&& req,
+            const oxenmq::ConnectionID& conn,
+            std::function<void(Response)> cb);
+
+    // Client request parameters: a json object (parsed, or read in place), or a bt-encoded dict.
+    using client_params = std::variant<nlohmann::json, oxenmq::bt_dict_consumer, json_object_view>;
+
     using rpc_map = std::unordered_map<
         std::string_view,
-        std::function<void(RequestHandler&, const nlohmann::json&, std::function<void(Response)>)>
+        std::function<void(RequestHandler&, client_params, bool, std::function<void(Response)>)>
     >;
     static const rpc_map client_rpc_endpoints;
 
     // Process a client request taking encoded json to be parsed containing something like
     // `{"method": "abc", "params": {"some_arg": 1}}`, dispatching to the appropriate request
-    // handler.
-    void process_client_req(std::string_view req_json, std::function<void(Response)> cb);
+    // handler.  The request may instead be bt-encoded (`d6:method3:abc6:paramsd8:some_argi1eee`), in
+    // which case the response is bt-encoded as well; `bt_response` requests a bt-encoded response to
+    // a json request.  bt-encoded responses contain raw binary values (rather than base64) and carry
+    // a http::BT_CONTENT_TYPE Content-Type header.
+    void process_client_req(
+            std::string_view req, std::function<void(Response)> cb, bool bt_response = false);
 
     // Processes a pre-parsed client request taking the method name ("store", "retrieve", etc.) and
-    // the json params object.
+    // the params.  If `bt_response` is true then the request is processed for a bt-encoded response
+    // (i.e. with binary instead of base64 values), but it is up to the caller to bt-encode any json
+    // response body.
     void process_client_req(
             std::string_view method,
-            nlohmann::json params,
-            std::function<void(Response)> cb);
+            client_params params,
+            std::function<void(Response)> cb,
+            bool bt_response = false);
 
     // Processes a swarm test request; if it succeeds the callback is immediately invoked, otherwise
-    // the test is scheduled for retries for some time until it succeeds, fails, or times out, at
-    // which point the callback is invoked to return the result.
+    // the test waits (see ServiceNode::wait_for_storage_test) until the message or block it needs
+    // arrives, or until it times out, at which point the callback is invoked to return the result.
     void process_storage_test_req(
             uint64_t height,
             legacy_pubkey tester,
@@ -0,0 +1,152 @@
+#include "response_writer.h"
+
+#include <cassert>
+#include <charconv>
+
+#include <oxenmq/base64.h>
+
+namespace oxen {
+
+namespace {
+
+    void append_integer(std::string& out, int64_t i) {
+        char buf[20];
+        auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), i);
+        out.append(buf, end);
+    }
+
+    void append_bt_string(std::string& out, std::string_view s) {
+        append_integer(out, s.size());
+        out += ':';
+        out += s;
+    }
+
+    // Appends `s` json-escaped in the same way as nlohmann::json::dump() (the string itself is
+    // expected to be valid UTF-8; we don't check).
+    void append_json_string(std::string& out, std::string_view s) {
+        constexpr auto hex = "0123456789abcdef";
+        out += '"';
+        size_t plain = 0;
+        for (size_t i = 0; i < s.size(); i++) {
+            unsigned char c = s[i];
+            if (c >= 0x20 && c != '"' && c != '\\')
+                continue;
+            out.append(s.data() + plain, i - plain);
+            plain = i + 1;
+            switch (c) {
+                case '"': out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\b': out += "\\b"; break;
+                case '\f': out += "\\f"; break;
+                case '\n': out += "\\n"; break;
+                case '\r': out += "\\r"; break;
+                case '\t': out += "\\t"; break;
+                default:
+                    out += "\\u00";
+                    out += hex[c >> 4];
+                    out += hex[c & 0xf];
+            }
+        }
+        out.append(s.data() + plain, s.size() - plain);
+        out += '"';
+    }
+
+    constexpr size_t base64_size(size_t size) { return (size + 2) / 3 * 4; }
+
+} // namespace
+
+void response_writer::next_value() {
+    if (bt_)
+        return;
+    if (after_key_) {
+        after_key_ = false;
+        return;
+    }
+    if (depth_ == 0)
+        return;
+    const uint64_t bit = uint64_t{1} << (depth_ - 1);
+    if (has_elements_ & bit)
+        out_ += ',';
+    else
+        has_elements_ |= bit;
+}
+
+void response_writer::open(char c) {
+    assert(depth_ < MAX_DEPTH);
+    next_value();
+    out_ += c;
+    has_elements_ &= ~(uint64_t{1} << depth_);
+    depth_++;
+}
+
+void response_writer::close(char c) {
+    assert(depth_ > 0 && !after_key_);
+    depth_--;
+    out_ += c;
+}
+
+void response_writer::begin_dict() { open(bt_ ? 'd' : '{'); }
+void response_writer::end_dict() { close(bt_ ? 'e' : '}'); }
+void response_writer::begin_list() { open(bt_ ? 'l' : '['); }
+void response_writer::end_list() { close(bt_ ? 'e' : ']'); }
+
+void response_writer::key(std::string_view k) {
+    assert(depth_ > 0 && !after_key_);
+    next_value();
+    if (bt_)
+        return append_bt_string(out_, k);
+    append_json_string(out_, k);
+    out_ += ':';
+    after_key_ = true;
+}
+
+void response_writer::string(std::string_view s) {
+    next_value();
+    if (bt_)
+        append_bt_string(out_, s);
+    else
+        append_json_string(out_, s);
+}
+
+void response_writer::binary(std::string_view s) {
+    if (bt_)
+        return string(s);
+    next_value();
+    out_ += '"';
+    auto pos = out_.size();
+    out_.resize(pos + base64_size(s.size()));
+    oxenmq::to_base64(s.begin(), s.end(), out_.data() + pos);
+    out_ += '"';
+}
+
+void response_writer::integer(int64_t i) {
+    next_value();
+    if (bt_)
+        out_ += 'i';
+    append_integer(out_, i);
+    if (bt_)
+        out_ += 'e';
+}
+
+void response_writer::boolean(bool b) {
+    if (bt_)
+        return integer(b);
+    next_value();
+    out_ += b ? "true" : "false";
+}
+
+void response_writer::raw(std::string_view encoded) {
+    next_value();
+    out_ += encoded;
+}
+
+size_t response_writer::binary_size(bool bt, size_t size) {
+    if (!bt)
+        return base64_size(size) + 2;
+    size_t digits = 1;
+    for (size_t s = size; s >= 10; s /= 10)
+        digits++;
+    return digits + 1 + size;
+}
+
+} // namespace oxen
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace oxen {
+
+/// Writes a response body straight into a string as either json or bt-encoded data, without
+/// building an intermediate nlohmann::json (or bt_value) tree to serialize afterwards.  Handlers
+/// write each field once and get whichever encoding the client asked for:
+///
+///     response_writer w{bt, out};
+///     w.begin_dict();
+///     w.key("data");
+///     w.binary(data); // base64-encoded for json, raw bytes for bt
+///     w.key("hash");
+///     w.string(hash);
+///     w.end_dict();
+///
+/// Dict keys must be written in ascending order (as bt-encoding requires, and as nlohmann::json
+/// serializes them), and each key must be followed by exactly one value.  The writer appends to
+/// `out`, so the caller can reserve (see `binary_size`) or reuse the buffer.
+class response_writer {
+  public:
+    // Maximum nesting depth of dicts and lists
+    inline static constexpr int MAX_DEPTH = 64;
+
+    response_writer(bool bt, std::string& out) : bt_{bt}, out_{out} {}
+
+    // True if writing bt-encoded data, false for json
+    bool bt() const { return bt_; }
+
+    void begin_dict();
+    void end_dict();
+    void begin_list();
+    void end_list();
+
+    // Writes a dict key.
+    void key(std::string_view k);
+
+    // Writes a text string value (json-escaped if needed).
+    void string(std::string_view s);
+
+    // Writes a binary value: base64-encoded (and padded) for json, or as-is for bt.
+    void binary(std::string_view s);
+
+    void integer(int64_t i);
+
+    // Writes a boolean; bt has no booleans so these are written as 1 or 0 (as json_to_bt does).
+    void boolean(bool b);
+
+    // Writes a value that is already encoded (as bt or json, whichever this writer writes) as-is,
+    // e.g. a bt-encoded dict received from elsewhere.  The value is not checked.
+    void raw(std::string_view encoded);
+
+    // Returns the number of bytes `binary()` writes for a `size`-byte value, for sizing buffers.
+    static size_t binary_size(bool bt, size_t size);
+
+  private:
+    // Writes the json separator (if needed) before a new value or key.
+    void next_value();
+    void open(char c);
+    void close(char c);
+
+    const bool bt_;
+    std::string& out_;
+    int depth_ = 0;
+    // Bit `d` is set once the dict or list at depth `d` has its first element (json only: all
+    // later elements need a comma before them).
+    uint64_t has_elements_ = 0;
+    bool after_key_ = false;
+};
+
+} // namespace oxen
@@ -8,8 +8,17 @@
 
 #include <boost/endian/conversion.hpp>
 #include <oxenmq/base64.h>
+#include <oxenmq/hex.h>
 
+#include <algorithm>
+#include <cassert>
+#include <charconv>
 #include <chrono>
+#include <deque>
+#include <iterator>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
 
 namespace oxen {
 
@@ -143,65 +152,284 @@ std::vector<message> deserialize_messages_old(std::string_view slice) {
 }
 }
 
-std::vector<std::string> serialize_messages(std::function<const message*()> next_msg, uint8_t version) {
+namespace v1 {
+namespace {
 
-    std::vector<std::string> res;
+// Returns the number of characters needed to write `v` in decimal
+size_t int_length(int64_t v) {
+    char buf[20];
+    return std::to_chars(std::begin(buf), std::end(buf), v).ptr - buf;
+}
 
-    if (version == SERIALIZATION_VERSION_OLD) {
-        res.emplace_back();
-        while (auto* msg = next_msg()) {
-            if (res.back().size() > SERIALIZATION_BATCH_SIZE)
-                res.emplace_back();
-            v0::serialize_message(res.back(), *msg);
-        }
-    } else if (version == SERIALIZATION_VERSION_BT) {
-        oxenmq::bt_list l;
-        size_t counter = 2;
-        while (auto* msg = next_msg()) {
-            size_t ser_size =
-                1 + // version byte
-                2 + // l...e
-                36 + // 33:pubkey
-                2*15 + // millisecond epochs (13 digits) + `i...e`
-                (4 + msg->hash.size()) + // xxx:HASH
-                (6 + msg->data.size()) // xxxxx:DATA
-            ;
-            counter += ser_size;
-            if (!l.empty() && counter > SERIALIZATION_BATCH_SIZE) {
-                // Adding this message would push us over the limit, so finish it off and start a
-                // new serialization piece.
-                std::ostringstream oss;
-                oss << SERIALIZATION_VERSION_BT << oxenmq::bt_serializer(l);
-                res.push_back(oss.str());
-                l.clear();
-                counter = 1 + 2 + ser_size;
+void append_int(std::string& buf, int64_t v) {
+    char tmp[20];
+    buf.append(tmp, std::to_chars(std::begin(tmp), std::end(tmp), v).ptr);
+}
+
+size_t string_length(size_t len) { return int_length(len) + 1 + len; }
+
+void append_string(std::string& buf, std::string_view s) {
+    append_int(buf, s.size());
+    buf += ':';
+    buf += s;
+}
+
+// The exact size of the bt-encoded list for `msg`:
+//     l 33:PUBKEY N:HASH iTIMESTAMPe iEXPIRYe N:DATA e
+size_t serialized_size(const message& msg) {
+    return 2 +
+        string_length(1 + msg.pubkey.raw().size()) +
+        string_length(msg.hash.size()) +
+        2 + int_length(to_epoch_ms(msg.timestamp)) +
+        2 + int_length(to_epoch_ms(msg.expiry)) +
+        string_length(msg.data.size());
+}
+
+// Writes the bt-encoded list for `msg` onto the end of `buf`.  This produces exactly what
+// bt-serializing a bt_list of the message fields would, without building the temporary list.
+void serialize_message(std::string& buf, const message& msg) {
+    buf += 'l';
+    append_int(buf, 1 + msg.pubkey.raw().size());
+    buf += ':';
+    buf += static_cast<char>(msg.pubkey.type());
+    buf += msg.pubkey.raw();
+    append_string(buf, msg.hash);
+    buf += 'i';
+    append_int(buf, to_epoch_ms(msg.timestamp));
+    buf += 'e';
+    buf += 'i';
+    append_int(buf, to_epoch_ms(msg.expiry));
+    buf += 'e';
+    append_string(buf, msg.data);
+    buf += 'e';
+}
+
+// Version byte plus the l...e of the outer list
+constexpr size_t BATCH_OVERHEAD = 1 + 2;
+
+// Writes out the pending messages into a single buffer allocated at exactly the needed size.
+std::string serialize_batch(const std::vector<const message*>& msgs, size_t size) {
+    std::string batch;
+    batch.reserve(size);
+    batch += static_cast<char>(SERIALIZATION_VERSION_BT);
+    batch += 'l';
+    for (auto* msg : msgs)
+        serialize_message(batch, *msg);
+    batch += 'e';
+    assert(batch.size() == size);
+    return batch;
+}
+
+}
+}
+
+namespace v2 {
+namespace {
+
+// Tag bytes that start each message record, indicating how the message hash is encoded
+enum class hash_tag : uint8_t {
+    text = 0,   // varint length + hash string, for anything that doesn't match one of the below
+    b64_32 = 1, // 32 raw bytes; the hash is unpadded base64 of them (i.e. blake2b hashes)
+    hex_64 = 2, // 64 raw bytes; the hash is lower-case hex of them (i.e. old sha512 hashes)
+};
+// Tag byte that ends the messages of an owner group
+constexpr uint8_t END_OF_GROUP = 0xff;
+
+constexpr size_t OWNER_SIZE = 33;
+
+uint64_t zigzag(int64_t v) { return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63); }
+int64_t unzigzag(uint64_t v) { return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1); }
+
+size_t varint_length(uint64_t v) {
+    size_t len = 1;
+    for (; v >= 0x80; v >>= 7)
+        len++;
+    return len;
+}
+
+void append_varint(std::string& buf, uint64_t v) {
+    for (; v >= 0x80; v >>= 7)
+        buf += static_cast<char>((v & 0x7f) | 0x80);
+    buf += static_cast<char>(v);
+}
+
+// Works out how a hash can be encoded, returning the tag and the number of bytes the hash takes
+// (not including the tag).
+std::pair<hash_tag, size_t> hash_encoding(std::string_view hash) {
+    if (hash.size() == 43 && oxenmq::is_base64(hash)) {
+        // Only use the binary form if it will decode back to exactly the same string (this rules
+        // out hashes with non-zero bits in the unused part of the last character).
+        std::string raw = oxenmq::from_base64(hash);
+        std::string b64 = oxenmq::to_base64(raw);
+        if (std::string_view{b64}.substr(0, 43) == hash)
+            return {hash_tag::b64_32, 32};
+    } else if (hash.size() == 128 && oxenmq::is_hex(hash) &&
+            std::none_of(hash.begin(), hash.end(), [](char c) { return c >= 'A' && c <= 'F'; })) {
+        return {hash_tag::hex_64, 64};
+    }
+    return {hash_tag::text, varint_length(hash.size()) + hash.size()};
+}
+
+void append_hash(std::string& buf, std::string_view hash, hash_tag tag) {
+    buf += static_cast<char>(tag);
+    if (tag == hash_tag::b64_32)
+        oxenmq::from_base64(hash.begin(), hash.end(), std::back_inserter(buf));
+    else if (tag == hash_tag::hex_64)
+        oxenmq::from_hex(hash.begin(), hash.end(), std::back_inserter(buf));
+    else {
+        append_varint(buf, hash.size());
+        buf += hash;
+    }
+}
+
+// The messages of one owner within a batch
+struct owner_group {
+    const user_pubkey_t* owner;
+    std::vector<const message*> msgs;
+    int64_t last_timestamp = 0; // Timestamps are delta-encoded from the previous one in the group
+};
+
+// Accumulates messages for a batch, grouped by owner, while tracking its exact serialized size.
+class batch_builder {
+    std::vector<owner_group> groups_;
+    std::unordered_map<user_pubkey_t, size_t> group_index_;
+    size_t size_ = 1; // version byte
+
+  public:
+    bool empty() const { return groups_.empty(); }
+    size_t size() const { return size_; }
+
+    // Returns how much adding `msg` would grow the batch.
+    size_t added_size(const message& msg) const {
+        size_t size = 0;
+        int64_t last_ts = 0;
+        if (auto it = group_index_.find(msg.pubkey); it != group_index_.end())
+            last_ts = groups_[it->second].last_timestamp;
+        else
+            size += OWNER_SIZE + 1; // owner + end-of-group tag
+        auto ts = to_epoch_ms(msg.timestamp);
+        return size + 1 + hash_encoding(msg.hash).second +
+            varint_length(zigzag(ts - last_ts)) +
+            varint_length(zigzag(to_epoch_ms(msg.expiry) - ts)) +
+            varint_length(msg.data.size()) + msg.data.size();
+    }
+
+    void add(const message& msg, size_t added_size) {
+        auto [it, ins] = group_index_.try_emplace(msg.pubkey, groups_.size());
+        if (ins)
+            groups_.push_back({&msg.pubkey});
+        auto& g = groups_[it->second];
+        g.msgs.push_back(&msg);
+        g.last_timestamp = to_epoch_ms(msg.timestamp);
+        size_ += added_size;
+    }
+
+    // Writes out the batch into a single buffer of exactly the needed size, and resets the builder
+    // for the next batch.
+    std::string finish() {
+        std::string batch;
+        batch.reserve(size_);
+        batch += static_cast<char>(SERIALIZATION_VERSION_COMPACT);
+        for (auto& g : groups_) {
+            batch += static_cast<char>(g.owner->type());
+            batch += g.owner->raw();
+            int64_t last_ts = 0;
+            for (auto* msg : g.msgs) {
+                append_hash(batch, msg->hash, hash_encoding(msg->hash).first);
+                auto ts = to_epoch_ms(msg->timestamp);
+                append_varint(batch, zigzag(ts - last_ts));
+                append_varint(batch, zigzag(to_epoch_ms(msg->expiry) - ts));
+                append_varint(batch, msg->data.size());
+                batch += msg->data;
+                last_ts = ts;
             }
-            assert(msg->pubkey);
-            l.push_back(oxenmq::bt_list{{
-                msg->pubkey.prefixed_raw(),
-                msg->hash,
-                to_epoch_ms(msg->timestamp),
-                to_epoch_ms(msg->expiry),
-                msg->data}});
+            batch += static_cast<char>(END_OF_GROUP);
         }
-
-        std::ostringstream oss;
-        oss << uint8_t{1} /* version*/ << oxenmq::bt_serializer(l);
-        res.push_back(oss.str());
-    } else {
-        OXEN_LOG(critical, "Invalid serialization version {}", +version);
-        throw std::logic_error{"Invalid serialization version " + std::to_string(version)};
+        assert(batch.size() == size_);
+        groups_.clear();
+        group_index_.clear();
+        size_ = 1;
+        return batch;
     }
+};
 
-    return res;
+}
 }
 
+batch_serializer::batch_serializer(std::function<const message*()> next_msg, uint8_t version) :
+    next_msg_{std::move(next_msg)}, version_{version} {
+    if (version_ != SERIALIZATION_VERSION_OLD && version_ != SERIALIZATION_VERSION_BT &&
+            version_ != SERIALIZATION_VERSION_COMPACT) {
+        OXEN_LOG(critical, "Invalid serialization version {}", +version_);
+        throw std::logic_error{"Invalid serialization version " + std::to_string(version_)};
+    }
+}
 
+std::optional<std::string> batch_serializer::next() {
+    if (done_)
+        return std::nullopt;
 
-std::vector<message> deserialize_messages(std::string_view slice) {
+    // When a message doesn't fit we finish off the batch and keep the message for the next one.
+    auto* msg = carry_ ? std::exchange(carry_, nullptr) : next_msg_();
+    std::string batch;
+    if (version_ == SERIALIZATION_VERSION_OLD) {
+        for (; msg; msg = next_msg_()) {
+            if (batch.size() > SERIALIZATION_BATCH_SIZE) {
+                carry_ = msg;
+                return batch;
+            }
+            v0::serialize_message(batch, *msg);
+        }
+    } else if (version_ == SERIALIZATION_VERSION_BT) {
+        // We hold on to the messages of the current batch until we know it is full so that we can
+        // then allocate the batch once, at its exact final size, and serialize directly into it.
+        std::vector<const message*> pending;
+        size_t size = v1::BATCH_OVERHEAD;
+        for (; msg; msg = next_msg_()) {
+            assert(msg->pubkey);
+            auto msg_size = v1::serialized_size(*msg);
+            if (!pending.empty() && size + msg_size > SERIALIZATION_BATCH_SIZE) {
+                // Adding this message would push us over the limit, so finish off this batch.
+                carry_ = msg;
+                return v1::serialize_batch(pending, size);
+            }
+            pending.push_back(msg);
+            size += msg_size;
+        }
+        batch = v1::serialize_batch(pending, size);
+    } else {
+        v2::batch_builder builder;
+        for (; msg; msg = next_msg_()) {
+            assert(msg->pubkey);
+            auto msg_size = builder.added_size(*msg);
+            if (!builder.empty() && builder.size() + msg_size > SERIALIZATION_BATCH_SIZE) {
+                carry_ = msg;
+                return builder.finish();
+            }
+            builder.add(*msg, msg_size);
+        }
+        batch = builder.finish();
+    }
+    done_ = true;
+    return batch;
+}
 
-    OXEN_LOG(trace, "=== Deserializing ===");
+void serialize_messages(
+        std::function<const message*()> next_msg, uint8_t version, const batch_callback& on_batch) {
+    batch_serializer serializer{std::move(next_msg), version};
+    while (auto batch = serializer.next())
+        on_batch(std::move(*batch));
+}
+
+std::vector<std::string> serialize_messages(std::function<const message*()> next_msg, uint8_t version) {
+    std::vector<std::string> res;
+    serialize_messages(std::move(next_msg), version,
+            [&res](std::string&& batch) { res.push_back(std::move(batch)); });
+    return res;
+}
 
+// Strips and returns the version byte from the beginning of a serialized batch.
+static uint8_t consume_version(std::string_view& slice) {
     // v0 didn't send a version at all, and sent things incredibly inefficiently.
     // v1+ put the version as the first byte (but can't use any of '0'..'9','a'..'f','A'..'F'
     // because v0 starts out with a hex pubkey).
@@ -210,17 +438,11 @@ std::vector<message> deserialize_messages(std::string_view slice) {
         version = slice.front();
         slice.remove_prefix(1);
     }
+    return version;
+}
 
-    if (version == SERIALIZATION_VERSION_OLD)
-        return v0::deserialize_messages_old(slice);
-
-    else if (version != SERIALIZATION_VERSION_BT) {
-        OXEN_LOG(err, "Invalid deserialization version {}", +version);
-        return {};
-    }
-
-    // v1:
-    std::vector<message> result;
+static std::vector<message_view> deserialize_message_views_v1(std::string_view slice) {
+    std::vector<message_view> result;
     try {
         oxenmq::bt_list_consumer l{slice};
         while (!l.is_finished()) {
@@ -228,19 +450,143 @@ std::vector<message> deserialize_messages(std::string_view slice) {
             auto m = l.consume_list_consumer();
             if (!item.pubkey.load(m.consume_string_view())) {
                 OXEN_LOG(debug, "Unable to deserialize(v1) pubkey");
-                return {};
+                result.clear();
+                break;
             }
-            item.hash = m.consume_string();
+            item.hash = m.consume_string_view();
             item.timestamp = from_epoch_ms(m.consume_integer<int64_t>());
             item.expiry = from_epoch_ms(m.consume_integer<int64_t>());
-            item.data = m.consume_string();
+            item.data = m.consume_string_view();
         }
     } catch (const std::exception& e) {
-        throw e;
         OXEN_LOG(debug, "Failed to deserialize(v1): {}", e.what());
-        return {};
+        result.clear();
     }
 
+    return result;
+}
+
+namespace v2 {
+namespace {
+
+std::string_view consume_bytes(std::string_view& slice, size_t n) {
+    if (slice.size() < n)
+        throw std::runtime_error{"truncated batch"};
+    auto bytes = slice.substr(0, n);
+    slice.remove_prefix(n);
+    return bytes;
+}
+
+uint8_t consume_byte(std::string_view& slice) {
+    return static_cast<uint8_t>(consume_bytes(slice, 1).front());
+}
+
+uint64_t consume_varint(std::string_view& slice) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        auto b = consume_byte(slice);
+        v |= uint64_t{b & 0x7fu} << shift;
+        if (!(b & 0x80))
+            return v;
+    }
+    throw std::runtime_error{"invalid varint"};
+}
+
+// Timestamps (in ms) beyond this in either direction don't fit in a system_clock time_point.
+constexpr int64_t MAX_EPOCH_MS = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::duration::max()).count();
+
+// Applies a zigzag-encoded delta to timestamp `ts`, throwing if the result is out of range.  (The
+// check comes before the addition since a hostile batch can send any 64-bit delta).
+int64_t add_timestamp_delta(int64_t ts, uint64_t delta) {
+    auto d = unzigzag(delta);
+    if (d > 0 ? ts > MAX_EPOCH_MS - d : ts < -MAX_EPOCH_MS - d)
+        throw std::runtime_error{"invalid timestamp"};
+    return ts + d;
+}
+
+std::vector<message_view> deserialize_message_views(
+        std::string_view slice, std::deque<std::string>& decoded_hashes) {
+    std::vector<message_view> result;
+    try {
+        while (!slice.empty()) {
+            user_pubkey_t owner;
+            if (!owner.load(consume_bytes(slice, OWNER_SIZE)))
+                throw std::runtime_error{"invalid owner pubkey"};
+            int64_t last_ts = 0;
+            for (uint8_t tag; (tag = consume_byte(slice)) != END_OF_GROUP; ) {
+                auto& item = result.emplace_back();
+                item.pubkey = owner;
+                switch (static_cast<hash_tag>(tag)) {
+                    case hash_tag::text:
+                        item.hash = consume_bytes(slice, consume_varint(slice));
+                        break;
+                    case hash_tag::b64_32: {
+                        auto raw = consume_bytes(slice, 32);
+                        auto& h = decoded_hashes.emplace_back(oxenmq::to_base64(raw));
+                        while (!h.empty() && h.back() == '=')
+                            h.pop_back();
+                        item.hash = h;
+                        break;
+                    }
+                    case hash_tag::hex_64:
+                        item.hash = decoded_hashes.emplace_back(
+                                oxenmq::to_hex(consume_bytes(slice, 64)));
+                        break;
+                    default:
+                        throw std::runtime_error{"invalid hash type " + std::to_string(tag)};
+                }
+                last_ts = add_timestamp_delta(last_ts, consume_varint(slice));
+                item.timestamp = from_epoch_ms(last_ts);
+                item.expiry = from_epoch_ms(add_timestamp_delta(last_ts, consume_varint(slice)));
+                item.data = consume_bytes(slice, consume_varint(slice));
+            }
+        }
+    } catch (const std::exception& e) {
+        OXEN_LOG(debug, "Failed to deserialize(v2): {}", e.what());
+        result.clear();
+    }
+    return result;
+}
+
+}
+}
+
+std::optional<std::vector<message_view>> deserialize_message_views(
+        std::string_view slice, std::deque<std::string>* decoded_hashes) {
+
+    uint8_t version = consume_version(slice);
+    if (version == SERIALIZATION_VERSION_OLD)
+        return std::nullopt;
+    if (version == SERIALIZATION_VERSION_BT)
+        return deserialize_message_views_v1(slice);
+    if (version == SERIALIZATION_VERSION_COMPACT) {
+        if (!decoded_hashes)
+            return std::nullopt;
+        return v2::deserialize_message_views(slice, *decoded_hashes);
+    }
+
+    OXEN_LOG(err, "Invalid deserialization version {}", +version);
+    return std::vector<message_view>{};
+}
+
+std::vector<message> deserialize_messages(std::string_view slice) {
+
+    OXEN_LOG(trace, "=== Deserializing ===");
+
+    std::deque<std::string> decoded_hashes;
+    auto views = deserialize_message_views(slice, &decoded_hashes);
+    if (!views) {
+        consume_version(slice);
+        return v0::deserialize_messages_old(slice);
+    }
+
+    std::vector<message> result;
+    result.reserve(views->size());
+    for (auto& v : *views)
+        result.emplace_back(std::move(v.pubkey), std::string{v.hash}, v.timestamp, v.expiry,
+                std::string{v.data});
+
     OXEN_LOG(trace, "=== END ===");
 
     return result;
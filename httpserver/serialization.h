@@ -1,12 +1,16 @@
 #pragma once
 
+#include <deque>
 #include <functional>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace oxen {
 
 struct message;
+struct message_view;
 
 inline constexpr size_t SERIALIZATION_BATCH_SIZE = 9'000'000;
 
@@ -16,6 +20,57 @@ inline constexpr uint8_t SERIALIZATION_VERSION_OLD = 0;
 // Newer serialization version based on bt-encoding.
 inline constexpr uint8_t SERIALIZATION_VERSION_BT = 1;
 
+// Compact binary serialization: messages are grouped by owner (so that each owner pubkey is only
+// sent once per batch), hashes are sent as raw bytes rather than base64/hex, and timestamps and
+// expiries are delta-encoded varints.  A batch is the version byte followed by owner groups of:
+//     OWNER (33 bytes)
+//     for each message:
+//         TAG (1 byte; hash encoding) HASH TIMESTAMP_DELTA EXPIRY_DELTA DATA_LEN DATA
+//     0xff
+// where the deltas are zigzag varints (the timestamp relative to the previous message of the group,
+// or 0 for the first one; the expiry relative to the timestamp) and DATA_LEN is a varint.
+inline constexpr uint8_t SERIALIZATION_VERSION_COMPACT = 2;
+
+/// Callback invoked with each completed batch of serialized messages.
+using batch_callback = std::function<void(std::string&& batch)>;
+
+/// Serializes messages one batch at a time, on demand: each call to next() pulls as many messages
+/// from `next_msg` as fit into a batch of at most SERIALIZATION_BATCH_SIZE bytes and returns the
+/// serialized batch.  This produces exactly the same batches as serialize_messages (including a
+/// single empty batch if there are no messages at all), but lets the caller hold off serializing
+/// (and holding in memory) later batches until it is ready to send them.  Pointers returned by
+/// `next_msg` must remain valid until the batch containing them has been returned.
+class batch_serializer {
+  public:
+    batch_serializer(std::function<const message*()> next_msg, uint8_t version);
+
+    /// Returns the next batch, or nullopt once all the messages have been serialized.
+    std::optional<std::string> next();
+
+  private:
+    std::function<const message*()> next_msg_;
+    uint8_t version_;
+    const message* carry_ = nullptr; // Message that didn't fit in the previous batch
+    bool done_ = false;
+};
+
+/// Serializes messages into batches of at most SERIALIZATION_BATCH_SIZE bytes (a single message
+/// that is larger than that goes into a batch of its own), passing each batch to `on_batch` as soon
+/// as it is complete rather than building them all up front.  `next_msg` returns a pointer to the
+/// next message, or nullptr when there are no more; returned pointers must remain valid until the
+/// batch containing them has been passed to `on_batch`.  (Note that compact serialization groups
+/// the messages of each batch by owner, and so doesn't preserve message order).
+void serialize_messages(
+        std::function<const message*()> next_msg, uint8_t version, const batch_callback& on_batch);
+
+template <typename It>
+void serialize_messages(It begin, It end, uint8_t version, const batch_callback& on_batch) {
+    serialize_messages([&begin, &end]() mutable -> const message* {
+        return begin == end ? nullptr : &*begin++;
+    }, version, on_batch);
+}
+
+/// Same as above, but returns all the batches at once.
 std::vector<std::string> serialize_messages(std::function<const message*()> next_msg, uint8_t version);
 
 template <typename It>
@@ -27,4 +82,15 @@ std::vector<std::string> serialize_messages(It begin, It end, uint8_t version) {
 
 std::vector<message> deserialize_messages(std::string_view blob);
 
+/// Deserializes a batch without copying message data: the returned message_views point into
+/// `blob`.  Hashes are viewed in place as well, except for those in compact (v2) batches which have
+/// to be decoded: these are stored in `decoded_hashes`, which must then outlive the views.
+///
+/// Returns an empty vector if the batch is invalid, and nullopt if the batch can't be viewed in
+/// place and has to go through deserialize_messages instead: that is, if it uses the old (v0)
+/// serialization (whose data is base64-encoded), or if it is a v2 batch and `decoded_hashes` is
+/// nullptr.
+std::optional<std::vector<message_view>> deserialize_message_views(
+        std::string_view blob, std::deque<std::string>* decoded_hashes = nullptr);
+
 } // namespace oxen
@@ -3,19 +3,31 @@
 extern "C" {
 #include <openssl/conf.h>
 #include <openssl/crypto.h>
-#include <openssl/dh.h>
 #include <openssl/err.h>
 #include <openssl/evp.h>
 #include <openssl/pem.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
 #include <openssl/x509v3.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
 }
 
 #include "oxen_logger.h"
 
 #include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
 
 namespace oxen {
 
+using namespace std::literals;
+
 namespace {
 
     /* Add extension using V3 code: we can set the config file as NULL
@@ -41,44 +53,25 @@ namespace {
         return 1;
     }
 
-    int mkcert(X509** x509p, EVP_PKEY** pkeyp, int bits, int serial, int days) {
-        X509* x;
-        EVP_PKEY* pk;
-        RSA* rsa;
-        X509_NAME* name = NULL;
-        BIGNUM* bne = NULL;
-        int res = 0;
-
-        if ((pkeyp == NULL) || (*pkeyp == NULL)) {
-            if ((pk = EVP_PKEY_new()) == NULL) {
-                abort();
-                return (0);
-            }
-        } else
-            pk = *pkeyp;
-
-        if ((x509p == NULL) || (*x509p == NULL)) {
-            if ((x = X509_new()) == NULL)
-                goto err;
-        } else
-            x = *x509p;
-
-        bne = BN_new();
-        rsa = RSA_new();
-
-        if (BN_set_word(bne, RSA_F4) != 1) {
-            goto err;
-        }
+    // Generates a new P-256 EC key.  Returns nullptr on failure.
+    EVP_PKEY* generate_ec_key() {
+        EVP_PKEY* pk = nullptr;
+        EVP_PKEY_CTX* kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+        if (kctx && EVP_PKEY_keygen_init(kctx) > 0
+                && EVP_PKEY_CTX_set_ec_paramgen_curve_nid(kctx, NID_X9_62_prime256v1) > 0
+                && EVP_PKEY_CTX_set_ec_param_enc(kctx, OPENSSL_EC_NAMED_CURVE) > 0)
+            EVP_PKEY_keygen(kctx, &pk);
+        EVP_PKEY_CTX_free(kctx);
+        return pk;
+    }
 
-        if (!RSA_generate_key_ex(rsa, bits, bne, NULL)) {
-            goto err;
-        }
+    int mkcert(X509** x509p, EVP_PKEY** pkeyp, int serial, int days) {
+        X509* x = X509_new();
+        EVP_PKEY* pk = generate_ec_key();
+        X509_NAME* name = NULL;
 
-        // https://www.openssl.org/docs/man1.0.2/man3/EVP_PKEY_assign_RSA.html
-        // "[rsa] will be freed when the parent pkey is freed."
-        if (!EVP_PKEY_assign_RSA(pk, rsa)) {
+        if (!x || !pk)
             goto err;
-        }
 
         X509_set_version(x, 2);
         ASN1_INTEGER_set(X509_get_serialNumber(x), serial);
@@ -104,101 +97,219 @@ namespace {
          */
         X509_set_issuer_name(x, name);
 
-        /* Add various extensions: standard extensions */
-        //    add_ext(x, NID_basic_constraints, "critical,CA:FALSE");
-        //    add_ext(x, NID_key_usage, "critical,keyCertSign,cRLSign");
-
         add_ext(x, NID_subject_key_identifier, (char*)"hash");
 
-        /* Some Netscape specific extensions */
-        //    add_ext(x, NID_netscape_cert_type, "sslCA");
-
-        //    add_ext(x, NID_netscape_comment, "example comment extension");
-
-#ifdef CUSTOM_EXT
-        /* Maybe even add our own extension based on existing */
-        {
-            int nid;
-            nid = OBJ_create("1.2.3.4", "MyAlias", "My Test Alias Extension");
-            X509V3_EXT_add_alias(nid, NID_netscape_comment);
-            add_ext(x, nid, "example comment alias");
-        }
-#endif
-
         if (!X509_sign(x, pk, EVP_sha256()))
             goto err;
 
         *x509p = x;
         *pkeyp = pk;
-        res = 1;
+        return 1;
     err:
-        BN_free(bne);
-        // rsa will be freed automatically when pk is freed by the caller
-        return (res);
-    }
-
-}
-
-void generate_dh_pem(const std::filesystem::path& dh_path) {
-    const int prime_len = 2048;
-    const int generator = DH_GENERATOR_2;
-    DH* dh = DH_new();
-    if (dh == NULL) {
-        OXEN_LOG(err, "Alloc for dh failed");
-        ERR_print_errors_fp(stderr);
-        abort();
+        X509_free(x);
+        EVP_PKEY_free(pk);
+        return 0;
     }
-    OXEN_LOG(info, "Generating DH parameter, this might take a while...");
 
-    const int res =
-        DH_generate_parameters_ex(dh, prime_len, generator, nullptr);
+    // Layout of tls_ticket_keys: the key name, then the HMAC key, then the AES key
+    constexpr size_t TICKET_KEY_NAME_SIZE = 16;
+    constexpr size_t TICKET_HMAC_KEY_SIZE = 32;
+    static_assert(TICKET_KEY_NAME_SIZE + TICKET_HMAC_KEY_SIZE + 32 == std::tuple_size_v<tls_ticket_keys>);
 
-    if (!res) {
-        OXEN_LOG(err, "Alloc for dh failed");
-        ERR_print_errors_fp(stderr);
-        abort();
-    }
-
-    OXEN_LOG(info, "DH parameter done!");
-    FILE* pFile = NULL;
-    pFile = fopen(dh_path.u8string().c_str(), "wt");
-    PEM_write_DHparams(pFile, dh);
-    fclose(pFile);
 }
 
 void generate_cert(const std::filesystem::path& cert_path, const std::filesystem::path& key_path) {
-    BIO* bio_err;
     X509* x509 = NULL;
     EVP_PKEY* pkey = NULL;
     FILE* key_f = NULL;
     FILE* cert_f = NULL;
+    bool ok = false;
 
-    OpenSSL_add_all_digests();
-
-    CRYPTO_mem_ctrl(CRYPTO_MEM_CHECK_ON);
-
-    bio_err = BIO_new_fp(stderr, BIO_NOCLOSE);
+    OXEN_LOG(info, "Generating new ECDSA HTTPS certificate");
 
-    if (!mkcert(&x509, &pkey, 2048, 1, 10000))
+    if (!mkcert(&x509, &pkey, 1, 10000))
         goto err;
-    // X509_print_fp(stdout, x509);
 
     key_f = fopen(key_path.u8string().c_str(), "wt");
-    if (!PEM_write_PrivateKey(key_f, pkey, NULL, NULL, 0, NULL, NULL))
+    if (!key_f || !PEM_write_PrivateKey(key_f, pkey, NULL, NULL, 0, NULL, NULL))
         goto err;
     cert_f = fopen(cert_path.u8string().c_str(), "wt");
-    PEM_write_X509(cert_f, x509);
+    if (!cert_f || !PEM_write_X509(cert_f, x509))
+        goto err;
+    ok = true;
 
 err:
-    fclose(cert_f);
-    fclose(key_f);
+    if (cert_f) fclose(cert_f);
+    if (key_f) fclose(key_f);
     X509_free(x509);
     EVP_PKEY_free(pkey);
 
-    CRYPTO_cleanup_all_ex_data();
+    if (!ok) {
+        ERR_print_errors_fp(stderr);
+        throw std::runtime_error{"Failed to generate HTTPS certificate " + cert_path.u8string()};
+    }
+}
+
+bool is_legacy_generated_cert(const std::filesystem::path& cert_path) {
+    FILE* f = fopen(cert_path.u8string().c_str(), "r");
+    if (!f)
+        return false;
+    X509* x = PEM_read_X509(f, NULL, NULL, NULL);
+    fclose(f);
+    if (!x)
+        return false;
+
+    bool legacy = false;
+    if (EVP_PKEY* pk = X509_get0_pubkey(x); pk && EVP_PKEY_base_id(pk) == EVP_PKEY_RSA) {
+        // Only replace what we generated ourselves; anything else was supplied by the operator.
+        char cn[64], org[64];
+        X509_NAME* name = X509_get_subject_name(x);
+        legacy = X509_NAME_get_text_by_NID(name, NID_commonName, cn, sizeof(cn)) > 0
+            && X509_NAME_get_text_by_NID(name, NID_organizationName, org, sizeof(org)) > 0
+            && cn == "localhost"sv && org == "Oxen"sv;
+    }
+    X509_free(x);
+    return legacy;
+}
+
+bool upgrade_legacy_cert(const std::filesystem::path& cert_path, const std::filesystem::path& key_path) {
+    if (!is_legacy_generated_cert(cert_path))
+        return false;
+
+    auto old_cert = cert_path, old_key = key_path;
+    old_cert += ".rsa-old";
+    old_key += ".rsa-old";
+    OXEN_LOG(warn, "Replacing old RSA HTTPS certificate {} with a new ECDSA certificate; the old "
+            "certificate and key have been moved to {} and {}",
+            cert_path.u8string(), old_cert.u8string(), old_key.u8string());
+    std::filesystem::rename(cert_path, old_cert);
+    std::filesystem::rename(key_path, old_key);
+    generate_cert(cert_path, key_path);
+    return true;
+}
+
+tls_ticket_keys generate_ticket_keys() {
+    tls_ticket_keys keys;
+    if (RAND_bytes(keys.data(), keys.size()) != 1)
+        throw std::runtime_error{"Failed to generate TLS session ticket keys"};
+    return keys;
+}
+
+tls_ticket_key_ring::tls_ticket_key_ring() : current_{generate_ticket_keys()} {}
+
+void tls_ticket_key_ring::rotate() {
+    auto fresh = generate_ticket_keys();
+    std::lock_guard lock{mutex_};
+    previous_ = current_;
+    current_ = fresh;
+}
+
+tls_ticket_keys tls_ticket_key_ring::current() const {
+    std::lock_guard lock{mutex_};
+    return current_;
+}
+
+std::optional<tls_ticket_keys> tls_ticket_key_ring::find(
+        const unsigned char* name, bool& is_current) const {
+    std::lock_guard lock{mutex_};
+    if ((is_current = std::memcmp(name, current_.data(), TICKET_KEY_NAME_SIZE) == 0))
+        return current_;
+    if (previous_ && std::memcmp(name, previous_->data(), TICKET_KEY_NAME_SIZE) == 0)
+        return previous_;
+    return std::nullopt;
+}
+
+namespace {
+
+int ticket_key_ring_index() {
+    static const int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    return index;
+}
+
+// Picks the keys for a session ticket: the current keys when issuing one (filling in the key name
+// and a random IV), otherwise the keys matching the ticket's key name.  Returns what the OpenSSL
+// ticket key callback should return: 1 to use the keys, 2 to use them but issue a new ticket (because
+// the keys are about to go away), 0 if the ticket's keys are unknown, or -1 on error.
+int select_ticket_keys(
+        SSL* ssl, unsigned char* name, unsigned char* iv, int enc, tls_ticket_keys& keys) {
+    auto* ring = static_cast<const tls_ticket_key_ring*>(
+            SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), ticket_key_ring_index()));
+    if (!ring)
+        return -1;
+    if (enc) {
+        keys = ring->current();
+        std::memcpy(name, keys.data(), TICKET_KEY_NAME_SIZE);
+        return RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) == 1 ? 1 : -1;
+    }
+    bool is_current;
+    auto found = ring->find(name, is_current);
+    if (!found)
+        return 0;
+    keys = *found;
+    return is_current ? 1 : 2;
+}
 
-    //    CRYPTO_mem_leaks(bio_err);
-    BIO_free(bio_err);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+int ticket_key_callback(SSL* ssl, unsigned char* name, unsigned char* iv,
+        EVP_CIPHER_CTX* cipher, EVP_MAC_CTX* mac, int enc) {
+#else
+int ticket_key_callback(SSL* ssl, unsigned char* name, unsigned char* iv,
+        EVP_CIPHER_CTX* cipher, HMAC_CTX* mac, int enc) {
+#endif
+    tls_ticket_keys keys;
+    int result = select_ticket_keys(ssl, name, iv, enc, keys);
+    if (result > 0) {
+        const auto* hmac_key = keys.data() + TICKET_KEY_NAME_SIZE;
+        const auto* aes_key = hmac_key + TICKET_HMAC_KEY_SIZE;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        char digest[] = "SHA256";
+        OSSL_PARAM params[] = {
+            OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+            OSSL_PARAM_construct_end()};
+        bool mac_ok = EVP_MAC_init(mac, hmac_key, TICKET_HMAC_KEY_SIZE, params);
+#else
+        bool mac_ok = HMAC_Init_ex(mac, hmac_key, TICKET_HMAC_KEY_SIZE, EVP_sha256(), nullptr);
+#endif
+        if (!mac_ok || !EVP_CipherInit_ex(cipher, EVP_aes_256_cbc(), nullptr, aes_key, iv, enc))
+            result = -1;
+    }
+    OPENSSL_cleanse(keys.data(), keys.size());
+    return result;
+}
+
+} // namespace
+
+void configure_tls_context(SSL_CTX* ctx, const tls_ticket_key_ring& keys) {
+    auto check = [](bool ok, const char* what) {
+        if (!ok) {
+            ERR_print_errors_fp(stderr);
+            throw std::runtime_error{"Failed to configure TLS: "s + what};
+        }
+    };
+
+    check(SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION), "minimum protocol version");
+    // TLS 1.3 suites are always (EC)DHE + AEAD; restrict TLS 1.2 to the same.
+    check(SSL_CTX_set_cipher_list(ctx, "ECDHE+AESGCM:ECDHE+CHACHA20"), "cipher list");
+    check(SSL_CTX_set1_groups_list(ctx, "X25519:P-256"), "key exchange groups");
+    SSL_CTX_set_options(ctx, SSL_OP_CIPHER_SERVER_PREFERENCE | SSL_OP_NO_RENEGOTIATION);
+
+    // Session id resumption (per context) and session tickets (resumable across all contexts
+    // sharing `keys`).
+    static constexpr unsigned char session_id_context[] = "oxen-storage";
+    check(SSL_CTX_set_session_id_context(ctx, session_id_context, sizeof(session_id_context) - 1),
+            "session id context");
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx, TLS_SESSION_CACHE_SIZE);
+    SSL_CTX_set_timeout(ctx, TLS_SESSION_TIMEOUT_SECONDS);
+    SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+    check(ticket_key_ring_index() >= 0
+            && SSL_CTX_set_ex_data(ctx, ticket_key_ring_index(), const_cast<tls_ticket_key_ring*>(&keys)),
+            "session ticket key ring");
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    check(SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, ticket_key_callback), "session ticket key callback");
+#else
+    check(SSL_CTX_set_tlsext_ticket_key_cb(ctx, ticket_key_callback), "session ticket key callback");
+#endif
 }
 
 }
@@ -1,10 +1,75 @@
 #pragma once
 
+#include <array>
+#include <chrono>
 #include <filesystem>
+#include <mutex>
+#include <optional>
+
+#include <openssl/ossl_typ.h>
 
 namespace oxen {
 
-void generate_dh_pem(const std::filesystem::path& dh_path);
+// How many TLS sessions each SSL context keeps in its server-side session cache, and how long
+// sessions (cached or ticket-based) can be resumed for.
+inline constexpr long TLS_SESSION_CACHE_SIZE = 20'000;
+inline constexpr long TLS_SESSION_TIMEOUT_SECONDS = 3600;
+
+// Generates a self-signed ECDSA (P-256) certificate and private key.
 void generate_cert(const std::filesystem::path& cert_path, const std::filesystem::path& key_path);
 
+// Returns true if the certificate at `cert_path` is an RSA certificate that was generated by an
+// older version of generate_cert (older versions generated RSA keys, and also needed DH parameters
+// for non-ECDHE key exchange).  Such certificates are safe to replace; a user-supplied certificate
+// (i.e. anything else) is left alone.
+bool is_legacy_generated_cert(const std::filesystem::path& cert_path);
+
+// Checks whether the certificate is an old, self-generated RSA one and, if so, moves it and its key
+// aside (appending ".rsa-old" to both filenames) and generates a new ECDSA certificate in their
+// place.  Returns true if the certificate was replaced.
+bool upgrade_legacy_cert(const std::filesystem::path& cert_path, const std::filesystem::path& key_path);
+
+// How often the TLS session ticket keys get replaced.  Tickets issued under the previous keys can
+// still be resumed until the following rotation, so as long as this is at least the session timeout
+// a ticket stays usable for its whole lifetime.
+inline constexpr std::chrono::seconds TLS_TICKET_KEY_ROTATION = std::chrono::hours{4};
+static_assert(TLS_TICKET_KEY_ROTATION.count() >= TLS_SESSION_TIMEOUT_SECONDS);
+
+// Key material for encrypting TLS session tickets: 16 bytes of key name, 32 of HMAC secret and 32 of
+// AES key.
+using tls_ticket_keys = std::array<unsigned char, 80>;
+
+// Returns new, random session ticket keys.
+tls_ticket_keys generate_ticket_keys();
+
+// The session ticket keys of a server.  Every SSL context of a server should use the same key ring
+// so that a ticket issued by one can be resumed by any of them.  New tickets are always issued with
+// the current keys; the keys they replaced on the last rotation are kept only to decrypt (and then
+// reissue) tickets issued before it.  Thread-safe.
+class tls_ticket_key_ring {
+  public:
+    tls_ticket_key_ring();
+
+    // Replaces the current keys with new, random ones, and discards the previous keys.
+    void rotate();
+
+    // Returns the keys to issue new tickets with.
+    tls_ticket_keys current() const;
+
+    // Returns the keys with the given 16-byte key name, if they are either the current or the
+    // previous keys.  `is_current` is set to whether they are the current ones.
+    std::optional<tls_ticket_keys> find(const unsigned char* name, bool& is_current) const;
+
+  private:
+    mutable std::mutex mutex_;
+    tls_ticket_keys current_;
+    std::optional<tls_ticket_keys> previous_;
+};
+
+// Applies our TLS settings to a server SSL context: TLS 1.2 or newer with ECDHE-only key exchange
+// and AEAD ciphers, a server-side session cache, and session tickets encrypted with the keys from
+// `keys` (which must outlive the context).  Throws std::runtime_error if OpenSSL rejects any of the
+// settings.
+void configure_tls_context(SSL_CTX* ctx, const tls_ticket_key_ring& keys);
+
 }
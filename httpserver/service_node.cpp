@@ -8,12 +8,12 @@
 #include "serialization.h"
 #include "signature.h"
 #include "string_utils.hpp"
+#include "swarm_sync.h"
 #include "utils.hpp"
 #include "version.h"
 
 #include <boost/endian/conversion.hpp>
 #include <chrono>
-#include <cpr/cpr.h>
 #include <mutex>
 #include <nlohmann/json.hpp>
 #include <oxenmq/base32z.h>
@@ -47,7 +47,24 @@ ServiceNode::ServiceNode(
       our_address_{std::move(address)},
       our_seckey_{skey},
       omq_server_{omq_server},
-      all_stats_{*omq_server} {
+      all_stats_{*omq_server},
+      relay_queue_{
+          [this](const sn_record& sn, const std::string& batch, RelayQueue::send_callback cb) {
+              omq_server_->request(
+                      sn.pubkey_x25519.view(),
+                      "sn.data",
+                      [cb = std::move(cb)](bool success, auto&&) { cb(success); },
+                      oxenmq::send_option::request_timeout{RELAY_TIMEOUT},
+                      batch);
+          },
+          [this](const legacy_pubkey& sn, bool gave_up) {
+              all_stats_.record_request_failed(sn);
+              if (gave_up)
+                  all_stats_.record_push_failed(sn);
+          }},
+      subscriptions_{[this](const oxenmq::ConnectionID& conn, std::string notification) {
+          omq_server_->send(conn, SUBSCRIPTION_NOTIFY_COMMAND, notification);
+      }} {
 
     swarm_ = std::make_unique<Swarm>(our_address_);
 
@@ -60,11 +77,11 @@ ServiceNode::ServiceNode(
     omq_server->add_timer([this] { std::lock_guard l{sn_mutex_}; db_->clean_expired(); },
             Database::CLEANUP_PERIOD);
 
-    // Periodically clean up any https request futures
-    omq_server_->add_timer([this] {
-        outstanding_https_reqs_.remove_if(
-                [](auto& f) { return f.wait_for(0ms) == std::future_status::ready; });
-    }, 1s);
+    // Resume relaying to peers whose retry backoff has elapsed
+    omq_server_->add_timer([this] { relay_queue_.retry_due(); }, RELAY_RETRY_CHECK_INTERVAL);
+
+    // Push newly arrived messages out to subscribed clients
+    omq_server_->add_timer([this] { subscriptions_.flush(); }, SUBSCRIPTION_FLUSH_INTERVAL);
 
     // We really want to make sure nodes don't get stuck in "syncing" mode,
     // so if we are still "syncing" after a long time, activate SN regardless
@@ -327,32 +344,45 @@ void ServiceNode::send_onion_to_sn(
     // hex, plus flexible enough to allow other metadata such as the hop number and the encryption
     // type).
     data.hop_no++;
+
+    // Don't wait for the next hop any longer than whoever sent us the request is waiting for us,
+    // and give the next hop a little less time than that so that its reply (even if only a
+    // timeout) gets back to us in time.
+    auto now = std::chrono::steady_clock::now();
+    auto timeout = std::min<std::chrono::steady_clock::duration>(ONION_HOP_TIMEOUT, data.deadline - now);
+    if (timeout <= 0s) {
+        omq_server_.shedder().expired(request_priority::onion, data.deadline, now);
+        return cb(false, {});
+    }
+    data.deadline = now + timeout - ONION_HOP_MARGIN;
+
     omq_server_->request(
         sn.pubkey_x25519.view(), "sn.onion_request", std::move(cb),
-        oxenmq::send_option::request_timeout{30s},
+        oxenmq::send_option::request_timeout{
+            std::chrono::duration_cast<std::chrono::milliseconds>(timeout)},
         omq_server_.encode_onion_data(payload, data));
 }
 
-void ServiceNode::relay_data_reliable(const std::string& blob,
+void ServiceNode::relay_data_reliable(std::shared_ptr<const std::string> blob,
                                       const sn_record& sn) const {
 
     OXEN_LOG(debug, "Relaying data to: {} (x25519 pubkey {})",
             sn.pubkey_legacy, sn.pubkey_x25519);
 
-    omq_server_->request(
-            sn.pubkey_x25519.view(),
-            "sn.data",
-            [](bool success, auto&& data) {
-                if (!success) OXEN_LOG(err, "Failed to relay batch data: timeout");
-            },
-            blob);
+    relay_queue_.enqueue(sn, std::move(blob));
 }
 
 void ServiceNode::record_proxy_request() { all_stats_.bump_proxy_requests(); }
 
 void ServiceNode::record_onion_request() { all_stats_.bump_onion_requests(); }
 
-bool ServiceNode::process_store(message msg, bool* new_msg) {
+void ServiceNode::record_retrieve_coalesced() { all_stats_.bump_retrieve_coalesced(); }
+
+void ServiceNode::record_swarm_early_reply() { all_stats_.bump_swarm_early_replies(); }
+
+void ServiceNode::record_swarm_late_result() { all_stats_.bump_swarm_late_results(); }
+
+bool ServiceNode::process_store(const message_view& msg, bool* new_msg) {
 
     std::lock_guard guard{sn_mutex_};
 
@@ -369,12 +399,19 @@ bool ServiceNode::process_store(message msg, bool* new_msg) {
     auto stored = db_->store(msg);
     if (stored)
         OXEN_LOG(trace, *stored ? "saved message: {}" : "message already exists: {}", msg.data);
+    if (stored.value_or(false)) {
+        wake_storage_test_waiters(msg.hash, msg.data);
+        subscriptions_.notify(msg);
+    }
     if (new_msg)
         *new_msg = stored.value_or(false);
 
     bool legacy_store = !hf_at_least(HARDFORK_RECURSIVE_STORE);
     if (legacy_store) {
-        auto serialized = std::move(serialize_messages(&msg, &msg+1, SERIALIZATION_VERSION_OLD).front());
+        // Pre-HF only, so not worth avoiding the copy that the old serialization needs
+        message copy{msg.pubkey, std::string{msg.hash}, msg.timestamp, msg.expiry, std::string{msg.data}};
+        auto serialized = std::make_shared<const std::string>(
+                std::move(serialize_messages(&copy, &copy+1, SERIALIZATION_VERSION_OLD).front()));
 
         for (auto& peer : swarm_->other_nodes())
             relay_data_reliable(serialized, peer);
@@ -384,17 +421,26 @@ bool ServiceNode::process_store(message msg, bool* new_msg) {
     return true;
 }
 
-void ServiceNode::save_bulk(const std::vector<message>& msgs) {
+template <typename Message>
+void ServiceNode::save_bulk(const std::vector<Message>& msgs) {
 
     std::lock_guard guard(sn_mutex_);
 
-    try { db_->bulk_store(msgs); }
+    std::vector<bool> inserted;
+    try { inserted = db_->bulk_store(msgs); }
     catch (const std::exception& e) {
         OXEN_LOG(err, "failed to save batch to the database: {}", e.what());
         return;
     }
 
     OXEN_LOG(trace, "saved messages count: {}", msgs.size());
+
+    for (size_t i = 0; i < msgs.size(); i++) {
+        if (!inserted[i])
+            continue;
+        wake_storage_test_waiters(msgs[i].hash, msgs[i].data);
+        subscriptions_.notify(msgs[i]);
+    }
 }
 
 void ServiceNode::on_bootstrap_update(block_update&& bu) {
@@ -490,6 +536,8 @@ void ServiceNode::on_swarm_update(block_update&& bu) {
             block_hashes_cache_.erase(block_hashes_cache_.begin());
 
         block_hashes_cache_.insert_or_assign(block_hashes_cache_.end(), bu.height, std::move(bu.block_hash));
+
+        wake_storage_test_height_waiters();
     } else {
         OXEN_LOG(trace, "already seen this block");
         return;
@@ -527,7 +575,10 @@ void ServiceNode::on_swarm_update(block_update&& bu) {
     swarm_->update_state(bu.swarms, bu.decommissioned_nodes, events, true);
 
     if (!events.new_snodes.empty()) {
-        relay_messages(get_all_messages(), events.new_snodes);
+        if (hf_at_least(HARDFORK_SWARM_SYNC))
+            schedule_swarm_sync(events.new_snodes, events.our_swarm_members);
+        else
+            relay_messages(get_all_messages(), events.new_snodes);
     }
 
     if (!events.new_swarms.empty()) {
@@ -723,37 +774,37 @@ void ServiceNode::test_reachability(const sn_record& sn, int previous_failures)
             sn, 0);
 
     bool old_ping_test = !hf_at_least(HARDFORK_HTTPS_PING_TEST_URL);
-    cpr::Url url{fmt::format("https://{}:{}{}/ping_test/v1",
-            sn.ip, sn.port, old_ping_test ? "/swarms" : "")};
-    cpr::Body body{""};
-    cpr::Header headers{
+    http_request req;
+    req.url = fmt::format("https://{}:{}{}/ping_test/v1",
+            sn.ip, sn.port, old_ping_test ? "/swarms" : "");
+    req.headers = {
         {"Host", sn.pubkey_ed25519
             ? oxenmq::to_base32z(sn.pubkey_ed25519.view()) + ".snode"
             : "service-node.snode"},
         {"Content-Type", "application/octet-stream"},
         {"User-Agent", "Lozzax Storage Server/" + std::string{STORAGE_SERVER_VERSION_STRING}},
     };
+    req.timeout = SN_PING_TIMEOUT;
+    req.verify_peer = false;
 
     if (old_ping_test)
-        for (auto& [h, v] : sign_request(body.str()))
-            headers[h] = std::move(v);
-
-    OXEN_LOG(debug, "Sending HTTPS ping to {} @ {}", sn.pubkey_legacy, url);
-    outstanding_https_reqs_.emplace_front(
-        cpr::PostCallback(
-            [this, &omq=*omq_server(), old_ping_test, test_results, previous_failures]
-            (cpr::Response r) {
+        for (auto& [h, v] : sign_request(req.body))
+            req.headers.emplace_back(h, std::move(v));
+
+    OXEN_LOG(debug, "Sending HTTPS ping to {} @ {}", sn.pubkey_legacy, req.url);
+    http_client_.post(std::move(req),
+            [this, old_ping_test, test_results, previous_failures](http_response r) {
                 auto& [sn, result] = *test_results;
                 auto& pk = sn.pubkey_legacy;
                 bool success = false;
-                if (r.error.code != cpr::ErrorCode::OK) {
-                    OXEN_LOG(debug, "FAILED HTTPS ping test of {}: {} {}", pk, r.error.code, r.error.message);
+                if (!r.error.empty()) {
+                    OXEN_LOG(debug, "FAILED HTTPS ping test of {}: {}", pk, r.error);
                 } else if (r.status_code != 200) {
-                    OXEN_LOG(debug, "FAILED HTTPS ping test of {}: received non-200 status {} {}",
-                            pk, r.status_code, r.status_line);
+                    OXEN_LOG(debug, "FAILED HTTPS ping test of {}: received non-200 status {}",
+                            pk, r.status_line);
                 } else {
                     if (old_ping_test) {
-                        if (r.header.count(http::SNODE_SIGNATURE_HEADER))
+                        if (r.header(http::SNODE_SIGNATURE_HEADER))
                             // The signature returned is of the cert.pem which is impossible to
                             // verify without going deeper into the low level SSL layer which isn't
                             // worth the bother, so just accept anything with the signature header
@@ -763,11 +814,10 @@ void ServiceNode::test_reachability(const sn_record& sn, int previous_failures)
                             OXEN_LOG(debug, "FAILED HTTPS ping test of {}: {} response header missing",
                                     pk, http::SNODE_SIGNATURE_HEADER);
                     } else {
-                        if (auto it = r.header.find(http::SNODE_PUBKEY_HEADER);
-                                it == r.header.end())
+                        if (auto* remote_pk_hex = r.header(http::SNODE_PUBKEY_HEADER); !remote_pk_hex)
                             OXEN_LOG(debug, "FAILED HTTPS ping test of {}: {} response header missing",
                                     pk, http::SNODE_PUBKEY_HEADER);
-                        else if (auto remote_pk = parse_legacy_pubkey(it->second); remote_pk != pk)
+                        else if (auto remote_pk = parse_legacy_pubkey(*remote_pk_hex); remote_pk != pk)
                             OXEN_LOG(debug, "FAILED HTTPS ping test of {}: reply has wrong pubkey {}",
                                     pk, remote_pk);
                         else
@@ -779,19 +829,7 @@ void ServiceNode::test_reachability(const sn_record& sn, int previous_failures)
 
                 if (auto r = result.exchange(success ? TEST_PASSED : TEST_FAILED); r != TEST_WAITING)
                     report_reachability(sn, success && r == TEST_PASSED, previous_failures);
-            },
-            std::move(url),
-            cpr::Timeout{SN_PING_TIMEOUT},
-            cpr::Ssl(
-                    cpr::ssl::TLSv1_2{},
-                    cpr::ssl::VerifyHost{false},
-                    cpr::ssl::VerifyPeer{false},
-                    cpr::ssl::VerifyStatus{false}),
-            cpr::MaxRedirects{0},
-            std::move(headers),
-            std::move(body)
-        )
-    );
+            });
 
     // test omq port:
     omq_server_->request(
@@ -906,40 +944,42 @@ void ServiceNode::send_storage_test_req(const sn_record& testee,
 
     if (!hf_at_least(HARDFORK_OMQ_STORAGE_TESTS)) {
         // Deprecated HTTPS storage test: remove after HF18.1
-        cpr::Body body{json{{"height", test_height}, {"hash", msg.hash}}.dump()};
-        cpr::Header headers{
+        http_request req;
+        req.url = fmt::format("https://{}:{}/swarms/storage_test/v1", testee.ip, testee.port);
+        req.body = json{{"height", test_height}, {"hash", msg.hash}}.dump();
+        req.headers = {
             {"Host", testee.pubkey_ed25519
                 ? oxenmq::to_base32z(testee.pubkey_ed25519.view()) + ".snode"
                 : "service-node.snode"},
             {"User-Agent", "Lozzax Storage Server/" + std::string{STORAGE_SERVER_VERSION_STRING}},
         };
+        req.timeout = STORAGE_TEST_TIMEOUT;
+        req.verify_peer = false;
 
-        for (auto& [h, v] : sign_request(body.str()))
-            headers[h] = std::move(v);
+        for (auto& [h, v] : sign_request(req.body))
+            req.headers.emplace_back(h, std::move(v));
 
-        outstanding_https_reqs_.emplace_front(
-            cpr::PostCallback(
-                [this, testee, msg, height=block_height_]
-                (cpr::Response r) {
+        http_client_.post(std::move(req),
+                [this, testee, msg, height=block_height_](http_response r) {
                     auto& pk = testee.pubkey_legacy;
                     std::string status;
                     std::string answer;
-                    if (r.error.code != cpr::ErrorCode::OK)
-                        OXEN_LOG(debug, "FAILED storage test of {}: {}", pk, r.error.message);
+                    if (!r.error.empty())
+                        OXEN_LOG(debug, "FAILED storage test of {}: {}", pk, r.error);
                     else if (r.status_code != 200)
-                        OXEN_LOG(debug, "FAILED storage test of {}: received non-200 status {} {}",
-                                pk, r.status_code, r.status_line);
-                    else if (r.text.empty())
+                        OXEN_LOG(debug, "FAILED storage test of {}: received non-200 status {}",
+                                pk, r.status_line);
+                    else if (r.body.empty())
                         OXEN_LOG(debug, "FAILED storage test of {}: received empty body", pk);
                     else {
                         try {
-                            json res_json = json::parse(r.text);
+                            json res_json = json::parse(r.body);
                             status = res_json.at("status").get<std::string>();
                             auto& ans = res_json.at("value").get_ref<const std::string&>();
                             if (oxenmq::is_base64(ans))
                                 answer = oxenmq::from_base64(ans);
                             else
-                                OXEN_LOG(debug, "FAILED storage test of {}: body of legacy HTTP request was not base64");
+                                OXEN_LOG(debug, "FAILED storage test of {}: body of legacy HTTP request was not base64", pk);
                         } catch (const std::exception& e) {
                             OXEN_LOG(debug, "FAILED storage test of {}: invalid json response ({})", pk, e.what());
                             status.clear();
@@ -948,19 +988,7 @@ void ServiceNode::send_storage_test_req(const sn_record& testee,
                     }
 
                     process_storage_test_response(testee, msg, height, std::move(status), std::move(answer));
-                },
-                cpr::Url{fmt::format("https://{}:{}/swarms/storage_test/v1", testee.ip, testee.port)},
-                cpr::Timeout{STORAGE_TEST_TIMEOUT},
-                cpr::Ssl(
-                        cpr::ssl::TLSv1_2{},
-                        cpr::ssl::VerifyHost{false},
-                        cpr::ssl::VerifyPeer{false},
-                        cpr::ssl::VerifyStatus{false}),
-                cpr::MaxRedirects{0},
-                std::move(headers),
-                std::move(body)
-            )
-        );
+                });
         return;
     }
 
@@ -1143,6 +1171,70 @@ std::pair<MessageTestStatus, std::string> ServiceNode::process_storage_test_req(
     return {MessageTestStatus::SUCCESS, std::move(msg->data)};
 }
 
+void ServiceNode::wait_for_storage_test(
+        uint64_t blk_height,
+        const legacy_pubkey& tester_addr,
+        std::string msg_hash_hex,
+        std::function<void(MessageTestStatus, std::string)> callback,
+        std::chrono::milliseconds timeout) {
+
+    auto w = std::make_shared<storage_test_waiter>();
+    w->height = blk_height;
+    w->tester = tester_addr;
+    w->msg_hash = std::move(msg_hash_hex);
+    w->callback = std::move(callback);
+
+    omq_server_->add_timer(w->deadline, [this, w, timeout] {
+        OXEN_LOG(debug, "Giving up on storage test for {}: still unanswerable after {}",
+                w->msg_hash, util::friendly_duration(timeout));
+        finish_storage_test_waiter(w, MessageTestStatus::RETRY, "");
+    }, timeout);
+
+    // Check again now that the timer is set up: the message (or block) could have arrived since the
+    // caller's initial attempt.
+    check_storage_test_waiter(w);
+}
+
+void ServiceNode::check_storage_test_waiter(const std::shared_ptr<storage_test_waiter>& w) {
+    std::unique_lock lock{sn_mutex_};
+    auto [status, answer] = process_storage_test_req(w->height, w->tester, w->msg_hash);
+
+    if (status == MessageTestStatus::RETRY && !shutting_down()) {
+        test_waiters_.add(w, block_height_);
+        return;
+    }
+
+    lock.unlock();
+    finish_storage_test_waiter(w, status, std::move(answer));
+}
+
+void ServiceNode::finish_storage_test_waiter(
+        const std::shared_ptr<storage_test_waiter>& w,
+        MessageTestStatus status,
+        std::string answer) {
+    if (!test_waiters_.finish(*w))
+        return;
+    omq_server_->cancel_timer(w->deadline);
+    w->callback(status, std::move(answer));
+}
+
+void ServiceNode::wake_storage_test_waiters(std::string_view hash, std::string_view data) {
+    // Waiters only get filed by hash once the height and tester have been verified, so the message
+    // itself is the answer.  We answer from a job so that we aren't invoking the callback while
+    // holding sn_mutex_.
+    for (auto& w : test_waiters_.take_by_hash(hash))
+        omq_server_->job([this, w = std::move(w), data = std::string{data}]() mutable {
+            finish_storage_test_waiter(w, MessageTestStatus::SUCCESS, std::move(data));
+        });
+}
+
+void ServiceNode::wake_storage_test_height_waiters() {
+    // Rechecked from a job because checking requires sn_mutex_, which our caller holds while it is
+    // still updating the swarm state that the tester/testee derivation depends on.
+    for (auto& w : test_waiters_.take_by_height(block_height_))
+        omq_server_->job([this, w = std::move(w)] { check_storage_test_waiter(w); });
+}
+
 void ServiceNode::initiate_peer_test() {
 
     std::lock_guard guard(sn_mutex_);
@@ -1194,21 +1286,38 @@ void ServiceNode::bootstrap_swarms(
     std::unordered_map<user_pubkey_t, swarm_id_t> pk_swarm_cache;
     std::unordered_map<swarm_id_t, std::vector<message>> to_relay;
 
-    std::vector<message> all_entries = get_all_messages();
-    OXEN_LOG(debug, "We have {} messages", all_entries.size());
-    for (auto& entry : all_entries) {
-        if (!entry.pubkey) {
-            OXEN_LOG(err, "Invalid pubkey in a message while bootstrapping other nodes");
-            continue;
-        }
+    auto add_entries = [&](std::vector<message>&& entries, std::optional<swarm_id_t> only) {
+        for (auto& entry : entries) {
+            if (!entry.pubkey) {
+                OXEN_LOG(err, "Invalid pubkey in a message while bootstrapping other nodes");
+                continue;
+            }
 
-        auto [it, ins] = pk_swarm_cache.try_emplace(entry.pubkey);
-        if (ins)
-            it->second = get_swarm_by_pk(all_swarms, entry.pubkey).swarm_id;
-        auto swarm_id = it->second;
+            auto [it, ins] = pk_swarm_cache.try_emplace(entry.pubkey);
+            if (ins)
+                it->second = get_swarm_by_pk(all_swarms, entry.pubkey).swarm_id;
+            auto swarm_id = it->second;
 
-        if (swarms.empty() || std::find(swarms.begin(), swarms.end(), swarm_id) != swarms.end())
-            to_relay[swarm_id].push_back(std::move(entry));
+            if (!only || *only == swarm_id)
+                to_relay[swarm_id].push_back(std::move(entry));
+        }
+    };
+
+    if (swarms.empty()) {
+        // Everything we have needs to go somewhere else
+        std::vector<message> all_entries = get_all_messages();
+        OXEN_LOG(debug, "We have {} messages", all_entries.size());
+        add_entries(std::move(all_entries), std::nullopt);
+    } else {
+        // Only load the owners that fall into the new swarms' parts of the swarm space
+        for (auto swarm_id : swarms) {
+            for (auto [begin, end] : swarm_space_ranges(all_swarms, swarm_id)) {
+                auto entries = db_->retrieve_swarm_space_range(begin, end);
+                OXEN_LOG(debug, "Found {} messages in swarm space [{}, {}] for swarm {}",
+                        entries.size(), begin, end, swarm_id);
+                add_entries(std::move(entries), swarm_id);
+            }
+        }
     }
 
     OXEN_LOG(trace, "Bootstrapping {} swarms", to_relay.size());
@@ -1217,30 +1326,150 @@ void ServiceNode::bootstrap_swarms(
     for (size_t i = 0; i < all_swarms.size(); ++i)
         swarm_id_to_idx.emplace(all_swarms[i].swarm_id, i);
 
-    for (const auto& [swarm_id, items] : to_relay)
-        relay_messages(items, all_swarms[swarm_id_to_idx[swarm_id]].snodes);
+    for (auto& [swarm_id, items] : to_relay)
+        relay_messages(std::move(items), all_swarms[swarm_id_to_idx[swarm_id]].snodes);
 }
 
-void ServiceNode::relay_messages(const std::vector<message>& messages,
-                                 const std::vector<sn_record>& snodes) const {
-    std::vector<std::string> batches = serialize_messages(messages.begin(), messages.end(),
-            !hf_at_least(HARDFORK_BT_MESSAGE_SERIALIZATION)
-                ? SERIALIZATION_VERSION_OLD : SERIALIZATION_VERSION_BT);
+void ServiceNode::schedule_swarm_sync(
+        const std::vector<sn_record>& new_snodes,
+        const std::vector<sn_record>& members) {
+
+    // Find our position amongst the existing (i.e. not new) members so that each of the existing
+    // members syncs at a different time.
+    std::vector<legacy_pubkey> existing;
+    for (const auto& sn : members)
+        if (std::find(new_snodes.begin(), new_snodes.end(), sn) == new_snodes.end())
+            existing.push_back(sn.pubkey_legacy);
+    std::sort(existing.begin(), existing.end());
+    auto rank = std::distance(existing.begin(),
+            std::lower_bound(existing.begin(), existing.end(), our_address_.pubkey_legacy));
+
+    for (const auto& sn : new_snodes) {
+        if (rank == 0) {
+            sync_swarm_member(sn);
+            continue;
+        }
+        OXEN_LOG(debug, "Scheduling swarm sync with {} in {}", sn.pubkey_legacy,
+                util::short_duration(rank * SWARM_SYNC_STAGGER));
+        auto delay_timer = std::make_shared<oxenmq::TimerID>();
+        auto& dtimer = *delay_timer; // Get reference before we move away the shared_ptr
+        omq_server_->add_timer(dtimer, [this, sn, timer=std::move(delay_timer)] {
+            omq_server_->cancel_timer(*timer);
+            sync_swarm_member(sn);
+        }, rank * SWARM_SYNC_STAGGER);
+    }
+}
 
+void ServiceNode::sync_swarm_member(const sn_record& sn) {
+
+    {
+        std::lock_guard guard{sn_mutex_};
+        const auto& peers = swarm_->other_nodes();
+        if (std::find(peers.begin(), peers.end(), sn) == peers.end()) {
+            OXEN_LOG(debug, "Not syncing with {}: no longer a swarm member", sn.pubkey_legacy);
+            return;
+        }
+    }
+
+    auto hashes = get_swarm_hashes();
+    auto request = swarm_sync::make_request(hashes);
+    OXEN_LOG(debug, "Starting swarm sync of {} messages with {} ({}B request)",
+            hashes.size(), sn.pubkey_legacy, request.size());
+
+    omq_server_->request(
+            sn.pubkey_x25519.view(),
+            "sn.sync",
+            [this, sn, hashes=std::move(hashes)](bool success, std::vector<std::string> data) mutable {
+                std::vector<std::string> missing;
+                if (success && data.size() == 1) {
+                    try {
+                        missing = swarm_sync::missing_hashes(data[0], hashes);
+                    } catch (const std::exception& e) {
+                        OXEN_LOG(warn, "Invalid swarm sync reply from {}: {}", sn.pubkey_legacy, e.what());
+                        success = false;
+                    }
+                } else {
+                    success = false;
+                }
+
+                if (success) {
+                    OXEN_LOG(info, "Swarm sync with {}: {} of our {} messages are missing",
+                            sn.pubkey_legacy, missing.size(), hashes.size());
+                } else {
+                    OXEN_LOG(warn, "Swarm sync with {} failed; pushing all {} swarm messages instead",
+                            sn.pubkey_legacy, hashes.size());
+                    missing = std::move(hashes);
+                }
+
+                if (!missing.empty())
+                    relay_messages(get_messages_by_hash(missing), {sn});
+            },
+            std::move(request),
+            oxenmq::send_option::request_timeout{SWARM_SYNC_TIMEOUT});
+}
+
+std::string ServiceNode::process_sync_request(std::string_view request) {
+    return swarm_sync::make_reply(request, get_swarm_hashes());
+}
+
+std::vector<std::string> ServiceNode::get_swarm_hashes() const {
+
+    // Work from a copy of the swarm state so that we don't hold up everything else that needs
+    // sn_mutex_ while scanning the database (which does its own locking).
+    std::vector<SwarmInfo> all_swarms;
+    swarm_id_t our_swarm;
+    {
+        std::lock_guard guard{sn_mutex_};
+        all_swarms = swarm_->all_valid_swarms();
+        our_swarm = swarm_->our_swarm_id();
+    }
+
+    std::unordered_map<user_pubkey_t, bool> is_ours;
+    std::vector<std::string> hashes;
+    for (auto [begin, end] : swarm_space_ranges(all_swarms, our_swarm)) {
+        for (auto& [pk, hash] : db_->retrieve_hashes_swarm_space_range(begin, end)) {
+            auto [it, ins] = is_ours.try_emplace(pk);
+            if (ins)
+                it->second = get_swarm_by_pk(all_swarms, pk).swarm_id == our_swarm;
+            if (it->second)
+                hashes.push_back(std::move(hash));
+        }
+    }
+    return hashes;
+}
+
+std::vector<message> ServiceNode::get_messages_by_hash(const std::vector<std::string>& hashes) const {
+    return db_->retrieve_by_hashes(hashes);
+}
+
+void ServiceNode::relay_messages(std::vector<message> messages,
+                                 const std::vector<sn_record>& snodes) const {
     if (OXEN_LOG_ENABLED(debug)) {
-        OXEN_LOG(debug, "Relayed messages:");
-        for (auto msg : batches)
-            OXEN_LOG(debug, "    {}", msg);
-        OXEN_LOG(debug, "To Snodes:");
+        OXEN_LOG(debug, "Relaying {} messages to snodes:", messages.size());
         for (auto sn : snodes)
             OXEN_LOG(debug, "    {}", sn.pubkey_legacy);
-
-        OXEN_LOG(debug, "Serialised batches: {}", batches.size());
     }
 
-    for (const sn_record& sn : snodes)
-        for (auto& batch : batches)
-            relay_data_reliable(batch, sn);
+    // Batches are serialized as the relay queue asks for them (i.e. once a peer has room for them)
+    // rather than all up front, and each one is shared (rather than copied) across all the snodes
+    // we are sending it to.
+    uint8_t version =
+        hf_at_least(HARDFORK_COMPACT_MESSAGE_SERIALIZATION) ? SERIALIZATION_VERSION_COMPACT :
+        hf_at_least(HARDFORK_BT_MESSAGE_SERIALIZATION) ? SERIALIZATION_VERSION_BT :
+        SERIALIZATION_VERSION_OLD;
+    auto msgs = std::make_shared<const std::vector<message>>(std::move(messages));
+    auto serializer = std::make_shared<batch_serializer>(
+            [msgs, it = msgs->begin()]() mutable -> const message* {
+                return it == msgs->end() ? nullptr : &*it++;
+            },
+            version);
+    relay_queue_.enqueue(snodes, [serializer]() -> std::shared_ptr<const std::string> {
+        auto batch = serializer->next();
+        if (!batch)
+            return nullptr;
+        OXEN_LOG(debug, "Relaying serialized batch of {}B", batch->size());
+        return std::make_shared<const std::string>(std::move(*batch));
+    });
 }
 
 std::vector<message> ServiceNode::retrieve(
@@ -1292,7 +1521,7 @@ static nlohmann::json to_json(const all_stats_t& stats) {
         auto& p = peers[pk.hex()];
 
         p["requests_failed"] = stats.requests_failed;
-        p["pushes_failed"] = stats.requests_failed;
+        p["pushes_failed"] = stats.pushes_failed;
         p["storage_tests"] = stats.storage_tests;
     }
 
@@ -1300,6 +1529,9 @@ static nlohmann::json to_json(const all_stats_t& stats) {
     return json{
         {"total_store_requests", stats.get_total_store_requests()},
         {"total_retrieve_requests", stats.get_total_retrieve_requests()},
+        {"total_retrieve_coalesced", stats.get_total_retrieve_coalesced()},
+        {"total_swarm_early_replies", stats.get_total_swarm_early_replies()},
+        {"total_swarm_late_results", stats.get_total_swarm_late_results()},
         {"total_onion_requests", stats.get_total_onion_requests()},
         {"total_proxy_requests", stats.get_total_proxy_requests()},
 
@@ -1329,6 +1561,35 @@ std::string ServiceNode::get_stats() const {
     val["db_used"] = db_->get_used_bytes();
     val["db_max"] = Database::SIZE_LIMIT;
 
+    auto retrieves = db_->get_retrieve_stats();
+    val["retrieve"] = json{
+        {"fast", retrieves.fast},
+        {"db", retrieves.db},
+        {"watermarks", retrieves.watermarks}
+    };
+
+    auto relay = relay_queue_.get_stats();
+    val["relay"] = json{
+        {"bytes_queued", relay.bytes_queued},
+        {"bytes_in_flight", relay.bytes_in_flight},
+        {"bytes_acked", relay.bytes_acked},
+        {"batches_acked", relay.batches_acked},
+        {"batches_retried", relay.batches_retried},
+        {"batches_failed", relay.batches_failed},
+        {"peers", relay.peers}
+    };
+
+    auto subs = subscriptions_.get_stats();
+    val["subscriptions"] = json{
+        {"connections", subs.connections},
+        {"subscriptions", subs.subscriptions},
+        {"notifications_sent", subs.notifications_sent},
+        {"messages_sent", subs.messages_sent},
+        {"messages_dropped", subs.messages_dropped}
+    };
+
+    val["queues"] = omq_server_.get_queue_stats();
+
     return val.dump();
 }
 
@@ -1389,21 +1650,25 @@ std::vector<message> ServiceNode::get_all_messages() const {
     return db_->retrieve_all();
 }
 
-void ServiceNode::process_push_batch(const std::string& blob) {
+void ServiceNode::process_push_batch(std::string_view blob) {
 
     std::lock_guard guard(sn_mutex_);
 
     if (blob.empty())
         return;
 
-    std::vector<message> items = deserialize_messages(blob);
-
     OXEN_LOG(trace, "Saving all: begin");
 
-    OXEN_LOG(debug, "Got {} messages from peers, size: {}", items.size(),
-             blob.size());
-
-    save_bulk(items);
+    std::deque<std::string> decoded_hashes;
+    if (auto views = deserialize_message_views(blob, &decoded_hashes)) {
+        OXEN_LOG(debug, "Got {} messages from peers, size: {}", views->size(), blob.size());
+        save_bulk(*views);
+    } else {
+        std::vector<message> items = deserialize_messages(blob);
+        OXEN_LOG(debug, "Got {} (old format) messages from peers, size: {}", items.size(),
+                blob.size());
+        save_bulk(items);
+    }
 
     OXEN_LOG(trace, "Saving all: end");
 }
@@ -1431,6 +1696,19 @@ SwarmInfo ServiceNode::get_swarm(const user_pubkey_t& pk) {
     return get_swarm_by_pk(swarm_->all_valid_swarms(), pk);
 }
 
+std::shared_ptr<const swarm_description>
+ServiceNode::get_swarm_description(const user_pubkey_t& pk) {
+
+    std::lock_guard guard(sn_mutex_);
+
+    if (!swarm_) {
+        OXEN_LOG(err, "Swarm data missing");
+        return std::make_shared<const swarm_description>(SwarmInfo{INVALID_SWARM_ID, {}});
+    }
+
+    return swarm_->description(get_swarm_by_pk(swarm_->all_valid_swarms(), pk).swarm_id);
+}
+
 std::vector<sn_record>
 ServiceNode::get_swarm_peers() {
     std::lock_guard guard{sn_mutex_};
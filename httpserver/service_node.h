@@ -2,6 +2,7 @@
 
 #include <chrono>
 #include <forward_list>
+#include <functional>
 #include <future>
 #include <map>
 #include <memory>
@@ -9,12 +10,17 @@
 #include <optional>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 
 #include "Database.hpp"
+#include "http_client.h"
 #include "oxen_common.h"
 #include "lozzaxd_key.h"
 #include "reachability_testing.h"
+#include "relay_queue.h"
 #include "stats.h"
+#include "storage_test_waiters.h"
+#include "subscriptions.h"
 #include "swarm.h"
 
 namespace oxen {
@@ -51,14 +57,26 @@ inline constexpr hf_revision HARDFORK_RECURSIVE_STORE = {18, 1};
 inline constexpr hf_revision HARDFORK_BT_MESSAGE_SERIALIZATION = {18, 1};
 // Hardfork where we switch the hash function to base64(blake2b) from hex(sha512)
 inline constexpr hf_revision HARDFORK_HASH_BLAKE2B = {18, 1};
+// HF at which new swarm members are brought up to date via digest-based swarm sync (see
+// swarm_sync.h) rather than by every existing member pushing all of its data to them.
+inline constexpr hf_revision HARDFORK_SWARM_SYNC = {19, 0};
+// HF at which forwarded client requests to swarm members get batched into sn.storage_cc_batch
+// requests rather than always being sent individually.
+inline constexpr hf_revision HARDFORK_BATCHED_FORWARDING = {19, 0};
+// HF at which we switch to the compact (v2) message serialization for pushing messages to other
+// swarm members.
+inline constexpr hf_revision HARDFORK_COMPACT_MESSAGE_SERIALIZATION = {19, 0};
+
+// When a node joins our swarm the existing members sync with it this far apart from each other (in
+// pubkey order), so that later members only have to fill in whatever earlier members lacked.
+inline constexpr auto SWARM_SYNC_STAGGER = 30s;
+// Timeout for sn.sync requests
+inline constexpr auto SWARM_SYNC_TIMEOUT = 30s;
 
 class OxenmqServer;
 struct OnionRequestMetadata;
 class Swarm;
 
-/// WRONG_REQ - request was ignored as not valid (e.g. incorrect tester)
-enum class MessageTestStatus { SUCCESS, RETRY, ERROR, WRONG_REQ };
-
 enum class SnodeStatus { UNKNOWN, UNSTAKED, DECOMMISSIONED, ACTIVE };
 
 /// All service node logic that is not network-specific
@@ -101,12 +119,44 @@ class ServiceNode {
 
     mutable all_stats_t all_stats_;
 
+    // Flow-controlled queue of sn.data batches we are relaying to other nodes
+    mutable RelayQueue relay_queue_;
+
+    // Client subscriptions to new messages (via storage.subscribe)
+    Subscriptions subscriptions_;
+
     mutable std::recursive_mutex sn_mutex_;
 
-    std::forward_list<std::future<void>> outstanding_https_reqs_;
+    // Client for our outgoing HTTPS requests (HTTPS reachability tests, legacy storage tests, and
+    // onion requests proxied to external servers)
+    HttpClient http_client_;
+
+    // Storage tests we can't answer yet, waiting either for the message to arrive or for us to
+    // reach the test's block height.
+    StorageTestWaiters test_waiters_;
+
+    // Re-runs a waiting storage test; answers it if it can now be answered, otherwise files it
+    // under the hash or height it is waiting for.
+    void check_storage_test_waiter(const std::shared_ptr<storage_test_waiter>& w);
 
-    // Save multiple messages to the database at once (i.e. in a single transaction)
-    void save_bulk(const std::vector<message>& msgs);
+    // Answers a waiting storage test (if not already answered) and cancels its deadline timer.
+    void finish_storage_test_waiter(
+            const std::shared_ptr<storage_test_waiter>& w,
+            MessageTestStatus status,
+            std::string answer);
+
+    // Answers any storage tests waiting for the given newly stored message.  Must be called with
+    // sn_mutex_ held.
+    void wake_storage_test_waiters(std::string_view hash, std::string_view data);
+
+    // Rechecks any storage tests waiting for a block height we have now reached.  Must be called
+    // with sn_mutex_ held.
+    void wake_storage_test_height_waiters();
+
+    // Save multiple messages (or message_views) to the database at once (i.e. in a single
+    // transaction)
+    template <typename Message>
+    void save_bulk(const std::vector<Message>& msgs);
 
     void on_bootstrap_update(block_update&& bu);
 
@@ -120,15 +170,33 @@ class ServiceNode {
     /// (called when our old node got dissolved)
     void salvage_data() const; // mutex not needed
 
-    /// Reliably push message/batch to a service node
+    /// Reliably push message/batch to a service node (via relay_queue_, which takes care of
+    /// flow control and retries)
     void
-    relay_data_reliable(const std::string& blob,
+    relay_data_reliable(std::shared_ptr<const std::string> blob,
                         const sn_record& address) const; // mutex not needed
 
     void relay_messages(
-        const std::vector<message>& msgs,
+        std::vector<message> msgs,
         const std::vector<sn_record>& snodes) const; // mutex not needed
 
+    /// Schedules swarm syncs with nodes that have newly joined our swarm.  `members` is the full
+    /// list of our swarm members (which includes the new nodes).
+    void schedule_swarm_sync(
+        const std::vector<sn_record>& new_snodes,
+        const std::vector<sn_record>& members);
+
+    /// Syncs with a swarm member, pushing it whichever of our swarm's messages it doesn't have.
+    void sync_swarm_member(const sn_record& sn);
+
+    /// Returns the hashes of all stored messages that belong to our swarm.  Only holds sn_mutex_
+    /// while copying the swarm state, not during the database scan, so must *not* be called with
+    /// sn_mutex_ held (or the scan would be done with it held).
+    std::vector<std::string> get_swarm_hashes() const;
+
+    /// Returns the stored messages with the given hashes (skipping any that no longer exist).
+    std::vector<message> get_messages_by_hash(const std::vector<std::string>& hashes) const;
+
     // Conducts any ping peer tests that are due; (this is designed to be called frequently and does
     // nothing if there are no tests currently due).
     void ping_peers();
@@ -175,10 +243,13 @@ class ServiceNode {
     // Record the time of our last being tested over omq/https
     void update_last_ping(ReachType type);
 
-    // These two are only needed because we store stats in Service Node,
+    // These are only needed because we store stats in Service Node,
     // might move it out later
     void record_proxy_request();
     void record_onion_request();
+    void record_retrieve_coalesced();
+    void record_swarm_early_reply();
+    void record_swarm_late_result();
 
     /// Sends an onion request to the next SS
     void send_onion_to_sn(
@@ -209,21 +280,41 @@ class ServiceNode {
     bool shutting_down() const { return shutting_down_; }
 
     /// Process message received from a client, return false if not in a swarm.  If new_msg is not
-    /// nullptr, sets it to true if we stored as a new message, false if we already had it.
-    bool process_store(message msg, bool* new_msg = nullptr);
+    /// nullptr, sets it to true if we stored as a new message, false if we already had it.  The
+    /// message data is stored straight from wherever the view points (typically the client request).
+    bool process_store(const message_view& msg, bool* new_msg = nullptr);
+
+    /// Process incoming blob of messages: add to DB if new.  Messages in the current serialization
+    /// format are stored straight out of `blob` without copying.
+    void process_push_batch(std::string_view blob);
 
-    /// Process incoming blob of messages: add to DB if new
-    void process_push_batch(const std::string& blob);
+    /// Process an incoming swarm sync request from a swarm member; returns the reply to send back.
+    /// Throws std::invalid_argument if the request is invalid.
+    std::string process_sync_request(std::string_view request);
 
     // Attempt to find an answer (message body) to the storage test
     std::pair<MessageTestStatus, std::string> process_storage_test_req(uint64_t blk_height,
                                                const legacy_pubkey& tester_addr,
                                                const std::string& msg_hash_hex);
 
+    /// Waits for a storage test that process_storage_test_req() returned RETRY for.  `callback` is
+    /// invoked exactly once: as soon as the message arrives (or, for a test ahead of our current
+    /// height, as soon as we reach that height and can answer it), or with a RETRY status if it
+    /// still can't be answered after `timeout`.
+    void wait_for_storage_test(
+            uint64_t blk_height,
+            const legacy_pubkey& tester_addr,
+            std::string msg_hash_hex,
+            std::function<void(MessageTestStatus, std::string)> callback,
+            std::chrono::milliseconds timeout);
+
     bool is_pubkey_for_us(const user_pubkey_t& pk) const;
 
     SwarmInfo get_swarm(const user_pubkey_t& pk);
 
+    // Returns the pre-serialized client description of the swarm for `pk` (see swarm_description)
+    std::shared_ptr<const swarm_description> get_swarm_description(const user_pubkey_t& pk);
+
     std::vector<sn_record> get_swarm_peers();
 
     std::vector<message> get_all_messages() const;
@@ -291,6 +382,10 @@ class ServiceNode {
     void update_swarms();
 
     OxenmqServer& omq_server() { return omq_server_; }
+
+    HttpClient& http_client() { return http_client_; }
+
+    Subscriptions& subscriptions() { return subscriptions_; }
 };
 
 } // namespace oxen
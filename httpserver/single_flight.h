@@ -0,0 +1,67 @@
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace oxen {
+
+/// Collapses concurrent identical requests: while the result for a key is being computed, further
+/// requests for the same key wait for (and share) that result instead of computing their own.
+/// Nothing is cached beyond that; a request arriving after a computation has finished starts a new
+/// one.
+///
+/// Waiting requests don't block: their callbacks are queued and invoked, in arrival order, by the
+/// thread that did the computation (after invoking its own callback).
+///
+/// Every callback gets the very same Result, so anything that should differ per request (such as a
+/// response timestamp) has to be left out of it and added by the callback.
+template <typename Key, typename Result, typename Hash = std::hash<Key>>
+class SingleFlight {
+  public:
+    using callback = std::function<void(const Result&)>;
+
+    /// Invokes `cb` with the result of `compute()` for `key`, sharing the result of an in-progress
+    /// computation for the same key if there is one.  `compute` must not throw (errors should be
+    /// encoded in the Result), as the waiting callbacks would otherwise never be called.  Returns
+    /// true if this request joined one already in progress.
+    template <typename Compute>
+    bool run(const Key& key, Compute&& compute, callback cb) {
+        {
+            std::lock_guard lock{mutex_};
+            auto [it, ins] = in_flight_.try_emplace(key);
+            if (!ins) {
+                it->second.push_back(std::move(cb));
+                return true;
+            }
+        }
+
+        const Result result = compute();
+
+        std::vector<callback> waiting;
+        {
+            std::lock_guard lock{mutex_};
+            auto it = in_flight_.find(key);
+            waiting = std::move(it->second);
+            in_flight_.erase(it);
+        }
+
+        cb(result);
+        for (auto& w : waiting)
+            w(result);
+        return false;
+    }
+
+    /// Returns the number of keys currently being computed.
+    size_t in_flight() const {
+        std::lock_guard lock{mutex_};
+        return in_flight_.size();
+    }
+
+  private:
+    mutable std::mutex mutex_;
+    std::unordered_map<Key, std::vector<callback>, Hash> in_flight_;
+};
+
+} // namespace oxen
@@ -70,6 +70,9 @@ class all_stats_t {
         current_client_store_requests{0},
         total_client_retrieve_requests{0},
         current_client_retrieve_requests{0},
+        total_client_retrieve_coalesced{0},
+        total_swarm_early_replies{0},
+        total_swarm_late_results{0},
         total_proxy_requests{0},
         current_proxy_requests{0},
         total_onion_requests{0},
@@ -132,11 +135,26 @@ class all_stats_t {
         total_client_retrieve_requests++;
         current_client_retrieve_requests++;
     }
+    // A retrieve request that shared the result of an identical in-progress one; these are also
+    // counted in the retrieve requests.
+    void bump_retrieve_coalesced() {
+        bump_retrieve_requests();
+        total_client_retrieve_coalesced++;
+    }
+
+    // A recursive request that we replied to before all swarm members had responded (because the
+    // quorum was reached or the reply timeout expired)
+    void bump_swarm_early_replies() { total_swarm_early_replies++; }
+    // A swarm member result that arrived after we had already replied
+    void bump_swarm_late_results() { total_swarm_late_results++; }
 
     uint64_t get_total_proxy_requests() const { return total_proxy_requests; }
     uint64_t get_total_onion_requests() const { return total_onion_requests; }
     uint64_t get_total_store_requests() const { return total_client_store_requests; }
     uint64_t get_total_retrieve_requests() const { return total_client_retrieve_requests; }
+    uint64_t get_total_retrieve_coalesced() const { return total_client_retrieve_coalesced; }
+    uint64_t get_total_swarm_early_replies() const { return total_swarm_early_replies; }
+    uint64_t get_total_swarm_late_results() const { return total_swarm_late_results; }
 
     /// Retrieves recent request counts using current period + stored previous period counts.
     ///
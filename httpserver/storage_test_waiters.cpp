@@ -0,0 +1,70 @@
+#include "storage_test_waiters.h"
+
+namespace oxen {
+
+bool StorageTestWaiters::add(const waiter_ptr& w, uint64_t block_height) {
+    std::lock_guard lock{mutex_};
+    if (w->done)
+        return false;
+    if (w->height > block_height)
+        by_height_.emplace(w->height, w);
+    else
+        by_hash_.emplace(w->msg_hash, w);
+    return true;
+}
+
+// Removes `w` from the waiters filed under `key` (if present).
+template <typename Map, typename Key>
+static void erase_waiter(Map& waiters, const Key& key, const storage_test_waiter* w) {
+    auto [it, end] = waiters.equal_range(key);
+    while (it != end) {
+        if (it->second.get() == w)
+            it = waiters.erase(it);
+        else
+            ++it;
+    }
+}
+
+bool StorageTestWaiters::finish(storage_test_waiter& w) {
+    std::lock_guard lock{mutex_};
+    if (w.done)
+        return false;
+    w.done = true;
+    erase_waiter(by_hash_, w.msg_hash, &w);
+    erase_waiter(by_height_, w.height, &w);
+    return true;
+}
+
+std::vector<StorageTestWaiters::waiter_ptr> StorageTestWaiters::take_by_hash(std::string_view hash) {
+    std::vector<waiter_ptr> found;
+    std::lock_guard lock{mutex_};
+    if (by_hash_.empty())
+        return found;
+    auto [begin, end] = by_hash_.equal_range(std::string{hash});
+    for (auto it = begin; it != end; ++it)
+        found.push_back(std::move(it->second));
+    by_hash_.erase(begin, end);
+    return found;
+}
+
+std::vector<StorageTestWaiters::waiter_ptr> StorageTestWaiters::take_by_height(uint64_t block_height) {
+    std::vector<waiter_ptr> found;
+    std::lock_guard lock{mutex_};
+    auto end = by_height_.upper_bound(block_height);
+    for (auto it = by_height_.begin(); it != end; ++it)
+        found.push_back(std::move(it->second));
+    by_height_.erase(by_height_.begin(), end);
+    return found;
+}
+
+size_t StorageTestWaiters::waiting_by_hash() const {
+    std::lock_guard lock{mutex_};
+    return by_hash_.size();
+}
+
+size_t StorageTestWaiters::waiting_by_height() const {
+    std::lock_guard lock{mutex_};
+    return by_height_.size();
+}
+
+} // namespace oxen
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <oxenmq/oxenmq.h>
+
+#include "lozzaxd_key.h"
+
+namespace oxen {
+
+/// WRONG_REQ - request was ignored as not valid (e.g. incorrect tester)
+enum class MessageTestStatus { SUCCESS, RETRY, ERROR, WRONG_REQ };
+
+/// A storage test that we couldn't answer yet, because we don't have the message or haven't reached
+/// the test's block height.
+struct storage_test_waiter {
+    uint64_t height;
+    legacy_pubkey tester;
+    std::string msg_hash;
+    std::function<void(MessageTestStatus, std::string)> callback;
+    oxenmq::TimerID deadline;
+    bool done = false; // Guarded by the StorageTestWaiters mutex
+};
+
+/// The storage tests we are waiting to answer, filed either under the message hash they are waiting
+/// for or under the block height they are waiting for us to reach.  This only keeps track of the
+/// waiters: answering them (and rechecking them) is up to the caller.
+class StorageTestWaiters {
+  public:
+    using waiter_ptr = std::shared_ptr<storage_test_waiter>;
+
+    /// Files `w` under its height if that is above `block_height`, otherwise under its message
+    /// hash.  Returns false (without filing it) if `w` has already been finished.
+    bool add(const waiter_ptr& w, uint64_t block_height);
+
+    /// Marks `w` as finished and removes it from wherever it is filed.  Returns false if it was
+    /// already finished, i.e. if someone else is answering it.
+    bool finish(storage_test_waiter& w);
+
+    /// Removes and returns the waiters for the given message hash.
+    std::vector<waiter_ptr> take_by_hash(std::string_view hash);
+
+    /// Removes and returns the waiters for heights up to and including `block_height`.
+    std::vector<waiter_ptr> take_by_height(uint64_t block_height);
+
+    /// Number of waiters filed by hash and by height, respectively.
+    size_t waiting_by_hash() const;
+    size_t waiting_by_height() const;
+
+  private:
+    mutable std::mutex mutex_;
+    std::unordered_multimap<std::string, waiter_ptr> by_hash_;
+    std::multimap<uint64_t, waiter_ptr> by_height_;
+};
+
+} // namespace oxen
@@ -0,0 +1,177 @@
+#include "subscriptions.h"
+
+#include "oxen_logger.h"
+#include "time.hpp"
+
+#include <oxenmq/bt_serialize.h>
+
+#include <algorithm>
+
+namespace oxen {
+
+Subscriptions::Subscriptions(sender send) : send_{std::move(send)} {}
+
+subscribe_result Subscriptions::subscribe(
+        const oxenmq::ConnectionID& conn,
+        const user_pubkey_t& pubkey,
+        std::chrono::steady_clock::time_point now) {
+    std::lock_guard lock{mutex_};
+    auto it = connections_.find(conn);
+    if (it == connections_.end()) {
+        if (connections_.size() >= SUBSCRIPTION_MAX_CONNECTIONS)
+            return subscribe_result::too_many_connections;
+        it = connections_.emplace(conn, connection{}).first;
+    }
+    auto& c = it->second;
+    auto [sub, ins] = c.pubkeys.try_emplace(pubkey);
+    if (ins) {
+        if (c.pubkeys.size() > SUBSCRIPTION_MAX_PUBKEYS) {
+            c.pubkeys.erase(sub);
+            if (c.pubkeys.empty())
+                connections_.erase(it);
+            return subscribe_result::too_many_pubkeys;
+        }
+        subscribers_[pubkey].push_back(conn);
+        stats_.subscriptions++;
+    }
+    sub->second = now + SUBSCRIPTION_LIFETIME;
+    return subscribe_result::ok;
+}
+
+bool Subscriptions::unsubscribe(const oxenmq::ConnectionID& conn, const user_pubkey_t& pubkey) {
+    std::lock_guard lock{mutex_};
+    auto it = connections_.find(conn);
+    if (it == connections_.end() || !it->second.pubkeys.erase(pubkey))
+        return false;
+    remove_subscriber(pubkey, conn);
+    if (it->second.pubkeys.empty())
+        connections_.erase(it);
+    return true;
+}
+
+void Subscriptions::remove_subscriber(const user_pubkey_t& pubkey, const oxenmq::ConnectionID& conn) {
+    stats_.subscriptions--;
+    auto it = subscribers_.find(pubkey);
+    if (it == subscribers_.end())
+        return;
+    auto& conns = it->second;
+    conns.erase(std::remove(conns.begin(), conns.end(), conn), conns.end());
+    if (conns.empty())
+        subscribers_.erase(it);
+}
+
+void Subscriptions::notify(
+        const user_pubkey_t& pubkey,
+        std::string_view hash,
+        std::chrono::system_clock::time_point timestamp,
+        std::chrono::system_clock::time_point expiry,
+        std::string_view data) {
+    std::lock_guard lock{mutex_};
+    auto it = subscribers_.find(pubkey);
+    if (it == subscribers_.end())
+        return;
+
+    // Serialize once; every subscribed connection shares the same copy
+    auto msg = std::make_shared<const std::string>(oxenmq::bt_serialize(oxenmq::bt_dict{
+        {"data", data},
+        {"expiration", to_epoch_ms(expiry)},
+        {"hash", hash},
+        {"pubkey", pubkey.prefixed_raw()},
+        {"timestamp", to_epoch_ms(timestamp)},
+    }));
+
+    for (auto& conn : it->second) {
+        auto c_it = connections_.find(conn);
+        if (c_it == connections_.end())
+            continue;
+        auto& c = c_it->second;
+        if (c.queue.empty())
+            pending_.push_back(conn);
+        c.queue.push_back(msg);
+        c.queued_bytes += msg->size();
+        // Bound the queue by dropping the oldest messages (but always keep the newest, even if it
+        // alone is over the byte limit).
+        while (c.queue.size() > 1 && (c.queue.size() > SUBSCRIPTION_MAX_QUEUED ||
+                    c.queued_bytes > SUBSCRIPTION_MAX_QUEUED_BYTES)) {
+            c.queued_bytes -= c.queue.front()->size();
+            c.queue.pop_front();
+            c.dropped++;
+            stats_.messages_dropped++;
+        }
+    }
+}
+
+void Subscriptions::expire(std::chrono::steady_clock::time_point now) {
+    for (auto it = connections_.begin(); it != connections_.end(); ) {
+        auto& [conn, c] = *it;
+        for (auto sub = c.pubkeys.begin(); sub != c.pubkeys.end(); ) {
+            if (sub->second <= now) {
+                remove_subscriber(sub->first, conn);
+                sub = c.pubkeys.erase(sub);
+            } else {
+                ++sub;
+            }
+        }
+        // Keep an expired connection around until its queue has been flushed
+        if (c.pubkeys.empty() && c.queue.empty())
+            it = connections_.erase(it);
+        else
+            ++it;
+    }
+}
+
+void Subscriptions::flush(std::chrono::steady_clock::time_point now) {
+    std::vector<std::pair<oxenmq::ConnectionID, std::string>> out;
+    {
+        std::lock_guard lock{mutex_};
+        out.reserve(pending_.size());
+        for (auto& conn : pending_) {
+            auto it = connections_.find(conn);
+            if (it == connections_.end() || it->second.queue.empty())
+                continue;
+            auto& c = it->second;
+
+            std::string notification;
+            notification.reserve(c.queued_bytes + 32);
+            notification += 'd';
+            if (c.dropped) {
+                notification += "7:droppedi";
+                notification += std::to_string(c.dropped);
+                notification += 'e';
+            }
+            notification += "8:messagesl";
+            for (auto& msg : c.queue)
+                notification += *msg;
+            notification += "ee";
+
+            stats_.notifications_sent++;
+            stats_.messages_sent += c.queue.size();
+            c.queue.clear();
+            c.queued_bytes = 0;
+            c.dropped = 0;
+            out.emplace_back(conn, std::move(notification));
+            if (c.pubkeys.empty())
+                connections_.erase(it);
+        }
+        pending_.clear();
+
+        if (now - last_expiry_check_ >= SUBSCRIPTION_EXPIRY_CHECK_INTERVAL) {
+            expire(now);
+            last_expiry_check_ = now;
+        }
+    }
+
+    for (auto& [conn, notification] : out) {
+        OXEN_LOG(trace, "Sending {}B subscription notification", notification.size());
+        send_(conn, std::move(notification));
+    }
+}
+
+subscription_stats Subscriptions::get_stats() const {
+    std::lock_guard lock{mutex_};
+    subscription_stats s = stats_;
+    s.connections = connections_.size();
+    return s;
+}
+
+} // namespace oxen
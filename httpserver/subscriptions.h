@@ -0,0 +1,130 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <oxenmq/oxenmq.h>
+
+#include "oxen_common.h"
+
+namespace oxen {
+
+using namespace std::literals;
+
+// How long a subscription lasts.  Clients renew a subscription by subscribing again before it
+// expires; we don't get notified when a client connection goes away, so this is also how long
+// a subscription for a disconnected client lingers.
+inline constexpr auto SUBSCRIPTION_LIFETIME = 30min;
+
+// Maximum number of pubkeys a single connection may be subscribed to at once.
+inline constexpr size_t SUBSCRIPTION_MAX_PUBKEYS = 32;
+
+// Maximum number of connections that may have subscriptions at once.
+inline constexpr size_t SUBSCRIPTION_MAX_CONNECTIONS = 50'000;
+
+// Maximum number of messages (and message bytes) queued for a single connection between flushes.
+// Beyond this the oldest queued messages are dropped, and the next notification tells the client
+// how many were dropped so that it can catch up with a `retrieve`.
+inline constexpr size_t SUBSCRIPTION_MAX_QUEUED = 100;
+inline constexpr size_t SUBSCRIPTION_MAX_QUEUED_BYTES = 2'000'000;
+
+// How often we send out queued notifications.
+inline constexpr auto SUBSCRIPTION_FLUSH_INTERVAL = 100ms;
+
+// How often we look for and remove expired subscriptions.
+inline constexpr auto SUBSCRIPTION_EXPIRY_CHECK_INTERVAL = 10s;
+
+// The command we invoke on a subscribed client connection with new messages.
+inline constexpr auto SUBSCRIPTION_NOTIFY_COMMAND = "notify.message"sv;
+
+struct subscription_stats {
+    size_t connections = 0;          // connections with at least one subscription
+    size_t subscriptions = 0;        // total (connection, pubkey) subscriptions
+    uint64_t notifications_sent = 0; // notification messages sent to clients
+    uint64_t messages_sent = 0;      // stored messages included in those notifications
+    uint64_t messages_dropped = 0;   // messages dropped because a connection's queue was full
+};
+
+enum class subscribe_result { ok, too_many_pubkeys, too_many_connections };
+
+/// Tracks client subscriptions (made through the OMQ `storage.subscribe` endpoint) to new messages
+/// for a pubkey, so that clients can be sent new messages as we store them instead of having to
+/// keep polling with `retrieve`.
+///
+/// New messages are serialized once (no matter how many connections are subscribed to the owner),
+/// queued per connection, and sent out periodically by flush() in a single notification per
+/// connection containing a bt-encoded dict of:
+/// - "messages" -- list of dicts of "pubkey" (33 bytes), "hash", "timestamp", "expiration" and
+///   "data" (bytes) values, i.e. the same values (but not base64-encoded) as `retrieve` returns.
+/// - "dropped" -- the number of messages dropped before this notification because too many were
+///   queued for the connection.  Omitted if 0.
+class Subscriptions {
+  public:
+    /// Called (without any lock held) to send a notification to a connection.
+    using sender = std::function<void(const oxenmq::ConnectionID& conn, std::string notification)>;
+
+    explicit Subscriptions(sender send);
+
+    /// Subscribes `conn` to new messages for `pubkey`, or renews an existing subscription, until
+    /// SUBSCRIPTION_LIFETIME from `now`.
+    subscribe_result subscribe(
+            const oxenmq::ConnectionID& conn,
+            const user_pubkey_t& pubkey,
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+    /// Removes a subscription; returns true if it existed.
+    bool unsubscribe(const oxenmq::ConnectionID& conn, const user_pubkey_t& pubkey);
+
+    /// Queues a newly stored message for sending to all connections subscribed to its owner.  Does
+    /// nothing (beyond a hash table lookup) if there are no subscribers.
+    template <typename Message>
+    void notify(const Message& msg) {
+        notify(msg.pubkey, msg.hash, msg.timestamp, msg.expiry, msg.data);
+    }
+
+    void notify(
+            const user_pubkey_t& pubkey,
+            std::string_view hash,
+            std::chrono::system_clock::time_point timestamp,
+            std::chrono::system_clock::time_point expiry,
+            std::string_view data);
+
+    /// Sends out queued notifications, and removes expired subscriptions (at most every
+    /// SUBSCRIPTION_EXPIRY_CHECK_INTERVAL).  Called every SUBSCRIPTION_FLUSH_INTERVAL.
+    void flush(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+    subscription_stats get_stats() const;
+
+  private:
+    struct connection {
+        // Subscribed pubkeys and when each subscription expires
+        std::unordered_map<user_pubkey_t, std::chrono::steady_clock::time_point> pubkeys;
+        // Serialized messages waiting to be sent
+        std::deque<std::shared_ptr<const std::string>> queue;
+        size_t queued_bytes = 0;
+        uint64_t dropped = 0;
+    };
+
+    void remove_subscriber(const user_pubkey_t& pubkey, const oxenmq::ConnectionID& conn);
+
+    void expire(std::chrono::steady_clock::time_point now);
+
+    mutable std::mutex mutex_;
+    std::unordered_map<oxenmq::ConnectionID, connection> connections_;
+    std::unordered_map<user_pubkey_t, std::vector<oxenmq::ConnectionID>> subscribers_;
+    // Connections with queued messages
+    std::vector<oxenmq::ConnectionID> pending_;
+    std::chrono::steady_clock::time_point last_expiry_check_;
+    subscription_stats stats_;
+    sender send_;
+};
+
+} // namespace oxen
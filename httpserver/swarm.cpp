@@ -3,11 +3,14 @@
 
 #include "service_node.h"
 
-#include <boost/endian/conversion.hpp>
+#include <algorithm>
 #include <cstdlib>
 #include <ostream>
 #include <unordered_map>
 
+#include <oxenmq/base32z.h>
+#include <oxenmq/bt_serialize.h>
+
 #include "string_utils.hpp"
 #include "utils.hpp"
 
@@ -184,6 +187,75 @@ void Swarm::apply_swarm_changes(const std::vector<SwarmInfo>& new_swarms) {
     OXEN_LOG(trace, "Applying swarm changes");
 
     all_valid_swarms_ = apply_ips(new_swarms, all_valid_swarms_);
+    update_descriptions();
+}
+
+swarm_description::swarm_description(SwarmInfo swarm_) : swarm{std::move(swarm_)} {
+
+    json = nlohmann::json{{"snodes", nlohmann::json::array()}};
+    auto& snodes_json = json["snodes"];
+    oxenmq::bt_list snodes_bt;
+    for (const auto& sn : swarm.snodes) {
+        auto address = oxenmq::to_base32z(sn.pubkey_legacy.view()) + ".snode";
+        auto port = std::to_string(sn.port);
+        snodes_json.push_back(nlohmann::json{
+                {"address", address}, // Deprecated, use pubkey_legacy instead
+                {"pubkey_legacy", sn.pubkey_legacy.hex()},
+                {"pubkey_x25519", sn.pubkey_x25519.hex()},
+                {"pubkey_ed25519", sn.pubkey_ed25519.hex()},
+                {"port", port}, // Deprecated port (as a string) for backwards compat; use "port_https" instead
+                {"port_https", sn.port},
+                {"port_omq", sn.omq_port},
+                {"ip", sn.ip}});
+        snodes_bt.push_back(oxenmq::bt_dict{
+                {"address", std::move(address)},
+                {"ip", sn.ip},
+                {"port", std::move(port)},
+                {"port_https", sn.port},
+                {"port_omq", sn.omq_port},
+                {"pubkey_ed25519", sn.pubkey_ed25519.hex()},
+                {"pubkey_legacy", sn.pubkey_legacy.hex()},
+                {"pubkey_x25519", sn.pubkey_x25519.hex()}});
+    }
+    auto id = util::int_to_string(swarm.swarm_id, 16);
+    json["swarm"] = id;
+
+    bt_prefix = oxenmq::bt_serialize(oxenmq::bt_dict{
+            {"snodes", std::move(snodes_bt)},
+            {"swarm", std::move(id)}});
+    bt_prefix.pop_back(); // Remove the dict's closing "e"
+}
+
+// Returns true if all the details we give to clients are the same for both lists of snodes
+static bool same_details(const std::vector<sn_record>& a, const std::vector<sn_record>& b) {
+    return std::equal(a.begin(), a.end(), b.begin(), b.end(),
+            [](const sn_record& x, const sn_record& y) {
+                return x.pubkey_legacy == y.pubkey_legacy && x.pubkey_ed25519 == y.pubkey_ed25519
+                    && x.pubkey_x25519 == y.pubkey_x25519 && x.ip == y.ip && x.port == y.port
+                    && x.omq_port == y.omq_port;
+            });
+}
+
+void Swarm::update_descriptions() {
+
+    std::unordered_map<swarm_id_t, std::shared_ptr<const swarm_description>> updated;
+    updated.reserve(all_valid_swarms_.size());
+    int rebuilt = 0;
+    for (const auto& si : all_valid_swarms_) {
+        if (si.swarm_id == INVALID_SWARM_ID)
+            continue;
+        auto& desc = updated[si.swarm_id];
+        if (auto it = descriptions_.find(si.swarm_id);
+                it != descriptions_.end() && same_details(it->second->swarm.snodes, si.snodes))
+            desc = std::move(it->second);
+        else {
+            desc = std::make_shared<const swarm_description>(si);
+            rebuilt++;
+        }
+    }
+    descriptions_ = std::move(updated);
+
+    OXEN_LOG(debug, "Rebuilt {} of {} swarm descriptions", rebuilt, descriptions_.size());
 }
 
 void Swarm::update_state(const std::vector<SwarmInfo>& swarms,
@@ -224,25 +296,78 @@ void Swarm::update_state(const std::vector<SwarmInfo>& swarms,
                      });
     }
 
-    // Store a copy of every node in a separate data structure
-    all_funded_nodes_.clear();
-    all_funded_ed25519_.clear();
-    all_funded_x25519_.clear();
-
-    for (const auto& si : swarms) {
-        for (const auto& sn : si.snodes) {
-            all_funded_nodes_.emplace(sn.pubkey_legacy, sn);
+    // Update our copy of every funded node.  This is called on every block, but the node list
+    // rarely changes between blocks so we diff against what we already have rather than clearing
+    // and rebuilding the lookup maps from scratch.
+    funded_scratch_.clear();
+    for (const auto& si : swarms)
+        for (const auto& sn : si.snodes)
+            update_funded_node(sn);
+    for (const auto& sn : decommissioned)
+        update_funded_node(sn);
+
+    // If every node we know about was in the update then there is nothing to remove; otherwise we
+    // sweep out the nodes that didn't appear (i.e. deregistered nodes).
+    std::sort(funded_scratch_.begin(), funded_scratch_.end());
+    funded_scratch_.erase(
+            std::unique(funded_scratch_.begin(), funded_scratch_.end()), funded_scratch_.end());
+    if (all_funded_nodes_.size() > funded_scratch_.size()) {
+        for (auto it = all_funded_nodes_.begin(); it != all_funded_nodes_.end(); ) {
+            if (std::binary_search(funded_scratch_.begin(), funded_scratch_.end(), it->first)) {
+                ++it;
+                continue;
+            }
+            const auto& [pk, sn] = *it;
+            OXEN_LOG(debug, "Removing deregistered SN {}", pk);
+            erase_key_mapping(all_funded_ed25519_, sn.pubkey_ed25519, pk);
+            erase_key_mapping(all_funded_x25519_, sn.pubkey_x25519, pk);
+            it = all_funded_nodes_.erase(it);
         }
     }
+}
+
+template <typename PubKey>
+void Swarm::erase_key_mapping(
+        std::unordered_map<PubKey, legacy_pubkey>& map,
+        const PubKey& key,
+        const legacy_pubkey& pk) {
+    if (auto it = map.find(key); it != map.end() && it->second == pk)
+        map.erase(it);
+}
 
-    for (const auto& sn : decommissioned) {
-        all_funded_nodes_.emplace(sn.pubkey_legacy, sn);
+void Swarm::update_funded_node(const sn_record& sn) {
+    funded_scratch_.push_back(sn.pubkey_legacy);
+
+    auto [it, inserted] = all_funded_nodes_.try_emplace(sn.pubkey_legacy, sn);
+    auto& cur = it->second;
+    // Secondary keys are assigned (rather than emplaced) because a key can move from one node to
+    // another within a single update: if the new owner is processed first then the old owner's
+    // mapping is still present, and gets left alone below because it no longer points at the old
+    // owner (see erase_key_mapping).
+    if (inserted) {
+        // Nodes with not-yet-known (null) secondary keys are only reachable by legacy pubkey
+        if (cur.pubkey_ed25519)
+            all_funded_ed25519_[cur.pubkey_ed25519] = cur.pubkey_legacy;
+        if (cur.pubkey_x25519)
+            all_funded_x25519_[cur.pubkey_x25519] = cur.pubkey_legacy;
+        return;
     }
 
-    for (const auto& [pk, sn] : all_funded_nodes_) {
-        all_funded_ed25519_.emplace(sn.pubkey_ed25519, pk);
-        all_funded_x25519_.emplace(sn.pubkey_x25519, pk);
+    if (cur.pubkey_ed25519 != sn.pubkey_ed25519) {
+        erase_key_mapping(all_funded_ed25519_, cur.pubkey_ed25519, cur.pubkey_legacy);
+        cur.pubkey_ed25519 = sn.pubkey_ed25519;
+        if (cur.pubkey_ed25519)
+            all_funded_ed25519_[cur.pubkey_ed25519] = cur.pubkey_legacy;
+    }
+    if (cur.pubkey_x25519 != sn.pubkey_x25519) {
+        erase_key_mapping(all_funded_x25519_, cur.pubkey_x25519, cur.pubkey_legacy);
+        cur.pubkey_x25519 = sn.pubkey_x25519;
+        if (cur.pubkey_x25519)
+            all_funded_x25519_[cur.pubkey_x25519] = cur.pubkey_legacy;
     }
+    cur.ip = sn.ip;
+    cur.port = sn.port;
+    cur.omq_port = sn.omq_port;
 }
 
 std::optional<sn_record>
@@ -266,22 +391,6 @@ Swarm::find_node(const x25519_pubkey& pk) const {
     return std::nullopt;
 }
 
-uint64_t pubkey_to_swarm_space(const user_pubkey_t& pk) {
-
-    const auto bytes = pk.raw();
-    assert(bytes.size() == 32);
-
-    uint64_t res = 0;
-    for (size_t i = 0; i < 4; i++) {
-        uint64_t buf;
-        std::memcpy(&buf, bytes.data() + i*8, 8);
-        res ^= buf;
-    }
-    boost::endian::big_to_native_inplace(res);
-
-    return res;
-}
-
 bool Swarm::is_pubkey_for_us(const user_pubkey_t& pk) const {
 
     /// TODO: Make sure no exceptions bubble up from here!
@@ -290,6 +399,13 @@ bool Swarm::is_pubkey_for_us(const user_pubkey_t& pk) const {
 
 static const SwarmInfo null_swarm{INVALID_SWARM_ID, {}};
 
+std::shared_ptr<const swarm_description> Swarm::description(swarm_id_t sid) const {
+    if (auto it = descriptions_.find(sid); it != descriptions_.end())
+        return it->second;
+    static const auto null_description = std::make_shared<const swarm_description>(null_swarm);
+    return null_description;
+}
+
 const SwarmInfo& get_swarm_by_pk(
         const std::vector<SwarmInfo>& all_swarms,
         const user_pubkey_t& pk) {
@@ -354,6 +470,43 @@ const SwarmInfo& get_swarm_by_pk(
     return *cur_best;
 }
 
+std::vector<std::pair<uint64_t, uint64_t>> swarm_space_ranges(
+        const std::vector<SwarmInfo>& all_swarms,
+        swarm_id_t swarm_id) {
+
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+    if (swarm_id == INVALID_SWARM_ID)
+        return ranges;
+
+    std::vector<swarm_id_t> ids;
+    ids.reserve(all_swarms.size());
+    for (const auto& si : all_swarms)
+        if (si.swarm_id != INVALID_SWARM_ID)
+            ids.push_back(si.swarm_id);
+    std::sort(ids.begin(), ids.end());
+
+    auto it = std::lower_bound(ids.begin(), ids.end(), swarm_id);
+    if (it == ids.end() || *it != swarm_id)
+        return ranges;
+
+    const bool leftmost = it == ids.begin(), rightmost = std::next(it) == ids.end();
+
+    // Everything up to (and including) the midpoints between us and our neighbours
+    uint64_t lo = leftmost ? 0 : *std::prev(it) + (swarm_id - *std::prev(it)) / 2;
+    uint64_t hi = rightmost ? UINT64_MAX : swarm_id + (*std::next(it) - swarm_id + 1) / 2;
+    ranges.emplace_back(lo, hi);
+
+    // The space beyond the rightmost swarm wraps around to the leftmost swarm, so the edge swarms
+    // also pick up the space past the opposite end (unless there is only one swarm, in which case
+    // we already cover everything).
+    if (leftmost && !rightmost)
+        ranges.emplace_back(ids.back(), UINT64_MAX);
+    else if (rightmost && !leftmost)
+        ranges.emplace_back(0, ids.front());
+
+    return ranges;
+}
+
 std::pair<int, int> count_missing_data(const block_update& bu) {
     auto result = std::make_pair(0, 0);
     auto& [missing, total] = result;
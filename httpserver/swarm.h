@@ -1,6 +1,8 @@
 #pragma once
 
 #include <iostream>
+#include <memory>
+#include <nlohmann/json.hpp>
 #include <oxenmq/auth.h>
 #include <string>
 #include <unordered_map>
@@ -18,6 +20,20 @@ struct SwarmInfo {
     std::vector<sn_record> snodes;
 };
 
+/// The description of a swarm that we give to clients (in get_swarm replies and wrong-swarm
+/// responses), serialized ahead of time so that answering a client only requires adding the current
+/// timestamp.  Descriptions are built when the swarm list changes, and only for swarms that changed.
+struct swarm_description {
+    explicit swarm_description(SwarmInfo swarm);
+
+    SwarmInfo swarm;
+    /// {"snodes": [...], "swarm": "<hex id>"}; the client-facing value also includes "t"
+    nlohmann::json json;
+    /// The bt-encoded equivalent of `json` (with the same string values) but without the dict's
+    /// closing "e", so that "1:t" (which sorts last) and the closing "e" can be appended.
+    std::string bt_prefix;
+};
+
 struct block_update {
     std::vector<SwarmInfo> swarms;
     std::vector<sn_record> decommissioned_nodes;
@@ -50,9 +66,14 @@ std::vector<SwarmInfo> apply_ips(
         const std::vector<SwarmInfo>& swarms_to_keep,
         const std::vector<SwarmInfo>& other_swarms);
 
-/// Maps a pubkey into a 64-bit "swarm space" value; the swarm you belong to is whichever one has a
-/// swarm id closest to this pubkey-derived value.
-uint64_t pubkey_to_swarm_space(const user_pubkey_t& pk);
+/// Returns the (inclusive) swarm space ranges that can contain pubkeys belonging to swarm
+/// `swarm_id`; see `pubkey_to_swarm_space`.  The ranges are a superset of the swarm's actual
+/// space (boundary values and the wrap-around space between the last and first swarm are included
+/// for both neighbours) and so callers must still confirm the swarm of any pubkeys in the range
+/// with `get_swarm_by_pk`.  Returns an empty vector if `swarm_id` is not in `all_swarms`.
+std::vector<std::pair<uint64_t, uint64_t>> swarm_space_ranges(
+        const std::vector<SwarmInfo>& all_swarms,
+        swarm_id_t swarm_id);
 
 struct SwarmEvents {
 
@@ -80,6 +101,26 @@ class Swarm {
     std::unordered_map<legacy_pubkey, sn_record> all_funded_nodes_;
     std::unordered_map<ed25519_pubkey, legacy_pubkey> all_funded_ed25519_;
     std::unordered_map<x25519_pubkey, legacy_pubkey> all_funded_x25519_;
+    /// Scratch space used during `update_state` to track which funded nodes were seen in the
+    /// latest update; kept as a member so that we don't reallocate it on every block.
+    std::vector<legacy_pubkey> funded_scratch_;
+    /// Client-facing descriptions of each of `all_valid_swarms_`
+    std::unordered_map<swarm_id_t, std::shared_ptr<const swarm_description>> descriptions_;
+
+    /// Rebuilds the descriptions of any swarms in `all_valid_swarms_` that changed since the last
+    /// call, and drops those of swarms that no longer exist.
+    void update_descriptions();
+
+    /// Inserts a funded node, or updates an existing record (and its secondary key mappings) in
+    /// place if it already exists.
+    void update_funded_node(const sn_record& sn);
+
+    /// Removes `key` from `map` if (and only if) it currently maps to `pk`.
+    template <typename PubKey>
+    static void erase_key_mapping(
+            std::unordered_map<PubKey, legacy_pubkey>& map,
+            const PubKey& key,
+            const legacy_pubkey& pk);
 
     /// Check if `sid` is an existing (active) swarm
     bool is_existing_swarm(swarm_id_t sid) const;
@@ -112,6 +153,10 @@ class Swarm {
 
     swarm_id_t our_swarm_id() const { return cur_swarm_id_; }
 
+    /// Returns the pre-serialized description of the given swarm; if there is no such swarm this
+    /// returns the description of an empty swarm with id INVALID_SWARM_ID.
+    std::shared_ptr<const swarm_description> description(swarm_id_t sid) const;
+
     bool is_valid() const { return cur_swarm_id_ != INVALID_SWARM_ID; }
 
     void set_swarm_id(swarm_id_t sid);
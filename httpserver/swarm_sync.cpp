@@ -0,0 +1,155 @@
+#include "swarm_sync.h"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <unordered_set>
+
+#include <oxenmq/bt_serialize.h>
+#include <sodium/crypto_generichash.h>
+
+namespace oxen::swarm_sync {
+
+namespace {
+
+using digest_t = std::array<unsigned char, DIGEST_SIZE>;
+
+digest_t hash_digest(std::string_view hash) {
+    digest_t d;
+    crypto_generichash(d.data(), d.size(),
+            reinterpret_cast<const unsigned char*>(hash.data()), hash.size(), nullptr, 0);
+    return d;
+}
+
+// Bucket selection has to agree between nodes, so we read the digest as a big-endian integer
+// rather than in native byte order.
+size_t bucket_of(const digest_t& d, size_t buckets) {
+    uint64_t x = 0;
+    for (size_t i = 0; i < 8; i++)
+        x = x << 8 | d[i];
+    return x % buckets;
+}
+
+// Computes the digests of `hashes` into `digests` (which must already be sized for `buckets`
+// buckets) and returns the bucket of each hash.
+std::vector<size_t> compute_digests(
+        const std::vector<std::string>& hashes, size_t buckets, std::string& digests) {
+    std::vector<size_t> hash_buckets;
+    hash_buckets.reserve(hashes.size());
+    for (auto& h : hashes) {
+        auto d = hash_digest(h);
+        auto b = hash_buckets.emplace_back(bucket_of(d, buckets));
+        auto* out = &digests[b * DIGEST_SIZE];
+        for (size_t i = 0; i < DIGEST_SIZE; i++)
+            out[i] ^= static_cast<char>(d[i]);
+    }
+    return hash_buckets;
+}
+
+} // anon. namespace
+
+size_t bucket_count(size_t num_messages) {
+    return std::clamp(num_messages / MESSAGES_PER_BUCKET, MIN_BUCKETS, MAX_BUCKETS);
+}
+
+std::string make_digests(const std::vector<std::string>& hashes, size_t buckets) {
+    std::string digests(buckets * DIGEST_SIZE, '\0');
+    compute_digests(hashes, buckets, digests);
+    return digests;
+}
+
+std::string make_request(const std::vector<std::string>& hashes) {
+    auto buckets = bucket_count(hashes.size());
+    return oxenmq::bt_serialize(oxenmq::bt_dict{
+            {"b", buckets},
+            {"d", make_digests(hashes, buckets)}});
+}
+
+std::string make_reply(std::string_view request, const std::vector<std::string>& hashes) {
+    size_t buckets;
+    std::string_view peer_digests;
+    try {
+        oxenmq::bt_dict_consumer req{request};
+        if (!req.skip_until("b"))
+            throw std::invalid_argument{"missing bucket count"};
+        buckets = req.consume_integer<size_t>();
+        if (!req.skip_until("d"))
+            throw std::invalid_argument{"missing digests"};
+        peer_digests = req.consume_string_view();
+    } catch (const std::exception& e) {
+        throw std::invalid_argument{std::string{"invalid sync request: "} + e.what()};
+    }
+    if (buckets < MIN_BUCKETS || buckets > MAX_BUCKETS)
+        throw std::invalid_argument{"invalid sync request: bad bucket count"};
+    if (peer_digests.size() != buckets * DIGEST_SIZE)
+        throw std::invalid_argument{"invalid sync request: digests have the wrong size"};
+
+    std::string digests(buckets * DIGEST_SIZE, '\0');
+    auto hash_buckets = compute_digests(hashes, buckets, digests);
+
+    // Maps bucket number to position in `differing` for buckets that don't match
+    std::vector<int> diff_pos(buckets, -1);
+    oxenmq::bt_list differing;
+    std::vector<oxenmq::bt_list> diff_hashes;
+    for (size_t b = 0; b < buckets; b++) {
+        if (peer_digests.substr(b * DIGEST_SIZE, DIGEST_SIZE) !=
+                std::string_view{digests}.substr(b * DIGEST_SIZE, DIGEST_SIZE)) {
+            diff_pos[b] = diff_hashes.size();
+            differing.push_back(b);
+            diff_hashes.emplace_back();
+        }
+    }
+
+    for (size_t i = 0; i < hashes.size(); i++)
+        if (int pos = diff_pos[hash_buckets[i]]; pos >= 0)
+            diff_hashes[pos].push_back(hashes[i]);
+
+    oxenmq::bt_list hash_lists;
+    for (auto& l : diff_hashes)
+        hash_lists.push_back(std::move(l));
+
+    return oxenmq::bt_serialize(oxenmq::bt_dict{
+            {"b", std::move(differing)},
+            {"h", std::move(hash_lists)},
+            {"n", buckets}});
+}
+
+std::vector<std::string> missing_hashes(std::string_view reply, const std::vector<std::string>& hashes) {
+    std::vector<size_t> differing;
+    std::unordered_set<std::string_view> peer_hashes;
+    size_t buckets;
+    try {
+        oxenmq::bt_dict_consumer r{reply};
+        if (!r.skip_until("b"))
+            throw std::invalid_argument{"missing differing buckets"};
+        for (auto l = r.consume_list_consumer(); !l.is_finished(); )
+            differing.push_back(l.consume_integer<size_t>());
+        if (!r.skip_until("h"))
+            throw std::invalid_argument{"missing hashes"};
+        for (auto l = r.consume_list_consumer(); !l.is_finished(); )
+            for (auto hl = l.consume_list_consumer(); !hl.is_finished(); )
+                peer_hashes.insert(hl.consume_string_view());
+        if (!r.skip_until("n"))
+            throw std::invalid_argument{"missing bucket count"};
+        buckets = r.consume_integer<size_t>();
+    } catch (const std::exception& e) {
+        throw std::invalid_argument{std::string{"invalid sync reply: "} + e.what()};
+    }
+    if (buckets < MIN_BUCKETS || buckets > MAX_BUCKETS)
+        throw std::invalid_argument{"invalid sync reply: bad bucket count"};
+
+    std::vector<bool> is_differing(buckets, false);
+    for (auto b : differing) {
+        if (b >= buckets)
+            throw std::invalid_argument{"invalid sync reply: bad bucket number"};
+        is_differing[b] = true;
+    }
+
+    std::vector<std::string> missing;
+    for (auto& h : hashes)
+        if (is_differing[bucket_of(hash_digest(h), buckets)] && !peer_hashes.count(h))
+            missing.push_back(h);
+    return missing;
+}
+
+} // namespace oxen::swarm_sync
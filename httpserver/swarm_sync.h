@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Digest-based reconciliation of the messages held by two members of the same swarm.
+//
+// The initiator sends its bucketed hash digests (`make_request`); the peer compares them against
+// its own and replies with the buckets that differ along with the message hashes it holds in each
+// of those buckets (`make_reply`); the initiator then works out which of its messages the peer is
+// missing (`missing_hashes`) and pushes just those.  The amount of data exchanged is thus
+// proportional to the difference between the two nodes rather than to the total amount stored.
+namespace oxen::swarm_sync {
+
+// The number of digest buckets is chosen by the initiator as roughly one bucket per this many
+// messages, clamped to [MIN_BUCKETS, MAX_BUCKETS].
+inline constexpr size_t MESSAGES_PER_BUCKET = 16;
+inline constexpr size_t MIN_BUCKETS = 16;
+inline constexpr size_t MAX_BUCKETS = 65536;
+
+// Size of each bucket digest, in bytes.
+inline constexpr size_t DIGEST_SIZE = 16;
+
+// Returns the number of buckets to use for the given number of messages.
+size_t bucket_count(size_t num_messages);
+
+// Returns the concatenated (buckets * DIGEST_SIZE bytes) digests of the given message hashes.
+// Each bucket digest is the XOR of the digests of the hashes that fall into it, so the order of
+// `hashes` does not matter.
+std::string make_digests(const std::vector<std::string>& hashes, size_t buckets);
+
+// Builds a (bt-encoded) sync request containing the digests of the given message hashes.
+std::string make_request(const std::vector<std::string>& hashes);
+
+// Handles a sync request from a peer: compares the request digests with those of our own `hashes`
+// and returns the (bt-encoded) reply listing the differing buckets and the hashes we hold in each.
+// Throws std::invalid_argument if the request is not valid.
+std::string make_reply(std::string_view request, const std::vector<std::string>& hashes);
+
+// Handles the reply to a sync request that we made: returns the subset of `hashes` (which should
+// be the same hashes used to make the request) that the peer does not have.  Throws
+// std::invalid_argument if the reply is not valid.
+std::vector<std::string> missing_hashes(std::string_view reply, const std::vector<std::string>& hashes);
+
+} // namespace oxen::swarm_sync
@@ -0,0 +1,151 @@
+#include "worker_pool.h"
+#include "oxen_logger.h"
+
+#include <algorithm>
+#include <exception>
+
+namespace oxen {
+
+using ms = std::chrono::duration<double, std::milli>;
+
+void queue_stats::queued() {
+    std::lock_guard lock{mutex_};
+    stats_.depth++;
+    stats_.max_depth = std::max(stats_.max_depth, stats_.depth);
+}
+
+void queue_stats::started(std::chrono::steady_clock::duration waited) {
+    const double wait = ms{waited}.count();
+    std::lock_guard lock{mutex_};
+    stats_.depth--;
+    stats_.wait_avg_ms = stats_.jobs == 0
+        ? wait
+        : stats_.wait_avg_ms + WAIT_AVG_WEIGHT * (wait - stats_.wait_avg_ms);
+    stats_.wait_max_ms = std::max(stats_.wait_max_ms, wait);
+    stats_.jobs++;
+}
+
+void queue_stats::dropped() {
+    std::lock_guard lock{mutex_};
+    stats_.depth--;
+    stats_.dropped++;
+}
+
+queue_stats_snapshot queue_stats::get() const {
+    std::lock_guard lock{mutex_};
+    return stats_;
+}
+
+worker_pool::worker_pool(
+        std::string name,
+        int min_threads,
+        int max_threads,
+        size_t max_queue,
+        clock::duration target_wait,
+        clock::duration idle_timeout) :
+    name_{std::move(name)},
+    min_threads_{static_cast<size_t>(std::max(min_threads, 1))},
+    max_threads_{std::max(min_threads_, static_cast<size_t>(std::max(max_threads, 1)))},
+    max_queue_{max_queue},
+    target_wait_{target_wait},
+    idle_timeout_{idle_timeout}
+{
+    std::lock_guard lock{mutex_};
+    for (size_t i = 0; i < min_threads_; i++)
+        spawn();
+}
+
+worker_pool::~worker_pool() {
+    std::unique_lock lock{mutex_};
+    stopping_ = true;
+    cv_.notify_all();
+    cv_.wait(lock, [this] { return threads_.empty(); });
+    auto finished = std::move(finished_);
+    auto abandoned = std::move(queue_);
+    lock.unlock();
+
+    for (auto& t : finished)
+        t.join();
+    for (size_t i = 0; i < abandoned.size(); i++)
+        stats_.dropped();
+}
+
+bool worker_pool::submit(std::function<void()> job) {
+    std::unique_lock lock{mutex_};
+    if (queue_.size() >= max_queue_) {
+        lock.unlock();
+        stats_.queued();
+        stats_.dropped();
+        return false;
+    }
+    auto now = clock::now();
+    // Don't wait for a thread to come free before noticing that the oldest job has been stuck
+    // behind busy threads for too long.
+    if (!queue_.empty() && idle_ == 0 && threads_.size() < max_threads_ &&
+            now - queue_.front().first > target_wait_)
+        spawn();
+    queue_.emplace_back(now, std::move(job));
+    stats_.queued();
+    cv_.notify_one();
+    return true;
+}
+
+int worker_pool::threads() const {
+    std::lock_guard lock{mutex_};
+    return static_cast<int>(threads_.size());
+}
+
+// Must be called with the mutex held.
+void worker_pool::spawn() {
+    join_finished();
+    auto it = threads_.emplace(threads_.end());
+    *it = std::thread{[this, it] { work(it); }};
+    OXEN_LOG(debug, "{} worker pool now has {} threads", name_, threads_.size());
+}
+
+// Must be called with the mutex held.  (The finished threads only ever get moved into finished_
+// holding the lock, as the very last thing they do, so joining them here can't deadlock).
+void worker_pool::join_finished() {
+    for (auto& t : finished_)
+        t.join();
+    finished_.clear();
+}
+
+void worker_pool::work(std::list<std::thread>::iterator self) {
+    std::unique_lock lock{mutex_};
+    while (!stopping_) {
+        if (queue_.empty()) {
+            idle_++;
+            bool woken = cv_.wait_for(lock, idle_timeout_,
+                    [this] { return stopping_ || !queue_.empty(); });
+            idle_--;
+            if (!woken && threads_.size() > min_threads_)
+                break;
+            continue;
+        }
+
+        auto [queued_at, job] = std::move(queue_.front());
+        queue_.pop_front();
+        auto waited = clock::now() - queued_at;
+        stats_.started(waited);
+        // We're about to be busy too; if the job waited too long then we need more threads.
+        if (waited > target_wait_ && idle_ == 0 && threads_.size() < max_threads_)
+            spawn();
+
+        lock.unlock();
+        try {
+            job();
+        } catch (const std::exception& e) {
+            OXEN_LOG(err, "Uncaught exception in {} worker job: {}", name_, e.what());
+        }
+        job = nullptr;
+        lock.lock();
+    }
+
+    finished_.splice(finished_.end(), threads_, self);
+    if (!stopping_)
+        OXEN_LOG(debug, "{} worker pool shrank to {} threads", name_, threads_.size());
+    cv_.notify_all();
+}
+
+} // namespace oxen
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace oxen {
+
+using namespace std::literals;
+
+// An adaptive worker pool starts another thread (up to its maximum) when a job has had to wait
+// longer than this in the queue while every thread was busy...
+inline constexpr auto ADAPTIVE_TARGET_WAIT = 20ms;
+
+// ... and a thread above the pool's minimum exits once it has been idle for this long.
+inline constexpr auto ADAPTIVE_IDLE_TIMEOUT = 10s;
+
+struct queue_stats_snapshot {
+    int64_t depth = 0;         // jobs currently waiting to start
+    int64_t max_depth = 0;     // most jobs ever waiting at once
+    uint64_t jobs = 0;         // jobs started
+    uint64_t dropped = 0;      // jobs dropped without being started (e.g. because the queue was full)
+    double wait_avg_ms = 0;    // moving average of how long jobs waited before starting
+    double wait_max_ms = 0;    // longest time any job waited before starting
+};
+
+/// Thread-safe queue depth and wait time statistics for a job queue.
+class queue_stats {
+  public:
+    // Weight of the latest wait time in the moving average
+    inline static constexpr double WAIT_AVG_WEIGHT = 0.05;
+
+    /// Records a job being added to the queue
+    void queued();
+
+    /// Records a queued job starting after waiting for `waited`
+    void started(std::chrono::steady_clock::duration waited);
+
+    /// Records a queued job being dropped without ever being started
+    void dropped();
+
+    queue_stats_snapshot get() const;
+
+  private:
+    mutable std::mutex mutex_;
+    queue_stats_snapshot stats_;
+};
+
+/// A pool of worker threads with its own job queue that sizes itself to the load: it keeps at
+/// least `min_threads` threads, starts more (up to `max_threads`) when queued jobs wait longer than
+/// ADAPTIVE_TARGET_WAIT with every thread busy, and lets the extra threads exit again once they
+/// have been idle for ADAPTIVE_IDLE_TIMEOUT.
+///
+/// This exists because OxenMQ's worker counts are fixed once it has started, so we can't grow or
+/// shrink an OxenMQ category to match the load.
+class worker_pool {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    worker_pool(
+            std::string name,
+            int min_threads,
+            int max_threads,
+            size_t max_queue,
+            clock::duration target_wait = ADAPTIVE_TARGET_WAIT,
+            clock::duration idle_timeout = ADAPTIVE_IDLE_TIMEOUT);
+
+    /// Stops and joins the worker threads.  Jobs still in the queue are destroyed without being
+    /// run; jobs already running are finished first.
+    ~worker_pool();
+
+    worker_pool(const worker_pool&) = delete;
+    worker_pool& operator=(const worker_pool&) = delete;
+
+    /// Adds a job to the queue.  Returns false (and destroys the job without running it) if the
+    /// queue already holds `max_queue` jobs.
+    bool submit(std::function<void()> job);
+
+    /// Current number of worker threads
+    int threads() const;
+
+    queue_stats_snapshot stats() const { return stats_.get(); }
+
+  private:
+    void spawn();
+    void work(std::list<std::thread>::iterator self);
+    void join_finished();
+
+    const std::string name_;
+    const size_t min_threads_, max_threads_, max_queue_;
+    const clock::duration target_wait_, idle_timeout_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::pair<clock::time_point, std::function<void()>>> queue_;
+    // Running worker threads, and ones that have exited (after shrinking) but not been joined yet
+    std::list<std::thread> threads_, finished_;
+    size_t idle_ = 0;
+    bool stopping_ = false;
+
+    queue_stats stats_;
+};
+
+} // namespace oxen
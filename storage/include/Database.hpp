@@ -8,6 +8,7 @@
 #include <memory>
 #include <optional>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace oxen {
@@ -25,6 +26,11 @@ class Database {
 
     inline static constexpr int64_t SIZE_LIMIT = int64_t(3584) * 1024 * 1024; // 3.5 GB
 
+    // Maximum number of owners for which we keep track of the newest message in memory, so that
+    // retrieve() can answer "nothing new" without querying the database.  Owners beyond this (or
+    // that we haven't seen yet) just go to the database.
+    inline static constexpr size_t WATERMARK_CACHE_SIZE = 100'000;
+
     // Constructor.  Note that you *must* also set up a timer that runs periodically (every
     // CLEANUP_PERIOD is recommended) and calls clean_expired().
     explicit Database(const std::filesystem::path& db_path);
@@ -40,14 +46,26 @@ class Database {
     // 
     // This means `if (db.store(...))` will be true if inserted *or* already present; to check only
     // for insertion use `ins && *ins`.
-    std::optional<bool> store(const message& msg);
+    //
+    // Takes a message_view (typically pointing into the client request) so that the message data
+    // gets bound directly, without copying.
+    std::optional<bool> store(const message_view& msg);
+
+    // Stores multiple messages in a single transaction, silently skipping any that already exist.
+    // Returns a vector of the same size as `items` indicating which were newly inserted.
+    std::vector<bool> bulk_store(const std::vector<message>& items);
 
-    void bulk_store(const std::vector<message>& items);
+    // Same as above, but takes message views (e.g. pointing into a received push batch) so that
+    // message data gets bound directly, without copying.
+    std::vector<bool> bulk_store(const std::vector<message_view>& items);
 
     // Retrieves messages owned by pubkey received since `last_hash` (which must also be owned by
     // pubkey).  If last_hash is empty or not found then returns all messages (up to the limit).
     // Optionally takes a maximum number of messages to return.
     //
+    // When last_hash is known to be the owner's newest message (or the owner is known to have no
+    // messages) this returns an empty result without querying the database.
+    //
     // Note that the `pubkey` value of the returned message's will be left default constructed,
     // i.e. *not* filled with the given pubkey.
     std::vector<message> retrieve(
@@ -58,6 +76,15 @@ class Database {
     // Retrieves all messages.
     std::vector<message> retrieve_all();
 
+    // Retrieves all messages whose owner pubkeys map into the given (inclusive) range of swarm space
+    // values (see `pubkey_to_swarm_space`).  Used to find the messages belonging to a swarm without
+    // having to load everything.
+    std::vector<message> retrieve_swarm_space_range(uint64_t begin, uint64_t end);
+
+    // Same as above, but only retrieves the owner pubkey and message hash of each message.
+    std::vector<std::pair<user_pubkey_t, std::string>> retrieve_hashes_swarm_space_range(
+            uint64_t begin, uint64_t end);
+
     // Return the total number of messages stored
     int64_t get_message_count();
 
@@ -67,12 +94,25 @@ class Database {
     // Returns the number of used bytes (i.e. used pages * page size) of the database
     int64_t get_used_bytes();
 
+    struct retrieve_stats {
+        uint64_t fast = 0;     // retrieve() calls answered from memory
+        uint64_t db = 0;       // retrieve() calls that queried the database
+        size_t watermarks = 0; // owners whose newest message we are currently tracking
+    };
+
+    // Returns counts of how retrieve() requests have been answered.
+    retrieve_stats get_retrieve_stats();
+
     // Get random message. Returns nullopt if there are no messages.
     std::optional<message> retrieve_random();
 
     // Get message by `msg_hash`, return true if found.  Note that this does *not* filter by pubkey!
     std::optional<message> retrieve_by_hash(const std::string& msg_hash);
 
+    // Gets the messages with any of the given hashes, in no particular order; hashes we don't have
+    // are skipped.  Like retrieve_by_hash, this does *not* filter by pubkey.
+    std::vector<message> retrieve_by_hashes(const std::vector<std::string>& msg_hashes);
+
     // Removes expired messages from the database; the `Database` instance owner should call this
     // periodically.
     void clean_expired();
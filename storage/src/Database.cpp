@@ -6,9 +6,13 @@
 #include "time.hpp"
 #include "utils.hpp"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <cstdlib>
 #include <exception>
+#include <mutex>
 #include <shared_mutex>
 #include <thread>
 #include <unordered_set>
@@ -41,14 +45,25 @@ void bind_blob_ref(SQLite::Statement& st, int i, std::string_view blob) {
     st.bindNoCopy(i, static_cast<const void*>(blob.data()), blob.size());
 }
 
+// Binds a string_view as no-copy text at parameter index i.  (SQLiteCpp's bindNoCopy only takes
+// null-terminated text, so we go to sqlite directly for this one).
+void bind_text_ref(SQLite::Statement& st, int i, std::string_view text) {
+    auto* stmt = st.getStatement();
+    if (int rc = sqlite3_bind_text(stmt, i, text.data(), static_cast<int>(text.size()), SQLITE_STATIC);
+            rc != SQLITE_OK)
+        throw SQLite::Exception{sqlite3_db_handle(stmt), rc};
+}
+
 // Called from exec_query and similar to bind statement parameters for immediate execution.  strings
-// (and c strings) use no-copy binding; user_pubkey_t values use *two* sequential binding slots for
-// pubkey (first) and type (second); integer values are bound by value.  You can bind a blob (by
-// reference, like strings) by passing `blob_binder{data}`.
+// (and c strings) and string_views use no-copy text binding; user_pubkey_t values use *two*
+// sequential binding slots for pubkey (first) and type (second); integer values are bound by
+// value.  You can bind a blob (by reference, like strings) by passing `blob_binder{data}`.
 template <typename T>
 void bind_oneshot(SQLite::Statement& st, int& i, const T& val) {
     if constexpr (std::is_same_v<T, std::string> || is_cstr<T>)
         st.bindNoCopy(i++, val);
+    else if constexpr (std::is_same_v<T, std::string_view>)
+        bind_text_ref(st, i++, val);
     else if constexpr (std::is_same_v<T, blob_binder>)
         bind_blob_ref(st, i++, val.data);
     else if constexpr (std::is_same_v<T, user_pubkey_t>) {
@@ -146,6 +161,150 @@ std::vector<type_or_tuple<T...>> get_all(SQLite::Statement& st, const Bind&... b
     return results;
 }
 
+// Swarm space values are unsigned 64-bit integers, but sqlite only has signed integers.  We flip the
+// top bit when storing them so that the signed order of stored values matches the unsigned swarm
+// space order, which lets us use indexed range queries on them.
+int64_t to_db_swarm_space(uint64_t s) {
+    return static_cast<int64_t>(s ^ (uint64_t{1} << 63));
+}
+
+// The owned_messages view and its insert trigger; these get (re)created both on initial schema
+// creation and when migrating the owners table.
+constexpr auto owned_messages_view = R"(
+CREATE VIEW owned_messages AS
+    SELECT owners.id AS oid, type, pubkey, swarm_space, messages.id AS mid, hash, timestamp, expiry, data
+    FROM messages JOIN owners ON messages.owner = owners.id;
+
+CREATE TRIGGER owned_messages_insert
+    INSTEAD OF INSERT ON owned_messages FOR EACH ROW WHEN NEW.oid IS NULL
+    BEGIN
+        INSERT INTO owners (type, pubkey, swarm_space) VALUES (NEW.type, NEW.pubkey, NEW.swarm_space)
+            ON CONFLICT DO NOTHING;
+        INSERT INTO messages values (
+            NEW.mid,
+            NEW.hash,
+            (SELECT id FROM owners WHERE type = NEW.type AND pubkey = NEW.pubkey),
+            NEW.timestamp,
+            NEW.expiry,
+            NEW.data);
+    END;
+)";
+
+// In-memory index of the newest message of each owner, used to answer the very common "anything new
+// since `last_hash`?" retrieve with "no" without touching the database.  An entry with an empty
+// hash means the owner has no messages at all.
+//
+// Entries are filled in when we store a message and when a retrieve has to go to the database, and
+// are dropped whenever something removes messages for (or changes expiries of) the owner.  Because
+// a retrieve reads the database before it fills in the entry, each shard keeps a generation counter
+// that every change bumps: an entry loaded from the database is only kept if nothing changed in
+// the shard while it was being loaded.
+class OwnerWatermarks {
+  public:
+    struct watermark {
+        std::string hash;
+        int64_t expiry = 0;
+    };
+
+    // Returns true if we know, without asking the database, that `pubkey` has nothing newer than
+    // `last_hash`.
+    bool up_to_date(const user_pubkey_t& pubkey, const std::string& last_hash, int64_t now_ms) {
+        auto& s = get_shard(pubkey);
+        std::lock_guard lock{s.mutex};
+        auto it = s.entries.find(pubkey);
+        if (it == s.entries.end())
+            return false;
+        auto& w = it->second;
+        // If the newest message has expired then it may already be gone from the database, in which
+        // case last_hash isn't found and the retrieve returns everything, so we can't answer that.
+        return w.hash.empty() || (w.hash == last_hash && w.expiry > now_ms);
+    }
+
+    // Returns the current generation for the shard containing `pubkey`; this must be obtained
+    // before reading the database for a later `load()`.
+    uint64_t generation(const user_pubkey_t& pubkey) {
+        auto& s = get_shard(pubkey);
+        std::lock_guard lock{s.mutex};
+        return s.generation;
+    }
+
+    // Records a watermark read from the database, as long as nothing has changed in the shard since
+    // `gen` was obtained from `generation()`.
+    void load(const user_pubkey_t& pubkey, uint64_t gen, watermark w) {
+        auto& s = get_shard(pubkey);
+        std::lock_guard lock{s.mutex};
+        if (s.generation == gen)
+            s.insert(pubkey, std::move(w));
+    }
+
+    // Records a newly stored message, which is now the newest message of its owner.
+    void stored(const user_pubkey_t& pubkey, std::string_view hash, int64_t expiry) {
+        auto& s = get_shard(pubkey);
+        std::lock_guard lock{s.mutex};
+        s.generation++;
+        s.insert(pubkey, {std::string{hash}, expiry});
+    }
+
+    // Forgets the watermark of an owner whose messages were deleted or had their expiries changed.
+    void invalidate(const user_pubkey_t& pubkey) {
+        auto& s = get_shard(pubkey);
+        std::lock_guard lock{s.mutex};
+        s.generation++;
+        s.entries.erase(pubkey);
+    }
+
+    // Drops entries whose newest message has expired.  (Such entries are never used to answer a
+    // retrieve, so this is just to free up the space).
+    void expire(int64_t now_ms) {
+        for (auto& s : shards_) {
+            std::lock_guard lock{s.mutex};
+            for (auto it = s.entries.begin(); it != s.entries.end(); ) {
+                if (!it->second.hash.empty() && it->second.expiry <= now_ms)
+                    it = s.entries.erase(it);
+                else
+                    ++it;
+            }
+        }
+    }
+
+    size_t size() {
+        size_t n = 0;
+        for (auto& s : shards_) {
+            std::lock_guard lock{s.mutex};
+            n += s.entries.size();
+        }
+        return n;
+    }
+
+  private:
+    static constexpr size_t SHARDS = 64;
+    static constexpr size_t SHARD_CAPACITY = Database::WATERMARK_CACHE_SIZE / SHARDS;
+
+    struct shard {
+        std::mutex mutex;
+        std::unordered_map<user_pubkey_t, watermark> entries;
+        uint64_t generation = 0;
+
+        void insert(const user_pubkey_t& pubkey, watermark w) {
+            auto it = entries.find(pubkey);
+            if (it != entries.end()) {
+                it->second = std::move(w);
+                return;
+            }
+            // When full we evict an arbitrary entry; its owner just falls back to the database
+            // until the next store or retrieve reloads it.
+            if (entries.size() >= SHARD_CAPACITY)
+                entries.erase(entries.begin());
+            entries.emplace(pubkey, std::move(w));
+        }
+    };
+    std::array<shard, SHARDS> shards_;
+
+    shard& get_shard(const user_pubkey_t& pubkey) {
+        return shards_[std::hash<user_pubkey_t>{}(pubkey) % SHARDS];
+    }
+};
+
 } // anon. namespace
 
 class DatabaseImpl {
@@ -163,6 +322,9 @@ public:
 
     int page_size;
 
+    OwnerWatermarks watermarks;
+    std::atomic<uint64_t> retrieve_fast = 0, retrieve_db = 0;
+
     DatabaseImpl(Database& parent, const std::filesystem::path& db_path) :
         parent{parent},
         db{
@@ -191,6 +353,10 @@ public:
 
         if (!db.tableExists("owners")) {
             create_schema();
+        } else if (!db.execAndGet(
+                    "SELECT COUNT(*) FROM pragma_table_info('owners') WHERE name = 'swarm_space'")
+                .getInt()) {
+            add_swarm_space();
         }
     }
 
@@ -203,10 +369,13 @@ CREATE TABLE owners (
     id INTEGER PRIMARY KEY,
     type INTEGER NOT NULL,
     pubkey BLOB NOT NULL,
+    swarm_space INTEGER NOT NULL, -- see to_db_swarm_space()
 
     UNIQUE(pubkey, type)
 );
 
+CREATE INDEX owners_swarm_space ON owners(swarm_space);
+
 CREATE TABLE messages (
     id INTEGER PRIMARY KEY,
     hash TEXT NOT NULL,
@@ -227,24 +396,8 @@ CREATE TRIGGER owner_autoclean
         DELETE FROM owners WHERE id = old.owner;
     END;
 
-CREATE VIEW owned_messages AS
-    SELECT owners.id AS oid, type, pubkey, messages.id AS mid, hash, timestamp, expiry, data
-    FROM messages JOIN owners ON messages.owner = owners.id;
-
-CREATE TRIGGER owned_messages_insert
-    INSTEAD OF INSERT ON owned_messages FOR EACH ROW WHEN NEW.oid IS NULL
-    BEGIN
-        INSERT INTO owners (type, pubkey) VALUES (NEW.type, NEW.pubkey) ON CONFLICT DO NOTHING;
-        INSERT INTO messages values (
-            NEW.mid,
-            NEW.hash,
-            (SELECT id FROM owners WHERE type = NEW.type AND pubkey = NEW.pubkey),
-            NEW.timestamp,
-            NEW.expiry,
-            NEW.data);
-    END;
-
         )");
+        db.exec(owned_messages_view);
 
         if (db.tableExists("Data")) {
             OXEN_LOG(warn, "Old database schema detected; performing migration...");
@@ -261,7 +414,8 @@ CREATE TRIGGER owned_messages_insert
             //    Data BLOB
             // );
 
-            SQLite::Statement ins_owner{db, "INSERT INTO owners (type, pubkey) VALUES (?, ?) RETURNING id"};
+            SQLite::Statement ins_owner{db,
+                "INSERT INTO owners (type, pubkey, swarm_space) VALUES (?, ?, ?) RETURNING id"};
 
             std::unordered_map<std::string, int> owner_ids;
             SQLite::Statement old_owners{db, "SELECT DISTINCT Owner FROM Data"};
@@ -280,7 +434,9 @@ CREATE TRIGGER owned_messages_insert
                     continue;
                 }
 
-                int id = exec_and_get<int>(ins_owner, type, old_owner);
+                user_pubkey_t pk{type, std::string{pubkey.data(), pubkey.size()}};
+                int id = exec_and_get<int>(ins_owner, type, blob_binder{pk.raw()},
+                        to_db_swarm_space(pubkey_to_swarm_space(pk)));
                 ins_owner.reset();
                 owner_ids.emplace(std::move(old_owner), id);
             }
@@ -318,6 +474,42 @@ CREATE TRIGGER owned_messages_insert
         OXEN_LOG(info, "Database setup complete");
     }
 
+    // Migrates a database created before owners had a swarm_space column: adds and populates the
+    // column and index, and recreates the owned_messages view and trigger to include it.
+    void add_swarm_space() {
+        OXEN_LOG(warn, "Adding swarm space values to database owners...");
+
+        SQLite::Transaction transaction{db};
+
+        db.exec("ALTER TABLE owners ADD COLUMN swarm_space INTEGER NOT NULL DEFAULT 0");
+
+        SQLite::Statement upd_owner{db, "UPDATE owners SET swarm_space = ? WHERE id = ?"};
+        SQLite::Statement owners{db, "SELECT id, type, pubkey FROM owners"};
+        int count = 0;
+        while (owners.executeStep()) {
+            auto [id, type, pubkey] = get<int64_t, int, std::string>(owners);
+            user_pubkey_t pk{type, std::move(pubkey)};
+            if (pk.raw().size() != 32) {
+                OXEN_LOG(warn, "Found invalid owner pubkey for owner id {}; ignoring", id);
+                continue;
+            }
+            exec_query(upd_owner, to_db_swarm_space(pubkey_to_swarm_space(pk)), id);
+            upd_owner.reset();
+            count++;
+        }
+
+        db.exec(R"(
+CREATE INDEX owners_swarm_space ON owners(swarm_space);
+DROP TRIGGER owned_messages_insert;
+DROP VIEW owned_messages;
+        )");
+        db.exec(owned_messages_view);
+
+        transaction.commit();
+
+        OXEN_LOG(warn, "Added swarm space values for {} owners", count);
+    }
+
     /** Wrapper around a SQLite::Statement that calls `tryReset()` on destruction of the wrapper. */
     class StatementWrapper {
         SQLite::Statement& st;
@@ -364,6 +556,14 @@ CREATE TRIGGER owned_messages_insert
     user_pubkey_t load_pubkey(uint8_t type, std::string pk) {
         return {type, std::move(pk)};
     }
+
+    // Takes the hashes of messages that were deleted or had their expiries changed, dropping the
+    // owner's watermark if there were any.  Returns the hashes.
+    std::vector<std::string> owner_changed(const user_pubkey_t& pubkey, std::vector<std::string> hashes) {
+        if (!hashes.empty())
+            watermarks.invalidate(pubkey);
+        return hashes;
+    }
 };
 
 Database::Database(const std::filesystem::path& db_path)
@@ -375,8 +575,9 @@ Database::Database(const std::filesystem::path& db_path)
 Database::~Database() = default;
 
 void Database::clean_expired() {
-    impl->prepared_exec("DELETE FROM messages WHERE expiry <= ?",
-            to_epoch_ms(std::chrono::system_clock::now()));
+    auto now_ms = to_epoch_ms(std::chrono::system_clock::now());
+    impl->prepared_exec("DELETE FROM messages WHERE expiry <= ?", now_ms);
+    impl->watermarks.expire(now_ms);
 }
 
 int64_t Database::get_message_count() {
@@ -391,6 +592,10 @@ int64_t Database::get_used_bytes() {
     return impl->prepared_get<int64_t>("PRAGMA page_count") * impl->page_size;
 }
 
+Database::retrieve_stats Database::get_retrieve_stats() {
+    return {impl->retrieve_fast, impl->retrieve_db, impl->watermarks.size()};
+}
+
 static std::optional<message> get_message(DatabaseImpl& impl, SQLite::Statement& st) {
     std::optional<message> msg;
     while (st.executeStep()) {
@@ -421,13 +626,14 @@ std::optional<message> Database::retrieve_by_hash(const std::string& msg_hash) {
     return get_message(*impl, st);
 }
 
-std::optional<bool> Database::store(const message& msg) {
+std::optional<bool> Database::store(const message_view& msg) {
     auto st = impl->prepared_st("INSERT INTO owned_messages"
-           " (pubkey, type, hash, timestamp, expiry, data) VALUES (?, ?, ?, ?, ?, ?)");
+           " (pubkey, type, swarm_space, hash, timestamp, expiry, data) VALUES (?, ?, ?, ?, ?, ?, ?)");
 
     try {
         exec_query(st,
             msg.pubkey,
+            to_db_swarm_space(pubkey_to_swarm_space(msg.pubkey)),
             msg.hash,
             to_epoch_ms(msg.timestamp),
             to_epoch_ms(msg.expiry),
@@ -444,16 +650,21 @@ std::optional<bool> Database::store(const message& msg) {
             throw;
         }
     }
+    impl->watermarks.stored(msg.pubkey, msg.hash, to_epoch_ms(msg.expiry));
     return true;
 }
 
 
-void Database::bulk_store(const std::vector<message>& items) {
-    SQLite::Transaction t{impl->db};
-    auto get_owner = impl->prepared_st(
+// Common implementation of bulk_store for messages and message_views
+template <typename Message>
+static std::vector<bool> bulk_store_impl(DatabaseImpl& impl, const std::vector<Message>& items) {
+    std::vector<bool> inserted(items.size(), false);
+    SQLite::Transaction t{impl.db};
+    auto get_owner = impl.prepared_st(
             "SELECT id FROM owners WHERE pubkey = ? AND type = ?");
-    auto insert_owner = impl->prepared_st(
-            "INSERT INTO owners (pubkey, type) VALUES (?, ?) ON CONFLICT DO NOTHING RETURNING id");
+    auto insert_owner = impl.prepared_st(
+            "INSERT INTO owners (pubkey, type, swarm_space) VALUES (?, ?, ?)"
+            " ON CONFLICT DO NOTHING RETURNING id");
     std::unordered_map<user_pubkey_t, int64_t> seen;
     for (auto& m : items) {
         if (!m.pubkey)
@@ -462,7 +673,8 @@ void Database::bulk_store(const std::vector<message>& items) {
             auto ownerid = exec_and_maybe_get<int64_t>(get_owner, m.pubkey);
             get_owner->reset();
             if (!ownerid) {
-                ownerid = exec_and_maybe_get<int64_t>(insert_owner, m.pubkey);
+                ownerid = exec_and_maybe_get<int64_t>(insert_owner, m.pubkey,
+                        to_db_swarm_space(pubkey_to_swarm_space(m.pubkey)));
                 insert_owner->reset();
             }
             if (ownerid)
@@ -474,28 +686,42 @@ void Database::bulk_store(const std::vector<message>& items) {
         }
     }
 
-    auto insert_message = impl->prepared_st(
+    auto insert_message = impl.prepared_st(
             "INSERT INTO messages (owner, hash, timestamp, expiry, data) VALUES (?, ?, ?, ?, ?)"
             " ON CONFLICT DO NOTHING");
 
-    for (auto& m : items) {
+    for (size_t i = 0; i < items.size(); i++) {
+        auto& m = items[i];
         if (!m.pubkey)
             continue;
         auto owner_it = seen.find(m.pubkey);
         if (owner_it == seen.end())
             continue;
 
-        int foo =
-        exec_query(insert_message,
+        inserted[i] = exec_query(insert_message,
                 owner_it->second,
                 m.hash,
                 to_epoch_ms(m.timestamp),
                 to_epoch_ms(m.expiry),
-                blob_binder{m.data});
+                blob_binder{m.data}) > 0;
         insert_message->reset();
     }
 
     t.commit();
+
+    for (size_t i = 0; i < items.size(); i++)
+        if (inserted[i])
+            impl.watermarks.stored(items[i].pubkey, items[i].hash, to_epoch_ms(items[i].expiry));
+
+    return inserted;
+}
+
+std::vector<bool> Database::bulk_store(const std::vector<message>& items) {
+    return bulk_store_impl(*impl, items);
+}
+
+std::vector<bool> Database::bulk_store(const std::vector<message_view>& items) {
+    return bulk_store_impl(*impl, items);
 }
 
 std::vector<message> Database::retrieve(
@@ -505,15 +731,26 @@ std::vector<message> Database::retrieve(
 
     std::vector<message> results;
 
+    if (impl->watermarks.up_to_date(pubkey, last_hash, to_epoch_ms(std::chrono::system_clock::now()))) {
+        impl->retrieve_fast++;
+        return results;
+    }
+    impl->retrieve_db++;
+    auto gen = impl->watermarks.generation(pubkey);
+
     auto owner_st = impl->prepared_st("SELECT id FROM owners WHERE pubkey = ? AND type = ?");
     auto ownerid = exec_and_maybe_get<int64_t>(owner_st, pubkey);
-    if (!ownerid)
+    if (!ownerid) {
+        impl->watermarks.load(pubkey, gen, {});
         return results;
+    }
 
     std::optional<int64_t> last_id;
+    int64_t last_expiry = 0;
     if (!last_hash.empty()) {
-        auto st = impl->prepared_st("SELECT id FROM messages WHERE owner = ? AND hash = ?");
-        last_id = exec_and_maybe_get<int64_t>(st, *ownerid, last_hash);
+        auto st = impl->prepared_st("SELECT id, expiry FROM messages WHERE owner = ? AND hash = ?");
+        if (auto row = exec_and_maybe_get<int64_t, int64_t>(st, *ownerid, last_hash))
+            std::tie(last_id, last_expiry) = *row;
     }
 
     auto st = impl->prepared_st(last_id
@@ -529,6 +766,15 @@ std::vector<message> Database::retrieve(
                 std::move(hash), from_epoch_ms(ts), from_epoch_ms(exp), std::move(data));
     }
 
+    // If we didn't hit the limit then the last message we saw (either the last one returned, or
+    // last_hash itself when there was nothing newer) is the owner's newest.
+    if (!num_results || results.size() < static_cast<size_t>(*num_results)) {
+        if (!results.empty())
+            impl->watermarks.load(pubkey, gen, {results.back().hash, to_epoch_ms(results.back().expiry)});
+        else if (last_id)
+            impl->watermarks.load(pubkey, gen, {last_hash, last_expiry});
+    }
+
     return results;
 }
 
@@ -551,11 +797,51 @@ std::vector<message> Database::retrieve_all() {
     return results;
 }
 
+std::vector<message> Database::retrieve_swarm_space_range(uint64_t begin, uint64_t end) {
+    std::vector<message> results;
+    auto st = impl->prepared_st("SELECT type, pubkey, hash, timestamp, expiry, data"
+            " FROM owners JOIN messages ON messages.owner = owners.id"
+            " WHERE swarm_space BETWEEN ? AND ? ORDER BY messages.id");
+
+    st->bind(1, to_db_swarm_space(begin));
+    st->bind(2, to_db_swarm_space(end));
+
+    while (st->executeStep()) {
+        auto [type, pubkey, hash, ts, exp, data] =
+            get<uint8_t, std::string, std::string, int64_t, int64_t, std::string>(st);
+        results.emplace_back(
+                impl->load_pubkey(type, std::move(pubkey)),
+                std::move(hash),
+                from_epoch_ms(ts),
+                from_epoch_ms(exp),
+                std::move(data));
+    }
+
+    return results;
+}
+
+std::vector<std::pair<user_pubkey_t, std::string>> Database::retrieve_hashes_swarm_space_range(
+        uint64_t begin, uint64_t end) {
+    std::vector<std::pair<user_pubkey_t, std::string>> results;
+    auto st = impl->prepared_st("SELECT type, pubkey, hash"
+            " FROM owners JOIN messages ON messages.owner = owners.id"
+            " WHERE swarm_space BETWEEN ? AND ?");
+    st->bind(1, to_db_swarm_space(begin));
+    st->bind(2, to_db_swarm_space(end));
+
+    while (st->executeStep()) {
+        auto [type, pubkey, hash] = get<uint8_t, std::string, std::string>(st);
+        results.emplace_back(impl->load_pubkey(type, std::move(pubkey)), std::move(hash));
+    }
+
+    return results;
+}
+
 std::vector<std::string> Database::delete_all(const user_pubkey_t& pubkey) {
     auto st = impl->prepared_st(
             "DELETE FROM messages WHERE owner = (SELECT id FROM owners WHERE pubkey = ? AND type = ?)"
             " RETURNING hash");
-    return get_all<std::string>(st, pubkey);
+    return impl->owner_changed(pubkey, get_all<std::string>(st, pubkey));
 }
 
 static std::string multi_in_query(std::string_view prefix, size_t count, std::string_view suffix) {
@@ -570,6 +856,36 @@ static std::string multi_in_query(std::string_view prefix, size_t count, std::st
     return query;
 }
 
+// SQLite limits the number of parameters in a query (to 32766, by default), so queries on long
+// lists of hashes get done this many hashes at a time.
+constexpr size_t MAX_HASHES_PER_QUERY = 1000;
+
+std::vector<message> Database::retrieve_by_hashes(const std::vector<std::string>& msg_hashes) {
+    std::vector<message> results;
+    results.reserve(msg_hashes.size());
+    for (size_t begin = 0; begin < msg_hashes.size(); begin += MAX_HASHES_PER_QUERY) {
+        const size_t count = std::min(MAX_HASHES_PER_QUERY, msg_hashes.size() - begin);
+        SQLite::Statement st{impl->db, multi_in_query("SELECT type, pubkey, hash, timestamp, expiry, data"
+            " FROM owned_messages WHERE hash IN ("sv, // ?,?,?,...,?
+            count,
+            ")"sv)};
+        for (size_t i = 0; i < count; i++)
+            st.bindNoCopy(1 + i, msg_hashes[begin + i]);
+
+        while (st.executeStep()) {
+            auto [type, pubkey, hash, ts, exp, data] =
+                get<uint8_t, std::string, std::string, int64_t, int64_t, std::string>(st);
+            results.emplace_back(
+                    impl->load_pubkey(type, std::move(pubkey)),
+                    std::move(hash),
+                    from_epoch_ms(ts),
+                    from_epoch_ms(exp),
+                    std::move(data));
+        }
+    }
+    return results;
+}
+
 std::vector<std::string> Database::delete_by_hash(
         const user_pubkey_t& pubkey, const std::vector<std::string>& msg_hashes) {
     if (msg_hashes.size() == 1) {
@@ -577,7 +893,7 @@ std::vector<std::string> Database::delete_by_hash(
         auto st = impl->prepared_st("DELETE FROM messages"
                 " WHERE owner = (SELECT id FROM owners WHERE pubkey = ? AND type = ?) AND hash = ?"
                 " RETURNING hash");
-        return get_all<std::string>(st, pubkey, msg_hashes[0]);
+        return impl->owner_changed(pubkey, get_all<std::string>(st, pubkey, msg_hashes[0]));
     }
 
     SQLite::Statement st{impl->db, multi_in_query("DELETE FROM messages "
@@ -589,7 +905,7 @@ std::vector<std::string> Database::delete_by_hash(
     bind_pubkey(st, 1, 2, pubkey);
     for (size_t i = 0; i < msg_hashes.size(); i++)
         st.bindNoCopy(3 + i, msg_hashes[i]);
-    return get_all<std::string>(st);
+    return impl->owner_changed(pubkey, get_all<std::string>(st));
 }
 
 std::vector<std::string> Database::delete_by_timestamp(
@@ -597,7 +913,7 @@ std::vector<std::string> Database::delete_by_timestamp(
     auto st = impl->prepared_st("DELETE FROM messages"
             " WHERE owner = (SELECT id FROM owners WHERE pubkey = ? AND type = ?)"
             " AND timestamp <= ? RETURNING hash");
-    return get_all<std::string>(st, pubkey, to_epoch_ms(timestamp));
+    return impl->owner_changed(pubkey, get_all<std::string>(st, pubkey, to_epoch_ms(timestamp)));
 }
 
 std::vector<std::string>
@@ -614,7 +930,8 @@ Database::update_expiry(
                 "WHERE expiry > ? AND hash = ?"
                 " AND owner = (SELECT id FROM owners WHERE pubkey = ? AND type = ?)"
                 " RETURNING hash");
-        return get_all<std::string>(st, new_exp_ms, new_exp_ms, msg_hashes[0], pubkey);
+        return impl->owner_changed(pubkey,
+                get_all<std::string>(st, new_exp_ms, new_exp_ms, msg_hashes[0], pubkey));
     }
 
     SQLite::Statement st{impl->db, multi_in_query("UPDATE messages SET expiry = ? "
@@ -628,7 +945,7 @@ Database::update_expiry(
     for (size_t i = 0; i < msg_hashes.size(); i++)
         st.bindNoCopy(5 + i, msg_hashes[i]);
 
-    return get_all<std::string>(st);
+    return impl->owner_changed(pubkey, get_all<std::string>(st));
 }
 
 std::vector<std::string>
@@ -640,7 +957,7 @@ Database::update_all_expiries(
     auto st = impl->prepared_st("UPDATE messages SET expiry = ? "
             "WHERE expiry > ? AND owner = (SELECT id FROM owners WHERE pubkey = ? AND type = ?) "
             "RETURNING hash");
-    return get_all<std::string>(st, new_exp_ms, new_exp_ms, pubkey);
+    return impl->owner_changed(pubkey, get_all<std::string>(st, new_exp_ms, new_exp_ms, pubkey));
 }
 
 } // namespace oxen
@@ -128,3 +128,78 @@ TEST_CASE("config not found", "[cli][config]") {
                 "--config-file", "foobar"}),
             "path provided in --config-file does not exist");
 }
+
+TEST_CASE("swarm reply options", "[cli][swarm-reply]") {
+    oxen::command_line_parser parser;
+    REQUIRE_NOTHROW(
+            parser.parse_args({"httpserver", "0.0.0.0", "80", "--omq-port", "123"}));
+    CHECK(parser.get_options().swarm_reply_quorum == 0);
+    CHECK(parser.get_options().swarm_reply_timeout == 0);
+
+    oxen::command_line_parser parser2;
+    REQUIRE_NOTHROW(
+            parser2.parse_args({"httpserver", "0.0.0.0", "80", "--omq-port", "123",
+                "--swarm-reply-quorum", "3", "--swarm-reply-timeout", "1500"}));
+    CHECK(parser2.get_options().swarm_reply_quorum == 3);
+    CHECK(parser2.get_options().swarm_reply_timeout == 1500);
+}
+
+TEST_CASE("https threads", "[cli][https-threads]") {
+    oxen::command_line_parser parser;
+    REQUIRE_NOTHROW(
+            parser.parse_args({"httpserver", "0.0.0.0", "80", "--omq-port", "123"}));
+    CHECK(parser.get_options().https_threads == 1);
+
+    oxen::command_line_parser parser2;
+    REQUIRE_NOTHROW(
+            parser2.parse_args({"httpserver", "0.0.0.0", "80", "--omq-port", "123",
+                "--https-threads", "4"}));
+    CHECK(parser2.get_options().https_threads == 4);
+
+    oxen::command_line_parser parser3;
+    CHECK_THROWS_WITH(
+            parser3.parse_args({"httpserver", "0.0.0.0", "80", "--omq-port", "123",
+                "--https-threads", "0"}),
+            "Invalid option: https-threads must be at least 1");
+}
+
+TEST_CASE("omq worker threads", "[cli][omq-threads]") {
+    oxen::command_line_parser parser;
+    REQUIRE_NOTHROW(
+            parser.parse_args({"httpserver", "0.0.0.0", "80", "--omq-port", "123"}));
+    auto& opts = parser.get_options();
+    CHECK(opts.omq_threads == 1);
+    CHECK(opts.omq_sn_threads == 2);
+    CHECK(opts.omq_sn_queue == 1000);
+    CHECK(opts.omq_storage_threads == 1);
+    CHECK(opts.omq_storage_queue == 200);
+    CHECK(opts.omq_https_threads == 2);
+    CHECK(opts.omq_https_queue == 1000);
+    CHECK_FALSE(opts.adaptive_workers);
+    CHECK(opts.adaptive_max_threads == 0);
+
+    oxen::command_line_parser parser2;
+    REQUIRE_NOTHROW(
+            parser2.parse_args({"httpserver", "0.0.0.0", "80", "--omq-port", "123",
+                "--omq-threads", "0", "--omq-storage-threads", "8", "--omq-storage-queue", "5000",
+                "--omq-https-threads", "4", "--adaptive-workers", "--adaptive-max-threads", "32"}));
+    auto& opts2 = parser2.get_options();
+    CHECK(opts2.omq_threads == 0);
+    CHECK(opts2.omq_storage_threads == 8);
+    CHECK(opts2.omq_storage_queue == 5000);
+    CHECK(opts2.omq_https_threads == 4);
+    CHECK(opts2.adaptive_workers);
+    CHECK(opts2.adaptive_max_threads == 32);
+
+    oxen::command_line_parser parser3;
+    CHECK_THROWS_WITH(
+            parser3.parse_args({"httpserver", "0.0.0.0", "80", "--omq-port", "123",
+                "--omq-storage-queue", "0"}),
+            "Invalid option: omq queue sizes must be at least 1");
+
+    oxen::command_line_parser parser4;
+    CHECK_THROWS_WITH(
+            parser4.parse_args({"httpserver", "0.0.0.0", "80", "--omq-port", "123",
+                "--omq-https-threads", "4", "--adaptive-workers", "--adaptive-max-threads", "2"}),
+            "Invalid option: adaptive-max-threads must not be less than omq-https-threads");
+}
@@ -0,0 +1,133 @@
+#include "forward_batch.h"
+
+#include <catch2/catch.hpp>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace oxen;
+using namespace std::literals;
+
+namespace {
+
+struct forward_result {
+    bool success;
+    std::vector<std::string> parts;
+};
+
+// Collects what each request's callback gets called with, by request index
+struct forward_results {
+    std::vector<std::vector<forward_result>> results;
+
+    forward_callback callback(size_t i) {
+        if (results.size() <= i)
+            results.resize(i + 1);
+        return [this, i](bool success, std::vector<std::string> parts) {
+            results[i].push_back({success, std::move(parts)});
+        };
+    }
+};
+
+const x25519_pubkey peer{};
+
+} // namespace
+
+TEST_CASE("forward batch - full batches", "[forward_batch]") {
+    forward_results res;
+    forward_batch batch;
+    for (size_t i = 0; i < FORWARD_BATCH_MAX_REQUESTS - 1; i++)
+        CHECK_FALSE(batch.add("store", "{}", res.callback(i)));
+    CHECK(batch.add("store", "{}", res.callback(FORWARD_BATCH_MAX_REQUESTS - 1)));
+    CHECK(batch.callbacks.size() == FORWARD_BATCH_MAX_REQUESTS);
+    CHECK(batch.parts.size() == 2 * FORWARD_BATCH_MAX_REQUESTS);
+    CHECK(batch.bytes == 7 * FORWARD_BATCH_MAX_REQUESTS);
+
+    forward_batch big;
+    CHECK_FALSE(big.add("store", std::string(FORWARD_BATCH_MAX_BYTES / 2, 'x'), res.callback(0)));
+    CHECK(big.add("store", std::string(FORWARD_BATCH_MAX_BYTES / 2, 'x'), res.callback(1)));
+    CHECK(big.callbacks.size() == 2);
+}
+
+TEST_CASE("forward batch - replies round trip", "[forward_batch]") {
+    forward_results res;
+    forward_batch batch;
+    batch.add("store", R"({"pubkey":"05..."})", res.callback(0));
+    batch.add("retrieve", "d6:pubkey4:05..e", res.callback(1));
+    batch.add("bogus", "{}", res.callback(2));
+    batch.add("delete_all", "{}", res.callback(3));
+    CHECK(batch.parts == std::vector{
+            "store"s, R"({"pubkey":"05..."})"s,
+            "retrieve"s, "d6:pubkey4:05..e"s,
+            "bogus"s, "{}"s,
+            "delete_all"s, "{}"s});
+
+    // What the receiving node sends back, one reply part per request (see
+    // OxenmqServer::handle_client_request_batch)
+    const auto binary = "d3:abc\0\xff"s;
+    std::vector<std::string> replies{
+        encode_forward_reply(http::OK, R"({"hash":"abc"})"),
+        encode_forward_reply(http::OK, binary),
+        encode_forward_reply(http::BAD_REQUEST, "invalid request: unknown method"),
+        encode_forward_reply(http::OK, "")};
+    CHECK(replies[0] == R"(l14:{"hash":"abc"}e)");
+    CHECK(replies[2] == "l3:40031:invalid request: unknown methode");
+    CHECK(replies[3] == "l0:e");
+
+    deliver_forward_replies(batch.callbacks, true, std::move(replies), peer);
+
+    // Each request gets the parts the equivalent single sn.storage_cc request would have replied
+    // with, in the order the requests were added.
+    REQUIRE(res.results.size() == 4);
+    for (auto& r : res.results) {
+        REQUIRE(r.size() == 1);
+        CHECK(r[0].success);
+    }
+    CHECK(res.results[0][0].parts == std::vector{R"({"hash":"abc"})"s});
+    CHECK(res.results[1][0].parts == std::vector{binary});
+    CHECK(res.results[2][0].parts == std::vector{"400"s, "invalid request: unknown method"s});
+    CHECK(res.results[3][0].parts == std::vector{""s});
+}
+
+TEST_CASE("forward batch - batch failures", "[forward_batch]") {
+    forward_results res;
+    forward_batch batch;
+    for (size_t i = 0; i < 3; i++)
+        batch.add("store", "{}", res.callback(i));
+
+    // E.g. a timeout: every request in the batch fails
+    deliver_forward_replies(batch.callbacks, false, {"timeout"}, peer);
+    REQUIRE(res.results.size() == 3);
+    for (auto& r : res.results) {
+        REQUIRE(r.size() == 1);
+        CHECK_FALSE(r[0].success);
+        CHECK(r[0].parts.empty());
+    }
+}
+
+TEST_CASE("forward batch - malformed replies", "[forward_batch]") {
+    forward_results res;
+    forward_batch batch;
+    for (size_t i = 0; i < 3; i++)
+        batch.add("store", "{}", res.callback(i));
+
+    // The wrong number of reply parts makes every reply a bad (empty) response
+    deliver_forward_replies(batch.callbacks, true, {"l2:hie", "l2:hie"}, peer);
+    for (auto& r : res.results) {
+        REQUIRE(r.size() == 1);
+        CHECK(r[0].success);
+        CHECK(r[0].parts.empty());
+    }
+
+    // A bad reply part only affects its own request
+    res.results.clear();
+    for (size_t i = 0; i < 3; i++)
+        batch.callbacks[i] = res.callback(i);
+    deliver_forward_replies(batch.callbacks, true, {"l2:hie", "l5:hie", ""}, peer);
+    REQUIRE(res.results.size() == 3);
+    CHECK(res.results[0][0].parts == std::vector{"hi"s});
+    CHECK(res.results[1][0].parts.empty());
+    CHECK(res.results[2][0].parts.empty());
+    for (auto& r : res.results)
+        CHECK(r[0].success);
+}
@@ -0,0 +1,284 @@
+#include "http_client.h"
+#include "server_certificates.h"
+
+#include <catch2/catch.hpp>
+
+extern "C" {
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <signal.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+}
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace oxen;
+using namespace std::literals;
+
+namespace {
+
+/// Minimal in-process HTTPS server for exercising the client.  Endpoints:
+/// - /echo -- replies 200 with the request body, echoing the X-Test header back as X-Echo-Header
+/// - /close -- like /echo, but closes the connection after replying
+/// - /slow -- waits 1s before replying
+class https_stub {
+    std::filesystem::path dir_;
+    SSL_CTX* ctx_ = nullptr;
+    int listen_fd_ = -1;
+    std::thread accept_thread_;
+    std::mutex conns_mutex_;
+    std::vector<int> conn_fds_;
+    std::vector<std::thread> conn_threads_;
+
+  public:
+    uint16_t port = 0;
+    std::atomic<int> connections{0}, resumed{0}, requests{0};
+
+    https_stub() {
+        // Writing a reply to a connection the client already gave up on must not kill us
+        ::signal(SIGPIPE, SIG_IGN);
+
+        dir_ = std::filesystem::temp_directory_path() /
+            ("ss-http-client-test-" + std::to_string(::getpid()));
+        std::filesystem::create_directories(dir_);
+        generate_cert(dir_ / "cert.pem", dir_ / "key.pem");
+
+        ctx_ = SSL_CTX_new(TLS_server_method());
+        REQUIRE(ctx_);
+        REQUIRE(SSL_CTX_use_certificate_file(ctx_, (dir_ / "cert.pem").c_str(), SSL_FILETYPE_PEM) == 1);
+        REQUIRE(SSL_CTX_use_PrivateKey_file(ctx_, (dir_ / "key.pem").c_str(), SSL_FILETYPE_PEM) == 1);
+        const unsigned char sid_ctx[] = "ss-test";
+        SSL_CTX_set_session_id_context(ctx_, sid_ctx, sizeof(sid_ctx) - 1);
+
+        listen_fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+        REQUIRE(listen_fd_ >= 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        REQUIRE(::bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0);
+        REQUIRE(::listen(listen_fd_, 16) == 0);
+        socklen_t len = sizeof(addr);
+        ::getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&addr), &len);
+        port = ntohs(addr.sin_port);
+
+        accept_thread_ = std::thread{[this] {
+            while (true) {
+                int fd = ::accept(listen_fd_, nullptr, nullptr);
+                if (fd < 0)
+                    return;
+                connections++;
+                std::lock_guard lock{conns_mutex_};
+                conn_fds_.push_back(fd);
+                conn_threads_.emplace_back([this, fd] { serve(fd); });
+            }
+        }};
+    }
+
+    ~https_stub() {
+        ::shutdown(listen_fd_, SHUT_RDWR);
+        ::close(listen_fd_);
+        accept_thread_.join();
+        {
+            std::lock_guard lock{conns_mutex_};
+            for (int fd : conn_fds_)
+                ::shutdown(fd, SHUT_RDWR);
+        }
+        for (auto& t : conn_threads_)
+            t.join();
+        for (int fd : conn_fds_)
+            ::close(fd);
+        SSL_CTX_free(ctx_);
+        std::filesystem::remove_all(dir_);
+    }
+
+    std::string url(std::string_view path) const {
+        return "https://127.0.0.1:" + std::to_string(port) + std::string{path};
+    }
+
+  private:
+    void serve(int fd) {
+        SSL* ssl = SSL_new(ctx_);
+        SSL_set_fd(ssl, fd);
+        if (SSL_accept(ssl) == 1) {
+            if (SSL_session_reused(ssl))
+                resumed++;
+            std::string buf;
+            char tmp[4096];
+            bool open = true;
+            while (open) {
+                size_t hdr_end;
+                while ((hdr_end = buf.find("\r\n\r\n")) == std::string::npos) {
+                    int n = SSL_read(ssl, tmp, sizeof(tmp));
+                    if (n <= 0) { open = false; break; }
+                    buf.append(tmp, n);
+                }
+                if (!open)
+                    break;
+
+                std::string head = buf.substr(0, hdr_end);
+                buf.erase(0, hdr_end + 4);
+                auto header = [&head](std::string_view name) -> std::string {
+                    for (size_t pos = head.find("\r\n"); pos != std::string::npos; pos = head.find("\r\n", pos + 2)) {
+                        auto line = std::string_view{head}.substr(pos + 2);
+                        line = line.substr(0, line.find("\r\n"));
+                        if (line.size() > name.size() && line[name.size()] == ':' &&
+                                strncasecmp(line.data(), name.data(), name.size()) == 0) {
+                            auto v = line.substr(name.size() + 1);
+                            while (!v.empty() && v.front() == ' ') v.remove_prefix(1);
+                            return std::string{v};
+                        }
+                    }
+                    return "";
+                };
+                size_t content_length = 0;
+                if (auto cl = header("Content-Length"); !cl.empty())
+                    content_length = std::stoul(cl);
+                while (buf.size() < content_length) {
+                    int n = SSL_read(ssl, tmp, sizeof(tmp));
+                    if (n <= 0) { open = false; break; }
+                    buf.append(tmp, n);
+                }
+                if (!open)
+                    break;
+                std::string body = buf.substr(0, content_length);
+                buf.erase(0, content_length);
+                requests++;
+
+                auto path = head.substr(head.find(' ') + 1);
+                path = path.substr(0, path.find(' '));
+                bool close = path == "/close";
+                if (path == "/slow")
+                    std::this_thread::sleep_for(1s);
+
+                std::string resp = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(body.size()) +
+                    "\r\nX-Echo-Header: " + header("X-Test") + "\r\n" +
+                    (close ? "Connection: close\r\n" : "") + "\r\n" + body;
+                if (SSL_write(ssl, resp.data(), resp.size()) <= 0 || close)
+                    open = false;
+            }
+        }
+        SSL_shutdown(ssl);
+        SSL_free(ssl);
+    }
+};
+
+http_response post_sync(HttpClient& client, http_request req) {
+    std::promise<http_response> prom;
+    auto fut = prom.get_future();
+    client.post(std::move(req), [&prom](http_response r) { prom.set_value(std::move(r)); });
+    return fut.get();
+}
+
+http_request stub_request(const https_stub& stub, std::string_view path, std::string body = "") {
+    http_request req;
+    req.url = stub.url(path);
+    req.body = std::move(body);
+    req.verify_peer = false;
+    req.timeout = 5s;
+    return req;
+}
+
+} // namespace
+
+TEST_CASE("http client - basic request", "[http][client]") {
+    https_stub stub;
+    HttpClient client;
+
+    auto req = stub_request(stub, "/echo", "hello world");
+    req.headers.emplace_back("X-Test", "abc");
+    auto res = post_sync(client, std::move(req));
+
+    CHECK(res.error == "");
+    CHECK(res.status_code == 200);
+    CHECK(res.status_line == "HTTP/1.1 200 OK");
+    CHECK(res.body == "hello world");
+    REQUIRE(res.header("x-echo-header"));
+    CHECK(*res.header("X-Echo-Header") == "abc");
+    CHECK_FALSE(res.header("x-not-there"));
+}
+
+TEST_CASE("http client - keep-alive connection reuse", "[http][client]") {
+    https_stub stub;
+    HttpClient client;
+
+    for (int i = 0; i < 5; i++) {
+        auto res = post_sync(client, stub_request(stub, "/echo", "req" + std::to_string(i)));
+        CHECK(res.status_code == 200);
+        CHECK(res.body == "req" + std::to_string(i));
+    }
+    CHECK(stub.requests == 5);
+    CHECK(stub.connections == 1);
+}
+
+TEST_CASE("http client - TLS session resumption", "[http][client]") {
+    https_stub stub;
+    HttpClient client;
+
+    // The server closes the connection after each of these, so each needs a new connection, but
+    // the later ones should resume the TLS session from the first.
+    for (int i = 0; i < 3; i++) {
+        auto res = post_sync(client, stub_request(stub, "/close", "x"));
+        CHECK(res.status_code == 200);
+    }
+    CHECK(stub.connections == 3);
+    CHECK(stub.resumed == 2);
+}
+
+TEST_CASE("http client - concurrent requests", "[http][client]") {
+    https_stub stub;
+    HttpClient client;
+
+    constexpr int count = 20;
+    std::vector<std::promise<http_response>> proms(count);
+    for (int i = 0; i < count; i++)
+        client.post(stub_request(stub, "/echo", std::to_string(i)),
+                [&p = proms[i]](http_response r) { p.set_value(std::move(r)); });
+    for (int i = 0; i < count; i++) {
+        auto res = proms[i].get_future().get();
+        CHECK(res.status_code == 200);
+        CHECK(res.body == std::to_string(i));
+    }
+    CHECK(stub.connections <= HTTP_CLIENT_MAX_HOST_CONNECTIONS);
+}
+
+TEST_CASE("http client - timeouts and failures", "[http][client]") {
+    https_stub stub;
+    HttpClient client;
+
+    auto req = stub_request(stub, "/slow");
+    req.timeout = 200ms;
+    auto res = post_sync(client, std::move(req));
+    CHECK(res.status_code == 0);
+    CHECK(res.timed_out);
+    CHECK(res.error != "");
+
+    // Nothing listening:
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    socklen_t len = sizeof(addr);
+    ::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+    ::close(fd);
+
+    http_request bad;
+    bad.url = "https://127.0.0.1:" + std::to_string(ntohs(addr.sin_port)) + "/";
+    bad.verify_peer = false;
+    res = post_sync(client, std::move(bad));
+    CHECK(res.status_code == 0);
+    CHECK_FALSE(res.timed_out);
+    CHECK(res.error != "");
+}
@@ -0,0 +1,165 @@
+#include "client_rpc_endpoints.h"
+#include "json_view.h"
+
+#include <catch2/catch.hpp>
+#include <nlohmann/json.hpp>
+#include <oxenmq/base64.h>
+
+#include <chrono>
+#include <string>
+
+using namespace oxen;
+using namespace std::literals;
+using nlohmann::json;
+using type = json_object_view::type;
+
+namespace {
+
+const auto pubkey_hex = "054368520005786b249bcd461d28f75e560ea794014eeb17fcf6003f37d876783e"s;
+
+std::string store_request(size_t data_size) {
+    std::string data(data_size, '\0');
+    for (size_t i = 0; i < data_size; i++)
+        data[i] = static_cast<char>(i * 37 & 0xff);
+    return json{
+        {"method", "store"},
+        {"params", {
+            {"pubkey", pubkey_hex},
+            {"timestamp", "1626000000000"},
+            {"ttl", "1209600000"},
+            {"data", oxenmq::to_base64(data)}}}}.dump();
+}
+
+std::string retrieve_request() {
+    return json{
+        {"method", "retrieve"},
+        {"params", {
+            {"pubkey", pubkey_hex},
+            {"last_hash", "Ib5X0RNobYcvTSNRq8SlbuVdTB/ATU3zt7+Tm2SIUFU"},
+            {"pubkey_ed25519", "4368520005786b249bcd461d28f75e560ea794014eeb17fcf6003f37d876783e"},
+            {"timestamp", 1626000000000},
+            {"signature", oxenmq::to_base64(std::string(64, '\x42'))}}}}.dump();
+}
+
+// Loads the params of a client request both through a json DOM and in place
+template <typename RPC>
+std::pair<RPC, RPC> load_both(const std::string& request) {
+    std::pair<RPC, RPC> result;
+    result.first.load_from(json::parse(request).at("params"));
+    json_object_view view{request};
+    result.second.load_from(json_object_view{view.find("params")->raw});
+    return result;
+}
+
+} // namespace
+
+TEST_CASE("json view - parsing", "[json_view]") {
+    json_object_view v{R"( {"a": "hi", "b": -12, "c": [1, "x", {"y": null}], "d": {"e": true},
+        "f": false, "g": null, "h": "esc\"aped\\ é🦆\n", "i": 1.5e3, "a": "last"} )"};
+    CHECK(v.size() == 9);
+    REQUIRE(v.find("a"));
+    CHECK(v.get_string(*v.find("a")) == "last");
+    CHECK(json_object_view::get_integer<int>(*v.find("b")) == -12);
+    CHECK_THROWS_AS(json_object_view::get_integer<unsigned>(*v.find("b")), std::invalid_argument);
+    CHECK_THROWS_AS(json_object_view::get_integer<int>(*v.find("i")), std::invalid_argument);
+    CHECK(v.find("i")->raw == "1.5e3");
+    auto c = json_object_view::get_array(*v.find("c"));
+    REQUIRE(c.size() == 3);
+    CHECK(c[1].t == type::string);
+    CHECK(c[2].raw == R"({"y": null})");
+    CHECK(v.find("d")->t == type::object);
+    CHECK(json_object_view::get_bool(*v.find("f")) == false);
+    CHECK(v.find("g")->is_null());
+    CHECK(v.find("h")->escaped);
+    CHECK(v.get_string(*v.find("h")) == "esc\"aped\\ é🦆\n");
+    CHECK_FALSE(v.find("z"));
+    CHECK_THROWS_AS(v.get_string(*v.find("b")), std::invalid_argument);
+
+    CHECK(json_object_view{"{}"}.size() == 0);
+    CHECK_THROWS_AS(json_object_view{R"(["a"])"}, std::invalid_argument);
+    for (auto bad : {"", "{", R"({"a":})", R"({"a":1,})", R"({"a":1} x)", R"({"a":01})",
+                R"({"a":"\x"})", "{\"a\":\"\n\"}", R"({"a":tru})", R"({a:1})", R"({"a":[1 2]})"})
+        CHECK_THROWS_AS(json_object_view{bad}, std::invalid_argument);
+
+    // Limited nesting
+    CHECK_THROWS_AS(json_object_view{R"({"a":)" + std::string(100, '[') + std::string(100, ']') + "}"},
+            std::invalid_argument);
+}
+
+TEST_CASE("json view - rpc loading matches json", "[json_view]") {
+    auto [store_json, store_view] = load_both<rpc::store>(store_request(2048));
+    CHECK(store_view.pubkey == store_json.pubkey);
+    CHECK(store_view.timestamp == store_json.timestamp);
+    CHECK(store_view.expiry == store_json.expiry);
+    CHECK(store_view.data.size() == 2048);
+    CHECK(store_view.data == store_json.data);
+
+    auto [retrieve_json, retrieve_view] = load_both<rpc::retrieve>(retrieve_request());
+    CHECK(retrieve_view.pubkey == retrieve_json.pubkey);
+    CHECK(retrieve_view.last_hash == retrieve_json.last_hash);
+    CHECK(retrieve_view.check_signature);
+    CHECK(retrieve_view.pubkey_ed25519 == retrieve_json.pubkey_ed25519);
+    CHECK(retrieve_view.timestamp == retrieve_json.timestamp);
+    CHECK(retrieve_view.signature == retrieve_json.signature);
+
+    // Escaped strings get decoded
+    auto escaped = store_request(30);
+    auto pos = escaped.find("\"data\":\"") + 8;
+    escaped.insert(pos, "\\u0041");
+    escaped.erase(pos + 6, 1);
+    auto [esc_json, esc_view] = load_both<rpc::store>(escaped);
+    CHECK(esc_view.data == esc_json.data);
+
+    // The same errors
+    for (auto params : {
+            R"({"pubkey": 123, "timestamp": 1626000000000, "ttl": 100, "data": ""})"s,
+            R"({"pubkey": ")" + pubkey_hex + R"(", "timestamp": "12x", "ttl": 100, "data": ""})",
+            R"({"pubkey": ")" + pubkey_hex + R"(", "timestamp": 1626000000000, "data": ""})",
+            R"({"pubkey": ")" + pubkey_hex + R"(", "timestamp": 1626000000000, "expiry": "x", "data": ""})",
+            R"({"pubkey": ")" + pubkey_hex + R"(", "timestamp": 1626000000000, "expiry": 1627000000, "data": ""})",
+            R"({"pubkey": ")" + pubkey_hex + R"(", "timestamp": 1626000000000, "ttl": 1, "data": "!"})"}) {
+        rpc::store s1, s2;
+        CHECK_THROWS_AS(s1.load_from(json::parse(params)), rpc::parse_error);
+        CHECK_THROWS_AS(s2.load_from(json_object_view{params}), rpc::parse_error);
+    }
+}
+
+// Not run by default; run with `Test "[benchmark]"` to see the numbers.
+TEST_CASE("json view - client request parsing speed", "[.][benchmark][json_view]") {
+    using us = std::chrono::duration<double, std::micro>;
+    constexpr int N = 2000;
+
+    auto bench = [&](const char* what, const std::string& request, auto load) {
+        auto started = std::chrono::steady_clock::now();
+        for (int i = 0; i < N; i++)
+            load(request);
+        auto elapsed = us(std::chrono::steady_clock::now() - started) / N;
+        WARN(what << " (" << request.size() << " bytes): " << elapsed.count() << "µs per request");
+        return elapsed;
+    };
+    auto dom = [](auto rpc) {
+        return [](const std::string& request) {
+            auto body = json::parse(request);
+            decltype(rpc) req;
+            req.load_from(std::move(body.at("params")));
+        };
+    };
+    auto view = [](auto rpc) {
+        return [](const std::string& request) {
+            json_object_view body{request};
+            decltype(rpc) req;
+            req.load_from(json_object_view{body.find("params")->raw});
+        };
+    };
+
+    for (size_t size : {100, 2048, 76'800}) {
+        auto req = store_request(size);
+        auto a = bench("store, json DOM", req, dom(rpc::store{}));
+        auto b = bench("store, in place", req, view(rpc::store{}));
+        CHECK(b < a);
+    }
+    auto req = retrieve_request();
+    auto a = bench("retrieve, json DOM", req, dom(rpc::retrieve{}));
+    auto b = bench("retrieve, in place", req, view(rpc::retrieve{}));
+    CHECK(b < a);
+}
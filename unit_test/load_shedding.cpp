@@ -0,0 +1,110 @@
+#include "load_shedding.h"
+#include "omq_server.h"
+#include "request_handler.h"
+
+#include <catch2/catch.hpp>
+#include <oxenmq/bt_serialize.h>
+
+#include <chrono>
+#include <string>
+#include <tuple>
+
+using namespace oxen;
+using namespace std::literals;
+
+namespace {
+
+queue_stats_snapshot queue(int64_t depth, double wait_avg_ms) {
+    queue_stats_snapshot q;
+    q.depth = depth;
+    q.wait_avg_ms = wait_avg_ms;
+    return q;
+}
+
+} // namespace
+
+TEST_CASE("load shedding - admission by priority", "[load_shedding]") {
+    load_shedder shedder;
+    const size_t max_queue = 1000;
+    using p = request_priority;
+
+    // Nothing gets refused while the queue is empty, however slow it was before
+    for (auto pri : {p::storage_test, p::onion, p::client})
+        CHECK(shedder.admit(pri, queue(0, 60'000), max_queue));
+
+    // As the wait grows, client requests get refused first, then onion requests; storage tests only
+    // get refused once they couldn't be answered in time anyway.
+    auto client_limit = SHED_THRESHOLD[2] * CLIENT_REQUEST_DEADLINE / 1.0ms;
+    auto onion_limit = SHED_THRESHOLD[1] * ONION_REQUEST_DEADLINE / 1.0ms;
+    auto storage_test_limit = request_deadline(p::storage_test) / 1.0ms;
+    CHECK(client_limit < onion_limit);
+    CHECK(client_limit < storage_test_limit);
+    CHECK(shedder.admit(p::client, queue(1, client_limit - 1), max_queue));
+    CHECK_FALSE(shedder.admit(p::client, queue(1, client_limit), max_queue));
+    CHECK(shedder.admit(p::onion, queue(1, client_limit), max_queue));
+    CHECK_FALSE(shedder.admit(p::onion, queue(1, onion_limit), max_queue));
+    CHECK(shedder.admit(p::storage_test, queue(1, storage_test_limit - 1), max_queue));
+    CHECK_FALSE(shedder.admit(p::storage_test, queue(1, storage_test_limit), max_queue));
+
+    // Likewise for queue depth
+    CHECK_FALSE(shedder.admit(p::client, queue(500, 0), max_queue));
+    CHECK(shedder.admit(p::onion, queue(500, 0), max_queue));
+    CHECK_FALSE(shedder.admit(p::onion, queue(750, 0), max_queue));
+    CHECK(shedder.admit(p::storage_test, queue(999, 0), max_queue));
+
+    auto client = shedder.get_stats(p::client);
+    CHECK(client.admitted == 2);
+    CHECK(client.shed == 2);
+    auto onion = shedder.get_stats(p::onion);
+    CHECK(onion.admitted == 3);
+    CHECK(onion.shed == 2);
+    auto st = shedder.get_stats(p::storage_test);
+    CHECK(st.admitted == 3);
+    CHECK(st.shed == 1);
+    CHECK(st.expired == 0);
+}
+
+TEST_CASE("load shedding - deadlines", "[load_shedding]") {
+    load_shedder shedder;
+    auto now = std::chrono::steady_clock::now();
+    CHECK_FALSE(shedder.expired(request_priority::client, now + 1ms, now));
+    CHECK(shedder.expired(request_priority::client, now, now));
+    CHECK(shedder.expired(request_priority::client, now - 1s, now));
+    CHECK(shedder.get_stats(request_priority::client).expired == 2);
+    CHECK(shedder.get_stats(request_priority::onion).expired == 0);
+
+    CHECK(load_shedder::retry_after(queue(0, 0)) == 1);
+    CHECK(load_shedder::retry_after(queue(10, 2'500)) == 3);
+    CHECK(load_shedder::retry_after(queue(10, 600'000)) == 30);
+}
+
+TEST_CASE("load shedding - onion request deadlines are passed to the next hop", "[load_shedding][onion]") {
+    OnionRequestMetadata data{x25519_pubkey{}, nullptr, 2, EncryptType::xchacha20};
+    data.deadline = std::chrono::steady_clock::now() + 10s;
+    auto encoded = OxenmqServer::encode_onion_data("payload", data);
+    auto [payload, decoded] = OxenmqServer::decode_onion_data(encoded);
+    CHECK(payload == "payload");
+    CHECK(decoded.hop_no == 2);
+    auto left = decoded.deadline - std::chrono::steady_clock::now();
+    CHECK(left > 9s);
+    CHECK(left <= 10s);
+
+    // Nobody gets to make us wait longer than the hop timeout...
+    data.deadline = std::chrono::steady_clock::now() + 1h;
+    std::tie(payload, decoded) = OxenmqServer::decode_onion_data(
+            OxenmqServer::encode_onion_data("payload", data));
+    CHECK(decoded.deadline - std::chrono::steady_clock::now() <= ONION_HOP_TIMEOUT);
+
+    // ... which is also what requests without a deadline (i.e. from older nodes) get
+    std::tie(payload, decoded) = OxenmqServer::decode_onion_data(oxenmq::bt_serialize(oxenmq::bt_dict{
+            {"data", "payload"}, {"ephemeral_key", std::string(32, '\0')}, {"hop_no", 1}}));
+    left = decoded.deadline - std::chrono::steady_clock::now();
+    CHECK(left > ONION_HOP_TIMEOUT - 1s);
+    CHECK(left <= ONION_HOP_TIMEOUT);
+
+    // An expired request stays expired
+    data.deadline = std::chrono::steady_clock::now() - 1s;
+    std::tie(payload, decoded) = OxenmqServer::decode_onion_data(
+            OxenmqServer::encode_onion_data("payload", data));
+    CHECK(decoded.deadline <= std::chrono::steady_clock::now());
+}
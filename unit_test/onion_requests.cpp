@@ -3,6 +3,9 @@
 #include <ostream>
 
 #include "onion_processing.h"
+#include "request_handler.h"
+
+#include <nlohmann/json.hpp>
 
 using namespace oxen;
 
@@ -27,6 +30,54 @@ TEST_CASE("onion request - final destination", "[onion][final]") {
 
 }
 
+// A final destination request can ask for a bt-encoded response either explicitly or by sending a
+// bt-encoded body.
+TEST_CASE("onion request - final destination with bt response", "[onion][final]") {
+    auto res = process_inner_request(prefix + R"#({"headers": "", "bt": true})#");
+    REQUIRE(std::holds_alternative<FinalDestinationInfo>(res));
+    auto& info = std::get<FinalDestinationInfo>(res);
+    CHECK(info.body == ciphertext);
+    CHECK(info.bt);
+    CHECK(info.base64);
+
+    const auto bt_body = "d6:method4:info6:paramsdee"s;
+    res = process_inner_request("\x1a\0\0\0"s + bt_body + R"#({"headers": "", "base64": false})#");
+    REQUIRE(std::holds_alternative<FinalDestinationInfo>(res));
+    auto expected = FinalDestinationInfo{bt_body, false, false, true};
+    CHECK(std::get<FinalDestinationInfo>(res) == expected);
+
+    res = process_inner_request(prefix + R"#({"headers": ""})#");
+    REQUIRE(std::holds_alternative<FinalDestinationInfo>(res));
+    CHECK_FALSE(std::get<FinalDestinationInfo>(res).bt);
+}
+
+// The response to a final destination request, before it gets encrypted for the client
+TEST_CASE("onion request - final destination responses", "[onion][final]") {
+    using nlohmann::json;
+    const auto bt_type = std::string{http::BT_CONTENT_TYPE};
+
+    // bt: json bodies are bt-encoded and embedded, as are bodies that are already bt-encoded
+    CHECK(onion_response_body({http::OK, json{{"hash", "abc"}, {"t", 123}}}, false, true) ==
+            "d4:bodyd4:hash3:abc1:ti123ee6:statusi200ee");
+    CHECK(onion_response_body({http::OK, "d1:xi1ee"s, {{"Content-Type", bt_type}}}, false, true) ==
+            "d4:bodyd1:xi1ee6:statusi200ee");
+    CHECK(onion_response_body({http::MISDIRECTED_REQUEST, "d5:snodeslee"s, {{"Content-Type", bt_type}}},
+                true, true) == "d4:bodyd5:snodeslee6:statusi421ee");
+    // ... and anything else (i.e. error text) is embedded as a string
+    CHECK(onion_response_body({http::BAD_REQUEST, "invalid json"sv}, false, true) ==
+            "d4:body12:invalid json6:statusi400ee");
+    CHECK(onion_response_body({http::SERVICE_UNAVAILABLE, "Snode not ready"s}, true, true) ==
+            "d4:body15:Snode not ready6:statusi503ee");
+
+    // json: json bodies are embedded, or double-encoded for older clients
+    CHECK(onion_response_body({http::OK, json{{"t", 123}}}, true, false) ==
+            R"({"body":{"t":123},"status":200})");
+    CHECK(onion_response_body({http::OK, json{{"t", 123}}}, false, false) ==
+            R"({"body":"{\"t\":123}","status":200})");
+    CHECK(onion_response_body({http::BAD_REQUEST, "invalid json"sv}, true, false) ==
+            R"({"body":"invalid json","status":400})");
+}
+
 // Provided "host", so the request should go
 // to an extrenal server. Default values will
 // be used for port and protocol.
@@ -4,7 +4,12 @@
 #include <catch2/catch.hpp>
 #include <oxenmq/oxenmq.h>
 
+#include <algorithm>
 #include <chrono>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 using oxen::RateLimiter;
 using namespace std::literals;
@@ -122,3 +127,150 @@ TEST_CASE("rate limiter - client - max client limit", "[ratelim][client]") {
     const auto delta = 1'000'000us / RateLimiter::TOKEN_RATE;
     CHECK_FALSE(rate_limiter.should_rate_limit_client(overflow_ip, now + delta));
 }
+
+TEST_CASE("rate limiter - client - max client limit expires every shard", "[ratelim][client]") {
+    oxenmq::OxenMQ omq;
+    RateLimiter rate_limiter{omq};
+    const auto now = std::chrono::steady_clock::now();
+
+    for (uint32_t i = 0; i < RateLimiter::MAX_CLIENTS; ++i)
+        rate_limiter.should_rate_limit_client((10<<24) + i, now);
+
+    // Once the IPv4 clients have gone idle a new IPv6 client (whose own shard has nothing to
+    // expire) still gets in, and everything idle gets cleared out.
+    const auto delta = 1'000'000us / RateLimiter::TOKEN_RATE;
+    CHECK_FALSE(rate_limiter.should_rate_limit_client("2001:db8::1", now + delta));
+    CHECK(rate_limiter.client_count() == 1);
+}
+
+TEST_CASE("rate limiter - request costs", "[ratelim][client]") {
+    CHECK(RateLimiter::request_cost(0) == 1);
+    CHECK(RateLimiter::request_cost(RateLimiter::BYTES_PER_TOKEN - 1) == 1);
+    CHECK(RateLimiter::request_cost(RateLimiter::BYTES_PER_TOKEN) == 2);
+    CHECK(RateLimiter::request_cost(76'800) == 38);
+
+    oxenmq::OxenMQ omq;
+    RateLimiter rate_limiter{omq};
+    uint32_t identifier = (10<<24) + (1<<16) + (1<<8) + 13;
+    const auto now = std::chrono::steady_clock::now();
+
+    // Expensive requests use up the bucket faster
+    const uint32_t cost = 100;
+    for (uint32_t i = 0; i < RateLimiter::BUCKET_SIZE / cost; ++i)
+        CHECK_FALSE(rate_limiter.should_rate_limit_client(identifier, now, cost));
+    CHECK(rate_limiter.should_rate_limit_client(identifier, now, cost));
+    CHECK(rate_limiter.should_rate_limit_client(identifier, now));
+
+    // ... and have to wait for all the tokens they need
+    const auto token = 1'000'000us / RateLimiter::TOKEN_RATE;
+    CHECK(rate_limiter.should_rate_limit_client(identifier, now + (cost - 1) * token, cost));
+    CHECK_FALSE(rate_limiter.should_rate_limit_client(identifier, now + cost * token, cost));
+
+    // A request can't cost more than a full bucket
+    CHECK(rate_limiter.should_rate_limit_client(identifier + 1, now, RateLimiter::BUCKET_SIZE + 1));
+    CHECK_FALSE(rate_limiter.should_rate_limit_client(identifier + 1, now, RateLimiter::BUCKET_SIZE));
+    CHECK(rate_limiter.should_rate_limit_client(identifier + 1, now));
+}
+
+TEST_CASE("rate limiter - client - addresses", "[ratelim][client]") {
+    oxenmq::OxenMQ omq;
+    RateLimiter rate_limiter{omq};
+    const auto now = std::chrono::steady_clock::now();
+
+    // Dotted quads, packed addresses and host order integers all refer to the same bucket
+    CHECK_FALSE(rate_limiter.should_rate_limit_client("10.1.1.13", now, RateLimiter::BUCKET_SIZE - 1));
+    CHECK_FALSE(rate_limiter.should_rate_limit_client_address("\x0a\x01\x01\x0d", now));
+    CHECK(rate_limiter.should_rate_limit_client((10<<24) + (1<<16) + (1<<8) + 13, now));
+
+    // IPv6 clients get limited too, per /64
+    CHECK_FALSE(rate_limiter.should_rate_limit_client("2001:db8:1:2::1", now, RateLimiter::BUCKET_SIZE));
+    CHECK(rate_limiter.should_rate_limit_client("[2001:db8:1:2:ffff::5]", now));
+    CHECK(rate_limiter.should_rate_limit_client_address(
+            "\x20\x01\x0d\xb8\x00\x01\x00\x02\x12\x34\x56\x78\x9a\xbc\xde\xf0"sv, now));
+    CHECK_FALSE(rate_limiter.should_rate_limit_client("2001:db8:1:3::1", now));
+    CHECK(rate_limiter.client_count() == 3);
+
+    // IPv4-mapped IPv6 addresses are limited as the IPv4 address, not as the (all zero) /64
+    CHECK(rate_limiter.should_rate_limit_client("::ffff:10.1.1.13", now));
+    CHECK(rate_limiter.should_rate_limit_client_address(
+            "\0\0\0\0\0\0\0\0\0\0\xff\xff\x0a\x01\x01\x0d"sv, now));
+    CHECK_FALSE(rate_limiter.should_rate_limit_client("::ffff:10.1.1.14", now, RateLimiter::BUCKET_SIZE));
+    CHECK_FALSE(rate_limiter.should_rate_limit_client("::ffff:10.1.1.15", now));
+    CHECK(rate_limiter.client_count() == 5);
+
+    // Unparseable addresses aren't limited; packed addresses of the wrong size always are
+    CHECK_FALSE(rate_limiter.should_rate_limit_client("not an ip", now));
+    CHECK(rate_limiter.should_rate_limit_client_address("\x01\x02\x03", now));
+}
+
+TEST_CASE("rate limiter - incremental expiry", "[ratelim][client]") {
+    oxenmq::OxenMQ omq;
+    RateLimiter rate_limiter{omq};
+    const auto now = std::chrono::steady_clock::now();
+    const auto token = 1'000'000us / RateLimiter::TOKEN_RATE;
+
+    for (uint32_t i = 0; i < 1000; ++i)
+        rate_limiter.should_rate_limit_client((10<<24) + i, now, 10);
+    CHECK(rate_limiter.client_count() == 1000);
+
+    // Nothing expires until the buckets have had time to refill
+    rate_limiter.expire(now + 9 * token);
+    CHECK(rate_limiter.client_count() == 1000);
+
+    // Requests expire a few idle buckets as they go...
+    for (uint32_t i = 0; i < 10; ++i)
+        rate_limiter.should_rate_limit_client((11<<24) + i, now + 10 * token);
+    CHECK(rate_limiter.client_count() < 1010);
+    CHECK(rate_limiter.client_count() >= 1010 - 10 * RateLimiter::EXPIRE_PER_CALL);
+
+    // ... and the periodic expiry gets the rest
+    rate_limiter.expire(now + RateLimiter::BUCKET_SIZE * token);
+    CHECK(rate_limiter.client_count() == 0);
+}
+
+// Not run by default; run with `Test "[benchmark]"` to see the numbers.
+TEST_CASE("rate limiter - multi-threaded throughput", "[.][benchmark][ratelim]") {
+    using namespace std::chrono;
+    oxenmq::OxenMQ omq;
+    const int max_threads = std::max(4u, std::thread::hardware_concurrency());
+    constexpr int N = 200'000;
+
+    // A single mutex around the buckets, as the rate limiter used to have, for comparison
+    struct single_lock {
+        std::mutex mutex;
+        std::unordered_map<uint32_t, std::pair<uint32_t, steady_clock::time_point>> buckets;
+        bool should_rate_limit_client(uint32_t ip, steady_clock::time_point now) {
+            std::lock_guard lock{mutex};
+            auto& [tokens, last] = buckets.try_emplace(ip, RateLimiter::BUCKET_SIZE, now).first->second;
+            tokens = std::min<uint32_t>(RateLimiter::BUCKET_SIZE,
+                    tokens + duration_cast<microseconds>(now - last).count() * RateLimiter::TOKEN_RATE / 1'000'000);
+            last = now;
+            if (tokens == 0) return true;
+            tokens--;
+            return false;
+        }
+    };
+
+    auto bench = [&](const char* what, int threads, auto& limiter) {
+        std::vector<std::thread> workers;
+        auto started = steady_clock::now();
+        for (int t = 0; t < threads; t++)
+            workers.emplace_back([&limiter, t] {
+                for (int i = 0; i < N; i++)
+                    limiter.should_rate_limit_client(
+                            static_cast<uint32_t>((t << 16) + i % 1000), steady_clock::now());
+            });
+        for (auto& w : workers)
+            w.join();
+        auto elapsed = duration<double>(steady_clock::now() - started).count();
+        auto rate = threads * N / elapsed;
+        WARN(what << ", " << threads << " threads: " << rate / 1e6 << "M requests/s");
+    };
+
+    for (int threads : {1, max_threads}) {
+        single_lock old;
+        RateLimiter sharded{omq};
+        bench("single lock", threads, old);
+        bench("sharded", threads, sharded);
+    }
+}
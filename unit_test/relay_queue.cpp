@@ -0,0 +1,236 @@
+#include "relay_queue.h"
+
+#include <catch2/catch.hpp>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+using oxen::RelayQueue;
+using namespace std::literals;
+
+namespace {
+
+struct sent_batch {
+    oxen::legacy_pubkey pk;
+    std::string data;
+    RelayQueue::send_callback reply;
+};
+
+oxen::sn_record make_snode(char last) {
+    oxen::sn_record sn;
+    sn.pubkey_legacy = oxen::legacy_pubkey::from_hex(
+            "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abc00"s + last);
+    return sn;
+}
+
+} // namespace
+
+TEST_CASE("relay queue - window limits in-flight batches", "[relay]") {
+    std::vector<sent_batch> sent;
+    sent.reserve(64); // replies can queue further sends while we are still iterating
+    RelayQueue q{[&](const oxen::sn_record& sn, const std::string& batch, auto reply) {
+        sent.push_back({sn.pubkey_legacy, batch, std::move(reply)});
+    }};
+
+    auto a = make_snode('a'), b = make_snode('b');
+    for (int i = 0; i < 5; i++) {
+        auto batch = std::make_shared<const std::string>("batch" + std::to_string(i));
+        q.enqueue(a, batch);
+        q.enqueue(b, batch);
+    }
+
+    // Only RELAY_WINDOW batches per peer should have been sent so far
+    REQUIRE(sent.size() == 2 * oxen::RELAY_WINDOW);
+    auto stats = q.get_stats();
+    CHECK(stats.peers == 2);
+    CHECK(stats.bytes_in_flight == 2 * oxen::RELAY_WINDOW * 6);
+    CHECK(stats.bytes_queued == 2 * (5 - oxen::RELAY_WINDOW) * 6);
+
+    // Acknowledging batches lets the rest through, in order
+    for (size_t i = 0; i < sent.size(); i++)
+        sent[i].reply(true);
+
+    REQUIRE(sent.size() == 10);
+    std::vector<std::string> to_a;
+    for (auto& s : sent)
+        if (s.pk == a.pubkey_legacy)
+            to_a.push_back(s.data);
+    CHECK(to_a == std::vector<std::string>{"batch0", "batch1", "batch2", "batch3", "batch4"});
+
+    stats = q.get_stats();
+    CHECK(stats.peers == 0);
+    CHECK(stats.bytes_queued == 0);
+    CHECK(stats.bytes_in_flight == 0);
+    CHECK(stats.bytes_acked == 60);
+    CHECK(stats.batches_acked == 10);
+}
+
+TEST_CASE("relay queue - failed batches are retried after backoff", "[relay]") {
+    std::vector<sent_batch> sent;
+    sent.reserve(64); // replies can queue further sends while we are still iterating
+    std::vector<std::pair<oxen::legacy_pubkey, bool>> failures;
+    RelayQueue q{
+        [&](const oxen::sn_record& sn, const std::string& batch, auto reply) {
+            sent.push_back({sn.pubkey_legacy, batch, std::move(reply)});
+        },
+        [&](const oxen::legacy_pubkey& pk, bool gave_up) { failures.emplace_back(pk, gave_up); }};
+
+    auto a = make_snode('a');
+    q.enqueue(a, std::make_shared<const std::string>("first"));
+    q.enqueue(a, std::make_shared<const std::string>("second"));
+    q.enqueue(a, std::make_shared<const std::string>("third"));
+    REQUIRE(sent.size() == 2);
+
+    // The first batch fails: nothing more should go out until the backoff elapses, even though the
+    // window now has room.
+    sent[0].reply(false);
+    REQUIRE(failures.size() == 1);
+    CHECK_FALSE(failures[0].second);
+    CHECK(sent.size() == 2);
+    q.retry_due();
+    CHECK(sent.size() == 2);
+
+    // The second batch (already in flight) still completes normally
+    sent[1].reply(true);
+    CHECK(sent.size() == 2);
+
+    // Once the backoff has passed the failed batch is resent ahead of the still-queued one
+    q.retry_due(std::chrono::steady_clock::now() + oxen::RELAY_RETRY_MIN + 1s);
+    REQUIRE(sent.size() == 4);
+    CHECK(sent[2].data == "first");
+    CHECK(sent[3].data == "third");
+
+    auto stats = q.get_stats();
+    CHECK(stats.batches_retried == 1);
+    CHECK(stats.batches_acked == 1);
+    CHECK(stats.bytes_in_flight == 10);
+}
+
+TEST_CASE("relay queue - batches are dropped after too many attempts", "[relay]") {
+    std::vector<sent_batch> sent;
+    sent.reserve(64); // replies can queue further sends while we are still iterating
+    int gave_up = 0, failed = 0;
+    RelayQueue q{
+        [&](const oxen::sn_record& sn, const std::string& batch, auto reply) {
+            sent.push_back({sn.pubkey_legacy, batch, std::move(reply)});
+        },
+        [&](const oxen::legacy_pubkey&, bool g) { failed++; if (g) gave_up++; }};
+
+    auto a = make_snode('a');
+    q.enqueue(a, std::make_shared<const std::string>("doomed"));
+
+    auto later = std::chrono::steady_clock::now();
+    for (int i = 0; i < oxen::RELAY_MAX_ATTEMPTS; i++) {
+        REQUIRE(sent.size() == size_t(i + 1));
+        sent.back().reply(false);
+        later += oxen::RELAY_RETRY_MAX + 1s;
+        q.retry_due(later);
+    }
+
+    CHECK(sent.size() == size_t(oxen::RELAY_MAX_ATTEMPTS));
+    CHECK(failed == oxen::RELAY_MAX_ATTEMPTS);
+    CHECK(gave_up == 1);
+    auto stats = q.get_stats();
+    CHECK(stats.batches_failed == 1);
+    CHECK(stats.bytes_queued == 0);
+    CHECK(stats.bytes_in_flight == 0);
+    CHECK(stats.peers == 0);
+}
+
+TEST_CASE("relay queue - failed batches keep their order", "[relay]") {
+    std::vector<sent_batch> sent;
+    sent.reserve(64); // replies can queue further sends while we are still iterating
+    RelayQueue q{[&](const oxen::sn_record& sn, const std::string& batch, auto reply) {
+        sent.push_back({sn.pubkey_legacy, batch, std::move(reply)});
+    }};
+
+    static_assert(oxen::RELAY_WINDOW == 2);
+    auto a = make_snode('a');
+    for (auto b : {"first", "second", "third"})
+        q.enqueue(a, std::make_shared<const std::string>(b));
+    REQUIRE(sent.size() == 2);
+
+    // Both in-flight batches fail
+    sent[0].reply(false);
+    sent[1].reply(false);
+    auto later = std::chrono::steady_clock::now() + oxen::RELAY_RETRY_MAX + 1s;
+    q.retry_due(later);
+    REQUIRE(sent.size() == 4);
+    CHECK(sent[2].data == "first");
+    CHECK(sent[3].data == "second");
+
+    // Same again (replies in the other order) with a batch that was never sent queued behind them
+    sent[2].reply(true);
+    q.retry_due(later);
+    REQUIRE(sent.size() == 5);
+    CHECK(sent[4].data == "third");
+    sent[4].reply(false);
+    sent[3].reply(false);
+    q.retry_due(later + oxen::RELAY_RETRY_MAX + 1s);
+    REQUIRE(sent.size() == 7);
+    CHECK(sent[5].data == "second");
+    CHECK(sent[6].data == "third");
+}
+
+TEST_CASE("relay queue - streamed batches are produced on demand", "[relay]") {
+    std::vector<sent_batch> sent;
+    sent.reserve(64); // replies can queue further sends while we are still iterating
+    RelayQueue q{[&](const oxen::sn_record& sn, const std::string& batch, auto reply) {
+        sent.push_back({sn.pubkey_legacy, batch, std::move(reply)});
+    }};
+
+    const int batches = 5;
+    int produced = 0;
+    bool finished = false;
+    auto a = make_snode('a'), b = make_snode('b');
+    q.enqueue(a, std::make_shared<const std::string>("queued"));
+    q.enqueue({a, b}, [&]() -> std::shared_ptr<const std::string> {
+        if (produced == batches) {
+            finished = true;
+            return nullptr;
+        }
+        return std::make_shared<const std::string>("batch" + std::to_string(produced++));
+    });
+
+    // Only what fits in the peers' windows has been produced, and both peers share the batches
+    REQUIRE(sent.size() == 2 * oxen::RELAY_WINDOW);
+    CHECK(produced == 2);
+    auto stats = q.get_stats();
+    CHECK(stats.peers == 2);
+    CHECK(stats.bytes_queued == 0);
+
+    // a keeps acknowledging while b sits on its batches: a gets ahead, producing the rest
+    auto to = [&](const oxen::sn_record& sn) {
+        std::vector<std::string> data;
+        for (auto& s : sent)
+            if (s.pk == sn.pubkey_legacy)
+                data.push_back(s.data);
+        return data;
+    };
+    for (size_t i = 0; i < sent.size(); i++)
+        if (sent[i].pk == a.pubkey_legacy)
+            sent[i].reply(true);
+    CHECK(produced == batches);
+    CHECK(finished);
+    CHECK(to(a) == std::vector<std::string>{"queued", "batch0", "batch1", "batch2", "batch3", "batch4"});
+    CHECK(to(b) == std::vector<std::string>{"batch0", "batch1"});
+    CHECK(q.get_stats().peers == 1);
+
+    // b then gets the same batches, without them being produced again
+    for (size_t i = 0; i < sent.size(); i++)
+        if (sent[i].pk == b.pubkey_legacy)
+            sent[i].reply(true);
+    CHECK(produced == batches);
+    CHECK(to(b) == std::vector<std::string>{"batch0", "batch1", "batch2", "batch3", "batch4"});
+
+    stats = q.get_stats();
+    CHECK(stats.peers == 0);
+    CHECK(stats.batches_acked == 11);
+    CHECK(stats.bytes_in_flight == 0);
+
+    // An empty stream doesn't leave anything behind
+    q.enqueue({a}, [] { return std::shared_ptr<const std::string>{}; });
+    CHECK(q.get_stats().peers == 0);
+}
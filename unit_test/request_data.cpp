@@ -0,0 +1,65 @@
+#include "client_rpc_endpoints.h"
+
+#include <catch2/catch.hpp>
+#include <oxenmq/base64.h>
+
+#include <string>
+
+using namespace oxen;
+using namespace std::literals;
+
+namespace {
+
+std::string payload(size_t size) {
+    std::string data(size, '\0');
+    for (size_t i = 0; i < size; i++)
+        data[i] = static_cast<char>(i * 37 & 0xff);
+    return data;
+}
+
+} // namespace
+
+TEST_CASE("request data - borrowing and decoding", "[request_data][rpc]") {
+    auto bytes = payload(100);
+
+    rpc::request_data d;
+    d.borrow(bytes);
+    CHECK_FALSE(d.owned());
+    CHECK(d.data() == bytes.data());
+
+    // Copies of borrowed data borrow the same data
+    auto d2 = d;
+    CHECK(d2.data() == bytes.data());
+
+    for (auto b64 : {oxenmq::to_base64(bytes), oxenmq::to_base64(bytes.substr(0, 98)),
+            oxenmq::to_base64(bytes.substr(0, 97))}) {
+        d.decode_base64(b64);
+        CHECK(d.owned());
+        CHECK(d.view() == oxenmq::from_base64(b64));
+        // Also without the padding:
+        while (b64.back() == '=')
+            b64.pop_back();
+        d.decode_base64(b64);
+        CHECK(d.view() == oxenmq::from_base64(b64));
+    }
+    d.decode_base64("");
+    CHECK(d.owned());
+    CHECK(d.empty());
+
+    // Owned data gets copied (and still points at the right place after a move, even when short
+    // enough to be stored inside the std::string)
+    for (auto b64 : {oxenmq::to_base64(bytes), "aGk="s}) {
+        d.decode_base64(b64);
+        auto copy = d;
+        CHECK(copy == d);
+        CHECK(copy.data() != d.data());
+        auto moved = std::move(copy);
+        CHECK(moved == d);
+        CHECK(moved.owned());
+        CHECK(copy.empty());
+        rpc::request_data assigned;
+        assigned = std::move(moved);
+        CHECK(assigned == d);
+        CHECK(assigned.data() != d.data());
+    }
+}
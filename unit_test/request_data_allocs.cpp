@@ -0,0 +1,160 @@
+#include "Database.hpp"
+#include "client_rpc_endpoints.h"
+#include "json_view.h"
+
+#include <catch2/catch.hpp>
+#include <nlohmann/json.hpp>
+#include <oxenmq/base64.h>
+#include <oxenmq/bt_serialize.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <new>
+#include <string>
+#include <unistd.h>
+
+using namespace oxen;
+using namespace std::literals;
+
+namespace {
+
+// Allocation tracking, for checking that store payloads don't get copied around.  We only count
+// allocations at least as large as `large_alloc` (i.e. ones that could hold the payload), made by
+// this thread while `counting` is set: everything else (e.g. the decoded pubkey, and the catch2
+// machinery) is just noise.
+//
+// This replaces the global operator new, which is why these tests get their own AllocTest binary
+// rather than going into Test.
+thread_local bool counting = false;
+thread_local size_t large_alloc = 0;
+thread_local int large_allocs = 0;
+
+// Counts large allocations made during its lifetime
+struct alloc_counter {
+    explicit alloc_counter(size_t min_size) {
+        large_alloc = min_size;
+        large_allocs = 0;
+        counting = true;
+    }
+    ~alloc_counter() { counting = false; }
+    int stop() {
+        counting = false;
+        return large_allocs;
+    }
+};
+
+} // namespace
+
+void* operator new(size_t size) {
+    if (counting && size >= large_alloc)
+        large_allocs++;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc{};
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+namespace {
+
+const auto pubkey_hex = "054368520005786b249bcd461d28f75e560ea794014eeb17fcf6003f37d876783e"s;
+
+std::string payload(size_t size) {
+    std::string data(size, '\0');
+    for (size_t i = 0; i < size; i++)
+        data[i] = static_cast<char>(i * 37 & 0xff);
+    return data;
+}
+
+int64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+std::string bt_store_request(const std::string& data) {
+    return oxenmq::bt_serialize(oxenmq::bt_dict{
+            {"data", data},
+            {"pubkey", pubkey_hex},
+            {"timestamp", now_ms()},
+            {"ttl", 1'209'600'000}});
+}
+
+std::string json_store_request(const std::string& data) {
+    return nlohmann::json{
+            {"data", oxenmq::to_base64(data)},
+            {"pubkey", pubkey_hex},
+            {"timestamp", now_ms()},
+            {"ttl", 1'209'600'000}}.dump();
+}
+
+bool points_into(std::string_view inner, std::string_view outer) {
+    return inner.data() >= outer.data() && inner.data() + inner.size() <= outer.data() + outer.size();
+}
+
+struct temp_db_dir {
+    std::filesystem::path path = std::filesystem::temp_directory_path() /
+        ("ss-request-data-test-" + std::to_string(::getpid()));
+    temp_db_dir() { std::filesystem::create_directories(path); }
+    ~temp_db_dir() { std::filesystem::remove_all(path); }
+};
+
+} // namespace
+
+TEST_CASE("request data - store payloads are not copied", "[request_data][rpc]") {
+    const size_t size = 4096;
+    const auto data = payload(size);
+
+    SECTION("bt requests borrow the data from the request") {
+        auto request = bt_store_request(data);
+        rpc::store req;
+        alloc_counter allocs{size};
+        req.load_from(oxenmq::bt_dict_consumer{request});
+        CHECK(allocs.stop() == 0);
+        CHECK_FALSE(req.data.owned());
+        CHECK(points_into(req.data, request));
+        CHECK(req.data == data);
+    }
+
+    SECTION("json requests decode straight into the request data") {
+        auto request = json_store_request(data);
+        rpc::store req;
+        alloc_counter allocs{size};
+        req.load_from(json_object_view{request});
+        CHECK(allocs.stop() == 1);
+        CHECK(req.data.owned());
+        CHECK(req.data == data);
+
+        // The json DOM already has its own copy of the base64 data, but it still only gets decoded
+        // once.
+        auto body = nlohmann::json::parse(request);
+        rpc::store req2;
+        alloc_counter allocs2{size};
+        req2.load_from(std::move(body));
+        CHECK(allocs2.stop() == 1);
+        CHECK(req2.data == data);
+    }
+
+    SECTION("stored from the request without another copy") {
+        auto request = bt_store_request(data);
+        rpc::store req;
+        req.load_from(oxenmq::bt_dict_consumer{request});
+
+        temp_db_dir dir;
+        Database db{dir.path};
+        // SQLite copies the bound data into its own (malloc'd) pages, but nothing should make a
+        // copy of it before that.
+        alloc_counter allocs{size};
+        auto stored = db.store(
+                {std::move(req.pubkey), "hash", req.timestamp, req.expiry, req.data});
+        CHECK(allocs.stop() == 0);
+        REQUIRE(stored);
+        CHECK(*stored);
+
+        user_pubkey_t pk;
+        REQUIRE(pk.load(pubkey_hex));
+        auto msgs = db.retrieve(pk, "");
+        REQUIRE(msgs.size() == 1);
+        CHECK(msgs[0].data == data);
+    }
+}
@@ -0,0 +1,153 @@
+#include "channel_encryption.hpp"
+#include "lozzaxd_key.h"
+#include "omq_server.h"
+#include "request_handler.h"
+#include "service_node.h"
+#include "version.h"
+
+#include <catch2/catch.hpp>
+#include <nlohmann/json.hpp>
+#include <oxenmq/bt_serialize.h>
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+using namespace oxen;
+using namespace std::literals;
+using nlohmann::json;
+
+namespace {
+
+using headers = std::vector<std::pair<std::string, std::string>>;
+const headers bt_headers{{"Content-Type", std::string{http::BT_CONTENT_TYPE}}};
+
+// A request handler for a node that isn't connected to anything, for the requests that don't need
+// the network (or the swarm).
+struct test_handler {
+    // The X25519 key pair from RFC 7748 (OxenMQ checks that the keys go together)
+    const x25519_seckey x_sk = x25519_seckey::from_hex(
+            "77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a");
+    const x25519_pubkey x_pk = x25519_pubkey::from_hex(
+            "8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a");
+    const std::filesystem::path db_dir =
+            std::filesystem::temp_directory_path() / "oxen-ss-request-handler-test";
+
+    std::optional<OxenmqServer> omq;
+    std::optional<ServiceNode> sn;
+    std::optional<ChannelEncryption> cipher;
+    std::optional<RequestHandler> handler;
+
+    test_handler() {
+        std::filesystem::remove_all(db_dir);
+        std::filesystem::create_directories(db_dir);
+        sn_record me{"127.0.0.1", 8080, 8081, {}, {}, x_pk};
+        omq.emplace(me, x_sk, std::vector<x25519_pubkey>{});
+        sn.emplace(me, legacy_seckey{}, *omq, db_dir, true);
+        cipher.emplace(x_sk, x_pk);
+        handler.emplace(*sn, *cipher, ed25519_seckey{});
+    }
+    ~test_handler() {
+        handler.reset();
+        sn.reset();
+        omq.reset();
+        std::filesystem::remove_all(db_dir);
+    }
+
+    // Processes a client request as the HTTPS server does, returning the response (which these
+    // requests all give right away)
+    Response request(std::string_view body, bool bt_response) {
+        std::optional<Response> res;
+        handler->process_client_req(body, [&res](Response r) { res = std::move(r); }, bt_response);
+        REQUIRE(res);
+        return std::move(*res);
+    }
+};
+
+// The expected bt-encoded body of an `info` response with timestamp `t`
+std::string bt_info(int64_t t) {
+    auto& v = STORAGE_SERVER_VERSION;
+    return "d9:timestampi" + std::to_string(t) + "e7:versionli" + std::to_string(v[0]) + "ei" +
+        std::to_string(v[1]) + "ei" + std::to_string(v[2]) + "eee";
+}
+
+int64_t bt_timestamp(std::string_view body) {
+    oxenmq::bt_dict_consumer d{body};
+    REQUIRE(d.skip_until("timestamp"));
+    return d.consume_integer<int64_t>();
+}
+
+} // namespace
+
+TEST_CASE("request handler - bt-encoded responses", "[request_handler][bt]") {
+    // json bodies get bt-encoded, with binary values as-is
+    auto res = bt_encode_response(Response{http::OK,
+            json{{"hash", "abc"}, {"list", {1, 2}}, {"t", 1626000000000}, {"ok", "\xff\x00"s}}});
+    CHECK(res.status == http::OK);
+    CHECK(std::get<std::string>(res.body) ==
+            "d4:hash3:abc4:listli1ei2ee2:ok2:\xff\x00" "1:ti1626000000000ee"s);
+    CHECK(res.headers == bt_headers);
+
+    // Successful and wrong swarm string bodies are already bt-encoded
+    res = bt_encode_response(Response{http::MISDIRECTED_REQUEST, "d5:snodeslee"s});
+    CHECK(std::get<std::string>(res.body) == "d5:snodeslee");
+    CHECK(res.headers == bt_headers);
+
+    // ... and only get the content type once
+    res = bt_encode_response(std::move(res));
+    CHECK(res.headers == bt_headers);
+
+    // Other errors are plain text
+    res = bt_encode_response(Response{http::BAD_REQUEST, "invalid request: bad pubkey"sv});
+    CHECK(res.status == http::BAD_REQUEST);
+    CHECK(std::get<std::string_view>(res.body) == "invalid request: bad pubkey");
+    CHECK(res.headers.empty());
+
+    // Unless they are json, which gets bt-encoded like any other json body
+    res = bt_encode_response(Response{http::NOT_ACCEPTABLE, json{{"failed", true}}});
+    CHECK(std::get<std::string>(res.body) == "d6:failedi1ee");
+    CHECK(res.headers == bt_headers);
+}
+
+TEST_CASE("request handler - bt-encoded client request responses", "[request_handler][bt]") {
+    test_handler h;
+
+    // A json request asking for a bt response (e.g. via the HTTPS Accept header)
+    auto res = h.request(R"({"method":"info","params":{}})", true);
+    CHECK(res.status == http::OK);
+    CHECK(res.headers == bt_headers);
+    auto& body = std::get<std::string>(res.body);
+    CHECK(body == bt_info(bt_timestamp(body)));
+
+    // A bt request gets a bt response either way
+    for (bool bt_response : {false, true}) {
+        res = h.request("d6:method4:info6:paramsdee", bt_response);
+        CHECK(res.status == http::OK);
+        CHECK(res.headers == bt_headers);
+        auto& b = std::get<std::string>(res.body);
+        CHECK(b == bt_info(bt_timestamp(b)));
+    }
+
+    // Whereas without it a json request gets json
+    res = h.request(R"({"method":"info","params":{}})", false);
+    CHECK(res.status == http::OK);
+    CHECK(res.headers.empty());
+    CHECK(std::get<json>(res.body)["version"] == json(STORAGE_SERVER_VERSION));
+
+    // Errors are sent as plain text
+    res = h.request(R"({"method":"bogus","params":{}})", true);
+    CHECK(res.status == http::BAD_REQUEST);
+    CHECK(std::get<std::string>(res.body) == "no method bogus");
+    CHECK(res.headers.empty());
+
+    res = h.request("d6:methodi1e6:paramsdee", true);
+    CHECK(res.status == http::BAD_REQUEST);
+    CHECK(std::get<std::string_view>(res.body) == "invalid bt request");
+    CHECK(res.headers.empty());
+
+    res = h.request(R"({"method":"store","params":{}})", true);
+    CHECK(res.status == http::BAD_REQUEST);
+    CHECK(std::get<std::string>(res.body).rfind("invalid request: ", 0) == 0);
+    CHECK(res.headers.empty());
+}
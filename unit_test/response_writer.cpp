@@ -0,0 +1,266 @@
+#include "omq_server.h"
+#include "request_handler.h"
+#include "response_writer.h"
+
+#include <catch2/catch.hpp>
+#include <nlohmann/json.hpp>
+#include <oxenmq/base64.h>
+#include <oxenmq/bt_serialize.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+using namespace oxen;
+using namespace std::literals;
+
+namespace {
+
+struct test_message {
+    std::string hash;
+    std::string data;
+    int64_t timestamp;
+    int64_t expiry;
+};
+
+std::vector<test_message> make_messages(size_t count, size_t data_size) {
+    std::vector<test_message> msgs;
+    for (size_t i = 0; i < count; i++) {
+        auto& m = msgs.emplace_back();
+        m.hash = oxenmq::to_base64(std::to_string(i * 7919) + "-hash-of-the-message");
+        m.data.resize(data_size);
+        for (size_t j = 0; j < data_size; j++)
+            m.data[j] = static_cast<char>((i + j * 31) & 0xff);
+        m.timestamp = 1'626'000'000'000 + i;
+        m.expiry = m.timestamp + 14 * 24 * 3600 * 1000LL;
+    }
+    return msgs;
+}
+
+// A retrieve response built as a json DOM, as process_client_req(rpc::retrieve) used to do.
+nlohmann::json retrieve_json(const std::vector<test_message>& msgs, int64_t t) {
+    auto messages = nlohmann::json::array();
+    for (const auto& m : msgs)
+        messages.push_back(nlohmann::json{
+                {"hash", m.hash},
+                {"timestamp", m.timestamp},
+                {"expiration", m.expiry},
+                {"data", oxenmq::to_base64(m.data)}});
+    return nlohmann::json{{"messages", std::move(messages)}, {"t", t}};
+}
+
+void write_retrieve(response_writer& w, const std::vector<test_message>& msgs, int64_t t) {
+    w.begin_dict();
+    w.key("messages");
+    w.begin_list();
+    for (const auto& m : msgs) {
+        w.begin_dict();
+        w.key("data");
+        w.binary(m.data);
+        w.key("expiration");
+        w.integer(m.expiry);
+        w.key("hash");
+        w.string(m.hash);
+        w.key("timestamp");
+        w.integer(m.timestamp);
+        w.end_dict();
+    }
+    w.end_list();
+    w.key("t");
+    w.integer(t);
+    w.end_dict();
+}
+
+std::string write_retrieve(bool bt, const std::vector<test_message>& msgs, int64_t t) {
+    std::string out;
+    response_writer w{bt, out};
+    write_retrieve(w, msgs, t);
+    return out;
+}
+
+} // namespace
+
+TEST_CASE("response writer - json output", "[response_writer]") {
+    std::string out;
+    response_writer w{false, out};
+    w.begin_dict();
+    w.key("a");
+    w.begin_list();
+    w.integer(-5);
+    w.string("quote\" backslash\\ newline\n tab\t ctrl\x01\x1f 🦆");
+    w.binary("\xff\x00\x01"sv);
+    w.boolean(true);
+    w.boolean(false);
+    w.begin_dict();
+    w.end_dict();
+    w.begin_list();
+    w.end_list();
+    w.end_list();
+    w.key("b");
+    w.integer(0);
+    w.key("c");
+    w.begin_dict();
+    w.key("z");
+    w.string("");
+    w.end_dict();
+    w.end_dict();
+
+    auto expected = nlohmann::json{
+            {"a", {-5, "quote\" backslash\\ newline\n tab\t ctrl\x01\x1f 🦆", "/wAB", true, false,
+                    nlohmann::json::object(), nlohmann::json::array()}},
+            {"b", 0},
+            {"c", {{"z", ""}}}};
+    CHECK(out == expected.dump());
+    CHECK(nlohmann::json::parse(out) == expected);
+
+    // Appends to what is already there
+    response_writer w2{false, out};
+    w2.integer(42);
+    CHECK(out == expected.dump() + "42");
+}
+
+TEST_CASE("response writer - bt output", "[response_writer]") {
+    std::string out;
+    response_writer w{true, out};
+    w.begin_dict();
+    w.key("a");
+    w.begin_list();
+    w.integer(-5);
+    w.string("str\"\n");
+    w.binary("\xff\x00\x01"sv);
+    w.boolean(true);
+    w.begin_dict();
+    w.end_dict();
+    w.begin_list();
+    w.end_list();
+    w.end_list();
+    w.key("b");
+    w.integer(0);
+    w.key("c");
+    w.raw("l1:xi3ee");
+    w.end_dict();
+
+    CHECK(out == oxenmq::bt_serialize(oxenmq::bt_dict{
+            {"a", oxenmq::bt_list{-5, "str\"\n"s, "\xff\x00\x01"sv, 1, oxenmq::bt_dict{}, oxenmq::bt_list{}}},
+            {"b", 0},
+            {"c", oxenmq::bt_list{"x", 3}}}));
+}
+
+TEST_CASE("response writer - retrieve responses", "[response_writer]") {
+    for (size_t data_size : {0, 1, 2, 3, 100}) {
+        auto msgs = make_messages(5, data_size);
+        const int64_t t = 1'626'000'123'456;
+
+        // Same as the DOM-built json...
+        CHECK(write_retrieve(false, msgs, t) == retrieve_json(msgs, t).dump());
+
+        // ... and as its bt conversion, except that data is raw instead of base64
+        auto j = retrieve_json(msgs, t);
+        for (size_t i = 0; i < msgs.size(); i++)
+            j["messages"][i]["data"] = msgs[i].data;
+        CHECK(write_retrieve(true, msgs, t) == oxenmq::bt_serialize(json_to_bt(j)));
+
+        for (auto& m : msgs) {
+            CHECK(response_writer::binary_size(false, m.data.size()) ==
+                    oxenmq::to_base64(m.data).size() + 2);
+            CHECK(response_writer::binary_size(true, m.data.size()) ==
+                    oxenmq::bt_serialize(m.data).size());
+        }
+    }
+}
+
+TEST_CASE("response writer - swarm responses", "[response_writer][swarm]") {
+    using nlohmann::json;
+    const auto sig = std::string(64, '\xee');
+    const auto own = std::string(64, 'a'), failed_peer = std::string(64, 'b');
+    const auto peer1 = std::string(64, 'c'), peer2 = std::string(64, 'd');
+    swarm_peer_results peers{
+        {peer1, oxenmq::bt_serialize(oxenmq::bt_dict{{"hash", "h1"}, {"signature", sig}})},
+        {peer2, oxenmq::bt_serialize(oxenmq::bt_dict{{"failed", 1}, {"query_failure", 1}})}};
+
+    // Our own result, as built by a recursive request handler for a bt client
+    json result{
+        {"hash", "h1"},
+        {"swarm", {
+            {own, {{"hash", "h1"}, {"signature", sig}}},
+            {failed_peer, {{"failed", true}, {"timeout", true}}}}},
+        {"t", 1'626'000'000'000}};
+
+    // The bt response is the same as converting everything through json, as we used to
+    auto expected = result;
+    for (auto& [member, r] : peers)
+        expected["swarm"][member] = bt_to_json(oxenmq::bt_dict_consumer{r});
+    CHECK(swarm_response_bt(result, peers) == oxenmq::bt_serialize(json_to_bt(expected)));
+    CHECK(swarm_response_bt(result, {}) == oxenmq::bt_serialize(json_to_bt(result)));
+
+    // ... even when our own result doesn't have any "swarm" entries (or other keys)
+    json no_swarm{{"t", 1}};
+    CHECK(swarm_response_bt(no_swarm, peers) == oxenmq::bt_serialize(oxenmq::bt_dict{
+            {"swarm", oxenmq::bt_dict{
+                {peer1, oxenmq::bt_dict{{"hash", "h1"}, {"signature", sig}}},
+                {peer2, oxenmq::bt_dict{{"failed", 1}, {"query_failure", 1}}}}},
+            {"t", 1}}));
+    CHECK(swarm_response_bt(json::object(), peers) ==
+            "d5:swarmd" + std::to_string(peer1.size()) + ":" + peer1 + peers[peer1] +
+            std::to_string(peer2.size()) + ":" + peer2 + peers[peer2] + "ee");
+
+    // For json, peer results get decoded, with base64 signatures
+    auto j = result;
+    peers["e"] = "not bt";
+    merge_swarm_response_json(j, peers);
+    CHECK(j["swarm"][peer1] == json{{"hash", "h1"}, {"signature", oxenmq::to_base64(sig)}});
+    CHECK(j["swarm"][peer2] == json{{"failed", 1}, {"query_failure", 1}});
+    CHECK(j["swarm"]["e"] == json{{"failed", true}, {"bad_peer_response", true}});
+    CHECK(j["swarm"][own] == result["swarm"][own]);
+    CHECK(j["swarm"][failed_peer] == result["swarm"][failed_peer]);
+    CHECK(j["hash"] == "h1");
+}
+
+TEST_CASE("response writer - bt dict validation", "[response_writer][swarm]") {
+    for (auto good : {"de"s, "d1:ai1ee"s, "d1:ai-12e1:bl0:d1:xleee3:sigl4:abcdee"s,
+                "d1:a4:"s + std::string{"\0\xff\x01\x02", 4} + "e"})
+        CHECK(is_bt_dict(good));
+    for (auto bad : {"", "le", "i1e", "d", "d1:ai1e", "d1:ai1eex", "di1ei2ee", "d1:ae", "d1:a3:xye",
+                "d1:aiee", "d1:ai-ee", "d1:ai1xee", "d1:ax1:be", "d1:a-1:xe", "d:e"})
+        CHECK_FALSE(is_bt_dict(bad));
+    // Limited nesting
+    CHECK_FALSE(is_bt_dict("d1:a" + std::string(100, 'l') + std::string(100, 'e') + "e"));
+}
+
+// Not run by default; run with `Test "[benchmark]"` to see the numbers.
+TEST_CASE("response writer - retrieve response generation", "[.][benchmark][response_writer]") {
+    using us = std::chrono::duration<double, std::micro>;
+    auto msgs = make_messages(100, 2048);
+    const int64_t t = 1'626'000'123'456;
+    constexpr int N = 200;
+
+    auto bench = [&](const char* what, auto f) {
+        size_t size = 0;
+        auto started = std::chrono::steady_clock::now();
+        for (int i = 0; i < N; i++)
+            size += f().size();
+        auto elapsed = us(std::chrono::steady_clock::now() - started) / N;
+        WARN(what << ": " << elapsed.count() << "µs per response (" << size / N << " bytes)");
+        return elapsed;
+    };
+
+    auto dom_json = bench("json DOM + dump", [&] { return retrieve_json(msgs, t).dump(); });
+    auto dom_bt = bench("json DOM + json_to_bt + bt_serialize", [&] {
+        return oxenmq::bt_serialize(json_to_bt(retrieve_json(msgs, t)));
+    });
+    std::string buf;
+    auto direct_json = bench("response_writer json", [&]() -> const std::string& {
+        buf.clear();
+        response_writer w{false, buf};
+        write_retrieve(w, msgs, t);
+        return buf;
+    });
+    auto direct_bt = bench("response_writer bt", [&]() -> const std::string& {
+        buf.clear();
+        response_writer w{true, buf};
+        write_retrieve(w, msgs, t);
+        return buf;
+    });
+    CHECK(direct_json < dom_json);
+    CHECK(direct_bt < dom_bt);
+}
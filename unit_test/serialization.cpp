@@ -2,8 +2,15 @@
 #include "service_node.h"
 
 #include <catch2/catch.hpp>
+#include <oxenmq/base64.h>
+#include <oxenmq/hex.h>
 
+#include <algorithm>
+#include <cctype>
 #include <chrono>
+#include <map>
+#include <random>
+#include <sstream>
 #include <string>
 
 using namespace oxen;
@@ -123,3 +130,343 @@ TEST_CASE("v1 serialization - batch serialization", "[serialization]") {
     serialized = serialize_messages(msgs.begin(), msgs.end(), 1);
     CHECK(serialized.size() == 2);
 }
+
+TEST_CASE("v1 serialization - exact batch packing", "[serialization]") {
+    user_pubkey_t pub_key;
+    REQUIRE(pub_key.load("054368520005786b249bcd461d28f75e560ea794014eeb17fcf6003f37d876783e"s));
+    const std::chrono::system_clock::time_point timestamp{1'622'576'077'123ms};
+    std::vector<message> msgs;
+    for (int i = 0; i < 200; i++)
+        msgs.emplace_back(pub_key, "hash" + std::to_string(i), timestamp, timestamp + 1h * i,
+                std::string(1 + 137'000 * (i % 7), 'a' + i % 26));
+    // Something too big to share a batch with anything:
+    msgs.emplace_back(pub_key, "huge", timestamp, timestamp + 1h, std::string(SERIALIZATION_BATCH_SIZE, 'z'));
+    msgs.emplace_back(pub_key, "last", timestamp, timestamp + 1h, "last"s);
+
+    // The serialized size of a single message, without the batch overhead
+    auto msg_size = [](const message& m) {
+        return serialize_messages(&m, &m + 1, 1).front().size() - 3;
+    };
+
+    std::vector<std::string> batches;
+    serialize_messages(msgs.begin(), msgs.end(), 1, [&](std::string&& batch) {
+        // Each batch should be allocated once, at exactly the size it needs
+        CHECK(batch.capacity() - batch.size() < 16);
+        batches.push_back(std::move(batch));
+    });
+    REQUIRE(batches.size() > 2);
+
+    size_t next = 0;
+    for (size_t b = 0; b < batches.size(); b++) {
+        auto& batch = batches[b];
+        auto views = deserialize_message_views(batch);
+        REQUIRE(views);
+        REQUIRE_FALSE(views->empty());
+        size_t expected_size = 3;
+        for (auto& v : *views) {
+            REQUIRE(next < msgs.size());
+            CHECK(v.hash == msgs[next].hash);
+            CHECK(v.data == msgs[next].data);
+            CHECK(v.expiry == msgs[next].expiry);
+            expected_size += msg_size(msgs[next++]);
+        }
+        CHECK(batch.size() == expected_size);
+        if (views->size() > 1)
+            CHECK(batch.size() <= SERIALIZATION_BATCH_SIZE);
+        // Batches are packed as full as possible: the next message wouldn't have fit
+        if (next < msgs.size())
+            CHECK(batch.size() + msg_size(msgs[next]) > SERIALIZATION_BATCH_SIZE);
+    }
+    CHECK(next == msgs.size());
+    CHECK(batches[batches.size() - 2].size() > SERIALIZATION_BATCH_SIZE); // the huge one
+}
+
+TEST_CASE("serialization - batches on demand", "[serialization]") {
+    user_pubkey_t pub_key;
+    REQUIRE(pub_key.load("054368520005786b249bcd461d28f75e560ea794014eeb17fcf6003f37d876783e"s));
+    const std::chrono::system_clock::time_point timestamp{1'622'576'077'123ms};
+    std::vector<message> msgs;
+    for (int i = 0; i < 30; i++)
+        msgs.emplace_back(pub_key, "hash" + std::to_string(i), timestamp, timestamp + 1h,
+                std::string(1'000'000, 'a' + i));
+
+    for (uint8_t version : {SERIALIZATION_VERSION_OLD, SERIALIZATION_VERSION_BT,
+            SERIALIZATION_VERSION_COMPACT}) {
+        auto expected = serialize_messages(msgs.begin(), msgs.end(), version);
+        REQUIRE(expected.size() > 2);
+
+        // Messages only get pulled in as each batch is asked for
+        size_t pulled = 0;
+        batch_serializer serializer{[&]() -> const message* {
+            return pulled < msgs.size() ? &msgs[pulled++] : nullptr;
+        }, version};
+        CHECK(pulled == 0);
+        std::vector<std::string> batches;
+        while (auto batch = serializer.next()) {
+            batches.push_back(std::move(*batch));
+            if (batches.size() == 1)
+                CHECK(pulled < msgs.size());
+        }
+        CHECK(batches == expected);
+        CHECK_FALSE(serializer.next());
+    }
+
+    // No messages still gives one (empty) batch, as with serialize_messages
+    batch_serializer empty{[]() -> const message* { return nullptr; }, SERIALIZATION_VERSION_COMPACT};
+    CHECK(empty.next());
+    CHECK_FALSE(empty.next());
+}
+
+TEST_CASE("v1 serialization - zero-copy deserialization", "[serialization]") {
+    user_pubkey_t pub_key;
+    REQUIRE(pub_key.load("054368520005786b249bcd461d28f75e560ea794014eeb17fcf6003f37d876783e"s));
+    const std::chrono::system_clock::time_point timestamp{1'622'576'077s};
+    std::vector<message> msgs;
+    for (int i = 0; i < 10; i++)
+        msgs.emplace_back(pub_key, "hash" + std::to_string(i), timestamp, timestamp + 24h,
+                std::string(1000 + i, 'a' + i));
+    auto serialized = serialize_messages(msgs.begin(), msgs.end(), 1);
+    REQUIRE(serialized.size() == 1);
+    const std::string& blob = serialized.front();
+
+    auto views = deserialize_message_views(blob);
+    REQUIRE(views);
+    REQUIRE(views->size() == msgs.size());
+    auto in_blob = [&blob](std::string_view v) {
+        return v.data() >= blob.data() && v.data() + v.size() <= blob.data() + blob.size();
+    };
+    for (size_t i = 0; i < msgs.size(); i++) {
+        auto& v = (*views)[i];
+        CHECK(v.pubkey == pub_key);
+        CHECK(v.hash == msgs[i].hash);
+        CHECK(v.data == msgs[i].data);
+        CHECK(v.timestamp == msgs[i].timestamp);
+        CHECK(v.expiry == msgs[i].expiry);
+        CHECK(in_blob(v.hash));
+        CHECK(in_blob(v.data));
+    }
+
+    // Old format batches can't be viewed:
+    auto old = serialize_messages(msgs.begin(), msgs.end(), 0);
+    REQUIRE(old.size() == 1);
+    CHECK_FALSE(deserialize_message_views(old.front()));
+
+    // Garbage gives an empty result rather than throwing:
+    auto bad = deserialize_message_views("\x01l33:abce"sv);
+    REQUIRE(bad);
+    CHECK(bad->empty());
+}
+
+// Not run by default; run with `Test "[benchmark]"` to see the numbers.
+TEST_CASE("v1 serialization - ingest copy benchmark", "[.][benchmark][serialization]") {
+    user_pubkey_t pub_key;
+    REQUIRE(pub_key.load("054368520005786b249bcd461d28f75e560ea794014eeb17fcf6003f37d876783e"s));
+    const std::chrono::system_clock::time_point timestamp{1'622'576'077s};
+    std::vector<message> msgs;
+    for (int i = 0; i < 2000; i++)
+        msgs.emplace_back(pub_key, "hash" + std::to_string(i), timestamp, timestamp + 24h,
+                std::string(4000, 'x'));
+    auto serialized = serialize_messages(msgs.begin(), msgs.end(), 1);
+    REQUIRE(serialized.size() == 1);
+    std::string_view blob = serialized.front();
+
+    // The old ingest path: concatenate the message parts through a stringstream (copying the whole
+    // batch twice) and then deserialize into owned messages (copying every hash and data value).
+    size_t copied_owned = 0;
+    auto started = std::chrono::steady_clock::now();
+    {
+        std::stringstream ss;
+        ss << blob;
+        std::string joined = ss.str();
+        copied_owned += 2 * joined.size();
+        for (auto& m : deserialize_messages(joined))
+            copied_owned += m.pubkey.raw().size() + m.hash.size() + m.data.size();
+    }
+    auto owned_time = std::chrono::steady_clock::now() - started;
+
+    // The new path: view directly into the incoming message buffer; only pubkeys get copied.
+    size_t copied_views = 0;
+    started = std::chrono::steady_clock::now();
+    {
+        auto views = deserialize_message_views(blob);
+        REQUIRE(views);
+        for (auto& m : *views)
+            copied_views += m.pubkey.raw().size();
+    }
+    auto views_time = std::chrono::steady_clock::now() - started;
+
+    using ms = std::chrono::duration<double, std::milli>;
+    WARN("bytes copied per ingested byte: owned: " << double(copied_owned) / blob.size()
+            << " (" << ms(owned_time).count() << "ms); views: "
+            << double(copied_views) / blob.size() << " (" << ms(views_time).count() << "ms)");
+    CHECK(copied_views * 100 < blob.size());
+}
+
+namespace {
+
+// Generates messages resembling what we relay when rebalancing swarms: a few messages each for a
+// bunch of owners, with blake2b (base64) hashes, and in no particular order.
+std::vector<message> rebalance_messages(size_t owners, size_t count, size_t data_size) {
+    std::mt19937_64 rng{12345};
+    std::vector<user_pubkey_t> pks(owners);
+    for (auto& pk : pks) {
+        std::string raw(33, 0x05);
+        for (size_t i = 1; i < raw.size(); i++)
+            raw[i] = static_cast<char>(rng());
+        REQUIRE(pk.load(raw));
+    }
+    const std::chrono::system_clock::time_point now{1'622'576'077'123ms};
+    std::vector<message> msgs;
+    for (size_t i = 0; i < count; i++) {
+        std::string hash_bytes(32, 0);
+        for (auto& c : hash_bytes)
+            c = static_cast<char>(rng());
+        auto hash = oxenmq::to_base64(hash_bytes);
+        hash.resize(43); // strip padding
+        auto timestamp = now - std::chrono::milliseconds{rng() % (14 * 24 * 3600 * 1000ULL)};
+        msgs.emplace_back(pks[rng() % owners], std::move(hash), timestamp,
+                timestamp + std::chrono::milliseconds{rng() % (14 * 24 * 3600 * 1000ULL)},
+                std::string(data_size, static_cast<char>(rng())));
+    }
+    return msgs;
+}
+
+// Deserializes all the batches, returning them as owned messages sorted by hash (since compact
+// serialization doesn't preserve order).
+std::vector<message> deserialize_sorted(const std::vector<std::string>& batches) {
+    std::vector<message> result;
+    for (auto& b : batches)
+        for (auto& m : deserialize_messages(b))
+            result.push_back(std::move(m));
+    std::sort(result.begin(), result.end(),
+            [](const auto& a, const auto& b) { return a.hash < b.hash; });
+    return result;
+}
+
+} // namespace
+
+TEST_CASE("v2 serialization - round trip", "[serialization]") {
+    auto msgs = rebalance_messages(20, 500, 100);
+    // Some hashes that can't be sent as raw bytes:
+    msgs[0].hash = "hash";
+    msgs[1].hash = msgs[1].hash.substr(0, 42) + "B"; // non-zero trailing bits
+    msgs[2].hash = oxenmq::to_hex(std::string(64, 'x'));
+    msgs[3].hash = oxenmq::to_hex(std::string(64, 'y'));
+    std::transform(msgs[3].hash.begin(), msgs[3].hash.end(), msgs[3].hash.begin(), ::toupper);
+    // Expiry before the timestamp:
+    msgs[4].expiry = msgs[4].timestamp - 1s;
+    // A message big enough that we need more than one batch:
+    msgs[5].data = std::string(SERIALIZATION_BATCH_SIZE - 1000, 'z');
+
+    std::vector<std::string> batches;
+    serialize_messages(msgs.begin(), msgs.end(), SERIALIZATION_VERSION_COMPACT,
+            [&](std::string&& batch) {
+                CHECK(batch.size() <= SERIALIZATION_BATCH_SIZE);
+                CHECK(batch.capacity() - batch.size() < 16);
+                batches.push_back(std::move(batch));
+            });
+    REQUIRE(batches.size() > 1);
+
+    auto got = deserialize_sorted(batches);
+    std::sort(msgs.begin(), msgs.end(), [](const auto& a, const auto& b) { return a.hash < b.hash; });
+    REQUIRE(got.size() == msgs.size());
+    for (size_t i = 0; i < msgs.size(); i++) {
+        CHECK(got[i].pubkey == msgs[i].pubkey);
+        CHECK(got[i].hash == msgs[i].hash);
+        CHECK(got[i].timestamp == msgs[i].timestamp);
+        CHECK(got[i].expiry == msgs[i].expiry);
+        CHECK(got[i].data == msgs[i].data);
+    }
+
+    // Views need somewhere to put the decoded hashes:
+    CHECK_FALSE(deserialize_message_views(batches[0]));
+    std::deque<std::string> decoded;
+    auto views = deserialize_message_views(batches[0], &decoded);
+    REQUIRE(views);
+    CHECK_FALSE(views->empty());
+    CHECK_FALSE(decoded.empty());
+
+    // Truncated batches are rejected:
+    auto truncated = deserialize_message_views(batches[0].substr(0, batches[0].size() - 1), &decoded);
+    REQUIRE(truncated);
+    CHECK(truncated->empty());
+}
+
+TEST_CASE("v2 serialization - hostile timestamps", "[serialization]") {
+    auto varint = [](uint64_t v) {
+        std::string s;
+        for (; v >= 0x80; v >>= 7)
+            s += static_cast<char>((v & 0x7f) | 0x80);
+        return s + static_cast<char>(v);
+    };
+    auto zigzag = [](int64_t v) {
+        return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+    };
+    // A batch for a single owner with messages with the given timestamp and expiry deltas
+    auto batch = [&](const std::vector<std::pair<int64_t, int64_t>>& deltas) {
+        std::string b;
+        b += static_cast<char>(SERIALIZATION_VERSION_COMPACT);
+        b += '\x05';
+        b += std::string(32, '\x42');
+        for (auto [ts, exp] : deltas)
+            b += '\x00' + varint(1) + "h" + varint(zigzag(ts)) + varint(zigzag(exp)) + varint(0);
+        b += '\xff';
+        return b;
+    };
+    auto deserialize = [](const std::string& b) {
+        std::deque<std::string> decoded;
+        auto views = deserialize_message_views(b, &decoded);
+        REQUIRE(views);
+        return views->size();
+    };
+
+    const int64_t ts = 1626000000000;
+    CHECK(deserialize(batch({{ts, 14 * 24h / 1ms}, {-1000, -1}})) == 2);
+
+    const int64_t max = INT64_MAX, min = INT64_MIN;
+    // Timestamps and expiries that overflow (or that system_clock can't hold) reject the batch:
+    CHECK(deserialize(batch({{max, 0}})) == 0);
+    CHECK(deserialize(batch({{min, 0}})) == 0);
+    CHECK(deserialize(batch({{ts, max}})) == 0);
+    CHECK(deserialize(batch({{-ts, min}})) == 0);
+    CHECK(deserialize(batch({{max / 2, 0}, {max / 2, 0}, {max / 2, 0}})) == 0);
+    CHECK(deserialize(batch({{min / 2, 0}, {min / 2, 0}, {min / 2, 0}})) == 0);
+    CHECK(deserialize(batch({{ts, 0}, {max, 0}})) == 0);
+    CHECK(deserialize(batch({{-ts, 0}, {min, 0}})) == 0);
+}
+
+// Not run by default; run with `Test "[benchmark]"` to see the numbers.
+TEST_CASE("v2 serialization - size and speed vs v1", "[.][benchmark][serialization]") {
+    using ms = std::chrono::duration<double, std::milli>;
+    for (size_t data_size : {100, 1000}) {
+        auto msgs = rebalance_messages(1000, 50'000, data_size);
+        size_t payload = 0;
+        for (auto& m : msgs)
+            payload += m.data.size();
+
+        std::map<uint8_t, size_t> sizes;
+        for (auto version : {SERIALIZATION_VERSION_BT, SERIALIZATION_VERSION_COMPACT}) {
+            auto started = std::chrono::steady_clock::now();
+            auto batches = serialize_messages(msgs.begin(), msgs.end(), version);
+            auto ser_time = std::chrono::steady_clock::now() - started;
+
+            size_t size = 0, count = 0;
+            std::deque<std::string> decoded;
+            started = std::chrono::steady_clock::now();
+            for (auto& b : batches) {
+                size += b.size();
+                auto views = deserialize_message_views(b, &decoded);
+                REQUIRE(views);
+                count += views->size();
+            }
+            auto deser_time = std::chrono::steady_clock::now() - started;
+            CHECK(count == msgs.size());
+            sizes[version] = size;
+
+            WARN("v" << +version << ", " << data_size << "B messages: " << size << "B ("
+                    << 100.0 * (size - payload) / payload << "% overhead); serialize "
+                    << ms(ser_time).count() << "ms; deserialize " << ms(deser_time).count() << "ms");
+        }
+        CHECK(sizes[SERIALIZATION_VERSION_COMPACT] < sizes[SERIALIZATION_VERSION_BT]);
+    }
+}
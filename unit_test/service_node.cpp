@@ -115,3 +115,170 @@ TEST_CASE("service nodes - pubkey to swarm id") {
     REQUIRE(pk.load("050000000000000000000000000000000000000000000000000123456789abcdef"));
     CHECK(pubkey_to_swarm_space(pk) == 0x0123456789abcdefULL);
 }
+
+TEST_CASE("service nodes - funded node updates", "[service-nodes][updates]") {
+
+    using oxen::sn_record;
+
+    auto a = create_dummy_sn_record();
+    auto b = a;
+    b.pubkey_legacy = oxen::legacy_pubkey::from_hex(
+        "0000000000000000000000000000000000000000000000000000000000000001");
+    b.pubkey_ed25519 = oxen::ed25519_pubkey::from_hex(
+        "0000000000000000000000000000000000000000000000000000000000000002");
+    b.pubkey_x25519 = oxen::x25519_pubkey::from_hex(
+        "0000000000000000000000000000000000000000000000000000000000000003");
+
+    oxen::Swarm swarm{a};
+    swarm.update_state({{0, {a, b}}}, {}, {}, false);
+
+    CHECK(swarm.all_funded_nodes().size() == 2);
+    REQUIRE(swarm.find_node(b.pubkey_ed25519));
+    CHECK(swarm.find_node(b.pubkey_x25519)->pubkey_legacy == b.pubkey_legacy);
+
+    // Change b's address and ed25519 key, and decommission a: lookups should follow the new values
+    auto b2 = b;
+    b2.ip = "1.2.3.4";
+    b2.pubkey_ed25519 = oxen::ed25519_pubkey::from_hex(
+        "0000000000000000000000000000000000000000000000000000000000000004");
+    swarm.update_state({{0, {b2}}}, {a}, {}, false);
+
+    CHECK(swarm.all_funded_nodes().size() == 2);
+    CHECK_FALSE(swarm.find_node(b.pubkey_ed25519));
+    REQUIRE(swarm.find_node(b2.pubkey_ed25519));
+    CHECK(swarm.find_node(b2.pubkey_ed25519)->ip == "1.2.3.4");
+    CHECK(swarm.find_node(b.pubkey_x25519)->ip == "1.2.3.4");
+    CHECK(swarm.find_node(a.pubkey_x25519));
+
+    // Deregister a
+    swarm.update_state({{0, {b2}}}, {}, {}, false);
+
+    CHECK(swarm.all_funded_nodes().size() == 1);
+    CHECK_FALSE(swarm.find_node(a.pubkey_legacy));
+    CHECK_FALSE(swarm.find_node(a.pubkey_ed25519));
+    CHECK_FALSE(swarm.find_node(a.pubkey_x25519));
+    CHECK(swarm.find_node(b2.pubkey_legacy));
+}
+
+TEST_CASE("service nodes - funded node key moves", "[service-nodes][updates]") {
+
+    using oxen::sn_record;
+
+    auto a = create_dummy_sn_record();
+    auto b = a;
+    b.pubkey_legacy = oxen::legacy_pubkey::from_hex(
+        "0000000000000000000000000000000000000000000000000000000000000001");
+    b.pubkey_ed25519 = oxen::ed25519_pubkey::from_hex(
+        "0000000000000000000000000000000000000000000000000000000000000002");
+    b.pubkey_x25519 = oxen::x25519_pubkey::from_hex(
+        "0000000000000000000000000000000000000000000000000000000000000003");
+
+    auto check_keys = [](const oxen::Swarm& swarm, const sn_record& sn) {
+        REQUIRE(swarm.find_node(sn.pubkey_ed25519));
+        CHECK(swarm.find_node(sn.pubkey_ed25519)->pubkey_legacy == sn.pubkey_legacy);
+        REQUIRE(swarm.find_node(sn.pubkey_x25519));
+        CHECK(swarm.find_node(sn.pubkey_x25519)->pubkey_legacy == sn.pubkey_legacy);
+    };
+
+    // a and b swap secondary keys; whichever of them gets updated first, both should end up
+    // reachable by their new keys.
+    for (bool b_first : {false, true}) {
+        oxen::Swarm swarm{a};
+        swarm.update_state({{0, {a, b}}}, {}, {}, false);
+        check_keys(swarm, a);
+        check_keys(swarm, b);
+
+        auto a2 = a, b2 = b;
+        std::swap(a2.pubkey_ed25519, b2.pubkey_ed25519);
+        std::swap(a2.pubkey_x25519, b2.pubkey_x25519);
+        if (b_first)
+            swarm.update_state({{0, {b2, a2}}}, {}, {}, false);
+        else
+            swarm.update_state({{0, {a2, b2}}}, {}, {}, false);
+        check_keys(swarm, a2);
+        check_keys(swarm, b2);
+    }
+
+    // b's keys move to a newly registered node c (processed before b) while b gets new keys
+    for (bool c_first : {false, true}) {
+        oxen::Swarm swarm{a};
+        swarm.update_state({{0, {a, b}}}, {}, {}, false);
+
+        auto c = b;
+        c.pubkey_legacy = oxen::legacy_pubkey::from_hex(
+            "0000000000000000000000000000000000000000000000000000000000000005");
+        auto b2 = b;
+        b2.pubkey_ed25519 = oxen::ed25519_pubkey::from_hex(
+            "0000000000000000000000000000000000000000000000000000000000000006");
+        b2.pubkey_x25519 = oxen::x25519_pubkey::from_hex(
+            "0000000000000000000000000000000000000000000000000000000000000007");
+        if (c_first)
+            swarm.update_state({{0, {c, a, b2}}}, {}, {}, false);
+        else
+            swarm.update_state({{0, {a, b2, c}}}, {}, {}, false);
+        CHECK(swarm.all_funded_nodes().size() == 3);
+        check_keys(swarm, a);
+        check_keys(swarm, b2);
+        check_keys(swarm, c);
+
+        // Deregistering b must not take c's (formerly b's) keys with it
+        swarm.update_state({{0, {a, c}}}, {}, {}, false);
+        CHECK_FALSE(swarm.find_node(b2.pubkey_ed25519));
+        CHECK_FALSE(swarm.find_node(b2.pubkey_x25519));
+        check_keys(swarm, c);
+    }
+}
+
+TEST_CASE("service nodes - swarm space ranges", "[service-nodes]") {
+    std::vector<oxen::SwarmInfo> swarms{{100, {}}, {200, {}}, {1000, {}}};
+
+    using ranges = std::vector<std::pair<uint64_t, uint64_t>>;
+    CHECK(oxen::swarm_space_ranges(swarms, 200) == ranges{{150, 600}});
+    CHECK(oxen::swarm_space_ranges(swarms, 100) == ranges{{0, 150}, {1000, UINT64_MAX}});
+    CHECK(oxen::swarm_space_ranges(swarms, 1000) == ranges{{600, UINT64_MAX}, {0, 100}});
+    CHECK(oxen::swarm_space_ranges(swarms, 123).empty());
+    CHECK(oxen::swarm_space_ranges({{42, {}}}, 42) == ranges{{0, UINT64_MAX}});
+}
+
+TEST_CASE("service nodes - swarm descriptions", "[service-nodes][swarm]") {
+
+    auto a = create_dummy_sn_record();
+    auto b = a;
+    b.pubkey_legacy = oxen::legacy_pubkey::from_hex(
+        "0000000000000000000000000000000000000000000000000000000000000001");
+    b.ip = "1.2.3.4";
+    auto c = a;
+    c.pubkey_legacy = oxen::legacy_pubkey::from_hex(
+        "0000000000000000000000000000000000000000000000000000000000000002");
+
+    oxen::Swarm swarm{a};
+    swarm.apply_swarm_changes({{100, {a}}, {200, {b}}});
+
+    auto d100 = swarm.description(100);
+    auto d200 = swarm.description(200);
+    CHECK(d100->json["swarm"] == "64");
+    REQUIRE(d100->json["snodes"].size() == 1);
+    const auto& snode = d100->json["snodes"][0];
+    CHECK(snode["pubkey_legacy"] == a.pubkey_legacy.hex());
+    CHECK(snode["ip"] == "0.0.0.0");
+    CHECK(snode["port"] == "8080");
+    CHECK(snode["port_https"] == 8080);
+    CHECK(snode["port_omq"] == 8081);
+    CHECK_FALSE(d100->json.contains("t"));
+    CHECK(d100->bt_prefix.substr(0, 11) == "d6:snodesld");
+    CHECK(d100->bt_prefix.find("4:porti8080e") == std::string::npos); // "port" is a string
+    CHECK(d100->bt_prefix.find("4:port4:8080") != std::string::npos);
+    CHECK(d100->bt_prefix.substr(d100->bt_prefix.size() - 13) == "ee5:swarm2:64");
+    CHECK(d200->json["snodes"][0]["ip"] == "1.2.3.4");
+
+    // Unchanged swarms keep their existing description; changed ones get rebuilt:
+    swarm.apply_swarm_changes({{100, {a}}, {200, {b, c}}});
+    CHECK(swarm.description(100) == d100);
+    CHECK(swarm.description(200) != d200);
+    CHECK(swarm.description(200)->json["snodes"].size() == 2);
+
+    // Swarms that go away get the empty, invalid swarm description:
+    swarm.apply_swarm_changes({{100, {a}}});
+    CHECK(swarm.description(200)->swarm.swarm_id == oxen::INVALID_SWARM_ID);
+    CHECK(swarm.description(200)->json["snodes"].empty());
+}
@@ -0,0 +1,66 @@
+#include "single_flight.h"
+
+#include <catch2/catch.hpp>
+
+#include <atomic>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace oxen;
+using namespace std::literals;
+
+TEST_CASE("single flight - sequential requests each compute", "[single_flight]") {
+    SingleFlight<std::string, int> sf;
+    int computed = 0;
+    std::vector<int> got;
+    for (int i = 0; i < 3; i++)
+        CHECK_FALSE(sf.run("k", [&] { return ++computed; }, [&](int r) { got.push_back(r); }));
+    CHECK(computed == 3);
+    CHECK(got == std::vector{1, 2, 3});
+    CHECK(sf.in_flight() == 0);
+}
+
+TEST_CASE("single flight - concurrent identical requests share a result", "[single_flight]") {
+    SingleFlight<std::string, int> sf;
+    std::promise<void> started, release;
+    auto release_fut = release.get_future().share();
+    std::atomic<int> computed{0};
+    std::vector<int> got;
+    std::mutex got_mutex;
+    auto record = [&](int r) {
+        std::lock_guard lock{got_mutex};
+        got.push_back(r);
+    };
+
+    std::thread leader{[&] {
+        CHECK_FALSE(sf.run("k", [&] {
+            started.set_value();
+            release_fut.wait();
+            return 100 + ++computed;
+        }, record));
+    }};
+    started.get_future().wait();
+
+    // These arrive while the first is computing, so just queue up for its result
+    for (int i = 0; i < 5; i++)
+        CHECK(sf.run("k", [&] { return ++computed; }, record));
+    // A different key doesn't wait:
+    CHECK_FALSE(sf.run("other", [&] { return 42; }, record));
+    {
+        std::lock_guard lock{got_mutex};
+        CHECK(got == std::vector{42});
+    }
+    CHECK(sf.in_flight() == 1);
+
+    release.set_value();
+    leader.join();
+    CHECK(computed == 1);
+    CHECK(got == std::vector{42, 101, 101, 101, 101, 101, 101});
+    CHECK(sf.in_flight() == 0);
+
+    // Once finished, the next request computes afresh
+    CHECK_FALSE(sf.run("k", [&] { return ++computed; }, record));
+    CHECK(got.back() == 2);
+}
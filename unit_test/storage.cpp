@@ -1,14 +1,21 @@
 #include "Database.hpp"
+#include "time.hpp"
 #include "utils.hpp"
 
 #include "oxen_logger.h"
 
+#include <algorithm>
 #include <chrono>
+#include <cstring>
 #include <filesystem>
 #include <iostream>
 #include <string>
 #include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
 
+#include <SQLiteCpp/SQLiteCpp.h>
 #include <catch2/catch.hpp>
 
 using namespace oxen;
@@ -253,7 +260,11 @@ TEST_CASE("storage - bulk storage with overlap", "[storage]") {
             items.emplace_back(pubkey, std::to_string(i), timestamp, timestamp + ttl, bytes);
         }
 
-        CHECK_NOTHROW(storage.bulk_store(items));
+        std::vector<bool> inserted;
+        CHECK_NOTHROW(inserted = storage.bulk_store(items));
+        REQUIRE(inserted.size() == num_items);
+        for (size_t i = 0; i < num_items; ++i)
+            CHECK(inserted[i] == (i != 0 && i != 5));
     }
 
     CHECK(storage.get_owner_count() == 1);
@@ -266,6 +277,36 @@ TEST_CASE("storage - bulk storage with overlap", "[storage]") {
     }
 }
 
+TEST_CASE("storage - bulk storage of message views", "[storage]") {
+    StorageDeleter fixture;
+
+    user_pubkey_t pubkey;
+    REQUIRE(pubkey.load("050123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"));
+    const auto timestamp = std::chrono::system_clock::now();
+
+    Database storage{"."};
+
+    // The hashes and data are slices of one buffer, so nothing is null-terminated where it ends
+    const std::string buf = "hash1hash22hash333data1data22data333";
+    std::string_view all{buf};
+    std::vector<message_view> items{
+        {pubkey, all.substr(0, 5), timestamp, timestamp + 100s, all.substr(18, 5)},
+        {pubkey, all.substr(5, 6), timestamp, timestamp + 100s, all.substr(23, 6)},
+        {pubkey, all.substr(11, 7), timestamp, timestamp + 100s, all.substr(29)}};
+    CHECK(storage.bulk_store(items) == std::vector{true, true, true});
+    CHECK(storage.bulk_store(items) == std::vector{false, false, false});
+
+    auto msgs = storage.retrieve(pubkey, "");
+    REQUIRE(msgs.size() == 3);
+    CHECK(msgs[0].hash == "hash1");
+    CHECK(msgs[0].data == "data1");
+    CHECK(msgs[1].hash == "hash22");
+    CHECK(msgs[1].data == "data22");
+    CHECK(msgs[2].hash == "hash333");
+    CHECK(msgs[2].data == "data333");
+    CHECK(storage.retrieve_by_hash("hash22"));
+}
+
 TEST_CASE("storage - retrieve limit", "[storage]") {
     StorageDeleter fixture;
 
@@ -300,3 +341,375 @@ TEST_CASE("storage - retrieve limit", "[storage]") {
     CHECK(storage.retrieve(pubkey, "", 101).size() == 100);
     CHECK(storage.retrieve(pubkey2, "", 10).size() == 5);
 }
+
+TEST_CASE("storage - retrieve by swarm space range", "[storage]") {
+    StorageDeleter fixture;
+
+    Database storage{"."};
+
+    // These map to swarm space values of 0, 0x0123456789abcdef, and 0xff00000000000000
+    user_pubkey_t pk_zero, pk_low, pk_high;
+    REQUIRE(pk_zero.load("050123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"));
+    REQUIRE(pk_low.load("050000000000000000000000000000000000000000000000000123456789abcdef"));
+    REQUIRE(pk_high.load("05ff00000000000000000000000000000000000000000000000000000000000000"));
+
+    auto now = std::chrono::system_clock::now();
+    CHECK(storage.store({pk_zero, "hash0", now, now + 100s, "bytesasstring"}));
+    CHECK(storage.store({pk_low, "hash1", now, now + 100s, "bytesasstring"}));
+    storage.bulk_store(std::vector<message>{{pk_high, "hash2", now, now + 100s, "bytesasstring"},
+                                            {pk_high, "hash3", now, now + 100s, "bytesasstring"}});
+
+    CHECK(storage.retrieve_swarm_space_range(0, UINT64_MAX).size() == 4);
+    CHECK(storage.retrieve_swarm_space_range(0, 0).size() == 1);
+    CHECK(storage.retrieve_swarm_space_range(1, 0x0123456789abcdefULL).size() == 1);
+    CHECK(storage.retrieve_swarm_space_range(0x0123456789abcdf0ULL, 0xfeffffffffffffffULL).empty());
+
+    auto high = storage.retrieve_swarm_space_range(0x8000000000000000ULL, UINT64_MAX);
+    REQUIRE(high.size() == 2);
+    CHECK(high[0].pubkey == pk_high);
+    CHECK(high[0].hash == "hash2");
+    CHECK(high[1].hash == "hash3");
+}
+
+TEST_CASE("storage - retrieve by hashes", "[storage]") {
+    StorageDeleter fixture;
+
+    Database storage{"."};
+
+    user_pubkey_t pk1, pk2;
+    REQUIRE(pk1.load("050123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"));
+    REQUIRE(pk2.load("050000000000000000000000000000000000000000000000000123456789abcdef"));
+
+    // Enough messages that they have to be looked up over several queries
+    const size_t num_msgs = 2500;
+    auto now = std::chrono::system_clock::now();
+    std::vector<message> msgs;
+    std::vector<std::string> hashes;
+    for (size_t i = 0; i < num_msgs; i++) {
+        msgs.emplace_back(i % 2 ? pk1 : pk2, "hash" + std::to_string(i), now, now + 100s,
+                "data" + std::to_string(i));
+        hashes.push_back(msgs.back().hash);
+    }
+    storage.bulk_store(msgs);
+
+    CHECK(storage.retrieve_by_hashes({}).empty());
+    CHECK(storage.retrieve_by_hashes({"nope"}).empty());
+
+    auto found = storage.retrieve_by_hashes({"hash7", "nope", "hash8"});
+    REQUIRE(found.size() == 2);
+    std::sort(found.begin(), found.end(), [](auto& a, auto& b) { return a.hash < b.hash; });
+    CHECK(found[0].hash == "hash7");
+    CHECK(found[0].pubkey == pk1);
+    CHECK(found[0].data == "data7");
+    CHECK(found[1].hash == "hash8");
+    CHECK(found[1].pubkey == pk2);
+
+    hashes.push_back("nope");
+    found = storage.retrieve_by_hashes(hashes);
+    CHECK(found.size() == num_msgs);
+    std::sort(found.begin(), found.end(), [](auto& a, auto& b) { return a.hash < b.hash; });
+    CHECK(std::unique(found.begin(), found.end(),
+                [](auto& a, auto& b) { return a.hash == b.hash; }) == found.end());
+}
+
+// Reads the swarm space value stored for `pk` straight from the owners table of storage.db.
+static uint64_t stored_swarm_space(const user_pubkey_t& pk) {
+    SQLite::Database db{"storage.db", SQLite::OPEN_READONLY};
+    SQLite::Statement st{db, "SELECT swarm_space FROM owners WHERE type = ? AND pubkey = ?"};
+    st.bind(1, pk.type());
+    st.bind(2, pk.raw().data(), static_cast<int>(pk.raw().size()));
+    REQUIRE(st.executeStep());
+    // Stored with the top bit flipped, so that signed order matches swarm space order
+    return static_cast<uint64_t>(st.getColumn(0).getInt64()) ^ (uint64_t{1} << 63);
+}
+
+TEST_CASE("storage - migration from the old Data table", "[storage][migration]") {
+    StorageDeleter fixture;
+
+    const auto pk1_hex = "050123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"s;
+    const auto pk2_hex = "050000000000000000000000000000000000000000000000000123456789abcdef"s;
+    user_pubkey_t pk1, pk2;
+    REQUIRE(pk1.load(pk1_hex));
+    REQUIRE(pk2.load(pk2_hex));
+    const int64_t ts = to_epoch_ms(std::chrono::system_clock::now()), exp = ts + 100'000;
+
+    {
+        SQLite::Database db{"storage.db", SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE};
+        db.exec(R"(
+CREATE TABLE Data(
+    Hash VARCHAR(128) NOT NULL,
+    Owner VARCHAR(256) NOT NULL,
+    TTL INTEGER NOT NULL,
+    Timestamp INTEGER NOT NULL,
+    TimeExpires INTEGER NOT NULL,
+    Nonce VARCHAR(128) NOT NULL,
+    Data BLOB
+);
+        )");
+        SQLite::Statement ins{db, "INSERT INTO Data VALUES (?, ?, 0, ?, ?, '', ?)"};
+        for (auto& [hash, owner, data] : std::vector<std::tuple<const char*, std::string, const char*>>{
+                {"hash1", pk1_hex, "data1"},
+                {"hash2", pk2_hex, "data2"},
+                {"hash3", pk1_hex, "data3"},
+                {"hash4", "not a pubkey"s, "data4"}}) {
+            ins.bind(1, hash);
+            ins.bind(2, owner);
+            ins.bind(3, static_cast<long long>(ts));
+            ins.bind(4, static_cast<long long>(exp));
+            ins.bind(5, data);
+            ins.exec();
+            ins.reset();
+        }
+    }
+
+    {
+        Database storage{"."};
+        CHECK(storage.get_owner_count() == 2);
+        CHECK(storage.get_message_count() == 3);
+
+        // Owner pubkeys are stored as bytes, so lookups by pubkey find the migrated messages
+        auto msgs = storage.retrieve(pk1, "");
+        REQUIRE(msgs.size() == 2);
+        CHECK(msgs[0].hash == "hash1");
+        CHECK(msgs[0].data == "data1");
+        CHECK(msgs[0].timestamp == from_epoch_ms(ts));
+        CHECK(msgs[0].expiry == from_epoch_ms(exp));
+        CHECK(msgs[1].hash == "hash3");
+        msgs = storage.retrieve(pk2, "");
+        REQUIRE(msgs.size() == 1);
+        CHECK(msgs[0].hash == "hash2");
+
+        auto s1 = pubkey_to_swarm_space(pk1);
+        CHECK(storage.retrieve_swarm_space_range(s1, s1).size() == 2);
+    }
+
+    SQLite::Database db{"storage.db", SQLite::OPEN_READONLY};
+    CHECK_FALSE(db.tableExists("Data"));
+    CHECK(stored_swarm_space(pk1) == pubkey_to_swarm_space(pk1));
+    CHECK(stored_swarm_space(pk2) == pubkey_to_swarm_space(pk2));
+}
+
+TEST_CASE("storage - migration adding owner swarm space", "[storage][migration]") {
+    StorageDeleter fixture;
+
+    user_pubkey_t pk1, pk2, pk3;
+    REQUIRE(pk1.load("050123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"));
+    REQUIRE(pk2.load("050000000000000000000000000000000000000000000000000123456789abcdef"));
+    REQUIRE(pk3.load("05ffffffffffffffff000000000000000000000000000000000000000000000000"));
+    const int64_t ts = to_epoch_ms(std::chrono::system_clock::now()), exp = ts + 100'000;
+
+    // The schema from before owners had a swarm_space column
+    {
+        SQLite::Database db{"storage.db", SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE};
+        db.exec(R"(
+CREATE TABLE owners (
+    id INTEGER PRIMARY KEY,
+    type INTEGER NOT NULL,
+    pubkey BLOB NOT NULL,
+
+    UNIQUE(pubkey, type)
+);
+
+CREATE TABLE messages (
+    id INTEGER PRIMARY KEY,
+    hash TEXT NOT NULL,
+    owner INTEGER NOT NULL REFERENCES owners(id),
+    timestamp INTEGER NOT NULL,
+    expiry INTEGER NOT NULL,
+    data BLOB NOT NULL,
+
+    UNIQUE(hash)
+);
+
+CREATE INDEX messages_expiry ON messages(expiry);
+CREATE INDEX messages_owner ON messages(owner, timestamp);
+
+CREATE TRIGGER owner_autoclean
+    AFTER DELETE ON messages FOR EACH ROW WHEN NOT EXISTS (SELECT * FROM messages WHERE owner = old.owner)
+    BEGIN
+        DELETE FROM owners WHERE id = old.owner;
+    END;
+
+CREATE VIEW owned_messages AS
+    SELECT owners.id AS oid, type, pubkey, messages.id AS mid, hash, timestamp, expiry, data
+    FROM messages JOIN owners ON messages.owner = owners.id;
+
+CREATE TRIGGER owned_messages_insert
+    INSTEAD OF INSERT ON owned_messages FOR EACH ROW WHEN NEW.oid IS NULL
+    BEGIN
+        INSERT INTO owners (type, pubkey) VALUES (NEW.type, NEW.pubkey) ON CONFLICT DO NOTHING;
+        INSERT INTO messages values (
+            NEW.mid,
+            NEW.hash,
+            (SELECT id FROM owners WHERE type = NEW.type AND pubkey = NEW.pubkey),
+            NEW.timestamp,
+            NEW.expiry,
+            NEW.data);
+    END;
+        )");
+        SQLite::Statement ins{db, "INSERT INTO owned_messages (type, pubkey, hash, timestamp, expiry, data)"
+            " VALUES (?, ?, ?, ?, ?, ?)"};
+        int i = 0;
+        for (auto* pk : {&pk1, &pk2, &pk1}) {
+            auto hash = "hash" + std::to_string(++i);
+            ins.bind(1, pk->type());
+            ins.bind(2, pk->raw().data(), static_cast<int>(pk->raw().size()));
+            ins.bind(3, hash);
+            ins.bind(4, static_cast<long long>(ts));
+            ins.bind(5, static_cast<long long>(exp));
+            ins.bind(6, "data");
+            ins.exec();
+            ins.reset();
+        }
+    }
+
+    {
+        Database storage{"."};
+        CHECK(storage.get_owner_count() == 2);
+        CHECK(storage.get_message_count() == 3);
+        CHECK(storage.retrieve(pk1, "").size() == 2);
+
+        auto s1 = pubkey_to_swarm_space(pk1), s2 = pubkey_to_swarm_space(pk2);
+        CHECK(storage.retrieve_swarm_space_range(s1, s1).size() == 2);
+        CHECK(storage.retrieve_swarm_space_range(s2, s2).size() == 1);
+        CHECK(storage.retrieve_swarm_space_range(0, UINT64_MAX).size() == 3);
+
+        // The recreated view and trigger fill in swarm space for new owners
+        auto now = std::chrono::system_clock::now();
+        CHECK(storage.store({pk3, "hash4", now, now + 100s, "data"}));
+        auto s3 = pubkey_to_swarm_space(pk3);
+        CHECK(storage.retrieve_swarm_space_range(s3, s3).size() == 1);
+    }
+
+    CHECK(stored_swarm_space(pk1) == pubkey_to_swarm_space(pk1));
+    CHECK(stored_swarm_space(pk2) == pubkey_to_swarm_space(pk2));
+    CHECK(stored_swarm_space(pk3) == pubkey_to_swarm_space(pk3));
+
+    // Reopening doesn't migrate again
+    Database storage{"."};
+    CHECK(storage.get_message_count() == 4);
+}
+
+TEST_CASE("storage - retrieve watermarks", "[storage]") {
+    StorageDeleter fixture;
+
+    Database storage{"."};
+
+    user_pubkey_t pubkey, pubkey2;
+    REQUIRE(pubkey.load("050123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"));
+    REQUIRE(pubkey2.load("050123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdee"));
+
+    auto now = std::chrono::system_clock::now();
+    for (int i = 0; i < 3; i++)
+        CHECK(storage.store({pubkey, "hash" + std::to_string(i), now, now + 100s, "bytesasstring"}));
+
+    auto fast = [&storage, prev = uint64_t{0}]() mutable {
+        auto f = storage.get_retrieve_stats().fast;
+        return f - std::exchange(prev, f);
+    };
+
+    // Storing tells us the newest message, so polling from it doesn't need the database
+    CHECK(storage.retrieve(pubkey, "hash2").empty());
+    CHECK(fast() == 1);
+    CHECK(storage.retrieve(pubkey, "hash1").size() == 1);
+    CHECK(storage.retrieve(pubkey, "").size() == 3);
+    CHECK(fast() == 0);
+
+    CHECK(storage.store({pubkey, "hash3", now, now + 100s, "bytesasstring"}));
+    CHECK(storage.retrieve(pubkey, "hash2").size() == 1);
+    CHECK(storage.retrieve(pubkey, "hash3").empty());
+    CHECK(fast() == 1);
+
+    // Deleting the newest message means last_hash isn't found anymore, so we get everything
+    CHECK(storage.delete_by_hash(pubkey, {"hash3"}) == std::vector{"hash3"s});
+    CHECK(storage.retrieve(pubkey, "hash3").size() == 3);
+    CHECK(fast() == 0);
+    // ... and that retrieve reloaded the watermark:
+    CHECK(storage.retrieve(pubkey, "hash2").empty());
+    CHECK(fast() == 1);
+
+    // Likewise when the newest message expires
+    CHECK(storage.update_expiry(pubkey, {"hash2"}, now) == std::vector{"hash2"s});
+    std::this_thread::sleep_for(5ms);
+    storage.clean_expired();
+    auto items = storage.retrieve(pubkey, "hash2");
+    REQUIRE(items.size() == 2);
+    CHECK(items[1].hash == "hash1");
+    CHECK(fast() == 0);
+    CHECK(storage.retrieve(pubkey, "hash1").empty());
+    CHECK(fast() == 1);
+
+    // Hitting the retrieve limit doesn't tell us the newest message
+    CHECK(storage.retrieve(pubkey, "", 1).size() == 1);
+    CHECK(storage.retrieve(pubkey, "hash0").size() == 1);
+    CHECK(fast() == 0);
+
+    // Owners without messages
+    CHECK(storage.retrieve(pubkey2, "").empty());
+    CHECK(storage.retrieve(pubkey2, "whatever").empty());
+    CHECK(fast() == 1);
+    CHECK(storage.store({pubkey2, "hash4", now, now + 100s, "bytesasstring"}));
+    CHECK(storage.retrieve(pubkey2, "whatever").size() == 1);
+    CHECK(fast() == 0);
+
+    CHECK(storage.delete_all(pubkey).size() == 2);
+    CHECK(storage.retrieve(pubkey, "hash1").empty());
+    CHECK(storage.retrieve(pubkey, "hash1").empty());
+    CHECK(fast() == 1);
+    storage.bulk_store(std::vector<message>{{pubkey, "hash5", now, now + 100s, "bytesasstring"},
+                                            {pubkey, "hash6", now, now + 100s, "bytesasstring"}});
+    CHECK(storage.retrieve(pubkey, "hash1").size() == 2);
+    CHECK(storage.retrieve(pubkey, "hash6").empty());
+    CHECK(fast() == 1);
+}
+
+TEST_CASE("storage - retrieve polling throughput", "[.][benchmark][storage]") {
+    StorageDeleter fixture;
+
+    Database storage{"."};
+
+    const int num_owners = 5000, polls = 20;
+    std::vector<std::pair<user_pubkey_t, std::string>> owners;
+    auto now = std::chrono::system_clock::now();
+    std::vector<message> msgs;
+    for (int i = 0; i < num_owners; i++) {
+        std::string pk(33, '\x05');
+        std::memcpy(pk.data() + 1, &i, sizeof(i));
+        auto& [pubkey, last] = owners.emplace_back();
+        REQUIRE(pubkey.load(pk));
+        for (int j = 0; j < 3; j++) {
+            last = "hash-" + std::to_string(i) + "-" + std::to_string(j);
+            msgs.emplace_back(pubkey, last, now, now + 1h, "bytesasstring");
+        }
+    }
+    storage.bulk_store(msgs);
+
+    // Poll from the newest hash, as an up-to-date client does
+    auto poll = [&] {
+        auto start = std::chrono::steady_clock::now();
+        size_t n = 0;
+        for (int p = 0; p < polls; p++)
+            for (auto& [pubkey, last] : owners)
+                n += storage.retrieve(pubkey, last).size();
+        CHECK(n == 0);
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    auto fast_time = poll();
+    auto stats = storage.get_retrieve_stats();
+    CHECK(stats.db == 0);
+
+    // The same polls for a hash we don't have go to the database.  (The zero limit stops those
+    // retrieves from loading watermarks, so every one of them has to query).
+    auto start = std::chrono::steady_clock::now();
+    size_t n = 0;
+    for (int p = 0; p < polls; p++)
+        for (auto& [pubkey, last] : owners)
+            n += storage.retrieve(pubkey, last + "-gone", 0).size();
+    auto db_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    CHECK(storage.get_retrieve_stats().db == stats.db + polls * num_owners);
+
+    const double total = polls * num_owners;
+    std::cout << "retrieve polling: " << total / fast_time << "/s with watermarks, "
+              << total / db_time << "/s from the database\n";
+}
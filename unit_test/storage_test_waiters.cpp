@@ -0,0 +1,109 @@
+#include "storage_test_waiters.h"
+
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace oxen;
+
+namespace {
+
+std::shared_ptr<storage_test_waiter> make_waiter(uint64_t height, std::string hash) {
+    auto w = std::make_shared<storage_test_waiter>();
+    w->height = height;
+    w->msg_hash = std::move(hash);
+    return w;
+}
+
+} // namespace
+
+TEST_CASE("storage test waiters - woken by message hash", "[storage_test_waiters]") {
+    StorageTestWaiters waiters;
+    auto w = make_waiter(100, "hash1");
+    CHECK(waiters.add(w, 100));
+    CHECK(waiters.waiting_by_hash() == 1);
+    CHECK(waiters.waiting_by_height() == 0);
+
+    CHECK(waiters.take_by_hash("hash2").empty());
+    auto woken = waiters.take_by_hash("hash1");
+    REQUIRE(woken.size() == 1);
+    CHECK(woken[0] == w);
+    CHECK(waiters.waiting_by_hash() == 0);
+    CHECK(waiters.take_by_hash("hash1").empty());
+
+    // Whoever woke it gets to answer it (once)
+    CHECK(waiters.finish(*w));
+    CHECK_FALSE(waiters.finish(*w));
+}
+
+TEST_CASE("storage test waiters - woken by block height", "[storage_test_waiters]") {
+    StorageTestWaiters waiters;
+    auto w1 = make_waiter(101, "hash1"), w2 = make_waiter(102, "hash2"), w3 = make_waiter(105, "hash3");
+    for (auto& w : {w3, w1, w2})
+        CHECK(waiters.add(w, 100));
+    CHECK(waiters.waiting_by_height() == 3);
+    CHECK(waiters.waiting_by_hash() == 0);
+
+    CHECK(waiters.take_by_height(100).empty());
+    auto woken = waiters.take_by_height(102);
+    REQUIRE(woken.size() == 2);
+    CHECK(woken[0] == w1);
+    CHECK(woken[1] == w2);
+    CHECK(waiters.waiting_by_height() == 1);
+
+    // Once rechecked at the reached height, a waiter that still lacks its message waits for that
+    CHECK(waiters.add(w1, 102));
+    CHECK(waiters.waiting_by_hash() == 1);
+    CHECK(waiters.take_by_hash("hash1") == std::vector{w1});
+
+    CHECK(waiters.take_by_height(1000) == std::vector{w3});
+    CHECK(waiters.waiting_by_height() == 0);
+}
+
+TEST_CASE("storage test waiters - timeouts", "[storage_test_waiters]") {
+    StorageTestWaiters waiters;
+    auto by_hash = make_waiter(100, "hash1"), by_height = make_waiter(200, "hash2");
+    CHECK(waiters.add(by_hash, 150));
+    CHECK(waiters.add(by_height, 150));
+    CHECK(waiters.waiting_by_hash() == 1);
+    CHECK(waiters.waiting_by_height() == 1);
+
+    // The deadline timer finishes the waiters, which removes them from wherever they are filed
+    CHECK(waiters.finish(*by_hash));
+    CHECK(waiters.waiting_by_hash() == 0);
+    CHECK(waiters.waiting_by_height() == 1);
+    CHECK(waiters.finish(*by_height));
+    CHECK(waiters.waiting_by_height() == 0);
+    CHECK(waiters.take_by_hash("hash1").empty());
+    CHECK(waiters.take_by_height(1000).empty());
+
+    // A finished waiter doesn't get finished again, e.g. when the message arrives just as it times
+    // out, and doesn't get filed again if a recheck was already under way.
+    CHECK_FALSE(waiters.finish(*by_hash));
+    CHECK_FALSE(waiters.add(by_hash, 150));
+    CHECK_FALSE(waiters.add(by_height, 150));
+    CHECK(waiters.waiting_by_hash() == 0);
+    CHECK(waiters.waiting_by_height() == 0);
+}
+
+TEST_CASE("storage test waiters - duplicate hashes", "[storage_test_waiters]") {
+    StorageTestWaiters waiters;
+    // E.g. the same test retried by the tester, or tests from different heights for the same message
+    auto w1 = make_waiter(100, "hash"), w2 = make_waiter(100, "hash"), w3 = make_waiter(99, "hash");
+    for (auto& w : {w1, w2, w3})
+        CHECK(waiters.add(w, 100));
+    CHECK(waiters.waiting_by_hash() == 3);
+
+    // Timing out one of them leaves the others alone
+    CHECK(waiters.finish(*w2));
+    CHECK(waiters.waiting_by_hash() == 2);
+
+    auto woken = waiters.take_by_hash("hash");
+    REQUIRE(woken.size() == 2);
+    CHECK(std::count(woken.begin(), woken.end(), w1) == 1);
+    CHECK(std::count(woken.begin(), woken.end(), w3) == 1);
+    CHECK(waiters.waiting_by_hash() == 0);
+}
@@ -0,0 +1,176 @@
+#include "subscriptions.h"
+
+#include <catch2/catch.hpp>
+#include <oxenmq/bt_serialize.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+using namespace oxen;
+using namespace std::literals;
+
+namespace {
+
+struct sent_notification {
+    oxenmq::ConnectionID conn;
+    std::string data;
+};
+
+user_pubkey_t make_pubkey(char last) {
+    user_pubkey_t pk;
+    pk.load("050123456789abcdef0123456789abcdef0123456789abcdef0123456789abcde"s + last);
+    REQUIRE(pk);
+    return pk;
+}
+
+oxenmq::ConnectionID make_conn(char c) { return oxenmq::ConnectionID{std::string(32, c)}; }
+
+message make_message(const user_pubkey_t& pk, std::string hash, std::string data = "data") {
+    const std::chrono::system_clock::time_point now{1'622'576'077'123ms};
+    return {pk, std::move(hash), now, now + 1h, std::move(data)};
+}
+
+// Returns the hashes of the messages in a notification, and the dropped count
+std::pair<std::vector<std::string>, int64_t> parse_notification(std::string_view notification) {
+    std::pair<std::vector<std::string>, int64_t> result{{}, 0};
+    oxenmq::bt_dict_consumer d{notification};
+    if (d.skip_until("dropped"))
+        result.second = d.consume_integer<int64_t>();
+    REQUIRE(d.skip_until("messages"));
+    auto msgs = d.consume_list_consumer();
+    while (!msgs.is_finished()) {
+        auto m = msgs.consume_dict_consumer();
+        REQUIRE(m.skip_until("data"));
+        CHECK_FALSE(m.consume_string_view().empty());
+        REQUIRE(m.skip_until("hash"));
+        result.first.push_back(m.consume_string());
+        REQUIRE(m.skip_until("pubkey"));
+        CHECK(m.consume_string_view().size() == 33);
+    }
+    return result;
+}
+
+} // namespace
+
+TEST_CASE("subscriptions - new messages are sent to subscribers", "[subscriptions]") {
+    std::vector<sent_notification> sent;
+    Subscriptions subs{[&](const oxenmq::ConnectionID& conn, std::string n) {
+        sent.push_back({conn, std::move(n)});
+    }};
+
+    auto alice = make_pubkey('a'), bob = make_pubkey('b');
+    auto c1 = make_conn('1'), c2 = make_conn('2');
+    REQUIRE(subs.subscribe(c1, alice) == subscribe_result::ok);
+    REQUIRE(subs.subscribe(c2, alice) == subscribe_result::ok);
+    REQUIRE(subs.subscribe(c2, bob) == subscribe_result::ok);
+    // Renewing doesn't add a second subscription:
+    REQUIRE(subs.subscribe(c2, bob) == subscribe_result::ok);
+
+    subs.notify(make_message(alice, "a1"));
+    subs.notify(make_message(bob, "b1"));
+    subs.notify(make_message(make_pubkey('c'), "c1"));
+    subs.notify(make_message(alice, "a2"));
+    CHECK(sent.empty()); // Nothing goes out until we flush
+
+    subs.flush();
+    REQUIRE(sent.size() == 2);
+    for (auto& s : sent) {
+        auto [hashes, dropped] = parse_notification(s.data);
+        CHECK(dropped == 0);
+        if (s.conn == c1)
+            CHECK(hashes == std::vector{"a1"s, "a2"s});
+        else
+            CHECK(hashes == std::vector{"a1"s, "b1"s, "a2"s});
+    }
+
+    // Nothing new, so nothing to send:
+    sent.clear();
+    subs.flush();
+    CHECK(sent.empty());
+
+    CHECK(subs.unsubscribe(c2, alice));
+    CHECK_FALSE(subs.unsubscribe(c2, alice));
+    subs.notify(make_message(alice, "a3"));
+    subs.flush();
+    REQUIRE(sent.size() == 1);
+    CHECK(sent[0].conn == c1);
+
+    auto stats = subs.get_stats();
+    CHECK(stats.connections == 2);
+    CHECK(stats.subscriptions == 2);
+    CHECK(stats.notifications_sent == 3);
+    CHECK(stats.messages_sent == 6);
+    CHECK(stats.messages_dropped == 0);
+}
+
+TEST_CASE("subscriptions - queues are bounded", "[subscriptions]") {
+    std::vector<sent_notification> sent;
+    Subscriptions subs{[&](const oxenmq::ConnectionID& conn, std::string n) {
+        sent.push_back({conn, std::move(n)});
+    }};
+    auto alice = make_pubkey('a');
+    auto c1 = make_conn('1');
+    REQUIRE(subs.subscribe(c1, alice) == subscribe_result::ok);
+
+    const int extra = 5;
+    for (size_t i = 0; i < SUBSCRIPTION_MAX_QUEUED + extra; i++)
+        subs.notify(make_message(alice, "h" + std::to_string(i)));
+    subs.flush();
+    REQUIRE(sent.size() == 1);
+    auto [hashes, dropped] = parse_notification(sent[0].data);
+    CHECK(dropped == extra);
+    REQUIRE(hashes.size() == SUBSCRIPTION_MAX_QUEUED);
+    // The oldest ones are the ones that get dropped:
+    CHECK(hashes.front() == "h" + std::to_string(extra));
+    CHECK(subs.get_stats().messages_dropped == extra);
+
+    // Also limited by size:
+    sent.clear();
+    std::string big(SUBSCRIPTION_MAX_QUEUED_BYTES / 3, 'x');
+    for (int i = 0; i < 4; i++)
+        subs.notify(make_message(alice, "big" + std::to_string(i), big));
+    subs.flush();
+    REQUIRE(sent.size() == 1);
+    std::tie(hashes, dropped) = parse_notification(sent[0].data);
+    CHECK(dropped == 2);
+    CHECK(hashes == std::vector{"big2"s, "big3"s});
+}
+
+TEST_CASE("subscriptions - limits and expiry", "[subscriptions]") {
+    std::vector<sent_notification> sent;
+    Subscriptions subs{[&](const oxenmq::ConnectionID& conn, std::string n) {
+        sent.push_back({conn, std::move(n)});
+    }};
+    auto c1 = make_conn('1');
+    auto now = std::chrono::steady_clock::now();
+
+    std::vector<user_pubkey_t> pks;
+    for (size_t i = 0; i <= SUBSCRIPTION_MAX_PUBKEYS; i++) {
+        user_pubkey_t pk;
+        std::string raw(33, 0x05);
+        raw[32] = static_cast<char>(i);
+        REQUIRE(pk.load(raw));
+        pks.push_back(pk);
+    }
+    for (size_t i = 0; i < SUBSCRIPTION_MAX_PUBKEYS; i++)
+        REQUIRE(subs.subscribe(c1, pks[i], now) == subscribe_result::ok);
+    CHECK(subs.subscribe(c1, pks.back(), now) == subscribe_result::too_many_pubkeys);
+    CHECK(subs.get_stats().subscriptions == SUBSCRIPTION_MAX_PUBKEYS);
+
+    // Renew one of them half way through the lifetime
+    REQUIRE(subs.subscribe(c1, pks[0], now + SUBSCRIPTION_LIFETIME / 2) == subscribe_result::ok);
+
+    subs.flush(now + SUBSCRIPTION_LIFETIME + 1s);
+    CHECK(subs.get_stats().subscriptions == 1);
+    subs.notify(make_message(pks[1], "expired"));
+    subs.notify(make_message(pks[0], "renewed"));
+    subs.flush(now + SUBSCRIPTION_LIFETIME + 1s + SUBSCRIPTION_EXPIRY_CHECK_INTERVAL);
+    REQUIRE(sent.size() == 1);
+    CHECK(parse_notification(sent[0].data).first == std::vector{"renewed"s});
+
+    subs.flush(now + 2 * SUBSCRIPTION_LIFETIME);
+    auto stats = subs.get_stats();
+    CHECK(stats.subscriptions == 0);
+    CHECK(stats.connections == 0);
+}
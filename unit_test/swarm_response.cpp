@@ -0,0 +1,190 @@
+#include "client_rpc_endpoints.h"
+#include "request_handler.h"
+
+#include <catch2/catch.hpp>
+#include <nlohmann/json.hpp>
+#include <oxenmq/bt_serialize.h>
+
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+using namespace oxen;
+using namespace std::literals;
+using nlohmann::json;
+
+namespace {
+
+const auto own = std::string(64, 'a'), peer1 = std::string(64, 'b'), peer2 = std::string(64, 'c');
+
+// A recursive request to a swarm of ourself plus two peers, collecting the replies it sends
+struct test_request {
+    std::shared_ptr<swarm_response> res = std::make_shared<swarm_response>();
+    std::vector<Response> replies;
+    int timer_cancels = 0;
+
+    explicit test_request(int quorum = 0, bool b64 = true) {
+        res->pending = 3;
+        res->b64 = b64;
+        res->quorum = quorum;
+        res->waiting = {own, peer1, peer2};
+        res->cb = [this](Response r) { replies.push_back(std::move(r)); };
+        res->cancel_timer = [this] { timer_cancels++; };
+    }
+
+    swarm_result_status own_result(bool success) {
+        auto& mine = res->result["swarm"][own];
+        if (success)
+            mine["hash"] = "h";
+        else
+            mine = json{{"failed", true}, {"query_failure", true}};
+        return swarm_result_done(*res, own, success);
+    }
+
+    swarm_result_status peer_result(const std::string& peer, bool success) {
+        // Late results don't get recorded (see distribute_command)
+        if (!res->replied) {
+            if (success)
+                res->peer_results[peer] = oxenmq::bt_serialize(oxenmq::bt_dict{{"hash", "h"}});
+            else
+                res->result["swarm"][peer] = json{{"failed", true}, {"timeout", true}};
+        }
+        return swarm_result_done(*res, peer, success);
+    }
+
+    const json& reply_json() const {
+        REQUIRE(replies.size() == 1);
+        return std::get<json>(replies[0].body);
+    }
+};
+
+} // namespace
+
+TEST_CASE("swarm response - waits for all results by default", "[swarm_response]") {
+    test_request req;
+    CHECK(req.own_result(true) == swarm_result_status::waiting);
+    CHECK(req.peer_result(peer1, false) == swarm_result_status::waiting);
+    CHECK(req.replies.empty());
+    CHECK(req.peer_result(peer2, true) == swarm_result_status::replied);
+
+    CHECK(req.replies[0].status == http::OK);
+    auto& j = req.reply_json();
+    CHECK_FALSE(j.contains("pending"));
+    CHECK(j["swarm"][own]["hash"] == "h");
+    CHECK(j["swarm"][peer1]["failed"] == true);
+    CHECK(j["swarm"][peer2]["hash"] == "h");
+    CHECK(req.timer_cancels == 1);
+}
+
+TEST_CASE("swarm response - quorum reached early", "[swarm_response]") {
+    test_request req{2};
+    CHECK(req.peer_result(peer1, true) == swarm_result_status::waiting);
+    // A failure doesn't count towards the quorum
+    CHECK(req.peer_result(peer2, false) == swarm_result_status::waiting);
+    CHECK(req.replies.empty());
+    CHECK(req.own_result(true) == swarm_result_status::replied);
+    CHECK(req.reply_json()["swarm"][peer2]["failed"] == true);
+
+    test_request early{2};
+    CHECK(early.own_result(true) == swarm_result_status::waiting);
+    CHECK(early.peer_result(peer1, true) == swarm_result_status::replied_early);
+    CHECK(early.replies[0].status == http::OK);
+    CHECK(early.reply_json()["pending"] == json::array({peer2}));
+    CHECK(early.reply_json()["swarm"][peer1]["hash"] == "h");
+    CHECK(early.timer_cancels == 1);
+
+    // Late results, successful or not, don't change the reply we already sent
+    CHECK(early.peer_result(peer2, true) == swarm_result_status::late);
+    CHECK(early.replies.size() == 1);
+    CHECK_FALSE(early.reply_json()["swarm"].contains(peer2));
+    CHECK(early.res->pending == 0);
+    CHECK(early.timer_cancels == 1);
+
+    test_request late_failure{1};
+    CHECK(late_failure.own_result(true) == swarm_result_status::replied_early);
+    CHECK(late_failure.peer_result(peer1, false) == swarm_result_status::late);
+    CHECK(late_failure.peer_result(peer2, false) == swarm_result_status::late);
+    CHECK(late_failure.replies.size() == 1);
+    CHECK(late_failure.replies[0].status == http::OK);
+    CHECK(late_failure.reply_json()["pending"] == json::array({peer1, peer2}));
+}
+
+TEST_CASE("swarm response - reply timeout", "[swarm_response]") {
+    test_request req;
+    CHECK(req.own_result(true) == swarm_result_status::waiting);
+    CHECK(req.peer_result(peer2, true) == swarm_result_status::waiting);
+    CHECK(swarm_reply_timeout(*req.res));
+    CHECK(req.replies[0].status == http::OK);
+    CHECK(req.reply_json()["pending"] == json::array({peer1}));
+    CHECK(req.reply_json()["swarm"][peer2]["hash"] == "h");
+    CHECK(req.timer_cancels == 1);
+
+    // Nothing more gets sent, whether the timer fires again or the remaining result shows up
+    CHECK_FALSE(swarm_reply_timeout(*req.res));
+    CHECK(req.peer_result(peer1, true) == swarm_result_status::late);
+    CHECK(req.replies.size() == 1);
+    CHECK(req.timer_cancels == 1);
+
+    // The timer can also fire before we have any results at all
+    test_request nothing;
+    CHECK(swarm_reply_timeout(*nothing.res));
+    CHECK(nothing.replies[0].status == http::INTERNAL_SERVER_ERROR);
+    CHECK(nothing.reply_json()["pending"] == json::array({own, peer1, peer2}));
+}
+
+TEST_CASE("swarm response - failures", "[swarm_response]") {
+    test_request req;
+    CHECK(req.own_result(false) == swarm_result_status::waiting);
+    CHECK(req.peer_result(peer1, false) == swarm_result_status::waiting);
+    CHECK(req.peer_result(peer2, false) == swarm_result_status::replied);
+    CHECK(req.replies[0].status == http::INTERNAL_SERVER_ERROR);
+    auto& j = req.reply_json();
+    for (auto& member : {own, peer1, peer2})
+        CHECK(j["swarm"][member]["failed"] == true);
+
+    // Failures never complete a quorum
+    test_request quorum{1};
+    CHECK(quorum.own_result(false) == swarm_result_status::waiting);
+    CHECK(quorum.peer_result(peer1, false) == swarm_result_status::waiting);
+    CHECK(quorum.peer_result(peer2, false) == swarm_result_status::replied);
+    CHECK(quorum.replies[0].status == http::INTERNAL_SERVER_ERROR);
+}
+
+TEST_CASE("swarm response - bt-encoded replies", "[swarm_response]") {
+    test_request req{0, false};
+    req.own_result(true);
+    req.peer_result(peer1, true);
+    CHECK(swarm_reply_timeout(*req.res));
+    REQUIRE(req.replies.size() == 1);
+    auto& r = req.replies[0];
+    CHECK(r.status == http::OK);
+    CHECK(r.headers == decltype(r.headers){{"Content-Type", std::string{http::BT_CONTENT_TYPE}}});
+    CHECK(std::get<std::string>(r.body) == oxenmq::bt_serialize(oxenmq::bt_dict{
+            {"pending", oxenmq::bt_list{peer2}},
+            {"swarm", oxenmq::bt_dict{
+                {own, oxenmq::bt_dict{{"hash", "h"}}},
+                {peer1, oxenmq::bt_dict{{"hash", "h"}}}}}}));
+}
+
+TEST_CASE("swarm response - reply_timeout limits", "[swarm_response]") {
+    auto load = [](std::optional<int64_t> reply_timeout) {
+        json params{
+            {"pubkey", "05" + std::string(64, '1')},
+            {"timestamp", 1626000000000},
+            {"ttl", 86400000},
+            {"data", "aGk="}};
+        if (reply_timeout)
+            params["reply_timeout"] = *reply_timeout;
+        rpc::store req;
+        req.load_from(params);
+        return req.reply_timeout;
+    };
+    CHECK_FALSE(load(std::nullopt));
+    CHECK(load(1) == 1ms);
+    CHECK(load(5000) == rpc::REPLY_TIMEOUT_MAX);
+    CHECK_THROWS_AS(load(0), rpc::parse_error);
+    CHECK_THROWS_AS(load(5001), rpc::parse_error);
+    CHECK_THROWS_AS(load(std::numeric_limits<int64_t>::max()), rpc::parse_error);
+}
@@ -0,0 +1,140 @@
+#include "request_handler.h"
+#include "serialization.h"
+#include "swarm_sync.h"
+
+#include <catch2/catch.hpp>
+
+#include <chrono>
+#include <map>
+#include <string>
+
+using namespace oxen;
+
+namespace {
+
+// In-process stand-in for a swarm member's message store
+struct test_node {
+    std::map<std::string, message> msgs;
+
+    std::vector<std::string> hashes() const {
+        std::vector<std::string> h;
+        for (auto& [hash, msg] : msgs)
+            h.push_back(hash);
+        return h;
+    }
+};
+
+std::vector<message> make_messages(size_t count) {
+    user_pubkey_t pk;
+    pk.load("054368520005786b249bcd461d28f75e560ea794014eeb17fcf6003f37d876783e"s);
+    const std::chrono::system_clock::time_point timestamp{1'622'576'077s};
+    std::vector<message> msgs;
+    for (size_t i = 0; i < count; i++) {
+        std::string data(100, 'a' + i % 26);
+        data += std::to_string(i);
+        auto hash = computeMessageHash(timestamp, timestamp + 24h, pk, data, false);
+        msgs.emplace_back(pk, std::move(hash), timestamp, timestamp + 24h, std::move(data));
+    }
+    return msgs;
+}
+
+// Runs a sync of `from` into `to`, applying the pushed messages to `to`; returns the total number
+// of bytes sent in either direction.
+size_t sync(const test_node& from, test_node& to) {
+    auto hashes = from.hashes();
+    auto request = swarm_sync::make_request(hashes);
+    auto reply = swarm_sync::make_reply(request, to.hashes());
+    size_t bytes = request.size() + reply.size();
+
+    std::vector<message> push;
+    for (auto& h : swarm_sync::missing_hashes(reply, hashes))
+        push.push_back(from.msgs.at(h));
+    for (auto& batch : serialize_messages(push.begin(), push.end(), SERIALIZATION_VERSION_BT)) {
+        bytes += batch.size();
+        for (auto& m : deserialize_messages(batch))
+            to.msgs.emplace(m.hash, m);
+    }
+    return bytes;
+}
+
+size_t full_push_size(const test_node& from) {
+    std::vector<message> all;
+    for (auto& [h, m] : from.msgs)
+        all.push_back(m);
+    size_t bytes = 0;
+    for (auto& batch : serialize_messages(all.begin(), all.end(), SERIALIZATION_VERSION_BT))
+        bytes += batch.size();
+    return bytes;
+}
+
+} // namespace
+
+TEST_CASE("swarm sync - identical nodes", "[swarm-sync]") {
+    test_node a, b;
+    for (auto& m : make_messages(1000)) {
+        a.msgs.emplace(m.hash, m);
+        b.msgs.emplace(m.hash, m);
+    }
+
+    auto request = swarm_sync::make_request(a.hashes());
+    CHECK(request.size() < 2 * swarm_sync::bucket_count(1000) * swarm_sync::DIGEST_SIZE);
+    auto reply = swarm_sync::make_reply(request, b.hashes());
+    CHECK(swarm_sync::missing_hashes(reply, a.hashes()).empty());
+    CHECK(reply.size() < 50);
+}
+
+TEST_CASE("swarm sync - partial overlap", "[swarm-sync]") {
+    test_node a, b;
+    auto msgs = make_messages(5000);
+    for (size_t i = 0; i < msgs.size(); i++) {
+        a.msgs.emplace(msgs[i].hash, msgs[i]);
+        if (i % 500 != 7)
+            b.msgs.emplace(msgs[i].hash, msgs[i]);
+    }
+    // b also has a few messages that a doesn't, which shouldn't get in the way
+    for (auto& m : make_messages(5003))
+        if (!a.msgs.count(m.hash))
+            b.msgs.emplace(m.hash, m);
+    REQUIRE(b.msgs.size() == 4993);
+
+    auto missing = swarm_sync::missing_hashes(
+            swarm_sync::make_reply(swarm_sync::make_request(a.hashes()), b.hashes()),
+            a.hashes());
+    REQUIRE(missing.size() == 10);
+    for (auto& h : missing)
+        CHECK_FALSE(b.msgs.count(h));
+
+    auto bytes = sync(a, b);
+    CHECK(b.msgs.size() == 5003);
+    // We should be sending a small fraction of what a full push would send
+    CHECK(bytes * 10 < full_push_size(a));
+}
+
+TEST_CASE("swarm sync - new swarm member", "[swarm-sync]") {
+    // Two existing members with the same data and an empty new member: the first sync should
+    // transfer everything, the second (staggered) sync should only exchange digests.
+    test_node a, c, b;
+    for (auto& m : make_messages(3000)) {
+        a.msgs.emplace(m.hash, m);
+        c.msgs.emplace(m.hash, m);
+    }
+
+    auto full = full_push_size(a);
+    auto first = sync(a, b);
+    CHECK(b.msgs.size() == 3000);
+    CHECK(first < full * 11 / 10);
+
+    auto second = sync(c, b);
+    CHECK(second * 20 < full);
+
+    INFO("full push to new member: " << full << "B; synced: " << first << "B + " << second << "B");
+    CHECK(first + second < 2 * full);
+}
+
+TEST_CASE("swarm sync - invalid requests", "[swarm-sync]") {
+    std::vector<std::string> hashes{"abc", "def"};
+    CHECK_THROWS_AS(swarm_sync::make_reply("", hashes), std::invalid_argument);
+    CHECK_THROWS_AS(swarm_sync::make_reply("d1:bi16e1:d3:abce", hashes), std::invalid_argument);
+    CHECK_THROWS_AS(swarm_sync::missing_hashes("de", hashes), std::invalid_argument);
+    CHECK_THROWS_AS(swarm_sync::missing_hashes("d1:bli99ee1:hle1:ni16ee", hashes), std::invalid_argument);
+}
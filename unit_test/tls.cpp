@@ -0,0 +1,255 @@
+#include "server_certificates.h"
+
+#include <catch2/catch.hpp>
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <unistd.h>
+
+using namespace oxen;
+using namespace std::literals;
+
+namespace {
+
+using ctx_ptr = std::unique_ptr<SSL_CTX, decltype(&SSL_CTX_free)>;
+using session_ptr = std::unique_ptr<SSL_SESSION, decltype(&SSL_SESSION_free)>;
+
+struct temp_dir {
+    std::filesystem::path path;
+    explicit temp_dir(std::string_view name) {
+        path = std::filesystem::temp_directory_path() /
+            (std::string{name} + "-" + std::to_string(::getpid()));
+        std::filesystem::create_directories(path);
+    }
+    ~temp_dir() { std::filesystem::remove_all(path); }
+};
+
+// Returns the key type (EVP_PKEY_EC, EVP_PKEY_RSA, ...) of a PEM certificate
+int cert_key_type(const std::filesystem::path& cert) {
+    FILE* f = fopen(cert.c_str(), "r");
+    REQUIRE(f);
+    X509* x = PEM_read_X509(f, nullptr, nullptr, nullptr);
+    fclose(f);
+    REQUIRE(x);
+    int type = EVP_PKEY_base_id(X509_get0_pubkey(x));
+    X509_free(x);
+    return type;
+}
+
+// Writes a self-signed RSA-2048 certificate with the given subject names, like the ones older
+// versions generated (with org "Oxen").
+void write_rsa_cert(
+        const std::filesystem::path& cert, const std::filesystem::path& key, const char* org) {
+    EVP_PKEY* pk = nullptr;
+    EVP_PKEY_CTX* kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, nullptr);
+    REQUIRE(EVP_PKEY_keygen_init(kctx) > 0);
+    REQUIRE(EVP_PKEY_CTX_set_rsa_keygen_bits(kctx, 2048) > 0);
+    REQUIRE(EVP_PKEY_keygen(kctx, &pk) > 0);
+    EVP_PKEY_CTX_free(kctx);
+
+    X509* x = X509_new();
+    X509_set_version(x, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(x), 1);
+    X509_gmtime_adj(X509_get_notBefore(x), 0);
+    X509_gmtime_adj(X509_get_notAfter(x), 86400);
+    X509_set_pubkey(x, pk);
+    X509_NAME* name = X509_get_subject_name(x);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"localhost", -1, -1, 0);
+    X509_NAME_add_entry_by_txt(name, "O", MBSTRING_ASC, (const unsigned char*)org, -1, -1, 0);
+    X509_set_issuer_name(x, name);
+    REQUIRE(X509_sign(x, pk, EVP_sha256()));
+
+    FILE* kf = fopen(key.c_str(), "w");
+    PEM_write_PrivateKey(kf, pk, nullptr, nullptr, 0, nullptr, nullptr);
+    fclose(kf);
+    FILE* cf = fopen(cert.c_str(), "w");
+    PEM_write_X509(cf, x);
+    fclose(cf);
+    X509_free(x);
+    EVP_PKEY_free(pk);
+}
+
+ctx_ptr server_ctx(
+        const std::filesystem::path& cert,
+        const std::filesystem::path& key,
+        const tls_ticket_key_ring* keys) {
+    ctx_ptr ctx{SSL_CTX_new(TLS_server_method()), SSL_CTX_free};
+    REQUIRE(SSL_CTX_use_certificate_file(ctx.get(), cert.c_str(), SSL_FILETYPE_PEM) == 1);
+    REQUIRE(SSL_CTX_use_PrivateKey_file(ctx.get(), key.c_str(), SSL_FILETYPE_PEM) == 1);
+    if (keys)
+        configure_tls_context(ctx.get(), *keys);
+    return ctx;
+}
+
+ctx_ptr client_ctx() { return {SSL_CTX_new(TLS_client_method()), SSL_CTX_free}; }
+
+struct handshake_result {
+    bool ok = false;
+    bool resumed = false;
+    session_ptr session{nullptr, SSL_SESSION_free};
+};
+
+// Performs a complete client/server handshake over an in-memory BIO pair, optionally resuming
+// `resume`.  Returns the client's resulting session, for resuming later.
+handshake_result handshake(SSL_CTX* server, SSL_CTX* client, SSL_SESSION* resume = nullptr) {
+    handshake_result result;
+    SSL* s = SSL_new(server);
+    SSL* c = SSL_new(client);
+    BIO *sbio, *cbio;
+    BIO_new_bio_pair(&sbio, 0, &cbio, 0);
+    SSL_set_bio(s, sbio, sbio);
+    SSL_set_bio(c, cbio, cbio);
+    SSL_set_accept_state(s);
+    SSL_set_connect_state(c);
+    if (resume)
+        SSL_set_session(c, resume);
+
+    bool s_done = false, c_done = false;
+    for (int i = 0; i < 20 && !(s_done && c_done); i++) {
+        if (!c_done)
+            c_done = SSL_do_handshake(c) == 1;
+        if (!s_done)
+            s_done = SSL_do_handshake(s) == 1;
+    }
+    if (s_done && c_done) {
+        // Let the client process any session tickets the server sent after the handshake (TLS 1.3)
+        char buf;
+        SSL_read(c, &buf, 1);
+        result.ok = true;
+        result.resumed = SSL_session_reused(c);
+        result.session.reset(SSL_get1_session(c));
+        // Without a clean shutdown OpenSSL treats the session as bad and won't resume it
+        SSL_shutdown(c);
+        SSL_shutdown(s);
+    }
+    SSL_free(c);
+    SSL_free(s);
+    return result;
+}
+
+} // namespace
+
+TEST_CASE("tls - generated certificates are ECDSA", "[tls]") {
+    temp_dir dir{"ss-tls-test-certs"};
+    auto cert = dir.path / "cert.pem", key = dir.path / "key.pem";
+
+    generate_cert(cert, key);
+    CHECK(cert_key_type(cert) == EVP_PKEY_EC);
+    CHECK_FALSE(is_legacy_generated_cert(cert));
+    CHECK_FALSE(upgrade_legacy_cert(cert, key));
+
+    // RSA certs generated by older versions get replaced:
+    write_rsa_cert(cert, key, "Oxen");
+    CHECK(is_legacy_generated_cert(cert));
+    CHECK(upgrade_legacy_cert(cert, key));
+    CHECK(cert_key_type(cert) == EVP_PKEY_EC);
+    CHECK(std::filesystem::exists(dir.path / "cert.pem.rsa-old"));
+    CHECK(std::filesystem::exists(dir.path / "key.pem.rsa-old"));
+    tls_ticket_key_ring tickets;
+    CHECK(handshake(server_ctx(cert, key, &tickets).get(), client_ctx().get()).ok);
+
+    // ... but operator-supplied ones don't:
+    write_rsa_cert(cert, key, "Some Operator");
+    CHECK_FALSE(is_legacy_generated_cert(cert));
+    CHECK_FALSE(upgrade_legacy_cert(cert, key));
+    CHECK(cert_key_type(cert) == EVP_PKEY_RSA);
+}
+
+TEST_CASE("tls - sessions resume across contexts sharing ticket keys", "[tls]") {
+    temp_dir dir{"ss-tls-test-resume"};
+    auto cert = dir.path / "cert.pem", key = dir.path / "key.pem";
+    generate_cert(cert, key);
+
+    // Two server contexts, as used by two HTTPS event loops
+    tls_ticket_key_ring keys;
+    auto server1 = server_ctx(cert, key, &keys), server2 = server_ctx(cert, key, &keys);
+    auto client = client_ctx();
+
+    auto first = handshake(server1.get(), client.get());
+    REQUIRE(first.ok);
+    CHECK_FALSE(first.resumed);
+    REQUIRE(first.session);
+
+    auto second = handshake(server2.get(), client.get(), first.session.get());
+    REQUIRE(second.ok);
+    CHECK(second.resumed);
+
+    // A context with different ticket keys can't resume it, and falls back to a full handshake
+    tls_ticket_key_ring other_keys;
+    auto server3 = server_ctx(cert, key, &other_keys);
+    auto third = handshake(server3.get(), client.get(), first.session.get());
+    REQUIRE(third.ok);
+    CHECK_FALSE(third.resumed);
+}
+
+TEST_CASE("tls - sessions resume for one ticket key rotation", "[tls]") {
+    temp_dir dir{"ss-tls-test-rotate"};
+    auto cert = dir.path / "cert.pem", key = dir.path / "key.pem";
+    generate_cert(cert, key);
+
+    tls_ticket_key_ring keys;
+    auto server = server_ctx(cert, key, &keys);
+    auto client = client_ctx();
+
+    auto first = handshake(server.get(), client.get());
+    REQUIRE(first.ok);
+    REQUIRE(first.session);
+
+    // After one rotation the old keys still decrypt the ticket (and a new ticket gets issued)
+    keys.rotate();
+    auto second = handshake(server.get(), client.get(), first.session.get());
+    REQUIRE(second.ok);
+    CHECK(second.resumed);
+
+    // After another the original ticket is no longer accepted, but the reissued one is
+    keys.rotate();
+    auto third = handshake(server.get(), client.get(), first.session.get());
+    REQUIRE(third.ok);
+    CHECK_FALSE(third.resumed);
+    auto fourth = handshake(server.get(), client.get(), second.session.get());
+    REQUIRE(fourth.ok);
+    CHECK(fourth.resumed);
+}
+
+TEST_CASE("tls - handshake throughput", "[.][benchmark][tls]") {
+    temp_dir dir{"ss-tls-test-bench"};
+    auto rsa_cert = dir.path / "rsa-cert.pem", rsa_key = dir.path / "rsa-key.pem";
+    auto ec_cert = dir.path / "cert.pem", ec_key = dir.path / "key.pem";
+    write_rsa_cert(rsa_cert, rsa_key, "Oxen");
+    generate_cert(ec_cert, ec_key);
+
+    tls_ticket_key_ring keys;
+    auto rsa_legacy = server_ctx(rsa_cert, rsa_key, nullptr);
+    auto ec = server_ctx(ec_cert, ec_key, &keys);
+    auto client = client_ctx();
+
+    constexpr int N = 500;
+    auto bench = [&](const char* what, SSL_CTX* server, bool resume) {
+        session_ptr session{nullptr, SSL_SESSION_free};
+        if (resume)
+            session = handshake(server, client.get()).session;
+        int resumed = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < N; i++) {
+            auto r = handshake(server, client.get(), session.get());
+            REQUIRE(r.ok);
+            resumed += r.resumed;
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::printf("%-28s %8.0f handshakes/s (%d/%d resumed)\n",
+                what, N / elapsed.count(), resumed, N);
+        if (resume)
+            CHECK(resumed == N);
+    };
+    bench("RSA-2048, full (old)", rsa_legacy.get(), false);
+    bench("ECDSA P-256, full", ec.get(), false);
+    bench("ECDSA P-256, resumed", ec.get(), true);
+}
@@ -0,0 +1,136 @@
+#include "worker_pool.h"
+
+#include <catch2/catch.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+using namespace oxen;
+using namespace std::literals;
+
+namespace {
+
+// Waits (up to a couple of seconds) for `pred` to become true
+template <typename Pred>
+bool eventually(Pred pred) {
+    auto until = std::chrono::steady_clock::now() + 2s;
+    while (!pred()) {
+        if (std::chrono::steady_clock::now() > until)
+            return false;
+        std::this_thread::sleep_for(1ms);
+    }
+    return true;
+}
+
+// Blocks jobs until released
+struct gate {
+    std::mutex m;
+    std::condition_variable cv;
+    bool open = false;
+
+    void wait() {
+        std::unique_lock lock{m};
+        cv.wait(lock, [this] { return open; });
+    }
+    void release() {
+        {
+            std::lock_guard lock{m};
+            open = true;
+        }
+        cv.notify_all();
+    }
+};
+
+} // namespace
+
+TEST_CASE("worker pool - queue stats", "[worker_pool]") {
+    queue_stats stats;
+    stats.queued();
+    stats.queued();
+    stats.queued();
+    auto s = stats.get();
+    CHECK(s.depth == 3);
+    CHECK(s.max_depth == 3);
+
+    stats.started(10ms);
+    stats.started(30ms);
+    stats.dropped();
+    s = stats.get();
+    CHECK(s.depth == 0);
+    CHECK(s.max_depth == 3);
+    CHECK(s.jobs == 2);
+    CHECK(s.dropped == 1);
+    CHECK(s.wait_max_ms == Approx(30));
+    CHECK(s.wait_avg_ms == Approx(10 + queue_stats::WAIT_AVG_WEIGHT * 20));
+}
+
+TEST_CASE("worker pool - runs jobs and limits its queue", "[worker_pool]") {
+    gate g;
+    std::atomic<int> ran = 0;
+    {
+        worker_pool pool{"test", 1, 1, 2, 1h};
+        CHECK(pool.threads() == 1);
+
+        REQUIRE(pool.submit([&] { g.wait(); ran++; }));
+        REQUIRE(eventually([&] { return pool.stats().jobs == 1; }));
+        CHECK(pool.submit([&] { ran++; }));
+        CHECK(pool.submit([&] { ran++; }));
+        CHECK_FALSE(pool.submit([&] { ran++; }));
+        auto s = pool.stats();
+        CHECK(s.depth == 2);
+        CHECK(s.dropped == 1);
+
+        g.release();
+        CHECK(eventually([&] { return ran == 3; }));
+        CHECK(pool.stats().depth == 0);
+        CHECK(pool.stats().jobs == 3);
+
+        // Exceptions don't kill the worker
+        pool.submit([] { throw std::runtime_error{"oops"}; });
+        pool.submit([&] { ran++; });
+        CHECK(eventually([&] { return ran == 4; }));
+    }
+    CHECK(ran == 4);
+}
+
+TEST_CASE("worker pool - grows with queue wait and shrinks when idle", "[worker_pool]") {
+    gate g;
+    std::atomic<int> ran = 0;
+    worker_pool pool{"test", 1, 4, 100, 5ms, 50ms};
+    CHECK(pool.threads() == 1);
+
+    // Jobs that are quick to start don't add threads
+    for (int i = 0; i < 10; i++) {
+        pool.submit([&] { ran++; });
+        REQUIRE(eventually([&] { return ran == i + 1; }));
+    }
+    CHECK(pool.threads() == 1);
+
+    // With every thread blocked the queued jobs wait longer than the target, so we keep adding
+    // threads (which then get blocked too) up to the maximum.
+    for (int i = 0; i < 10; i++) {
+        pool.submit([&] { g.wait(); ran++; });
+        std::this_thread::sleep_for(10ms);
+    }
+    CHECK(eventually([&] { return pool.threads() == 4; }));
+    CHECK(pool.stats().wait_max_ms >= 5);
+
+    g.release();
+    CHECK(eventually([&] { return ran == 20; }));
+
+    // Once idle the extra threads go away again
+    CHECK(eventually([&] { return pool.threads() == 1; }));
+
+    // ... and come back when needed
+    gate g2;
+    for (int i = 0; i < 4; i++) {
+        pool.submit([&] { g2.wait(); ran++; });
+        std::this_thread::sleep_for(10ms);
+    }
+    CHECK(eventually([&] { return pool.threads() > 1; }));
+    g2.release();
+    CHECK(eventually([&] { return ran == 24; }));
+}